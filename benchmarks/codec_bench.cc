@@ -0,0 +1,360 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  codec_bench.cc
+// @Version :  1.0
+// @Desc    :  Frame codec microbenchmarks.
+//
+// 分别测试帧封装, 帧解析, 掩码, Base64编解码, 握手和SHA-1在不同负载长度下
+// 的耗时, 输出每次操作的纳秒数, 每周期处理的字节数和内存分配次数.
+// 周期数取自TSC, 为参考周期而非实际核心周期; 非x86平台不输出该列.
+// 内存分配次数通过替换全局operator new统计.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <atomic>
+#include <chrono>  // NOLINT.
+#include <new>
+#include <string>
+#include <vector>
+
+#include "websocket/frame_codec.h"
+#include "websocket/websocket.h"
+#include "base64.h"
+#include "sha1.h"
+
+
+using libwebsocket::ClientFrameCodec;
+using libwebsocket::FrameHeader;
+using libwebsocket::ServerFrameCodec;
+using libwebsocket::WebSocketMsg;
+
+
+namespace {
+
+std::atomic<uint64_t> allocations{0};
+
+}  // namespace
+
+void* operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  void* ptr = malloc(size > 0 ? size : 1);
+  if (ptr == nullptr) throw std::bad_alloc();
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+  free(ptr);
+}
+
+
+namespace {
+
+constexpr char kHandshakeRequest[] =
+    "GET /chat HTTP/1.1\r\n"
+    "Host: 127.0.0.1:8081\r\n"
+    "Upgrade: websocket\r\n"
+    "Connection: Upgrade\r\n"
+    "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+    "Sec-WebSocket-Version: 13\r\n"
+    "\r\n";
+constexpr uint8_t kMaskKey[4] = {0x12, 0x34, 0x56, 0x78};
+
+struct Options {
+  std::vector<int> sizes = {16, 128, 1024, 16384, 131072, 1048576};
+  double min_time_s = 0.2;
+  std::string filter;
+};
+
+Options options;
+bool failed = false;
+
+// 阻止编译器优化掉未使用的结果.
+template <typename T>
+inline void KeepAlive(T const& value) {
+  asm volatile("" : : "g"(&value) : "memory");
+}
+
+inline uint64_t ReadCycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+// 检查被测函数的返回值, 失败时不再输出该项结果.
+bool Check(bool const& ok, char const* name) {
+  if (!ok) {
+    fprintf(stderr, "%s failed !!!\n", name);
+    failed = true;
+  }
+  return ok;
+}
+
+// 运行被测函数直到累计时间不少于min_time_s, 输出最后一轮的统计.
+// bytes为每次操作处理的字节数, 为0时不输出每周期字节数.
+template <typename Function>
+void RunBenchmark(char const* name, size_t const& bytes,
+                  Function const& function) {
+  if (!options.filter.empty() && strstr(name, options.filter.c_str()) == 0) {
+    return;
+  }
+  function();  // 预热, 并让复用的缓冲区达到所需容量.
+  uint64_t iterations = 1;
+  while (true) {
+    uint64_t allocations_begin = allocations.load(std::memory_order_relaxed);
+    auto time_begin = std::chrono::steady_clock::now();
+    uint64_t cycles_begin = ReadCycles();
+    for (uint64_t i = 0; i < iterations; ++i) function();
+    uint64_t cycles = ReadCycles() - cycles_begin;
+    double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - time_begin).count();
+    uint64_t allocated = allocations.load(std::memory_order_relaxed) -
+                         allocations_begin;
+    if (seconds >= options.min_time_s || iterations >= (1ULL << 40)) {
+      printf("%-34s %9zu %14.1f", name, bytes, seconds*1e9/iterations);
+      if (bytes > 0 && cycles > 0) {
+        printf(" %12.3f", static_cast<double>(bytes)*iterations/cycles);
+      } else {
+        printf(" %12s", "-");
+      }
+      printf(" %10.2f\n", static_cast<double>(allocated)/iterations);
+      return;
+    }
+    // 按本轮耗时估算下一轮的次数, 每轮至少翻倍, 至多增长100倍.
+    double scale = seconds > 0.0 ? options.min_time_s*1.2/seconds : 100.0;
+    if (scale < 2.0) scale = 2.0;
+    if (scale > 100.0) scale = 100.0;
+    iterations = static_cast<uint64_t>(iterations*scale);
+  }
+}
+
+void BenchFrames(int const& size) {
+  std::vector<char> payload(size, 'x');
+  // 旧接口: WebSocketFramePackaging / WebSocketFrameParse.
+  WebSocketMsg msg {};
+  msg.msg_head.bit.fin = 1;
+  msg.msg_head.bit.opcode = libwebsocket::kOPCodeBinary;
+  msg.payload_content = payload;
+  std::vector<char> server_frame;
+  msg.msg_head.bit.mask = 0;
+  if (!Check(libwebsocket::WebSocketFramePackaging(msg, &server_frame) == 0,
+             "WebSocketFramePackaging")) {
+    return;
+  }
+  std::vector<char> client_frame;
+  msg.msg_head.bit.mask = 1;
+  if (!Check(libwebsocket::WebSocketFramePackaging(msg, &client_frame) == 0,
+             "WebSocketFramePackaging")) {
+    return;
+  }
+  std::vector<char> out;
+  msg.msg_head.bit.mask = 0;
+  RunBenchmark("WebSocketFramePackaging", size, [&] () {
+    libwebsocket::WebSocketFramePackaging(msg, &out);
+    KeepAlive(out);
+  });
+  msg.msg_head.bit.mask = 1;
+  RunBenchmark("WebSocketFramePackaging/masked", size, [&] () {
+    libwebsocket::WebSocketFramePackaging(msg, &out);
+    KeepAlive(out);
+  });
+  WebSocketMsg parsed {};
+  RunBenchmark("WebSocketFrameParse", size, [&] () {
+    libwebsocket::WebSocketFrameParse(server_frame, &parsed);
+    KeepAlive(parsed);
+  });
+  RunBenchmark("WebSocketFrameParse/masked", size, [&] () {
+    libwebsocket::WebSocketFrameParse(client_frame, &parsed);
+    KeepAlive(parsed);
+  });
+
+  // 当前接口: FrameCodec::Package / FrameCodec::Parse.
+  uint8_t const flags = libwebsocket::kFrameFinBit |
+                        libwebsocket::kOPCodeBinary;
+  RunBenchmark("ServerFrameCodec::Package", size, [&] () {
+    ServerFrameCodec::Package(flags, payload.data(), payload.size(), &out);
+    KeepAlive(out);
+  });
+  RunBenchmark("ClientFrameCodec::Package", size, [&] () {
+    ClientFrameCodec::Package(flags, payload.data(), payload.size(), &out);
+    KeepAlive(out);
+  });
+  FrameHeader header;
+  uint64_t frame_length = 0;
+  RunBenchmark("ClientFrameCodec::Parse", size, [&] () {
+    ClientFrameCodec::Parse(server_frame.data(), server_frame.size(),
+                            UINT64_MAX, &header, &frame_length);
+    KeepAlive(header);
+  });
+  // 原地去掉掩码, 重复解析时负载在明文和密文之间交替, 不影响耗时.
+  RunBenchmark("ServerFrameCodec::Parse/masked", size, [&] () {
+    ServerFrameCodec::Parse(client_frame.data(), client_frame.size(),
+                            UINT64_MAX, &header, &frame_length);
+    KeepAlive(header);
+  });
+
+  RunBenchmark("MaskPayload/in-place", size, [&] () {
+    libwebsocket::MaskPayload(payload.data(), payload.size(), kMaskKey,
+                              payload.data());
+    KeepAlive(payload);
+  });
+  std::vector<char> masked(size);
+  RunBenchmark("MaskPayload/copy", size, [&] () {
+    libwebsocket::MaskPayload(payload.data(), payload.size(), kMaskKey,
+                              masked.data());
+    KeepAlive(masked);
+  });
+}
+
+void BenchBase64(int const& size) {
+  std::vector<char> src(size);
+  for (int i = 0; i < size; ++i) src[i] = static_cast<char>(i*131 + 7);
+  std::string encoded;
+  if (!Check(libwebsocket::Base64Encode(src, &encoded) == 0,
+             "Base64Encode")) {
+    return;
+  }
+  std::vector<char> decoded;
+  if (!Check(libwebsocket::Base64Decode(encoded, &decoded) == 0 &&
+             decoded == src, "Base64Decode")) {
+    return;
+  }
+  std::string text;
+  RunBenchmark("Base64Encode", size, [&] () {
+    libwebsocket::Base64Encode(src, &text);
+    KeepAlive(text);
+  });
+  std::vector<char> buffer(libwebsocket::Base64EncodedLength(size));
+  RunBenchmark("Base64Encode/buffer", size, [&] () {
+    libwebsocket::Base64Encode(src.data(), src.size(), buffer.data());
+    KeepAlive(buffer);
+  });
+  // 解码按输出字节数计算吞吐量, 与编码可直接比较.
+  std::vector<char> bytes;
+  RunBenchmark("Base64Decode", size, [&] () {
+    libwebsocket::Base64Decode(encoded, &bytes);
+    KeepAlive(bytes);
+  });
+  RunBenchmark("Base64Decode/buffer", size, [&] () {
+    libwebsocket::Base64Decode(encoded.data(), encoded.size(), buffer.data());
+    KeepAlive(buffer);
+  });
+}
+
+void BenchSha1(int const& size) {
+  std::vector<char> data(size, 'x');
+  libwebsocket::SHA1 sha1;
+  unsigned digest[5];
+  RunBenchmark("SHA1", size, [&] () {
+    sha1.Reset();
+    sha1.Input(data.data(), static_cast<unsigned>(data.size()));
+    sha1.Result(digest);
+    KeepAlive(digest);
+  });
+}
+
+void BenchHandshake(void) {
+  std::string const request(kHandshakeRequest);
+  std::string respond;
+  if (!Check(libwebsocket::HandShake(request, &respond) == 0, "HandShake")) {
+    return;
+  }
+  RunBenchmark("HandShake", request.size(), [&] () {
+    libwebsocket::HandShake(request, &respond);
+    KeepAlive(respond);
+  });
+  char buffer[libwebsocket::kMaxHandshakeRespondLength];
+  RunBenchmark("HandshakeRequestParse+Packaging", request.size(), [&] () {
+    libwebsocket::HandshakeRequest parsed;
+    size_t length = 0;
+    libwebsocket::HandshakeRequestParse(request.data(), request.size(),
+                                        &parsed, &length);
+    int ret = libwebsocket::HandshakeRespondPackaging(parsed, buffer,
+                                                      sizeof(buffer));
+    KeepAlive(ret);
+  });
+  char accept[libwebsocket::kWebSocketAcceptKeyLength];
+  RunBenchmark("WebSocketAcceptKey", 24, [&] () {
+    libwebsocket::WebSocketAcceptKey("dGhlIHNhbXBsZSBub25jZQ==", 24, accept);
+    KeepAlive(accept);
+  });
+}
+
+bool ParseList(char const* text, std::vector<int>* out) {
+  out->clear();
+  while (*text != '\0') {
+    char* end = nullptr;
+    long value = strtol(text, &end, 10);
+    if (end == text || value < 0) return false;
+    out->push_back(static_cast<int>(value));
+    if (*end != ',' && *end != '\0') return false;
+    text = (*end == ',') ? end + 1 : end;
+  }
+  return !out->empty();
+}
+
+void PrintUsage(char const* name) {
+  fprintf(stderr, "Usage: %s [options]\n"
+          "  -s list       payload sizes (default 16,128,1024,16384,131072,"
+          "1048576)\n"
+          "  -t seconds    minimum time per benchmark (default 0.2)\n"
+          "  -f name       only run benchmarks whose name contains name\n",
+          name);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int opt = 0;
+  while ((opt = getopt(argc, argv, "s:t:f:")) != -1) {
+    switch (opt) {
+      case 's':
+        if (!ParseList(optarg, &options.sizes)) {
+          PrintUsage(argv[0]);
+          return 1;
+        }
+        break;
+      case 't': options.min_time_s = atof(optarg); break;
+      case 'f': options.filter = optarg; break;
+      default:
+        PrintUsage(argv[0]);
+        return 1;
+    }
+  }
+  printf("%-34s %9s %14s %12s %10s\n", "benchmark", "bytes", "ns/op",
+         "bytes/cycle", "allocs/op");
+  BenchHandshake();
+  for (int size : options.sizes) {
+    BenchFrames(size);
+    BenchBase64(size);
+    BenchSha1(size);
+  }
+  return failed ? 1 : 0;
+}
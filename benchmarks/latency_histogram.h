@@ -0,0 +1,119 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  latency_histogram.h
+// @Version :  1.0
+// @Desc    :  None
+
+#ifndef WEBSOCKET_BENCHMARKS_LATENCY_HISTOGRAM_H_
+#define WEBSOCKET_BENCHMARKS_LATENCY_HISTOGRAM_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+
+namespace libwebsocket {
+
+// 对数线性分桶的延迟直方图, 每个2的幂区间分为32个桶, 相对误差不超过约3%.
+// 不加锁, 每个线程记录自己的直方图, 汇总时合并.
+//
+// Example:
+//    LatencyHistogram histogram;
+//    histogram.Record(end_us - start_us);
+//    printf("p99: %lld\n", static_cast<long long>(histogram.Percentile(99.0)));
+class LatencyHistogram {
+ public:
+  LatencyHistogram() : counts_(kBucketCount, 0), count_(0), sum_(0),
+      min_(INT64_MAX), max_(0) {}
+
+  // 记录一个非负数值, 负值按0记录.
+  void Record(int64_t value) {
+    if (value < 0) value = 0;
+    ++counts_[BucketIndex(value)];
+    ++count_;
+    sum_ += value;
+    if (value < min_) min_ = value;
+    if (value > max_) max_ = value;
+  }
+  // 合并另一直方图的记录.
+  void Merge(LatencyHistogram const& other) {
+    for (int i = 0; i < kBucketCount; ++i) counts_[i] += other.counts_[i];
+    count_ += other.count_;
+    sum_ += other.sum_;
+    if (other.min_ < min_) min_ = other.min_;
+    if (other.max_ > max_) max_ = other.max_;
+  }
+  // 获取百分位数(0~100), 返回所在桶的上界, 不超过记录的最大值.
+  int64_t Percentile(double const& percentile) const {
+    if (count_ == 0) return 0;
+    uint64_t rank = static_cast<uint64_t>(percentile/100.0*count_ + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > count_) rank = count_;
+    uint64_t seen = 0;
+    for (int i = 0; i < kBucketCount; ++i) {
+      seen += counts_[i];
+      if (seen >= rank) {
+        int64_t value = BucketUpperBound(i);
+        return value < max_ ? value : max_;
+      }
+    }
+    return max_;
+  }
+
+  uint64_t count(void) const { return count_; }
+  int64_t min(void) const { return count_ > 0 ? min_ : 0; }
+  int64_t max(void) const { return max_; }
+  double mean(void) const {
+    return count_ > 0 ? static_cast<double>(sum_)/count_ : 0.0;
+  }
+
+ private:
+  static constexpr int kSubBucketBits = 5;
+  static constexpr int kSubBucketCount = 1 << kSubBucketBits;
+  // 小于64的值每值一桶, 之后每个2的幂区间分kSubBucketCount个桶.
+  static constexpr int kBucketCount = 2*kSubBucketCount +
+                                      (63 - kSubBucketBits)*kSubBucketCount;
+
+  static int BucketIndex(int64_t const& value) {
+    if (value < 2*kSubBucketCount) return static_cast<int>(value);
+    int shift = 63 - __builtin_clzll(static_cast<uint64_t>(value)) -
+                kSubBucketBits;
+    return kSubBucketCount*shift + static_cast<int>(value >> shift);
+  }
+  static int64_t BucketUpperBound(int const& index) {
+    if (index < 2*kSubBucketCount) return index;
+    int shift = index/kSubBucketCount - 1;
+    int64_t base = index - kSubBucketCount*shift;
+    return ((base + 1) << shift) - 1;
+  }
+
+  std::vector<uint64_t> counts_;  // 各桶的记录数.
+  uint64_t count_;  // 记录总数.
+  int64_t sum_;  // 记录值之和.
+  int64_t min_;  // 最小记录值.
+  int64_t max_;  // 最大记录值.
+};
+
+}  // namespace libwebsocket
+
+#endif  // WEBSOCKET_BENCHMARKS_LATENCY_HISTOGRAM_H_
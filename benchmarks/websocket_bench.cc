@@ -0,0 +1,388 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  websocket_bench.cc
+// @Version :  1.0
+// @Desc    :  WebSocket echo benchmark.
+//
+// 在进程内启动WebSocketServer回显服务器, 由进程内的客户端经回环地址连接,
+// 对每组(消息大小, 连接数)以闭环方式测试: 每个连接同时只有一条在途消息,
+// 收到回显后立即发送下一条. 结果以JSON输出到标准输出, 便于比较不同版本.
+// CPU时间为整个进程(服务器和客户端)的用户态与内核态时间之和.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>  // NOLINT.
+#include <memory>
+#include <mutex>  // NOLINT.
+#include <string>
+#include <thread>  // NOLINT.
+#include <vector>
+
+#include "websocket/client.h"
+#include "websocket/client_event_loop.h"
+#include "websocket/server.h"
+#include "latency_histogram.h"
+
+
+using libwebsocket::ClientEventLoop;
+using libwebsocket::LatencyHistogram;
+using libwebsocket::OPCodeType;
+using libwebsocket::WebSocketClient;
+using libwebsocket::WebSocketServer;
+
+
+namespace {
+
+// 同时发起握手的连接数, 避免超出监听队列长度.
+constexpr int kConnectBatch = 512;
+// 所有连接在途消息的总大小上限, 超过的组合跳过.
+constexpr uint64_t kMaxInflightBytes = 256ULL*1024*1024;
+
+struct Options {
+  std::string host = "127.0.0.1";
+  int port = 18081;
+  int threads = 2;
+  double duration_s = 2.0;
+  double warmup_s = 0.5;
+  std::vector<int> sizes = {16, 256, 4096, 65536, 1048576};
+  std::vector<int> connections = {1, 10, 100, 1000, 10000};
+  std::string output;
+};
+
+struct CaseResult {
+  int size = 0;
+  int connections = 0;
+  uint64_t messages = 0;
+  double seconds = 0.0;
+  double cpu_us = 0.0;
+  LatencyHistogram latency;  // 纳秒.
+};
+
+// 每个线程的统计, 只由所属线程写入, 结束后由主线程合并.
+struct Recorder {
+  LatencyHistogram latency;
+  uint64_t messages = 0;
+};
+
+struct BenchConnection {
+  std::unique_ptr<WebSocketClient> client;
+  std::atomic<int64_t> sent_ns{0};  // 在途消息的发送时间.
+};
+
+struct BenchContext {
+  std::vector<char> payload;
+  std::atomic<int64_t> measure_begin_ns{INT64_MAX};
+  std::atomic<int64_t> measure_end_ns{INT64_MAX};
+  std::atomic<bool> sending{true};
+  std::atomic<uint64_t> sent{0};
+  std::atomic<uint64_t> received{0};
+  std::mutex recorders_mutex;
+  std::vector<std::unique_ptr<Recorder>> recorders;
+
+  // 获取当前线程的统计, 首次调用时登记.
+  Recorder* LocalRecorder(void) {
+    thread_local Recorder* recorder = nullptr;
+    thread_local BenchContext* owner = nullptr;
+    if (recorder == nullptr || owner != this) {
+      std::lock_guard<std::mutex> lock(recorders_mutex);
+      recorders.emplace_back(new Recorder());
+      recorder = recorders.back().get();
+      owner = this;
+    }
+    return recorder;
+  }
+};
+
+int64_t SteadyClockNanoseconds(void) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 进程累计的CPU时间(微秒).
+double ProcessCpuMicroseconds(void) {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0.0;
+  return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)*1e6 +
+         usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+void SendOne(BenchContext* ctx, BenchConnection* conn) {
+  conn->sent_ns.store(SteadyClockNanoseconds(), std::memory_order_relaxed);
+  if (conn->client->SendData(ctx->payload.data(),
+                             static_cast<int>(ctx->payload.size()),
+                             libwebsocket::kOPCodeBinary) >= 0) {
+    ctx->sent.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+// 收到回显消息, 在事件循环线程中执行.
+void HandleEcho(BenchContext* ctx, BenchConnection* conn) {
+  int64_t now = SteadyClockNanoseconds();
+  ctx->received.fetch_add(1, std::memory_order_relaxed);
+  if (now >= ctx->measure_begin_ns.load(std::memory_order_relaxed) &&
+      now < ctx->measure_end_ns.load(std::memory_order_relaxed)) {
+    Recorder* recorder = ctx->LocalRecorder();
+    recorder->latency.Record(
+        now - conn->sent_ns.load(std::memory_order_relaxed));
+    ++recorder->messages;
+  }
+  if (ctx->sending.load(std::memory_order_relaxed)) SendOne(ctx, conn);
+}
+
+// 测试一组参数, 连接全部失败时返回-1.
+int RunCase(Options const& options, int const& size, int const& count,
+            CaseResult* result) {
+  BenchContext ctx;
+  ctx.payload.assign(size, 'x');
+  ClientEventLoop loop(options.threads);
+  if (!loop.Start()) return -1;
+  std::vector<std::unique_ptr<BenchConnection>> conns;
+  std::atomic<int> finished{0};
+  std::atomic<int> failed{0};
+  for (int i = 0; i < count; ++i) {
+    conns.emplace_back(new BenchConnection());
+    BenchConnection* conn = conns.back().get();
+    conn->client.reset(new WebSocketClient());
+    WebSocketClient* client = conn->client.get();
+    client->Init();
+    client->SetRemoteAccessPoint(options.host, options.port);
+    client->OnMessage([&ctx, conn] (WebSocketClient::Socket const& fd,
+        OPCodeType const& opcode, char const* buffer, int const& length) {
+      HandleEcho(&ctx, conn);
+    });
+    if (client->ConnectAsync(&loop, [&] (int const& ret) {
+          if (ret != libwebsocket::kConnectOk) failed.fetch_add(1);
+          finished.fetch_add(1);
+        }) < 0) {
+      failed.fetch_add(1);
+      finished.fetch_add(1);
+    }
+    // 分批握手, 等待本批完成后再发起下一批.
+    if ((i + 1) % kConnectBatch == 0 || i + 1 == count) {
+      while (finished.load() < i + 1) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    }
+  }
+  if (failed.load() > 0) {
+    fprintf(stderr, "%d of %d connections failed\n", failed.load(), count);
+  }
+  std::vector<BenchConnection*> ready;
+  for (auto const& conn : conns) {
+    if (conn->client->service_is_running()) ready.push_back(conn.get());
+  }
+  if (ready.empty()) {
+    loop.Stop();
+    return -1;
+  }
+
+  int64_t begin_ns = SteadyClockNanoseconds() +
+                     static_cast<int64_t>(options.warmup_s*1e9);
+  int64_t end_ns = begin_ns + static_cast<int64_t>(options.duration_s*1e9);
+  ctx.measure_begin_ns.store(begin_ns);
+  ctx.measure_end_ns.store(end_ns);
+  for (auto conn : ready) SendOne(&ctx, conn);
+  std::this_thread::sleep_for(std::chrono::nanoseconds(
+      begin_ns - SteadyClockNanoseconds()));
+  double cpu_begin = ProcessCpuMicroseconds();
+  std::this_thread::sleep_for(std::chrono::nanoseconds(
+      end_ns - SteadyClockNanoseconds()));
+  double cpu_end = ProcessCpuMicroseconds();
+  ctx.sending.store(false);
+  // 等待在途消息回显, 最多1秒.
+  int64_t drain_ns = SteadyClockNanoseconds() + 1000000000LL;
+  while (ctx.received.load() < ctx.sent.load() &&
+         SteadyClockNanoseconds() < drain_ns) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  for (auto conn : ready) conn->client->Stop();
+  loop.Stop();
+
+  result->size = size;
+  result->connections = static_cast<int>(ready.size());
+  result->seconds = options.duration_s;
+  result->cpu_us = cpu_end - cpu_begin;
+  for (auto const& recorder : ctx.recorders) {
+    result->latency.Merge(recorder->latency);
+    result->messages += recorder->messages;
+  }
+  return 0;
+}
+
+void WriteResult(FILE* out, CaseResult const& result, bool const& last) {
+  double msgs = result.messages/result.seconds;
+  fprintf(out,
+          "    {\"size\": %d, \"connections\": %d, \"messages\": %llu, "
+          "\"msgs_per_s\": %.1f, \"mb_per_s\": %.3f, \"p50_us\": %.2f, "
+          "\"p99_us\": %.2f, \"p999_us\": %.2f, \"max_us\": %.2f, "
+          "\"cpu_us_per_msg\": %.3f}%s\n",
+          result.size, result.connections,
+          static_cast<unsigned long long>(result.messages), msgs,
+          msgs*result.size/(1024.0*1024.0),
+          result.latency.Percentile(50.0)/1000.0,
+          result.latency.Percentile(99.0)/1000.0,
+          result.latency.Percentile(99.9)/1000.0,
+          result.latency.max()/1000.0,
+          result.messages > 0 ? result.cpu_us/result.messages : 0.0,
+          last ? "" : ",");
+}
+
+bool ParseList(char const* text, std::vector<int>* out) {
+  out->clear();
+  while (*text != '\0') {
+    char* end = nullptr;
+    long value = strtol(text, &end, 10);
+    if (end == text || value <= 0) return false;
+    out->push_back(static_cast<int>(value));
+    text = (*end == ',') ? end + 1 : end;
+    if (*end != ',' && *end != '\0') return false;
+  }
+  return !out->empty();
+}
+
+void PrintUsage(char const* name) {
+  fprintf(stderr, "Usage: %s [options]\n"
+          "  -p port       loopback port for the echo server (default 18081)\n"
+          "  -t count      client event loop threads (default 2)\n"
+          "  -d seconds    measured duration per case (default 2)\n"
+          "  -w seconds    warm-up per case (default 0.5)\n"
+          "  -s list       message sizes (default 16,256,4096,65536,1048576)\n"
+          "  -c list       connection counts (default 1,10,100,1000,10000)\n"
+          "  -o file       write JSON to file instead of stdout\n", name);
+}
+
+bool ParseOptions(int argc, char* argv[], Options* options) {
+  int opt = 0;
+  while ((opt = getopt(argc, argv, "p:t:d:w:s:c:o:")) != -1) {
+    switch (opt) {
+      case 'p': options->port = atoi(optarg); break;
+      case 't': options->threads = atoi(optarg); break;
+      case 'd': options->duration_s = atof(optarg); break;
+      case 'w': options->warmup_s = atof(optarg); break;
+      case 's':
+        if (!ParseList(optarg, &options->sizes)) return false;
+        break;
+      case 'c':
+        if (!ParseList(optarg, &options->connections)) return false;
+        break;
+      case 'o': options->output = optarg; break;
+      default: return false;
+    }
+  }
+  return options->port > 0 && options->threads > 0 &&
+         options->duration_s > 0.0 && options->warmup_s >= 0.0;
+}
+
+// 尽量提高可打开的文件描述符数量, 每个连接在进程内占用两个描述符.
+void RaiseFileLimit(void) {
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+      limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  Options options;
+  if (!ParseOptions(argc, argv, &options)) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+  RaiseFileLimit();
+  // 库的日志输出到标准输出, 改为输出到标准错误, 标准输出只保留JSON结果.
+  FILE* out = nullptr;
+  if (options.output.empty()) {
+    fflush(stdout);
+    out = fdopen(dup(STDOUT_FILENO), "w");
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+  } else {
+    out = fopen(options.output.c_str(), "w");
+  }
+  if (out == nullptr) {
+    fprintf(stderr, "Open output failed !!!\n");
+    return 1;
+  }
+  struct rlimit limit;
+  uint64_t max_fds = 0;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0) max_fds = limit.rlim_cur;
+
+  WebSocketServer server;
+  server.Init();
+  server.SetServerAccessPoint(options.host, options.port);
+  server.OnMessage([&server] (WebSocketServer::Socket const& fd,
+      OPCodeType const& opcode, char const* buffer, int const& size) {
+    server.SendData(fd, buffer, size, opcode);
+  });
+  if (server.InitServer() != 0 || !server.Run()) {
+    fprintf(stderr, "Start echo server failed !!!\n");
+    return 1;
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  std::vector<std::unique_ptr<CaseResult>> results;
+  for (int size : options.sizes) {
+    for (int count : options.connections) {
+      if (static_cast<uint64_t>(size)*count > kMaxInflightBytes) {
+        fprintf(stderr, "Skip size %d x %d connections: too much data in "
+                "flight\n", size, count);
+        continue;
+      }
+      if (static_cast<uint64_t>(count)*2 + 64 > max_fds) {
+        fprintf(stderr, "Skip size %d x %d connections: file descriptor "
+                "limit %llu\n", size, count,
+                static_cast<unsigned long long>(max_fds));
+        continue;
+      }
+      fprintf(stderr, "Run size %d x %d connections\n", size, count);
+      std::unique_ptr<CaseResult> result(new CaseResult());
+      if (RunCase(options, size, count, result.get()) < 0) {
+        fprintf(stderr, "Case failed !!!\n");
+        continue;
+      }
+      results.push_back(std::move(result));
+      // 等待服务器处理完上一组连接的关闭.
+      std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+  }
+  server.Stop();
+
+  fprintf(out, "{\n  \"benchmark\": \"websocket_bench\",\n"
+          "  \"threads\": %d,\n  \"duration_s\": %.2f,\n  \"results\": [\n",
+          options.threads, options.duration_s);
+  for (size_t i = 0; i < results.size(); ++i) {
+    WriteResult(out, *results[i], i + 1 == results.size());
+  }
+  fprintf(out, "  ]\n}\n");
+  fclose(out);
+  return 0;
+}
@@ -0,0 +1,435 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  websocket_loadgen.cc
+// @Version :  1.0
+// @Desc    :  WebSocket load generator.
+//
+// 按指定连接数和线程数连接回显服务器, 以开环(固定速率)或闭环方式发送消息,
+// 统计吞吐量和延迟百分位数. 每条消息的前32字节以十六进制文本携带计划发送时间
+// 和实际发送时间, 服务器须原样回显消息.
+// 开环模式的延迟从计划发送时间算起, 发送线程或连接落后于计划时排队的时间也
+// 计入延迟, 不会因协调遗漏(coordinated omission)而低估尾部延迟; 同时单独
+// 报告从实际发送时间算起的服务时间. 闭环模式两者相同.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include <atomic>
+#include <chrono>  // NOLINT.
+#include <memory>
+#include <mutex>  // NOLINT.
+#include <string>
+#include <thread>  // NOLINT.
+#include <vector>
+
+#include "websocket/client.h"
+#include "websocket/client_event_loop.h"
+#include "websocket/rtt_stats.h"
+#include "latency_histogram.h"
+
+
+using libwebsocket::BatchOptions;
+using libwebsocket::ClientEventLoop;
+using libwebsocket::LatencyHistogram;
+using libwebsocket::OPCodeType;
+using libwebsocket::PayloadSegment;
+using libwebsocket::SteadyClockMicroseconds;
+using libwebsocket::WebSocketClient;
+
+
+namespace {
+
+// 消息头长度, 计划发送时间和实际发送时间各16个十六进制字符.
+constexpr int kStampLength = 32;
+
+struct Options {
+  std::string host = "127.0.0.1";
+  int port = 8081;
+  int connections = 100;
+  int threads = 2;
+  int duration_s = 10;
+  int warmup_s = 1;
+  double rate = 0.0;  // 总发送速率(消息/秒), 0为闭环.
+  int window = 1;  // 闭环模式每个连接的在途消息数.
+  int size = 64;
+  OPCodeType opcode = libwebsocket::kOPCodeBinary;
+  uint64_t fragment_size = 0;
+  int batch_delay_us = 0;
+};
+
+// 每个线程的统计, 只由所属线程写入, 结束后由主线程合并.
+struct Recorder {
+  LatencyHistogram latency;  // 从计划发送时间算起.
+  LatencyHistogram service;  // 从实际发送时间算起.
+  std::atomic<uint64_t> messages{0};  // 测量区间内收到的消息数.
+  std::atomic<uint64_t> bytes{0};  // 测量区间内收到的负载字节数.
+};
+
+struct LoadContext {
+  Options options;
+  std::vector<char> filler;  // 消息头之后的负载内容.
+  std::atomic<int64_t> measure_begin_us{INT64_MAX};
+  std::atomic<int64_t> measure_end_us{INT64_MAX};
+  std::atomic<bool> sending{true};
+  std::atomic<uint64_t> sent{0};
+  std::atomic<uint64_t> send_errors{0};
+  std::atomic<uint64_t> received{0};
+  std::mutex recorders_mutex;
+  std::vector<std::unique_ptr<Recorder>> recorders;
+
+  // 获取当前线程的统计, 首次调用时登记.
+  Recorder* LocalRecorder(void) {
+    thread_local Recorder* recorder = nullptr;
+    thread_local LoadContext* owner = nullptr;
+    if (recorder == nullptr || owner != this) {
+      std::lock_guard<std::mutex> lock(recorders_mutex);
+      recorders.emplace_back(new Recorder());
+      recorder = recorders.back().get();
+      owner = this;
+    }
+    return recorder;
+  }
+};
+
+void EncodeHex(uint64_t value, char* out) {
+  static char const kDigits[] = "0123456789abcdef";
+  for (int i = 15; i >= 0; --i) {
+    out[i] = kDigits[value & 0x0F];
+    value >>= 4;
+  }
+}
+
+bool DecodeHex(char const* in, int64_t* value) {
+  uint64_t result = 0;
+  for (int i = 0; i < 16; ++i) {
+    char c = in[i];
+    int digit = 0;
+    if (c >= '0' && c <= '9') {
+      digit = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      digit = c - 'a' + 10;
+    } else {
+      return false;
+    }
+    result = (result << 4) | digit;
+  }
+  *value = static_cast<int64_t>(result);
+  return true;
+}
+
+// 发送一条消息, 消息头写入调用方的栈上缓冲区, 负载内容共享.
+int SendStamped(LoadContext* ctx, WebSocketClient* client,
+                int64_t const& intended_us) {
+  char stamp[kStampLength];
+  EncodeHex(static_cast<uint64_t>(intended_us), stamp);
+  EncodeHex(static_cast<uint64_t>(SteadyClockMicroseconds()), stamp + 16);
+  int ret = client->SendData(ctx->options.opcode, {
+      PayloadSegment{stamp, kStampLength},
+      PayloadSegment{ctx->filler.data(), ctx->filler.size()}});
+  if (ret < 0) {
+    ctx->send_errors.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    ctx->sent.fetch_add(1, std::memory_order_relaxed);
+  }
+  return ret;
+}
+
+// 收到回显消息, 在事件循环线程中执行.
+void HandleEcho(LoadContext* ctx, WebSocketClient* client,
+                char const* buffer, int const& size) {
+  int64_t now = SteadyClockMicroseconds();
+  ctx->received.fetch_add(1, std::memory_order_relaxed);
+  int64_t intended_us = 0;
+  int64_t sent_us = 0;
+  if (size < kStampLength || !DecodeHex(buffer, &intended_us) ||
+      !DecodeHex(buffer + 16, &sent_us)) {
+    return;
+  }
+  if (intended_us >= ctx->measure_begin_us.load(std::memory_order_relaxed) &&
+      intended_us < ctx->measure_end_us.load(std::memory_order_relaxed)) {
+    Recorder* recorder = ctx->LocalRecorder();
+    recorder->latency.Record(now - intended_us);
+    recorder->service.Record(now - sent_us);
+    recorder->messages.store(
+        recorder->messages.load(std::memory_order_relaxed) + 1,
+        std::memory_order_relaxed);
+    recorder->bytes.store(
+        recorder->bytes.load(std::memory_order_relaxed) + size,
+        std::memory_order_relaxed);
+  }
+  // 闭环模式收到回显后立即发送下一条.
+  if (ctx->options.rate <= 0.0 &&
+      ctx->sending.load(std::memory_order_relaxed)) {
+    SendStamped(ctx, client, SteadyClockMicroseconds());
+  }
+}
+
+// 开环发送线程, 按固定间隔轮流向所属连接发送. 落后于计划时立即补发,
+// 消息仍携带原计划时间.
+void OpenLoopSender(LoadContext* ctx,
+                    std::vector<WebSocketClient*> const& clients,
+                    double const& rate, int64_t const& begin_us) {
+  if (clients.empty() || rate <= 0.0) return;
+  double interval_us = 1000000.0/rate;
+  double next_us = static_cast<double>(begin_us);
+  size_t index = 0;
+  while (ctx->sending.load(std::memory_order_relaxed)) {
+    int64_t intended_us = static_cast<int64_t>(next_us);
+    int64_t wait_us = intended_us - SteadyClockMicroseconds();
+    if (wait_us > 200) {
+      std::this_thread::sleep_for(std::chrono::microseconds(wait_us - 100));
+      continue;
+    }
+    if (wait_us > 0) {
+      std::this_thread::yield();
+      continue;
+    }
+    SendStamped(ctx, clients[index], intended_us);
+    index = (index + 1) % clients.size();
+    next_us += interval_us;
+  }
+}
+
+void PrintUsage(char const* name) {
+  printf("Usage: %s [options]\n"
+         "  -h host       server address (default 127.0.0.1)\n"
+         "  -p port       server port (default 8081)\n"
+         "  -c count      number of connections (default 100)\n"
+         "  -t count      event loop and sender threads (default 2)\n"
+         "  -d seconds    measured duration (default 10)\n"
+         "  -w seconds    warm-up before measuring (default 1)\n"
+         "  -r rate       open-loop total rate in msg/s, 0 for closed-loop"
+         " (default 0)\n"
+         "  -n count      closed-loop messages in flight per connection"
+         " (default 1)\n"
+         "  -s bytes      message size, at least %d (default 64)\n"
+         "  -o opcode     text or binary (default binary)\n"
+         "  -f bytes      fragment size, 0 to disable (default 0)\n"
+         "  -b us         batch outbound frames for up to us microseconds\n",
+         name, kStampLength);
+}
+
+bool ParseOptions(int argc, char* argv[], Options* options) {
+  int opt = 0;
+  while ((opt = getopt(argc, argv, "h:p:c:t:d:w:r:n:s:o:f:b:")) != -1) {
+    switch (opt) {
+      case 'h': options->host = optarg; break;
+      case 'p': options->port = atoi(optarg); break;
+      case 'c': options->connections = atoi(optarg); break;
+      case 't': options->threads = atoi(optarg); break;
+      case 'd': options->duration_s = atoi(optarg); break;
+      case 'w': options->warmup_s = atoi(optarg); break;
+      case 'r': options->rate = atof(optarg); break;
+      case 'n': options->window = atoi(optarg); break;
+      case 's': options->size = atoi(optarg); break;
+      case 'o':
+        if (strcmp(optarg, "text") == 0) {
+          options->opcode = libwebsocket::kOPCodeText;
+        } else if (strcmp(optarg, "binary") == 0) {
+          options->opcode = libwebsocket::kOPCodeBinary;
+        } else {
+          return false;
+        }
+        break;
+      case 'f': options->fragment_size = strtoull(optarg, nullptr, 10); break;
+      case 'b': options->batch_delay_us = atoi(optarg); break;
+      default: return false;
+    }
+  }
+  return options->port > 0 && options->connections > 0 &&
+         options->threads > 0 && options->duration_s > 0 &&
+         options->warmup_s >= 0 && options->rate >= 0.0 &&
+         options->window > 0 && options->size >= kStampLength &&
+         options->batch_delay_us >= 0;
+}
+
+// 尽量提高可打开的文件描述符数量.
+void RaiseFileLimit(void) {
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+      limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+}
+
+void PrintHistogram(char const* title, LatencyHistogram const& histogram) {
+  printf("%s (us): min %lld, mean %.1f, p50 %lld, p90 %lld, p99 %lld, "
+         "p99.9 %lld, p99.99 %lld, max %lld\n", title,
+         static_cast<long long>(histogram.min()), histogram.mean(),
+         static_cast<long long>(histogram.Percentile(50.0)),
+         static_cast<long long>(histogram.Percentile(90.0)),
+         static_cast<long long>(histogram.Percentile(99.0)),
+         static_cast<long long>(histogram.Percentile(99.9)),
+         static_cast<long long>(histogram.Percentile(99.99)),
+         static_cast<long long>(histogram.max()));
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  LoadContext ctx;
+  if (!ParseOptions(argc, argv, &ctx.options)) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+  Options const& options = ctx.options;
+  ctx.filler.assign(options.size - kStampLength, 'x');
+  RaiseFileLimit();
+
+  ClientEventLoop loop(options.threads);
+  if (!loop.Start()) {
+    printf("Start event loop failed !!!\n");
+    return 1;
+  }
+  // 异步建立全部连接, 由事件循环并行完成握手.
+  std::vector<std::unique_ptr<WebSocketClient>> clients;
+  std::atomic<int> connected{0};
+  std::atomic<int> failed{0};
+  for (int i = 0; i < options.connections; ++i) {
+    clients.emplace_back(new WebSocketClient());
+    WebSocketClient* client = clients.back().get();
+    client->Init();
+    client->SetRemoteAccessPoint(options.host, options.port);
+    client->SetFragmentSize(options.fragment_size);
+    if (options.batch_delay_us > 0) {
+      BatchOptions batch;
+      batch.enabled = true;
+      batch.max_delay_us = options.batch_delay_us;
+      client->SetBatching(batch);
+    }
+    client->OnMessage([&ctx, client] (WebSocketClient::Socket const& fd,
+        OPCodeType const& opcode, char const* buffer, int const& size) {
+      HandleEcho(&ctx, client, buffer, size);
+    });
+    if (client->ConnectAsync(&loop, [&] (int const& result) {
+          if (result == libwebsocket::kConnectOk) {
+            connected.fetch_add(1);
+          } else {
+            failed.fetch_add(1);
+          }
+        }) < 0) {
+      failed.fetch_add(1);
+    }
+  }
+  while (connected.load() + failed.load() < options.connections) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  printf("Connected %d/%d to %s:%d\n", connected.load(), options.connections,
+         options.host.c_str(), options.port);
+  if (connected.load() == 0) {
+    loop.Stop();
+    return 1;
+  }
+  std::vector<WebSocketClient*> ready;
+  for (auto const& client : clients) {
+    if (client->service_is_running()) ready.push_back(client.get());
+  }
+
+  int64_t begin_us = SteadyClockMicroseconds();
+  ctx.measure_begin_us.store(begin_us + options.warmup_s*1000000LL);
+  ctx.measure_end_us.store(ctx.measure_begin_us.load() +
+                           options.duration_s*1000000LL);
+  std::vector<std::thread> senders;
+  if (options.rate > 0.0) {
+    // 连接按线程均分, 每个发送线程负责其中一组.
+    std::vector<std::vector<WebSocketClient*>> groups(options.threads);
+    for (size_t i = 0; i < ready.size(); ++i) {
+      groups[i % options.threads].push_back(ready[i]);
+    }
+    int active = options.threads < static_cast<int>(ready.size()) ?
+                 options.threads : static_cast<int>(ready.size());
+    for (int i = 0; i < active; ++i) {
+      senders.emplace_back(OpenLoopSender, &ctx, groups[i],
+                           options.rate/active, begin_us);
+    }
+  } else {
+    for (int i = 0; i < options.window; ++i) {
+      for (auto client : ready) SendStamped(&ctx, client, begin_us);
+    }
+  }
+
+  // 每秒输出一次进度.
+  int64_t end_us = ctx.measure_end_us.load();
+  uint64_t last_received = 0;
+  int64_t last_us = begin_us;
+  while (SteadyClockMicroseconds() < end_us) {
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    int64_t now = SteadyClockMicroseconds();
+    uint64_t received = ctx.received.load();
+    printf("[%3llds] sent %llu, received %llu, %.0f msg/s\n",
+           static_cast<long long>((now - begin_us)/1000000),
+           static_cast<unsigned long long>(ctx.sent.load()),
+           static_cast<unsigned long long>(received),
+           (received - last_received)*1000000.0/(now - last_us));
+    last_received = received;
+    last_us = now;
+  }
+  ctx.sending.store(false);
+  for (auto& sender : senders) sender.join();
+  // 等待在途消息回显, 最多1秒.
+  int64_t drain_us = SteadyClockMicroseconds() + 1000000;
+  while (ctx.received.load() < ctx.sent.load() &&
+         SteadyClockMicroseconds() < drain_us) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  for (auto client : ready) client->Stop();
+  loop.Stop();
+
+  LatencyHistogram latency;
+  LatencyHistogram service;
+  uint64_t messages = 0;
+  uint64_t bytes = 0;
+  for (auto const& recorder : ctx.recorders) {
+    latency.Merge(recorder->latency);
+    service.Merge(recorder->service);
+    messages += recorder->messages.load();
+    bytes += recorder->bytes.load();
+  }
+  double seconds = static_cast<double>(options.duration_s);
+  printf("Mode: %s", options.rate > 0.0 ? "open-loop" : "closed-loop");
+  if (options.rate > 0.0) {
+    printf(", target %.0f msg/s", options.rate);
+  } else {
+    printf(", %d in flight per connection", options.window);
+  }
+  printf(", %zu connections, %d threads, %d-byte %s messages\n",
+         ready.size(), options.threads, options.size,
+         options.opcode == libwebsocket::kOPCodeText ? "text" : "binary");
+  printf("Sent %llu, received %llu, send errors %llu\n",
+         static_cast<unsigned long long>(ctx.sent.load()),
+         static_cast<unsigned long long>(ctx.received.load()),
+         static_cast<unsigned long long>(ctx.send_errors.load()));
+  printf("Throughput: %.0f msg/s, %.2f MB/s\n", messages/seconds,
+         bytes/seconds/(1024.0*1024.0));
+  if (options.rate > 0.0) {
+    PrintHistogram("Latency from intended send", latency);
+    PrintHistogram("Service time from actual send", service);
+  } else {
+    PrintHistogram("Latency", service);
+  }
+  return 0;
+}
@@ -18,16 +18,72 @@
 #include <windows.h>
 #endif
 
+#include <stdint.h>
+
 #include <atomic>
+#include <condition_variable>
 #include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 #include <thread>
 
+#include "frame_codec.h"
+#include "permessage_deflate.h"
+#include "replay_ring.h"
+#include "rtt_stats.h"
+#include "send_queue.h"
+#include "timer_wheel.h"
+#include "utf8_validator.h"
+#include "wakeup.h"
+#include "websocket.h"
+
 
 namespace libwebsocket {
 
+class ClientEventLoop;
+
+// 异步连接结果.
+enum ConnectResult {
+  kConnectOk = 0,  // 握手成功.
+  kConnectFailed = -1,  // TCP连接失败或连接中断.
+  kConnectTimeout = -2,  // TCP连接或握手超时.
+  kConnectRejected = -3,  // 握手响应无效.
+};
+
+// 客户端连接状态.
+enum ClientState {
+  kClientConnecting = 0,  // 正在连接或等待握手响应.
+  kClientOpen,  // 握手成功.
+  kClientWaiting,  // 连接断开, 等待重连.
+  kClientClosed,  // 连接断开且不再重连.
+};
+
+// 自动重连参数.
+// 第n次重连前等待[0, min(max_delay_ms, base_delay_ms*2^n)]内的随机时间
+// (full jitter), 使大量客户端的重连分散开, 而不是同时涌向服务端.
+struct ReconnectOptions {
+  bool enabled = false;  // 是否自动重连.
+  int base_delay_ms = 100;  // 第一次重连的最长等待时间.
+  int max_delay_ms = 30000;  // 重连等待时间的上限.
+  int max_attempts = 0;  // 连续失败的最大重连次数, 0表示不限制.
+};
+
+// 批量发送参数.
+// 启用后数据帧先在发送队列中积攒, 第一帧最多等待max_delay_us微秒, 或积攒
+// 到max_bytes字节后与之后的帧一起以一次writev写出, 以有限的延迟换取更少的
+// 系统调用和TCP分段. 控制帧不积攒, 并带出已积攒的数据帧.
+struct BatchOptions {
+  bool enabled = false;  // 是否批量发送.
+  int max_delay_us = 1000;  // 积攒的第一帧最多等待的时间(微秒).
+  size_t max_bytes = 16384;  // 积攒到该字节数时立即写出.
+};
+
 // Websocket客户端.
+// Run()为每个连接创建一个服务线程; Run(loop)由ClientEventLoop的线程驱动,
+// 连接不再占用单独的线程, 回调在事件循环线程中执行.
 //
 // Example:
 //     WebSocketClient client;
@@ -38,7 +94,7 @@ namespace libwebsocket {
 //         const char *buffer, const int &size) -> void {
 //     printf("Recv[%d]: %s\n", size, buffer);
 //   });
-//   if ((client.ConnectRemote() == 0) &&
+//   if ((client.ConnectRemote() == 0 ) &&
 //       client.Run()) {
 //     std::vector<char> msg;
 //     msg.assign(str, str + sizeof(str) -1);
@@ -51,7 +107,8 @@ namespace libwebsocket {
 //   }
 class WebSocketClient {
  public:
-  WebSocketClient() {}
+  WebSocketClient() : timers_(nullptr), loop_(nullptr), loop_index_(0),
+                      scheduled_(false), want_write_(false) {}
   ~WebSocketClient() { Stop(); }
 
   // 重要参数初始化.
@@ -61,12 +118,21 @@ class WebSocketClient {
     server_ip_ = ip;
     server_port_ = port;
   }
-  // 连接到远程服务器.
+  // 连接到远程服务器, 最多等待连接超时时间.
   int ConnectRemote(void);
+  // 连接结果回调函数定义, result为ConnectResult.
+  using ConnectCallback = std::function<void (int const& result)>;
+  // 以非阻塞方式连接远程服务器并完成握手, 发起连接后立即返回, 之后由事件
+  // 循环驱动. 握手成功或失败时在事件循环线程中回调一次, 成功后与Run(loop)
+  // 启动的连接相同. 可在事件循环线程中调用.
+  int ConnectAsync(ClientEventLoop* loop, ConnectCallback const& callback);
 
   // 启动服务线程.
   bool Run(void);
-  // 停止服务线程.
+  // 将连接交给事件循环驱动, 不创建服务线程; 握手完成或超时后返回.
+  // 不能在事件循环线程中调用. 之后添加的定时器在事件循环线程中执行.
+  bool Run(ClientEventLoop* loop);
+  // 停止服务线程, 由事件循环驱动时将连接移出事件循环. 之后不再自动重连.
   void Stop(void);
   // 获取当前服务线程运行状态.
   bool service_is_running(void) const {
@@ -86,21 +152,204 @@ class WebSocketClient {
   void OnDeepReceived(ReceiveCallback const &callback) {
     deep_callback_ = callback;
   }
+  // 接收到完整消息时的回调函数定义, opcode为消息首帧的操作码.
+  using MessageCallback = std::function<void (Socket const& fd,
+      OPCodeType const& opcode, char const* buffer, int const& size)>;
+  // 设置接收完整消息回调函数, 分片消息组装完成后回调一次, 在Run之前调用.
+  // 与OnReceived同时生效, 未设置时不组装分片.
+  void OnMessage(MessageCallback const& callback) {
+    message_callback_ = callback;
+  }
+  // 连接关闭时的回调函数定义, code为关闭状态码,
+  // 未经关闭握手直接断开时为kCloseAbnormal.
+  using CloseCallback = std::function<void (Socket const& fd, int const& code)>;
+  // 设置握手成功后的连接关闭时的回调函数.
+  void OnClosed(CloseCallback const& callback) {
+    close_callback_ = callback;
+  }
+  // 连接状态变化时的回调函数定义, state为ClientState.
+  using StateCallback = std::function<void (int const& state)>;
+  // 设置连接状态变化时的回调函数, 在服务线程或事件循环线程中执行.
+  void OnStateChanged(StateCallback const& callback) {
+    state_callback_ = callback;
+  }
+  // 设置自动重连参数. 启用后, 握手成功过的连接在非主动断开(Stop或
+  // Disconnect)时按退避时间重新连接并握手, 服务线程或事件循环保持不变.
+  void SetReconnect(ReconnectOptions const& options) {
+    reconnect_options_ = options;
+  }
+  // 自上次握手成功以来的重连次数.
+  int reconnect_attempts(void) const { return reconnect_attempts_; }
+  // 设置是否请求会话恢复, 在Run之前调用. 服务端接受后, 重连时带上会话标识
+  // 和已收到的最后一条消息的序号, 服务端只补发之后的消息; 消息负载前的
+  // 序号在回调前去除.
+  void SetResume(bool const& enable) { resume_enabled_ = enable; }
+  // 会话恢复结果的回调函数定义, resumed为false表示服务端新建了会话
+  // 或不支持会话恢复, 需要重新获取完整状态.
+  using ResumeCallback = std::function<void (bool const& resumed)>;
+  // 设置启用会话恢复时每次握手成功后的回调函数.
+  void OnResumed(ResumeCallback const& callback) {
+    resume_callback_ = callback;
+  }
+  // 已完整接收的最后一条消息的序号.
+  uint64_t last_sequence(void) const { return last_sequence_; }
+
+  // 设置单帧负载长度上限, 超出时以1009状态码关闭连接.
+  void SetMaxFrameSize(uint64_t const& size) { max_frame_size_ = size; }
+  // 设置单条消息(含所有分片)负载长度上限, 超出时以1009状态码关闭连接.
+  void SetMaxMessageSize(uint64_t const& size) { max_message_size_ = size; }
+  // 设置是否校验文本消息和关闭原因为合法的UTF-8, 非法时以1007状态码关闭
+  // 连接. 跨分片的字符可正确校验, 非法序列出现后其所在分片不再回调.
+  void SetValidateUtf8(bool const& enable) { validate_utf8_ = enable; }
+
+  // 设置向服务端发送带时间戳ping的间隔(毫秒), 0表示不发送.
+  // 收到的ping会自动回复pong, ping/pong不再传递给接收回调.
+  void SetPingInterval(int const& interval_ms) {
+    ping_interval_ms_ = interval_ms;
+  }
+  // 设置TCP连接超时时间(毫秒).
+  void SetConnectTimeout(int const& timeout_ms) {
+    connect_timeout_ms_ = timeout_ms;
+  }
+  // 设置握手超时时间(毫秒), Run最多等待该时间.
+  void SetHandshakeTimeout(int const& timeout_ms) {
+    handshake_timeout_ms_ = timeout_ms;
+  }
+  // 设置空闲超时时间(毫秒), 超时未收到任何数据则断开连接, 0表示不限制.
+  void SetIdleTimeout(int const& timeout_ms) {
+    idle_timeout_ms_ = timeout_ms;
+  }
+  // 设置关闭握手超时时间(毫秒), 超时未完成关闭握手则直接断开.
+  void SetCloseTimeout(int const& timeout_ms) {
+    close_timeout_ms_ = timeout_ms;
+  }
+  // 发起关闭握手: 已排队的数据写出后发送关闭帧, 收到服务端的关闭帧或超时后
+  // 断开连接. 之后不再接受新的发送数据.
+  int Disconnect(int const& code = kCloseNormal,
+                 std::string const& reason = std::string());
+  // 添加定时器, 回调在服务线程中执行, interval_ms大于0时重复执行.
+  TimerWheel::TimerId AddTimer(int64_t const& delay_ms,
+                               TimerWheel::Callback const& callback,
+                               int64_t const& interval_ms = 0) {
+    auto id = timers()->Add(delay_ms, callback, interval_ms);
+    WakeService();
+    return id;
+  }
+  // 取消定时器.
+  bool CancelTimer(TimerWheel::TimerId const& id) {
+    return timers()->Cancel(id);
+  }
+  // 获取往返时延统计.
+  void GetRttStats(RttStats* stats) {
+    std::lock_guard<std::mutex> lock(rtt_mutex_);
+    if (stats != nullptr) *stats = rtt_stats_;
+  }
+  // 设置批量发送参数, 在Run之前调用, 对之后握手成功的连接生效.
+  void SetBatching(BatchOptions const& options) { batch_options_ = options; }
+  // 设置SendData发送分片的最大负载长度, 0表示不分片.
+  void SetFragmentSize(uint64_t const& size) { fragment_size_ = size; }
+  // 设置permessage-deflate参数, 在Run之前调用. 服务端接受后SendData发送的
+  // 数据帧按协商结果压缩, 接收回调得到解压后的内容.
+  void SetPerMessageDeflate(DeflateOptions const& options) {
+    deflate_options_ = options;
+  }
 
-  // 直接发送原始数据.
+  // 直接发送原始数据, 数据需为已封装的完整帧.
   int SendRawData(char const* buffer, int const& size);
   int SendRawData(std::vector<char> const& msg) {
     return SendRawData(msg.data(), msg.size());
   }
-  // 封装并发送协议格式数据.
-  int SendData(char const*buffer, int const& size);
+  // 封装并发送协议格式数据, 长消息按分片长度拆分为多个分片帧.
+  // 已协商permessage-deflate时先压缩再分片.
+  int SendData(char const*buffer, int const& size) {
+    return SendData(buffer, size, kOPCodeText);
+  }
   int SendData(std::vector<char> const& msg) {
     return SendData(msg.data(), msg.size());
   }
+  // 以指定操作码(文本或二进制)封装并发送数据.
+  int SendData(char const* buffer, int const& size, OPCodeType const& opcode);
+  // 封装并发送由多个片段组成的消息. 片段直接加掩码写入连接的发送暂存区,
+  // 不需要先拼接; 发送队列为空时整条消息一次写出, 不再分配帧缓冲区.
+  int SendData(OPCodeType const& opcode, PayloadSegment const* segments,
+               size_t const& count);
+  int SendData(OPCodeType const& opcode,
+               std::initializer_list<PayloadSegment> const& segments) {
+    return SendData(opcode, segments.begin(), segments.size());
+  }
+  // 封装并发送控制帧, 控制帧优先于排队中的数据帧发送.
+  int SendControl(OPCodeType const& opcode,
+                  char const* buffer, int const& size);
 
  private:
+  friend class ClientEventLoop;
+
+  // 创建非阻塞套接字并发起连接, 返回0表示已连接, 1表示正在连接.
+  int OpenSocket(void);
+  // 生成并排队握手请求, 启动握手超时定时器.
+  int StartHandshake(void);
   // 服务线程处理函数.
   void ThreadHandler(void);
+  // 在服务线程中处理一个连接, 直到连接断开.
+  void ServiceLoop(char* buffer);
+  // 连接中时检查连接结果; 之后写出发送队列, readable为true时接收并处理
+  // 数据. 返回值小于0时需断开连接.
+  int HandleEvents(bool const& readable, bool const& writable,
+                   char* buffer, int const& size);
+  // 是否需要等待可写事件, 正在积攒的数据不需要.
+  bool WantWrite(void) {
+    return handshake_state_ == kConnecting || send_queue_.blocked();
+  }
+  // 数据帧开始积攒时设置截止时间, 由服务线程或事件循环按时写出.
+  void ArmBatch(void);
+  // 取消定时器, 关闭套接字并回调连接关闭.
+  void FinishService(void);
+  // 通知服务线程或事件循环处理本连接.
+  void WakeService(void);
+  // 在服务线程或事件循环中停止本连接.
+  void RequestStop(void) {
+    service_is_running_.store(false);
+    WakeService();
+  }
+  // 当前使用的定时器, 未由事件循环驱动时首次使用时创建.
+  TimerWheel* timers(void) {
+    if (timers_ == nullptr) {
+      own_timers_.reset(new TimerWheel());
+      timers_ = own_timers_.get();
+    }
+    return timers_;
+  }
+  // 解析接收缓冲区中的完整帧, 返回值小于0时需关闭连接.
+  int ProcessFrames(void);
+  // 处理接收缓冲区中的握手响应, 返回值小于0时需关闭连接.
+  int ProcessHandshake(void);
+  // 检查连接是否空闲超时, 未超时则按剩余时间重新设置定时器.
+  void CheckIdle(void);
+  // 结束握手等待并通知Run.
+  void FinishHandshake(int const& state);
+  // 发送关闭帧并启动关闭握手超时定时器.
+  int BeginClose(int const& code, std::string const& reason);
+  // 发起非阻塞连接并交给事件循环.
+  int BeginConnect(ClientEventLoop* loop);
+  // 连接断开后计算下一次重连的等待时间, 不再重连时返回false.
+  bool PrepareReconnect(int64_t* delay_ms);
+  // 在事件循环的定时器中等待后重连.
+  void ScheduleReconnect(void);
+  // 在服务线程中等待后重连, 重新发出握手请求后返回true.
+  bool ReconnectInThread(void);
+  // 等待重连的TCP连接建立, Stop可随时中断等待. 成功返回0.
+  int WaitReconnected(void);
+  // 校验握手响应中的会话恢复头部, 返回是否补发了断开期间的消息.
+  bool AcceptResume(HttpToken const& resume);
+  void ChangeState(int const& state) { state_callback_(state); }
+
+  // 握手状态.
+  enum HandshakeState {
+    kConnecting = -1,  // 等待TCP连接完成.
+    kHandshaking = 0,  // 等待握手响应.
+    kHandshakeDone,  // 握手成功.
+    kHandshakeFailed,  // 握手失败.
+  };
 
   Socket socket_;  // 通用TCP连接socket.
   std::atomic_bool is_connected_;  // 与服务端TCP连接状态.
@@ -110,6 +359,72 @@ class WebSocketClient {
   std::atomic_bool service_is_running_;  // 服务线程运行标志.
   ReceiveCallback deep_callback_;  // 原始消息回调函数.
   ReceiveCallback callback_;  // 解析后的消息回调函数.
+  MessageCallback message_callback_;  // 完整消息回调函数.
+  CloseCallback close_callback_;  // 连接关闭回调函数.
+  StateCallback state_callback_;  // 连接状态回调函数.
+  ReconnectOptions reconnect_options_;  // 自动重连参数.
+  std::atomic_bool stop_requested_;  // 已主动断开, 不再重连.
+  bool reconnect_armed_;  // 是否握手成功过, 之后断开时才重连.
+  std::atomic_int reconnect_attempts_;  // 连续重连次数.
+  std::atomic<TimerWheel::TimerId> reconnect_timer_;  // 重连等待定时器.
+  bool resume_enabled_;  // 是否请求会话恢复.
+  ResumeCallback resume_callback_;  // 会话恢复结果回调函数.
+  std::string session_id_;  // 服务端分配的会话标识.
+  std::atomic<uint64_t> last_sequence_;  // 已完整接收的最后一条消息的序号.
+  bool sequenced_;  // 当前连接的消息是否带序号.
+  uint64_t sequence_;  // 当前消息的序号.
+  size_t sequence_length_;  // 当前消息已接收的序号字节数.
+  std::vector<char> recv_buffer_;  // 尚未组成完整帧的接收数据.
+  uint64_t message_length_;  // 当前分片消息已接收的负载长度.
+  bool fragmented_;  // 是否有尚未收到最后一个分片的消息.
+  bool compressed_;  // 当前分片消息是否经过压缩.
+  bool text_;  // 当前分片消息是否为文本消息.
+  OPCodeType message_opcode_;  // 当前分片消息的操作码.
+  std::vector<char> message_buffer_;  // 组装中的分片消息.
+  Utf8Validator utf8_;  // 文本消息的UTF-8校验状态.
+  uint64_t max_frame_size_;  // 单帧负载长度上限.
+  uint64_t max_message_size_;  // 单条消息负载长度上限.
+  bool validate_utf8_;  // 是否校验文本消息的UTF-8编码.
+  uint64_t fragment_size_;  // 发送分片的最大负载长度.
+  DeflateOptions deflate_options_;  // permessage-deflate参数.
+  PerMessageDeflate deflate_;  // 压缩/解压上下文.
+  std::mutex send_mutex_;  // 保证消息的压缩顺序与入队顺序一致.
+  std::vector<char> send_input_;  // 压缩前拼接片段的暂存区.
+  std::vector<char> send_compressed_;  // 压缩结果的暂存区.
+  std::vector<char> send_buffer_;  // 封装发送帧的暂存区.
+  std::vector<uint64_t> send_lengths_;  // 暂存区中各帧的长度.
+  SendQueue send_queue_;  // 发送队列.
+  BatchOptions batch_options_;  // 批量发送参数.
+  std::atomic<int64_t> batch_deadline_us_;  // 积攒数据的写出时间, 0表示无.
+  int ping_interval_ms_;  // 发送ping的间隔.
+  RttStats rtt_stats_;  // 往返时延统计.
+  std::mutex rtt_mutex_;  // 往返时延统计互斥锁.
+  int connect_timeout_ms_;  // TCP连接超时时间.
+  int handshake_timeout_ms_;  // 握手超时时间.
+  int idle_timeout_ms_;  // 空闲超时时间.
+  int64_t last_recv_ms_;  // 最近一次接收数据的时间.
+  std::string accept_key_;  // 期望的Sec-WebSocket-Accept值.
+  int handshake_state_;  // 握手状态.
+  std::mutex handshake_mutex_;  // 握手状态互斥锁.
+  std::condition_variable handshake_cv_;  // 握手完成通知.
+  ConnectCallback connect_callback_;  // 异步连接结果回调.
+  int connect_result_;  // 异步连接失败的原因.
+  TimerWheel::TimerId handshake_timer_;  // 握手超时定时器.
+  TimerWheel::TimerId idle_timer_;  // 空闲超时定时器.
+  TimerWheel::TimerId ping_timer_;  // 定时ping定时器.
+  TimerWheel::TimerId deflate_timer_;  // 释放空闲压缩流定时器.
+  int close_timeout_ms_;  // 关闭握手超时时间.
+  std::atomic_bool closing_;  // 已发出关闭帧.
+  std::atomic_bool peer_closed_;  // 已收到对端关闭帧.
+  std::atomic_int close_code_;  // 关闭状态码.
+  std::atomic<TimerWheel::TimerId> close_timer_;  // 关闭握手超时定时器.
+  TimerWheel* timers_;  // 当前使用的定时器.
+  std::unique_ptr<TimerWheel> own_timers_;  // 服务线程的定时器.
+  std::unique_ptr<Wakeup> wakeup_;  // 唤醒阻塞中的服务线程.
+  ClientEventLoop* loop_;  // 驱动本连接的事件循环, 为空时使用服务线程.
+  size_t loop_index_;  // 所在事件循环线程的序号.
+  std::atomic_bool scheduled_;  // 已加入事件循环的待处理列表.
+  bool want_write_;  // 事件循环中是否在等待可写事件.
 };
 
 }  // namespace libwebsocket
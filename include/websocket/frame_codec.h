@@ -0,0 +1,134 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  frame_codec.h
+// @Version :  1.0
+// @Desc    :  None
+
+
+#ifndef WEBSOCKET_FRAME_CODEC_H_
+#define WEBSOCKET_FRAME_CODEC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "websocket.h"
+
+
+namespace libwebsocket {
+
+// 帧首字节中的FIN位.
+constexpr uint8_t kFrameFinBit = 0x80;
+// 帧首字节中的opcode.
+constexpr uint8_t kFrameOpcodeBits = 0x0F;
+// 帧第二字节中的MASK位.
+constexpr uint8_t kFrameMaskBit = 0x80;
+// 帧头最大长度: 2字节基本头, 8字节扩展长度和4字节掩码.
+constexpr size_t kMaxFrameHeaderLength = 14;
+
+// 负载片段, 由多个缓冲区组成的消息可不经拼接直接封装.
+struct PayloadSegment {
+  char const* data;  // 片段数据.
+  uint64_t size;  // 片段长度.
+};
+
+// 解码后的帧头.
+struct FrameHeader {
+  bool fin;  // 是否为消息的最后一个分片.
+  uint8_t reserve;  // RSV1-RSV3, 保持在首字节中的位置, 即kFrameRsvBits.
+  uint8_t opcode;  // 帧类型.
+  bool mask;  // 负载是否经过掩码处理.
+  uint8_t mask_key[4];  // 掩码.
+  uint64_t payload_length;  // 负载长度.
+  size_t header_length;  // 帧头长度.
+};
+
+// 按网络字节序编码帧头, flags为首字节, mask_key为空时不加掩码.
+// out至少有kMaxFrameHeaderLength字节, 返回帧头长度.
+size_t EncodeFrameHeader(uint8_t flags, uint64_t payload_length,
+                         uint8_t const* mask_key, uint8_t* out);
+// 解码数据流头部的帧头, 拒绝保留的操作码, 检查控制帧的分片和长度限制.
+int DecodeFrameHeader(char const* data, uint64_t size, FrameHeader* out);
+// 以mask_key对负载进行掩码处理, 按8字节为单位异或, src与dst可以相同.
+void MaskPayload(char const* src, uint64_t size, uint8_t const* mask_key,
+                 char* dst);
+// 从负载的第offset字节处继续掩码处理, 用于分段写入同一帧的负载.
+void MaskPayload(char const* src, uint64_t size, uint8_t const* mask_key,
+                 uint64_t offset, char* dst);
+
+// 连接中本端的角色.
+enum FrameRole {
+  kClientRole = 0,  // 客户端, 发送的帧总是加掩码.
+  kServerRole,  // 服务端, 发送的帧从不加掩码.
+};
+
+// 按角色在编译期确定掩码处理的帧编解码器.
+// 客户端发送的帧总是加掩码且要求收到的帧不带掩码, 服务端相反(RFC 6455 5.1).
+//
+// Example:
+//    std::vector<char> frame;
+//    FrameCodec<kServerRole>::Package(kFrameFinBit | kOPCodeText,
+//                                     "hello", 5, &frame);
+//    FrameHeader header;
+//    uint64_t frame_length = 0;
+//    FrameCodec<kClientRole>::Parse(frame.data(), frame.size(), UINT64_MAX,
+//                                   &header, &frame_length);
+template <FrameRole kRole>
+class FrameCodec {
+ public:
+  // 本端发送的帧是否加掩码.
+  static constexpr bool kMaskOutbound = (kRole == kClientRole);
+
+  // 封装一帧, flags为首字节(FIN, RSV和opcode).
+  static int Package(uint8_t flags, char const* payload, uint64_t size,
+                     std::vector<char>* out);
+  // 将一条消息拆分为负载不超过fragment_size的分片帧并分别封装,
+  // reserve只设置在首帧中.
+  static int PackageMessage(OPCodeType const& opcode,
+                            char const* buffer, uint64_t size,
+                            uint64_t fragment_size, uint8_t reserve,
+                            std::vector<std::vector<char>>* out);
+  // 将由多个片段组成的消息拆分为分片帧, 依次追加到out末尾. 片段在写入时
+  // 直接加掩码, 不需要先拼接; frame_lengths非空时追加各帧的长度.
+  static int PackageMessage(OPCodeType const& opcode,
+                            PayloadSegment const* segments, size_t count,
+                            uint64_t fragment_size, uint8_t reserve,
+                            std::vector<char>* out,
+                            std::vector<uint64_t>* frame_lengths);
+  // 从数据流头部解析一个完整的帧, 负载在原缓冲区中去掉掩码,
+  // 位于data + header->header_length. 数据帧的负载长度超过
+  // max_payload_length时返回kFrameParseTooLarge, 掩码位与角色不符时返回
+  // kFrameParseError.
+  static int Parse(char* data, uint64_t size, uint64_t max_payload_length,
+                   FrameHeader* header, uint64_t* frame_length);
+};
+
+// 客户端帧编解码器.
+using ClientFrameCodec = FrameCodec<kClientRole>;
+// 服务端帧编解码器.
+using ServerFrameCodec = FrameCodec<kServerRole>;
+
+}  // namespace libwebsocket
+
+#endif  // WEBSOCKET_FRAME_CODEC_H_
@@ -0,0 +1,292 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  rpc.h
+// @Version :  1.0
+// @Desc    :  None
+
+#ifndef WEBSOCKET_RPC_H_
+#define WEBSOCKET_RPC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <vector>
+
+#include "client.h"
+#include "server.h"
+
+
+namespace libwebsocket {
+
+// RPC消息头: 标识(1字节), 类型(1字节), 关联ID(8字节, 网络字节序),
+// 之后为负载. RPC消息以二进制消息发送.
+constexpr size_t kRpcHeaderLength = 10;
+constexpr uint8_t kRpcMagic = 0xA5;
+// 默认的待完成调用表容量.
+constexpr size_t kDefaultRpcCapacity = 4096;
+// 默认的调用超时时间(毫秒).
+constexpr int kDefaultRpcTimeout = 5000;
+// 有待完成调用时检查超时的间隔(毫秒).
+constexpr int kRpcSweepInterval = 10;
+
+// RPC消息类型.
+enum RpcMessageType {
+  kRpcRequest = 1,  // 请求.
+  kRpcResponse,  // 正常响应.
+  kRpcError,  // 错误响应, 负载为错误描述.
+};
+
+// RPC调用结果.
+enum RpcResult {
+  kRpcOk = 0,  // 收到正常响应.
+  kRpcTimeout = -1,  // 超时未收到响应.
+  kRpcRemoteError = -2,  // 收到错误响应.
+  kRpcCancelled = -3,  // 调用被取消, 如连接已关闭.
+  kRpcSendFailed = -4,  // 请求发送失败或待完成调用表已满.
+};
+
+// 封装RPC消息头, out至少kRpcHeaderLength字节.
+void RpcHeaderPackaging(RpcMessageType const& type, uint64_t const& id,
+                        char* out);
+// 解析RPC消息头, 不是RPC消息时返回-1.
+int RpcHeaderParse(char const* data, size_t const& size,
+                   RpcMessageType* type, uint64_t* id);
+
+// RPC调用结果, 由Call返回的future给出.
+struct RpcReply {
+  int result = kRpcOk;  // 调用结果, 见RpcResult.
+  std::vector<char> data;  // 响应负载或错误描述.
+};
+
+// 无锁的待完成调用表.
+// 槽位数组加带版本号的空闲链表, 关联ID由槽位序号和槽位的使用次数组成,
+// 登记和完成调用只需几次原子操作, 迟到的响应和超时不会误认槽位的新主人.
+// 回调在完成调用的线程中执行.
+//
+// Example:
+//     RpcPendingTable table(4096);
+//     uint64_t id = table.Add(deadline_us, 0, [] (int const& result,
+//         char const* data, size_t const& size) { ... });
+//     // 收到响应时.
+//     table.Complete(id, 0, kRpcOk, data, size);
+//     // 定时检查超时.
+//     table.Expire(SteadyClockMicroseconds());
+class RpcPendingTable {
+ public:
+  // 调用完成时的回调函数定义, result为RpcResult.
+  using Callback = std::function<
+      void (int const& result, char const* data, size_t const& size)>;
+
+  explicit RpcPendingTable(size_t const& capacity);
+  RpcPendingTable(RpcPendingTable const&) = delete;
+  RpcPendingTable& operator=(RpcPendingTable const&) = delete;
+  ~RpcPendingTable() = default;
+
+  // 登记调用, deadline_us为单调时钟的截止时间(微秒), owner标识调用所属
+  // 的连接, 响应须来自同一连接. 返回关联ID, 表已满时返回0.
+  uint64_t Add(int64_t const& deadline_us, uint64_t const& owner,
+               Callback const& callback);
+  // 撤销调用, 不回调. 调用不存在时返回false.
+  bool Remove(uint64_t const& id);
+  // 完成调用并回调, 调用不存在(已完成, 已超时或不属于owner)时返回false.
+  bool Complete(uint64_t const& id, uint64_t const& owner, int const& result,
+                char const* data, size_t const& size);
+  // 以kRpcTimeout完成已到期的调用, 返回完成的调用数.
+  int Expire(int64_t const& now_us);
+  // 以result完成所有属于owner的调用, 返回完成的调用数.
+  int CancelOwner(uint64_t const& owner, int const& result);
+  // 以result完成所有调用, 返回完成的调用数.
+  int CancelAll(int const& result);
+  // 待完成的调用数.
+  size_t size(void) const { return count_; }
+  size_t capacity(void) const { return capacity_; }
+
+ private:
+  struct Slot {
+    std::atomic<uint64_t> id;  // 关联ID, 空闲时为0.
+    std::atomic<uint32_t> next;  // 空闲链表中的下一个槽位.
+    std::atomic<int64_t> deadline_us;  // 截止时间.
+    std::atomic<uint64_t> owner;  // 所属连接.
+    uint32_t generation;  // 槽位的使用次数, 只由持有者修改.
+    Callback callback;  // 完成回调, 只由持有者访问.
+  };
+  // 取出一个空闲槽位, 没有时返回kNoSlot.
+  uint32_t Acquire(void);
+  // 归还槽位.
+  void Release(uint32_t const& index);
+  // 取得调用的所有权并取出回调, 调用不存在时返回false.
+  bool Take(uint64_t const& id, Callback* callback);
+  // 以result完成所有满足match的调用, 返回完成的调用数.
+  int Finish(std::function<bool (Slot const&)> const& match,
+             int const& result);
+
+  static constexpr uint32_t kNoSlot = 0xFFFFFFFF;
+
+  size_t capacity_;  // 槽位数.
+  std::unique_ptr<Slot[]> slots_;  // 槽位数组.
+  std::atomic<uint64_t> free_head_;  // 空闲链表头, 高32位为防ABA的版本号.
+  std::atomic<uint32_t> used_;  // 使用过的槽位数, 之后的槽位从未分配.
+  std::atomic<size_t> count_;  // 待完成的调用数.
+};
+
+struct RpcSweeper;
+
+// 客户端RPC.
+// 请求附加关联ID后以二进制消息发送, 响应按关联ID匹配到待完成调用, 完成
+// 对应的回调或future; 大量调用可同时在同一连接上等待, 响应可以乱序到达.
+// 超时由客户端所在的服务线程或事件循环的定时器检查. 也可以处理服务端
+// 发来的请求. 须在client.Init之后, Run之前创建, 在client.Stop之后析构.
+// 回调在服务线程或事件循环线程中执行, 不能在其中等待future.
+//
+// Example:
+//     WebSocketClient client;
+//     client.Init();
+//     RpcClient rpc(&client);
+//     client.SetRemoteAccessPoint("127.0.0.1", 8081);
+//     if (client.ConnectRemote() == 0 && client.Run()) {
+//       rpc.Call(request.data(), request.size(), 1000, [] (
+//           int const& result, char const* data, size_t const& size) {
+//         if (result == kRpcOk) ...
+//       });
+//       RpcReply reply = rpc.Call(request.data(), request.size()).get();
+//     }
+class RpcClient {
+ public:
+  using Callback = RpcPendingTable::Callback;
+  // 收到请求时的回调函数定义, 通过Respond回复, 可稍后在任意线程中回复.
+  using RequestHandler = std::function<
+      void (uint64_t const& id, char const* data, int const& size)>;
+
+  explicit RpcClient(WebSocketClient* client,
+                     size_t const& capacity = kDefaultRpcCapacity);
+  RpcClient(RpcClient const&) = delete;
+  RpcClient& operator=(RpcClient const&) = delete;
+  // 以kRpcCancelled完成所有待完成的调用.
+  ~RpcClient();
+
+  // 设置收到请求时的回调函数.
+  void OnRequest(RequestHandler const& handler) { request_handler_ = handler; }
+  // 设置收到非RPC消息时的回调函数.
+  void OnMessage(WebSocketClient::MessageCallback const& callback) {
+    message_callback_ = callback;
+  }
+
+  // 发起调用, 完成或超时后回调一次. 发送失败时不回调并返回-1.
+  int Call(char const* data, int const& size, int const& timeout_ms,
+           Callback const& callback);
+  // 发起调用, 通过返回的future获取结果.
+  std::future<RpcReply> Call(char const* data, int const& size,
+                             int const& timeout_ms = kDefaultRpcTimeout);
+  // 回复服务端的请求, error为true时发送错误响应.
+  int Respond(uint64_t const& id, char const* data, int const& size,
+              bool const& error = false);
+  // 以kRpcCancelled完成所有待完成的调用, 可在连接关闭回调中调用.
+  int CancelPending(void);
+  // 待完成的调用数.
+  size_t pending(void) const;
+
+ private:
+  // 处理接收到的完整消息.
+  void HandleMessage(WebSocketClient::Socket const& fd,
+                     OPCodeType const& opcode, char const* data,
+                     int const& size);
+  // 封装并发送RPC消息.
+  int SendMessage(RpcMessageType const& type, uint64_t const& id,
+                  char const* data, int const& size);
+
+  WebSocketClient* client_;  // 承载RPC的客户端.
+  std::shared_ptr<RpcSweeper> sweeper_;  // 待完成调用表及超时检查.
+  RequestHandler request_handler_;  // 请求回调函数.
+  WebSocketClient::MessageCallback message_callback_;  // 非RPC消息回调.
+};
+
+// 服务端RPC.
+// 处理客户端的请求, 回复可以在任意线程中乱序发出; 也可以向指定客户端发起
+// 调用. 超时由主服务线程的定时器检查. 须在server.Init之后, Run之前创建,
+// 在server.Stop之后析构. 回调在主服务线程中执行.
+//
+// Example:
+//     RpcServer rpc(&server);
+//     rpc.OnRequest([&] (WebSocketServer::Socket const& fd,
+//         uint64_t const& id, char const* data, int const& size) {
+//       rpc.Respond(fd, id, data, size);
+//     });
+class RpcServer {
+ public:
+  using Callback = RpcPendingTable::Callback;
+  // 收到请求时的回调函数定义, 通过Respond回复, 可稍后在任意线程中回复.
+  using RequestHandler = std::function<void (WebSocketServer::Socket const& fd,
+      uint64_t const& id, char const* data, int const& size)>;
+
+  explicit RpcServer(WebSocketServer* server,
+                     size_t const& capacity = kDefaultRpcCapacity);
+  RpcServer(RpcServer const&) = delete;
+  RpcServer& operator=(RpcServer const&) = delete;
+  // 以kRpcCancelled完成所有待完成的调用.
+  ~RpcServer();
+
+  // 设置收到请求时的回调函数.
+  void OnRequest(RequestHandler const& handler) { request_handler_ = handler; }
+  // 设置收到非RPC消息时的回调函数.
+  void OnMessage(WebSocketServer::MessageCallback const& callback) {
+    message_callback_ = callback;
+  }
+
+  // 向指定客户端发起调用, 完成或超时后回调一次. 发送失败时不回调并返回-1.
+  int Call(WebSocketServer::Socket const& socket, char const* data,
+           int const& size, int const& timeout_ms, Callback const& callback);
+  // 向指定客户端发起调用, 通过返回的future获取结果.
+  std::future<RpcReply> Call(WebSocketServer::Socket const& socket,
+                             char const* data, int const& size,
+                             int const& timeout_ms = kDefaultRpcTimeout);
+  // 回复客户端的请求, error为true时发送错误响应.
+  int Respond(WebSocketServer::Socket const& socket, uint64_t const& id,
+              char const* data, int const& size, bool const& error = false);
+  // 以kRpcCancelled完成向指定客户端发起的调用, 可在连接关闭回调中调用.
+  int CancelPending(WebSocketServer::Socket const& socket);
+  // 待完成的调用数.
+  size_t pending(void) const;
+
+ private:
+  // 处理接收到的完整消息.
+  void HandleMessage(WebSocketServer::Socket const& fd,
+                     OPCodeType const& opcode, char const* data,
+                     int const& size);
+  // 封装并发送RPC消息.
+  int SendMessage(WebSocketServer::Socket const& socket,
+                  RpcMessageType const& type, uint64_t const& id,
+                  char const* data, int const& size);
+
+  WebSocketServer* server_;  // 承载RPC的服务端.
+  std::shared_ptr<RpcSweeper> sweeper_;  // 待完成调用表及超时检查.
+  RequestHandler request_handler_;  // 请求回调函数.
+  WebSocketServer::MessageCallback message_callback_;  // 非RPC消息回调.
+};
+
+}  // namespace libwebsocket
+
+#endif  // WEBSOCKET_RPC_H_
@@ -0,0 +1,62 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  rtt_stats.h
+// @Version :  1.0
+// @Desc    :  None
+
+
+#ifndef WEBSOCKET_RTT_STATS_H_
+#define WEBSOCKET_RTT_STATS_H_
+
+#include <stdint.h>
+
+
+namespace libwebsocket {
+
+// 往返时延直方图桶数, 第i个桶统计[2^i, 2^(i+1))微秒的样本, 第0个桶含0.
+constexpr int kRttHistogramBuckets = 24;
+
+// 单个连接的往返时延统计.
+struct RttStats {
+  int64_t smoothed_us;  // 平滑往返时延(RFC 6298, 增益1/8).
+  int64_t variance_us;  // 往返时延平均偏差(增益1/4).
+  int64_t last_us;  // 最近一次往返时延.
+  int64_t min_us;  // 最小往返时延.
+  int64_t max_us;  // 最大往返时延.
+  uint64_t samples;  // 样本数.
+  uint64_t histogram[kRttHistogramBuckets];  // 往返时延分布.
+};
+
+// 加入一个往返时延样本.
+void RttStatsUpdate(int64_t const& rtt_us, RttStats* stats);
+
+// 获取单调时钟的当前时间, 单位微秒.
+int64_t SteadyClockMicroseconds(void);
+// 将时间戳编码为8字节网络字节序的ping负载.
+void EncodePingTimestamp(int64_t const& timestamp_us, char* out);
+// 从pong负载中解码时间戳, 负载不是本端生成的ping时返回-1.
+int64_t DecodePingTimestamp(char const* payload, int const& size);
+
+}  // namespace libwebsocket
+
+#endif  // WEBSOCKET_RTT_STATS_H_
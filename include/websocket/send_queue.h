@@ -0,0 +1,136 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  send_queue.h
+// @Version :  1.0
+// @Desc    :  None
+
+#ifndef WEBSOCKET_SEND_QUEUE_H_
+#define WEBSOCKET_SEND_QUEUE_H_
+
+#if defined(__linux__)
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <winsock2.h>
+#include <windows.h>
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+namespace libwebsocket {
+
+// 单个连接的发送队列.
+// 控制帧(ping/pong/close)与数据帧分别排队, 每写完一个完整的帧后优先
+// 发送控制帧, 因此控制帧最多等待当前正在发送的一个数据帧(分片).
+// 当前帧之后没有控制帧时, 排队的数据帧与其一起以一次writev写出.
+// 所有接口均可在任意线程调用.
+// 写出类接口返回0表示已全部写出, 1表示套接字暂不可写, 2表示数据帧正在
+// 积攒等待批量写出, -1表示发送出错.
+class SendQueue {
+ public:
+  // 通用套接字类型定义.
+  using Socket = decltype(socket(0, 0, 0));
+  // 完整帧数据, 可被多个连接的队列共享.
+  using Frame = std::shared_ptr<std::vector<char> const>;
+
+  SendQueue() : offset_(0), pending_bytes_(0), closed_(false),
+                shutdown_(false), batch_bytes_(0), holding_(false) {}
+
+  // 将数据帧加入队列并尝试立即发送.
+  int PushData(Socket const& socket, Frame const& frame);
+  // 加入连续存放的多个数据帧, lengths为各帧的长度. 队列为空时直接从data
+  // 写出, 只把未写出的部分按帧复制到队列中, data可以是调用方反复使用的
+  // 暂存区.
+  int PushData(Socket const& socket, char const* data,
+               std::vector<uint64_t> const& lengths);
+  // 将控制帧加入优先队列并尝试立即发送.
+  int PushControl(Socket const& socket, Frame const& frame);
+  // 将关闭帧加入队列并尝试立即发送, 之后不再接受新的帧.
+  // discard_data为false时关闭帧排在已排队的数据帧之后, 保证数据先写出;
+  // 为true时丢弃排队中的数据帧, 关闭帧优先发送.
+  int PushClose(Socket const& socket, Frame const& frame,
+                bool const& discard_data);
+  // 尽可能多地写出队列中的数据, 正在积攒时不写出.
+  int Flush(Socket const& socket);
+  // 设置批量发送的字节数, 0表示不积攒. 大于0时新的数据帧先在队列中积攒,
+  // 积攒的字节数达到该值, 调用FlushBatch或加入控制帧后才一起写出.
+  // 套接字暂不可写时不积攒. Clear后恢复为0.
+  void SetBatchBytes(size_t const& bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    batch_bytes_ = bytes;
+  }
+  // 结束本次积攒并写出队列中的数据.
+  int FlushBatch(Socket const& socket) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    holding_ = false;
+    return FlushLocked(socket);
+  }
+  // 是否有数据在等待套接字可写, 正在积攒的数据不计入.
+  bool blocked(void) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pending_bytes_ > 0 && !holding_;
+  }
+  // 队列中尚未写出的字节数.
+  size_t pending_bytes(void) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pending_bytes_;
+  }
+  // 是否已加入关闭帧.
+  bool closed(void) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return closed_;
+  }
+  // 丢弃所有未发送的数据, 并重新允许加入新的帧.
+  void Clear(void);
+  // 套接字即将关闭, 丢弃未发送的数据, 之后的加入和写出均返回-1, 直到Clear.
+  // 返回时其它线程中正在进行的写出已经结束, 关闭后被复用的套接字不会再被写入.
+  void Shutdown(void);
+
+ private:
+  int FlushLocked(Socket const& socket);
+  // 加入数据帧后判断是否继续积攒.
+  bool HoldLocked(void);
+
+  std::deque<Frame> control_frames_;  // 控制帧优先队列.
+  std::deque<Frame> data_frames_;  // 数据帧队列.
+  Frame current_;  // 正在发送的帧.
+  size_t offset_;  // 当前帧已发送的字节数.
+  size_t pending_bytes_;  // 未写出的总字节数.
+  bool closed_;  // 是否已加入关闭帧.
+  bool shutdown_;  // 套接字是否已关闭.
+  size_t batch_bytes_;  // 批量发送的字节数, 0表示不积攒.
+  bool holding_;  // 数据帧是否正在积攒.
+  std::mutex mutex_;  // 队列互斥锁, 同时保证帧不会被交错写出.
+};
+
+}  // namespace libwebsocket
+
+#endif  // WEBSOCKET_SEND_QUEUE_H_
@@ -18,15 +18,42 @@
 #include <windows.h>
 #endif
 
+#include <stdint.h>
+
 #include <atomic>
+#include <condition_variable>
 #include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 #include <thread>
 
+#include "permessage_deflate.h"
+#include "replay_ring.h"
+#include "rtt_stats.h"
+#include "send_queue.h"
+#include "timer_wheel.h"
+#include "utf8_validator.h"
+#include "wakeup.h"
+#include "websocket.h"
+
 
 namespace libwebsocket {
 
+// 会话恢复参数.
+// 客户端在握手请求中带上会话标识和已收到的最后一条消息的序号, 服务端只补发
+// 之后的消息, 重连的流量与断开期间的消息量成正比, 而不是重新下发全部状态.
+struct ResumeOptions {
+  bool enabled = false;  // 是否接受会话恢复请求.
+  size_t ring_bytes = 1024*1024;  // 每个会话重放缓冲区的字节数.
+  int session_timeout_ms = 60000;  // 连接断开后会话的保留时间.
+  // 非空时重放缓冲区映射到该目录下的文件, InitServer时恢复目录中的会话,
+  // 服务端重启后客户端仍可在保留时间内恢复会话.
+  std::string directory;
+};
+
 // WebSocket服务端.
 //
 // Example:
@@ -90,28 +117,234 @@ class WebSocketServer {
   void OnDeepReceived(ReceiveCallback const &callback) {
     deep_callback_ = callback;
   }
-  // 发送消息给指定的处于已连接状态的客户端.
+  // 接收到完整消息时的回调函数定义, opcode为消息首帧的操作码.
+  using MessageCallback = std::function<void (Socket const& fd,
+      OPCodeType const& opcode, char const* buffer, int const& size)>;
+  // 设置接收完整消息回调函数, 分片消息组装完成后回调一次, 在Run之前调用.
+  // 与OnReceived同时生效, 未设置时不组装分片.
+  void OnMessage(MessageCallback const& callback) {
+    message_callback_ = callback;
+  }
+  // 连接关闭时的回调函数定义, code为关闭状态码,
+  // 未经关闭握手直接断开时为kCloseAbnormal.
+  using CloseCallback = std::function<void (Socket const& fd, int const& code)>;
+  // 设置已认证连接关闭时的回调函数.
+  void OnClosed(CloseCallback const& callback) {
+    close_callback_ = callback;
+  }
+  // 设置单帧负载长度上限, 超出时以1009状态码关闭连接.
+  void SetMaxFrameSize(uint64_t const& size) { max_frame_size_ = size; }
+  // 设置单条消息(含所有分片)负载长度上限, 超出时以1009状态码关闭连接.
+  void SetMaxMessageSize(uint64_t const& size) { max_message_size_ = size; }
+  // 设置是否校验文本消息和关闭原因为合法的UTF-8, 非法时以1007状态码关闭
+  // 连接. 跨分片的字符可正确校验, 非法序列出现后其所在分片不再回调.
+  void SetValidateUtf8(bool const& enable) { validate_utf8_ = enable; }
+  // 设置向客户端发送带时间戳ping的间隔(毫秒), 0表示不发送.
+  // 收到的ping会自动回复pong, ping/pong不再传递给接收回调.
+  void SetPingInterval(int const& interval_ms) {
+    ping_interval_ms_ = interval_ms;
+  }
+  // 设置握手超时时间(毫秒), 连接后超时仍未完成握手则关闭连接.
+  void SetHandshakeTimeout(int const& timeout_ms) {
+    handshake_timeout_ms_ = timeout_ms;
+  }
+  // 设置空闲超时时间(毫秒), 超时未收到任何数据则关闭连接, 0表示不限制.
+  void SetIdleTimeout(int const& timeout_ms) {
+    idle_timeout_ms_ = timeout_ms;
+  }
+  // 设置关闭握手超时时间(毫秒), 超时未完成关闭握手则直接断开.
+  void SetCloseTimeout(int const& timeout_ms) {
+    close_timeout_ms_ = timeout_ms;
+  }
+  // 向指定客户端发起关闭握手: 已排队的数据写出后发送关闭帧,
+  // 收到对端的关闭帧或超时后断开连接. 之后该连接不再接受新的发送数据.
+  int Disconnect(Socket const& socket, int const& code = kCloseNormal,
+                 std::string const& reason = std::string());
+  // 停止接受新连接, 同时向所有连接发起关闭握手并写出排队中的数据,
+  // 所有连接关闭或超过deadline_ms毫秒后停止服务.
+  // 返回到期时仍未完成关闭而被强制断开的连接数.
+  int Drain(int const& deadline_ms);
+  // 添加定时器, 回调在主服务线程中执行, interval_ms大于0时重复执行.
+  TimerWheel::TimerId AddTimer(int64_t const& delay_ms,
+                               TimerWheel::Callback const& callback,
+                               int64_t const& interval_ms = 0) {
+    auto id = timer_wheel_.Add(delay_ms, callback, interval_ms);
+    wakeup_.Notify();
+    return id;
+  }
+  // 取消定时器.
+  bool CancelTimer(TimerWheel::TimerId const& id) {
+    return timer_wheel_.Cancel(id);
+  }
+  // 获取指定客户端的往返时延统计.
+  int GetRttStats(Socket const& socket, RttStats* stats);
+  // 设置SendData发送分片的最大负载长度, 0表示不分片.
+  void SetFragmentSize(uint64_t const& size) { fragment_size_ = size; }
+  // 设置permessage-deflate参数, 对之后完成握手的连接生效.
+  // 启用后SendData发送的数据帧按协商结果压缩, 接收回调得到解压后的内容.
+  // 压缩/解压流在首次使用时从服务端共用的对象池中取出, 空闲超过
+  // release_idle_ms后归还; 降低窗口和mem_level可减少活跃连接的内存占用.
+  void SetPerMessageDeflate(DeflateOptions const& options) {
+    deflate_options_ = options;
+  }
+  // 设置会话恢复参数, 在InitServer之前调用. 启用后请求了会话恢复的
+  // 连接上, SendData, SendDataToAll和SendDataToSession发送的文本和二进制
+  // 消息在负载前附加序号并记入会话的重放缓冲区. 已封装的帧无法附加序号,
+  // SendToOne对这类连接返回-1, SendToAll跳过这类连接.
+  void SetResume(ResumeOptions const& options) { resume_options_ = options; }
+  // 会话建立或恢复时的回调函数定义, resumed为false表示新会话,
+  // 客户端需要重新获取完整状态.
+  using SessionCallback = std::function<void (Socket const& fd,
+      std::string const& session_id, bool const& resumed)>;
+  // 设置会话建立或恢复时的回调函数, 在主服务线程中执行.
+  void OnSessionOpened(SessionCallback const& callback) {
+    session_callback_ = callback;
+  }
+  // 发送消息给指定的处于已连接状态的客户端, 数据需为已封装的完整帧.
+  // 连接绑定了会话时返回-1, 须改用SendData.
   int SendToOne(Socket const& socket, char const* buffer, int const& size);
-  // 发送消息给所有处于已连接状态的客户端.
+  // 发送消息给所有处于已连接状态且未绑定会话的客户端,
+  // 数据需为已封装的完整帧.
   int SendToAll(char const* buffer, int const& size);
+  // 封装并发送消息给指定客户端, 长消息按分片长度拆分为多个分片帧.
+  // 已协商permessage-deflate时文本和二进制消息先压缩再分片.
+  int SendData(Socket const& socket, char const* buffer, int const& size,
+               OPCodeType const& opcode = kOPCodeText);
+  // 封装并发送消息给所有处于已连接状态的客户端, 返回加入发送队列的连接数.
+  // 协商了相同压缩参数且不保留压缩上下文的连接共享同一份压缩结果.
+  // 连接已断开但仍保留的会话只记入重放缓冲区.
+  int SendDataToAll(char const* buffer, int const& size,
+                    OPCodeType const& opcode = kOPCodeText);
+  // 封装并发送消息给指定会话. 会话的连接已断开时只记入重放缓冲区,
+  // 客户端恢复会话后补发.
+  int SendDataToSession(std::string const& session_id,
+                        char const* buffer, int const& size,
+                        OPCodeType const& opcode = kOPCodeText);
+  // 封装并发送控制帧给指定客户端, 控制帧优先于排队中的数据帧发送.
+  int SendControl(Socket const& socket, OPCodeType const& opcode,
+                  char const* buffer, int const& size);
 
  private:
   // 等待客户端连接线程处理函数.
   void WaitHandler(void);
   // 主服务线程处理函数.
   void ServiceHandler(void);
+  // 通知两个服务线程退出, 不等待线程结束, 可在服务线程中调用.
+  void RequestStop(void);
+
+  struct Session;
+  // 客户端连接.
+  struct Connection {
+    Socket socket;  // 连接套接字.
+    std::atomic_bool established;  // 是否已完成握手.
+    std::vector<char> recv_buffer;  // 尚未组成完整请求或帧的接收数据.
+    uint64_t message_length;  // 当前分片消息已接收的负载长度.
+    bool fragmented;  // 是否有尚未收到最后一个分片的消息.
+    bool compressed;  // 当前分片消息是否经过压缩.
+    bool text;  // 当前分片消息是否为文本消息.
+    OPCodeType message_opcode;  // 当前分片消息的操作码.
+    std::vector<char> message_buffer;  // 组装中的分片消息.
+    Utf8Validator utf8;  // 文本消息的UTF-8校验状态.
+    PerMessageDeflate deflate;  // 压缩/解压上下文.
+    std::mutex send_mutex;  // 保证消息的压缩顺序与入队顺序一致.
+    SendQueue send_queue;  // 发送队列.
+    RttStats rtt_stats;  // 往返时延统计.
+    std::mutex rtt_mutex;  // 往返时延统计互斥锁.
+    int64_t last_recv_ms;  // 最近一次接收数据的时间.
+    TimerWheel::TimerId handshake_timer;  // 握手超时定时器.
+    TimerWheel::TimerId idle_timer;  // 空闲超时定时器.
+    TimerWheel::TimerId ping_timer;  // 定时ping定时器.
+    TimerWheel::TimerId deflate_timer;  // 归还空闲压缩流定时器.
+    std::atomic_bool closing;  // 已发出关闭帧.
+    std::atomic_bool peer_closed;  // 已收到对端关闭帧.
+    std::atomic_bool closed;  // 套接字已关闭, 编号可能已被新连接复用.
+    std::atomic_int close_code;  // 关闭状态码.
+    std::atomic<TimerWheel::TimerId> close_timer;  // 关闭握手超时定时器.
+    std::shared_ptr<Session> session;  // 绑定的会话, 握手完成后不再改变.
+  };
+  // 可恢复的会话.
+  struct Session {
+    std::string id;  // 会话标识.
+    std::mutex mutex;  // 会话互斥锁, 先于所绑定连接的发送锁获取.
+    ReplayRing ring;  // 已发送消息的重放缓冲区.
+    std::weak_ptr<Connection> owner;  // 绑定的连接, 断开后为空.
+    TimerWheel::TimerId expire_timer;  // 断开后的过期定时器.
+  };
+  // 查找已认证的连接, 不存在时返回空指针.
+  std::shared_ptr<Connection> FindConnection(Socket const& socket);
+  // 处理接收缓冲区中的握手请求, 返回值小于0时需关闭连接.
+  int ProcessHandshake(std::shared_ptr<Connection> const& conn);
+  // 检查连接是否空闲超时, 未超时则按剩余时间重新设置定时器.
+  void CheckIdle(std::weak_ptr<Connection> const& weak_conn);
+  // 发送关闭帧并启动关闭握手超时定时器, 可在任意线程调用.
+  int BeginClose(std::shared_ptr<Connection> const& conn, int const& code,
+                 std::string const& reason, int const& timeout_ms);
+  // 取消连接的定时器, 移出连接表并关闭套接字, 只在主服务线程中调用.
+  void CloseConnection(std::shared_ptr<Connection> const& conn);
+  // 解析连接接收缓冲区中的完整帧, 返回值小于0时需关闭连接.
+  int ProcessFrames(std::shared_ptr<Connection> const& conn);
+  // 按握手请求中的会话恢复头部找回或新建会话. 可以补发时resumed为true,
+  // last为客户端已收到的最后序号; 否则丢弃旧会话并新建, last为0.
+  // 返回的会话已加锁, 失败时返回空指针.
+  std::shared_ptr<Session> OpenSession(HttpToken const& resume,
+                                       std::unique_lock<std::mutex>* lock,
+                                       uint64_t* last, bool* resumed);
+  // 从会话表中移除会话, 删除其重放缓冲区并关闭仍绑定的连接.
+  void DropSession(std::shared_ptr<Session> const& session);
+  // 连接关闭时解除与会话的绑定并启动过期定时器.
+  void DetachSession(std::shared_ptr<Connection> const& conn);
+  // 启动过期定时器, 超过保留时间仍未恢复则移除会话. 调用方须持有会话锁.
+  void ExpireSession(std::shared_ptr<Session> const& session);
+  // 从重放缓冲区目录中恢复服务端重启前的会话.
+  void RestoreSessions(void);
+  // 为消息分配序号并记入会话的重放缓冲区, 会话绑定了连接时一并加入发送
+  // 队列. 调用方须持有会话锁. 返回1表示已加入发送队列, 0表示只记录.
+  int SendSessionMessage(Session* session, OPCodeType const& opcode,
+                         char const* buffer, int const& size);
+  // 在负载前附加序号后压缩, 分片并加入发送队列, 调用方须持有发送锁.
+  int QueueSequenced(Connection* conn, uint64_t const& seq,
+                     OPCodeType const& opcode, char const* buffer,
+                     uint64_t const& size);
+  // 压缩, 分片并加入发送队列, 调用方须持有发送锁.
+  int QueueMessage(Connection* conn, OPCodeType const& opcode,
+                   char const* buffer, uint64_t const& size);
+  // 将消息按分片长度封装为帧, compressed为true时在首帧设置RSV1.
+  int PackageFrames(OPCodeType const& opcode, char const* buffer,
+                    uint64_t size, bool compressed,
+                    std::vector<SendQueue::Frame>* out);
 
   Socket listen_socket_;  // 监听客户端连接的套接字.
   std::string server_ip_;  // 服务端IP地址.
   int server_port_;  // 服务端端口.
   std::atomic_bool is_ready_;  // 服务端socket状态.
-  std::vector<Socket> valid_sockets_;  // 已认证socket连接.
+  DeflatePool deflate_pool_;  // 各连接共用的zlib流对象池, 须晚于连接析构.
+  std::map<Socket, std::shared_ptr<Connection>> connections_;  // 已认证连接.
+  std::mutex connections_mutex_;  // 已认证连接表互斥锁.
+  std::condition_variable connections_cv_;  // 连接关闭通知.
+  std::atomic_bool draining_;  // 是否正在停止服务.
+  uint64_t max_frame_size_;  // 单帧负载长度上限.
+  uint64_t max_message_size_;  // 单条消息负载长度上限.
+  bool validate_utf8_;  // 是否校验文本消息的UTF-8编码.
+  uint64_t fragment_size_;  // 发送分片的最大负载长度.
+  DeflateOptions deflate_options_;  // permessage-deflate参数.
+  int ping_interval_ms_;  // 发送ping的间隔.
+  int handshake_timeout_ms_;  // 握手超时时间.
+  int idle_timeout_ms_;  // 空闲超时时间.
+  int close_timeout_ms_;  // 关闭握手超时时间.
+  ResumeOptions resume_options_;  // 会话恢复参数.
+  std::map<std::string, std::shared_ptr<Session>> sessions_;  // 会话表.
+  std::mutex sessions_mutex_;  // 会话表互斥锁, 先于会话锁获取.
+  TimerWheel timer_wheel_;  // 定时器, 在主服务线程中推进.
+  Wakeup wakeup_;  // 唤醒阻塞中的主服务线程.
   std::thread waiting_thread_;  // 等待客户端连接线程.
   std::atomic_bool waiting_is_running_;  // 等待客户端连接线程运行标志.
   std::thread service_thread_;  // 主服务线程.
   std::atomic_bool service_is_running_;  // 主服务线程运行标志.
   ReceiveCallback deep_callback_;  // 原始消息回调函数.
   ReceiveCallback callback_;  // 解析后的消息回调函数.
+  MessageCallback message_callback_;  // 完整消息回调函数.
+  CloseCallback close_callback_;  // 连接关闭回调函数.
+  SessionCallback session_callback_;  // 会话建立回调函数.
 };
 
 }  // namespace libwebsocket
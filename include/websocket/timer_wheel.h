@@ -0,0 +1,111 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  timer_wheel.h
+// @Version :  1.0
+// @Desc    :  None
+
+
+#ifndef WEBSOCKET_TIMER_WHEEL_H_
+#define WEBSOCKET_TIMER_WHEEL_H_
+
+#include <stdint.h>
+
+#include <functional>
+#include <mutex>
+#include <vector>
+
+
+namespace libwebsocket {
+
+// 分层时间轮定时器.
+// 第0层256个槽, 其余3层各64个槽, 以tick_ms为最小刻度, 默认可覆盖约7.7天,
+// 更远的定时器按最大范围处理. 添加, 取消和到期处理均为O(1).
+// 所有接口均可在任意线程调用, 回调在调用Advance的线程中执行,
+// 执行回调时不持有内部锁, 因此回调中可以添加或取消定时器.
+//
+// Example:
+//    TimerWheel wheel;
+//    auto id = wheel.Add(1000, [] () { printf("timeout\n"); });
+//    while (running) {
+//      wheel.Advance();
+//      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+//    }
+class TimerWheel {
+ public:
+  // 定时器标识, 0为无效值.
+  using TimerId = uint64_t;
+  // 定时器回调函数定义.
+  using Callback = std::function<void (void)>;
+
+  explicit TimerWheel(int const& tick_ms = 10);
+
+  // 添加定时器, delay_ms毫秒后执行回调; interval_ms大于0时按该间隔重复执行,
+  // 直到被取消.
+  TimerId Add(int64_t const& delay_ms, Callback const& callback,
+              int64_t const& interval_ms = 0);
+  // 取消定时器, 定时器不存在或已执行完毕时返回false.
+  bool Cancel(TimerId const& id);
+  // 推进到当前时间并执行所有到期的回调, 返回执行的回调数.
+  int Advance(void);
+  // 距离下一次需要调用Advance的毫秒数, 没有定时器时返回-1.
+  int64_t NextTimeout(void);
+  // 当前定时器数量.
+  size_t size(void) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return count_;
+  }
+
+ private:
+  struct Node {
+    uint32_t prev;  // 槽内链表前一节点.
+    uint32_t next;  // 槽内链表后一节点.
+    uint32_t generation;  // 节点复用计数, 用于识别失效的TimerId.
+    int32_t slot;  // 所在槽, -1表示空闲.
+    uint64_t expire_tick;  // 到期刻度.
+    uint64_t interval_ticks;  // 重复间隔, 0表示只执行一次.
+    Callback callback;  // 回调函数.
+  };
+
+  uint64_t NowTick(void) const;
+  uint32_t AllocNode(void);
+  void FreeNode(uint32_t const& index);
+  // 按到期刻度将节点放入对应层的槽中.
+  void Place(uint32_t const& index);
+  void Unlink(uint32_t const& index);
+  // 取出整个槽的链表, 返回链表头.
+  uint32_t Detach(int const& slot);
+  // 将高层槽中的节点重新分配到低层.
+  void Cascade(int const& slot);
+
+  int tick_ms_;  // 最小刻度(毫秒).
+  uint64_t current_tick_;  // 已处理到的刻度.
+  size_t count_;  // 定时器数量.
+  std::vector<Node> nodes_;  // 节点池.
+  std::vector<uint32_t> heads_;  // 各槽链表头.
+  uint32_t free_head_;  // 空闲节点链表头.
+  std::mutex mutex_;  // 互斥锁.
+};
+
+}  // namespace libwebsocket
+
+#endif  // WEBSOCKET_TIMER_WHEEL_H_
@@ -0,0 +1,70 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  wakeup.h
+// @Version :  1.0
+// @Desc    :  None
+
+
+#ifndef WEBSOCKET_WAKEUP_H_
+#define WEBSOCKET_WAKEUP_H_
+
+#include <atomic>
+
+
+namespace libwebsocket {
+
+// 用于唤醒阻塞在poll上的服务线程.
+// Linux下基于eventfd实现, 其它平台fd()返回-1, 服务线程退化为定时轮询.
+// 两次Consume之间的多次Notify只产生一次写操作.
+//
+// Example:
+//    Wakeup wakeup;
+//    // 服务线程.
+//    struct pollfd fds[1] = {{wakeup.fd(), POLLIN, 0}};
+//    poll(fds, 1, -1);
+//    wakeup.Consume();
+//    // 其它线程.
+//    wakeup.Notify();
+class Wakeup {
+ public:
+  Wakeup();
+  Wakeup(Wakeup const&) = delete;
+  Wakeup& operator=(Wakeup const&) = delete;
+  ~Wakeup();
+
+  // 唤醒服务线程, 可在任意线程调用.
+  void Notify(void);
+
+  // 清除唤醒状态, 由服务线程在poll返回后调用.
+  void Consume(void);
+
+  int fd(void) const { return fd_; }
+
+ private:
+  int fd_;
+  std::atomic_bool pending_;
+};
+
+}  // namespace libwebsocket
+
+#endif  // WEBSOCKET_WAKEUP_H_
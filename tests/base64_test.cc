@@ -0,0 +1,227 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  base64_test.cc
+// @Version :  1.0
+// @Desc    :  None
+//
+// 分别强制使用查表和AVX2实现, 与逐位计算的参考实现比较编解码结果,
+// 并检查各位置的非法字符. 长度覆盖向量实现的块大小和最小输入长度附近.
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "base64.h"
+#include "test_util.h"
+
+
+using libwebsocket::NextRandom;
+using libwebsocket::TestKernel;
+
+
+namespace {
+
+struct KnownEncoding {
+  std::string data;
+  std::string text;
+};
+
+// RFC 4648 10中的测试向量.
+std::vector<KnownEncoding> const kKnownEncodings = {
+  {"", ""},
+  {"f", "Zg=="},
+  {"fo", "Zm8="},
+  {"foo", "Zm9v"},
+  {"foob", "Zm9vYg=="},
+  {"fooba", "Zm9vYmE="},
+  {"foobar", "Zm9vYmFy"},
+};
+
+char const kAlphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// 与各合法字符相邻的非法字符, 以及控制字符和高位字符.
+char const kInvalidChars[] = {
+  '\0', '\t', ' ', '!', '*', ',', '-', '.', ':', '@', '[', '_', '`', '{',
+  '~', '\x7F', '\x80', '\xAB', '\xC0', '\xFF',
+};
+
+// 检查写出的长度之后的哨兵字节.
+constexpr size_t kGuardSize = 64;
+constexpr char kGuardByte = '\x5A';
+
+std::vector<TestKernel> const kKernels = {
+  {libwebsocket::kBase64KernelScalar, "scalar"},
+  {libwebsocket::kBase64KernelAvx2, "avx2"},
+};
+
+// 逐位计算的参考编码.
+std::string ReferenceEncode(std::string const& data) {
+  std::string text;
+  uint32_t bits = 0;
+  int count = 0;
+  for (unsigned char byte : data) {
+    bits = (bits << 8) | byte;
+    count += 8;
+    while (count >= 6) {
+      count -= 6;
+      text.push_back(kAlphabet[(bits >> count) & 0x3F]);
+    }
+  }
+  if (count > 0) text.push_back(kAlphabet[(bits << (6 - count)) & 0x3F]);
+  while (text.size()%4 != 0) text.push_back('=');
+  return text;
+}
+
+// 使用缓冲区接口编码, 检查没有越界写入.
+std::string Encode(char const* name, std::string const& data) {
+  size_t const length = libwebsocket::Base64EncodedLength(data.size());
+  std::vector<char> buffer(length + kGuardSize, kGuardByte);
+  size_t written = libwebsocket::Base64Encode(data.data(), data.size(),
+                                              buffer.data());
+  TEST_CHECK(written == length, "%s: encode size %zu wrote %zu", name,
+             data.size(), written);
+  for (size_t i = length; i < buffer.size(); ++i) {
+    if (buffer[i] == kGuardByte) continue;
+    TEST_CHECK(buffer[i] == kGuardByte, "%s: encode size %zu overflow",
+               name, data.size());
+    break;
+  }
+  return std::string(buffer.data(), written < length ? written : length);
+}
+
+// 使用缓冲区接口解码, 检查没有越界写入, 失败时返回-1.
+int64_t Decode(char const* name, std::string const& text, std::string* data) {
+  size_t const capacity = text.size()/4*3;
+  std::vector<char> buffer(capacity + kGuardSize, kGuardByte);
+  int64_t length = libwebsocket::Base64Decode(text.data(), text.size(),
+                                              buffer.data());
+  for (size_t i = capacity; i < buffer.size(); ++i) {
+    if (buffer[i] == kGuardByte) continue;
+    TEST_CHECK(buffer[i] == kGuardByte, "%s: decode size %zu overflow",
+               name, text.size());
+    break;
+  }
+  if (length >= 0) data->assign(buffer.data(), length);
+  return length;
+}
+
+void CheckKnown(char const* name) {
+  for (auto const& known : kKnownEncodings) {
+    TEST_CHECK(Encode(name, known.data) == known.text, "%s: encode \"%s\"",
+               name, known.data.c_str());
+    std::string data;
+    TEST_CHECK(Decode(name, known.text, &data) ==
+               static_cast<int64_t>(known.data.size()) && data == known.data,
+               "%s: decode \"%s\"", name, known.text.c_str());
+  }
+}
+
+void CheckRoundTrip(char const* name, std::vector<std::string> const& inputs) {
+  for (auto const& input : inputs) {
+    std::string const expected = ReferenceEncode(input);
+    std::string const text = Encode(name, input);
+    TEST_CHECK(text == expected, "%s: encode size %zu", name, input.size());
+    std::string data;
+    TEST_CHECK(Decode(name, expected, &data) ==
+               static_cast<int64_t>(input.size()) && data == input,
+               "%s: decode size %zu", name, expected.size());
+    if (input.empty()) continue;
+    // 容器接口.
+    std::string out;
+    TEST_CHECK(libwebsocket::Base64Encode(
+                   std::vector<char>(input.begin(), input.end()), &out) == 0 &&
+               out == expected, "%s: encode vector size %zu", name,
+               input.size());
+    std::vector<char> decoded;
+    TEST_CHECK(libwebsocket::Base64Decode(expected, &decoded) == 0 &&
+               std::string(decoded.begin(), decoded.end()) == input,
+               "%s: decode string size %zu", name, expected.size());
+  }
+}
+
+void CheckInvalid(char const* name, std::vector<std::string> const& inputs) {
+  std::string data;
+  for (auto const& input : inputs) {
+    std::string const text = ReferenceEncode(input);
+    for (size_t i = 0; i < text.size(); ++i) {
+      std::string bad = text;
+      for (char c : kInvalidChars) {
+        bad[i] = c;
+        TEST_CHECK(Decode(name, bad, &data) < 0,
+                   "%s: decode size %zu, char 0x%02X at %zu", name,
+                   bad.size(), static_cast<unsigned char>(c), i);
+      }
+      // 填充字符只能出现在最后两个位置.
+      if (i + 2 < text.size()) {
+        bad[i] = '=';
+        TEST_CHECK(Decode(name, bad, &data) < 0,
+                   "%s: decode size %zu, padding at %zu", name, bad.size(), i);
+      }
+    }
+    if (text.empty()) continue;
+    // 长度不是4的倍数.
+    for (size_t cut = 1; cut < 4 && cut <= text.size(); ++cut) {
+      std::string const bad = text.substr(0, text.size() - cut);
+      TEST_CHECK(Decode(name, bad, &data) < 0, "%s: decode size %zu", name,
+                 bad.size());
+    }
+  }
+  std::vector<char> decoded;
+  TEST_CHECK(libwebsocket::Base64Decode(std::string("Zg="), &decoded) < 0,
+             "%s: decode string with bad length", name);
+  TEST_CHECK(libwebsocket::Base64Decode(std::string("===="), &decoded) < 0,
+             "%s: decode only padding", name);
+}
+
+}  // namespace
+
+int main(void) {
+  // 0~300字节覆盖AVX2的24字节编码块, 32字符解码块和64的最小长度附近.
+  uint32_t seed = 0x2545F491;
+  std::vector<std::string> inputs;
+  for (size_t size = 0; size <= 300; ++size) {
+    std::string input(size, '\0');
+    for (auto& c : input) c = static_cast<char>(NextRandom(&seed));
+    inputs.push_back(input);
+  }
+  for (size_t size : {1024 + 1, 4096 + 2, 65536}) {
+    std::string input(size, '\0');
+    for (auto& c : input) c = static_cast<char>(NextRandom(&seed));
+    inputs.push_back(input);
+  }
+  // 所有字节值, 保证每个字符都被编码和解码.
+  std::string all(768, '\0');
+  for (size_t i = 0; i < all.size(); ++i) all[i] = static_cast<char>(i);
+  inputs.push_back(all);
+  std::vector<std::string> const invalid_inputs(inputs.begin(),
+                                                inputs.begin() + 160);
+  libwebsocket::ForEachKernel(libwebsocket::Base64ForceKernel, kKernels,
+                              [&] (char const* name) {
+    CheckKnown(name);
+    CheckRoundTrip(name, inputs);
+    CheckInvalid(name, invalid_inputs);
+  });
+  return libwebsocket::TestResult();
+}
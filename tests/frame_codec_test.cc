@@ -0,0 +1,227 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  frame_codec_test.cc
+// @Version :  1.0
+// @Desc    :  None
+//
+// 按表检查帧头解码对保留操作码, 分片或过长的控制帧, 64位长度最高位和
+// 不完整帧头的处理, 以及两种角色的帧编解码器的掩码规则和往返结果.
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "frame_codec.h"
+#include "test_util.h"
+
+
+using libwebsocket::ClientFrameCodec;
+using libwebsocket::FrameHeader;
+using libwebsocket::kFrameFinBit;
+using libwebsocket::kFrameParseError;
+using libwebsocket::kFrameParseIncomplete;
+using libwebsocket::kFrameParseOk;
+using libwebsocket::kFrameRsv1Bit;
+using libwebsocket::NextRandom;
+using libwebsocket::ServerFrameCodec;
+
+
+namespace {
+
+struct HeaderCase {
+  char const* name;
+  std::vector<uint8_t> bytes;
+  int result;
+  // 以下字段只在result为kFrameParseOk时比较.
+  bool fin;
+  uint8_t reserve;
+  uint8_t opcode;
+  uint64_t payload_length;
+  size_t header_length;
+};
+
+std::vector<HeaderCase> const kHeaderCases = {
+  {"text", {0x81, 0x05}, kFrameParseOk, true, 0, 0x1, 5, 2},
+  {"first fragment", {0x01, 0x00}, kFrameParseOk, false, 0, 0x1, 0, 2},
+  {"last continuation", {0x80, 0x03}, kFrameParseOk, true, 0, 0x0, 3, 2},
+  {"rsv1", {0xC2, 0x01}, kFrameParseOk, true, 0x40, 0x2, 1, 2},
+  {"rsv2 and rsv3", {0xB2, 0x01}, kFrameParseOk, true, 0x30, 0x2, 1, 2},
+  {"16-bit length", {0x82, 0x7E, 0x01, 0x00}, kFrameParseOk, true, 0, 0x2,
+   256, 4},
+  {"64-bit length", {0x82, 0x7F, 0, 0, 0, 1, 0, 0, 0, 0}, kFrameParseOk,
+   true, 0, 0x2, 1ULL << 32, 10},
+  {"largest 64-bit length",
+   {0x82, 0x7F, 0x7F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF},
+   kFrameParseOk, true, 0, 0x2, 0x7FFFFFFFFFFFFFFFULL, 10},
+  {"64-bit length high bit", {0x82, 0x7F, 0x80, 0, 0, 0, 0, 0, 0, 0},
+   kFrameParseError},
+  {"64-bit length all ones",
+   {0x82, 0x7F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF},
+   kFrameParseError},
+  {"masked", {0x81, 0x85, 1, 2, 3, 4}, kFrameParseOk, true, 0, 0x1, 5, 6},
+  {"masked 64-bit length", {0x82, 0xFF, 0, 0, 0, 0, 0, 1, 0, 0, 1, 2, 3, 4},
+   kFrameParseOk, true, 0, 0x2, 65536, 14},
+  {"close 125 bytes", {0x88, 0x7D}, kFrameParseOk, true, 0, 0x8, 125, 2},
+  {"ping 126 bytes", {0x89, 0x7E, 0x00, 0x7E}, kFrameParseError},
+  {"pong 64-bit length", {0x8A, 0x7F, 0, 0, 0, 0, 0, 0, 0x10, 0},
+   kFrameParseError},
+  {"fragmented close", {0x08, 0x00}, kFrameParseError},
+  {"fragmented ping", {0x09, 0x00}, kFrameParseError},
+  {"fragmented pong", {0x0A, 0x00}, kFrameParseError},
+  {"empty", {}, kFrameParseIncomplete},
+  {"first byte only", {0x81}, kFrameParseIncomplete},
+  {"partial 16-bit length", {0x82, 0x7E, 0x01}, kFrameParseIncomplete},
+  {"partial 64-bit length", {0x82, 0x7F, 0, 0, 0, 0, 0, 0, 1},
+   kFrameParseIncomplete},
+  {"partial mask key", {0x81, 0x85, 1, 2, 3}, kFrameParseIncomplete},
+};
+
+void CheckHeaderCases(void) {
+  for (auto const& test : kHeaderCases) {
+    // 多留一个字节, 空数据时指针也不为空.
+    std::vector<uint8_t> buffer(test.bytes);
+    buffer.push_back(0);
+    FrameHeader header {};
+    int ret = libwebsocket::DecodeFrameHeader(
+        reinterpret_cast<char const*>(buffer.data()), test.bytes.size(),
+        &header);
+    TEST_CHECK(ret == test.result, "%s: returned %d", test.name, ret);
+    if (ret != kFrameParseOk || test.result != kFrameParseOk) continue;
+    TEST_CHECK(header.fin == test.fin && header.reserve == test.reserve &&
+               header.opcode == test.opcode &&
+               header.payload_length == test.payload_length &&
+               header.header_length == test.header_length,
+               "%s: fin %d, rsv 0x%02X, opcode 0x%X, length %llu, header %zu",
+               test.name, header.fin, header.reserve, header.opcode,
+               static_cast<unsigned long long>(header.payload_length),
+               header.header_length);
+  }
+}
+
+// 0x3-0x7和0xB-0xF为保留操作码, 无论FIN, RSV和长度如何都拒绝.
+void CheckOpcodes(void) {
+  for (int opcode = 0; opcode < 16; ++opcode) {
+    bool const known = opcode <= 0x2 || (opcode >= 0x8 && opcode <= 0xA);
+    for (uint8_t flags : {0x80, 0xC0, 0x00}) {
+      bool const control = (opcode & 0x8) != 0;
+      uint8_t const bytes[2] = {static_cast<uint8_t>(flags | opcode), 0x05};
+      FrameHeader header {};
+      int ret = libwebsocket::DecodeFrameHeader(
+          reinterpret_cast<char const*>(bytes), sizeof(bytes), &header);
+      int const expected =
+          (known && (!control || (flags & kFrameFinBit))) ? kFrameParseOk :
+                                                           kFrameParseError;
+      TEST_CHECK(ret == expected, "opcode 0x%X, flags 0x%02X: returned %d",
+                 opcode, flags, ret);
+    }
+  }
+}
+
+// 一端封装的帧由另一端解析, 负载与原始数据相同; 掩码位与角色不符时拒绝.
+template <typename Sender, typename Receiver>
+void CheckRoundTrip(char const* name) {
+  uint32_t seed = 0x510E527F;
+  for (uint8_t opcode : {0x1, 0x2, 0x9}) {
+    for (uint64_t size : {0, 1, 7, 125, 126, 127, 65535, 65536, 70001}) {
+      if ((opcode & 0x8) && size > 125) continue;
+      std::string payload(size, '\0');
+      for (auto& c : payload) c = static_cast<char>(NextRandom(&seed));
+      std::vector<char> frame;
+      TEST_CHECK(Sender::Package(kFrameFinBit | opcode, payload.data(), size,
+                                 &frame) == 0,
+                 "%s: package opcode 0x%X, size %llu", name, opcode,
+                 static_cast<unsigned long long>(size));
+      std::vector<char> copy = frame;
+      FrameHeader header {};
+      uint64_t frame_length = 0;
+      // 负载缺少最后一个字节时需继续接收.
+      if (size > 0) {
+        TEST_CHECK(Receiver::Parse(copy.data(), copy.size() - 1, UINT64_MAX,
+                                   &header, &frame_length) ==
+                   kFrameParseIncomplete,
+                   "%s: truncated opcode 0x%X, size %llu", name, opcode,
+                   static_cast<unsigned long long>(size));
+      }
+      int ret = Receiver::Parse(copy.data(), copy.size(), UINT64_MAX,
+                                &header, &frame_length);
+      TEST_CHECK(ret == kFrameParseOk && frame_length == frame.size() &&
+                 header.opcode == opcode && header.payload_length == size &&
+                 std::string(copy.data() + header.header_length, size) ==
+                     payload,
+                 "%s: parse opcode 0x%X, size %llu returned %d", name, opcode,
+                 static_cast<unsigned long long>(size), ret);
+      // 发送端自己的角色解析时掩码位不符.
+      copy = frame;
+      TEST_CHECK(Sender::Parse(copy.data(), copy.size(), UINT64_MAX, &header,
+                               &frame_length) == kFrameParseError,
+                 "%s: own frame accepted, opcode 0x%X, size %llu", name,
+                 opcode, static_cast<unsigned long long>(size));
+    }
+  }
+}
+
+// 分片后首帧带操作码和RSV, 之后为续帧, 只有最后一帧设置FIN.
+template <typename Sender, typename Receiver>
+void CheckFragments(char const* name) {
+  std::string const message = "0123456789abcdefghijklmnopqrstuvwxyz";
+  for (uint64_t fragment_size : {1, 10, 35, 36, 0}) {
+    std::vector<std::vector<char>> frames;
+    TEST_CHECK(Sender::PackageMessage(libwebsocket::kOPCodeText,
+                                      message.data(), message.size(),
+                                      fragment_size, kFrameRsv1Bit,
+                                      &frames) == 0,
+               "%s: fragment size %llu", name,
+               static_cast<unsigned long long>(fragment_size));
+    std::string joined;
+    for (size_t i = 0; i < frames.size(); ++i) {
+      FrameHeader header {};
+      uint64_t frame_length = 0;
+      int ret = Receiver::Parse(frames[i].data(), frames[i].size(), UINT64_MAX,
+                                &header, &frame_length);
+      bool const first = (i == 0);
+      bool const last = (i + 1 == frames.size());
+      TEST_CHECK(ret == kFrameParseOk && header.fin == last &&
+                 header.opcode == (first ? 0x1 : 0x0) &&
+                 header.reserve == (first ? kFrameRsv1Bit : 0),
+                 "%s: fragment size %llu, frame %zu", name,
+                 static_cast<unsigned long long>(fragment_size), i);
+      joined.append(frames[i].data() + header.header_length,
+                    header.payload_length);
+    }
+    TEST_CHECK(joined == message, "%s: fragment size %llu, message differs",
+               name, static_cast<unsigned long long>(fragment_size));
+  }
+}
+
+}  // namespace
+
+int main(void) {
+  CheckHeaderCases();
+  CheckOpcodes();
+  CheckRoundTrip<ClientFrameCodec, ServerFrameCodec>("client to server");
+  CheckRoundTrip<ServerFrameCodec, ClientFrameCodec>("server to client");
+  CheckFragments<ClientFrameCodec, ServerFrameCodec>("client to server");
+  CheckFragments<ServerFrameCodec, ClientFrameCodec>("server to client");
+  return libwebsocket::TestResult();
+}
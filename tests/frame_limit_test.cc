@@ -0,0 +1,316 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  frame_limit_test.cc
+// @Version :  1.0
+// @Desc    :  None
+//
+// 按表检查帧和消息的长度限制: 数据帧在解出帧头后即与上限比较, 控制帧不受
+// 上限约束; 服务端对超出单帧或整条消息上限的数据以1009状态码关闭连接.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#if defined(__linux__)
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "frame_codec.h"
+#include "server.h"
+#include "test_util.h"
+
+
+using libwebsocket::ClientFrameCodec;
+using libwebsocket::FrameHeader;
+using libwebsocket::kFrameFinBit;
+using libwebsocket::kFrameParseIncomplete;
+using libwebsocket::kFrameParseOk;
+using libwebsocket::kFrameParseTooLarge;
+using libwebsocket::kOPCodeBinary;
+using libwebsocket::kOPCodeClose;
+using libwebsocket::kOPCodePacket;
+using libwebsocket::kOPCodePing;
+using libwebsocket::kOPCodeText;
+using libwebsocket::ServerFrameCodec;
+using libwebsocket::WebSocketMsg;
+
+
+namespace {
+
+uint8_t const kZeroMask[4] = {0, 0, 0, 0};
+
+// 客户端发送的帧, 掩码键为0, 负载长度超过payload时只有帧头.
+std::vector<char> ClientFrame(uint8_t flags, uint64_t length,
+                              std::string const& payload = std::string()) {
+  uint8_t header[libwebsocket::kMaxFrameHeaderLength];
+  size_t header_length = libwebsocket::EncodeFrameHeader(flags, length,
+                                                         kZeroMask, header);
+  std::vector<char> frame(header, header + header_length);
+  frame.insert(frame.end(), payload.begin(), payload.end());
+  return frame;
+}
+
+// 长度为length的完整帧.
+std::vector<char> FullFrame(uint8_t flags, uint64_t length) {
+  return ClientFrame(flags, length, std::string(length, 'a'));
+}
+
+struct ParseCase {
+  char const* name;
+  std::vector<char> frame;
+  uint64_t max_payload_length;
+  int result;
+};
+
+std::vector<ParseCase> const kParseCases = {
+  {"at limit", FullFrame(kFrameFinBit | kOPCodeText, 100), 100,
+   kFrameParseOk},
+  {"at limit, header only", ClientFrame(kFrameFinBit | kOPCodeText, 100), 100,
+   kFrameParseIncomplete},
+  {"over limit, header only", ClientFrame(kFrameFinBit | kOPCodeText, 101),
+   100, kFrameParseTooLarge},
+  {"over limit", FullFrame(kFrameFinBit | kOPCodeBinary, 101), 100,
+   kFrameParseTooLarge},
+  {"continuation over limit", ClientFrame(kOPCodePacket, 2), 1,
+   kFrameParseTooLarge},
+  {"empty frame, zero limit", FullFrame(kFrameFinBit | kOPCodeText, 0), 0,
+   kFrameParseOk},
+  {"one byte, zero limit", ClientFrame(kFrameFinBit | kOPCodeText, 1), 0,
+   kFrameParseTooLarge},
+  {"16-bit length over limit", ClientFrame(kFrameFinBit | kOPCodeText, 65535),
+   65534, kFrameParseTooLarge},
+  {"64-bit length over limit",
+   ClientFrame(kFrameFinBit | kOPCodeBinary, uint64_t(1) << 40), 1 << 20,
+   kFrameParseTooLarge},
+  {"64-bit length, no limit",
+   ClientFrame(kFrameFinBit | kOPCodeBinary, INT64_MAX), UINT64_MAX,
+   kFrameParseIncomplete},
+  {"ping over limit", FullFrame(kFrameFinBit | kOPCodePing, 125), 0,
+   kFrameParseOk},
+  {"close over limit", FullFrame(kFrameFinBit | kOPCodeClose, 2), 1,
+   kFrameParseOk},
+};
+
+void CheckParse(void) {
+  for (auto const& test : kParseCases) {
+    WebSocketMsg msg {};
+    uint64_t frame_length = 0;
+    int ret = libwebsocket::WebSocketFrameParse(
+        test.frame.data(), test.frame.size(), test.max_payload_length, &msg,
+        &frame_length);
+    TEST_CHECK(ret == test.result, "%s: WebSocketFrameParse returned %d",
+               test.name, ret);
+    std::vector<char> frame = test.frame;
+    FrameHeader header {};
+    ret = ServerFrameCodec::Parse(frame.data(), frame.size(),
+                                  test.max_payload_length, &header,
+                                  &frame_length);
+    TEST_CHECK(ret == test.result, "%s: ServerFrameCodec returned %d",
+               test.name, ret);
+  }
+}
+
+#if defined(__linux__)
+// 服务端的单帧和单条消息上限.
+constexpr uint64_t kMaxFrameSize = 64;
+constexpr uint64_t kMaxMessageSize = 100;
+
+struct ServerCase {
+  char const* name;
+  std::vector<std::vector<char>> frames;  // 依次发送的帧.
+  int close_code;  // 收到的关闭帧中的状态码.
+};
+
+// 以上各帧之后客户端发起正常关闭, 未超出上限时服务端回复1000.
+std::vector<ServerCase> const kServerCases = {
+  {"frame at limit", {FullFrame(kFrameFinBit | kOPCodeText, 64)}, 1000},
+  {"frame over limit, header only",
+   {ClientFrame(kFrameFinBit | kOPCodeBinary, 65)}, 1009},
+  {"frame far over limit, header only",
+   {ClientFrame(kFrameFinBit | kOPCodeBinary, uint64_t(1) << 40)}, 1009},
+  {"message at limit",
+   {FullFrame(kOPCodeText, 64), FullFrame(kFrameFinBit | kOPCodePacket, 36)},
+   1000},
+  {"message over limit",
+   {FullFrame(kOPCodeText, 64), FullFrame(kFrameFinBit | kOPCodePacket, 37)},
+   1009},
+  {"message over limit in third fragment",
+   {FullFrame(kOPCodeBinary, 50), FullFrame(kOPCodePacket, 50),
+    ClientFrame(kFrameFinBit | kOPCodePacket, 1)},
+   1009},
+  {"limit applies per message",
+   {FullFrame(kOPCodeText, 64), FullFrame(kFrameFinBit | kOPCodePacket, 36),
+    FullFrame(kOPCodeText, 64), FullFrame(kFrameFinBit | kOPCodePacket, 36)},
+   1000},
+  {"ping over frame limit", {FullFrame(kFrameFinBit | kOPCodePing, 125)},
+   1000},
+  {"ping inside a message at limit",
+   {FullFrame(kOPCodeBinary, 64), FullFrame(kFrameFinBit | kOPCodePing, 125),
+    FullFrame(kFrameFinBit | kOPCodePacket, 36)},
+   1000},
+};
+
+// 取得一个当前空闲的本地端口.
+int FreePort(void) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t length = sizeof(addr);
+  int port = -1;
+  if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0 &&
+      getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &length) == 0) {
+    port = ntohs(addr.sin_port);
+  }
+  close(fd);
+  return port;
+}
+
+bool SendAll(int fd, std::vector<char> const& data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    sent += n;
+  }
+  return true;
+}
+
+// 连接服务端并完成握手, 失败时返回-1.
+// 服务端在等待线程中开始监听, 启动后的一段时间内连接可能被拒绝.
+int Connect(int port) {
+  sockaddr_in addr {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  int fd = -1;
+  for (int retry = 0; retry < 500 && fd < 0; ++retry) {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+      close(fd);
+      fd = -1;
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  }
+  if (fd < 0) return -1;
+  timeval timeout {5, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  std::string const request =
+      "GET / HTTP/1.1\r\nHost: 127.0.0.1\r\nUpgrade: websocket\r\n"
+      "Connection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+      "Sec-WebSocket-Version: 13\r\n\r\n";
+  if (!SendAll(fd, std::vector<char>(request.begin(), request.end()))) {
+    close(fd);
+    return -1;
+  }
+  // 逐字节读取响应, 不读入之后的帧.
+  std::string respond;
+  char ch = 0;
+  while (respond.size() < 4 ||
+         respond.compare(respond.size() - 4, 4, "\r\n\r\n") != 0) {
+    if (recv(fd, &ch, 1, 0) != 1) {
+      close(fd);
+      return -1;
+    }
+    respond.push_back(ch);
+  }
+  if (respond.compare(0, 12, "HTTP/1.1 101") != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// 读取服务端的帧直到关闭帧, 返回其中的状态码, 连接断开或超时返回-1.
+int ReadCloseCode(int fd) {
+  std::vector<char> buffer;
+  char data[4096];
+  while (true) {
+    ssize_t n = recv(fd, data, sizeof(data), 0);
+    if (n <= 0) return -1;
+    buffer.insert(buffer.end(), data, data + n);
+    FrameHeader header {};
+    uint64_t frame_length = 0;
+    int ret = kFrameParseOk;
+    while ((ret = ClientFrameCodec::Parse(buffer.data(), buffer.size(),
+                                          UINT64_MAX, &header,
+                                          &frame_length)) == kFrameParseOk) {
+      if (header.opcode == kOPCodeClose) {
+        return libwebsocket::WebSocketCloseCodeParse(
+            buffer.data() + header.header_length, header.payload_length);
+      }
+      buffer.erase(buffer.begin(), buffer.begin() + frame_length);
+      if (buffer.empty()) break;
+    }
+    if (ret != kFrameParseOk && ret != kFrameParseIncomplete) return -1;
+  }
+}
+
+void CheckServer(void) {
+  int const port = FreePort();
+  libwebsocket::WebSocketServer server;
+  server.Init();
+  server.SetServerAccessPoint("127.0.0.1", port);
+  server.SetMaxFrameSize(kMaxFrameSize);
+  server.SetMaxMessageSize(kMaxMessageSize);
+  if (port < 0 || server.InitServer() != 0 || !server.Run()) {
+    TEST_CHECK(false, "start server on port %d", port);
+    return;
+  }
+  std::vector<char> close_frame;
+  libwebsocket::WebSocketCloseFramePackaging(1000, true, &close_frame);
+  for (auto const& test : kServerCases) {
+    int fd = Connect(port);
+    TEST_CHECK(fd >= 0, "%s: handshake failed", test.name);
+    if (fd < 0) continue;
+    bool sent = true;
+    for (auto const& frame : test.frames) sent = sent && SendAll(fd, frame);
+    sent = sent && SendAll(fd, close_frame);
+    int code = ReadCloseCode(fd);
+    TEST_CHECK(code == test.close_code, "%s: close code %d (sent %d)",
+               test.name, code, sent);
+    close(fd);
+  }
+  server.Stop();
+}
+#endif  // __linux__
+
+}  // namespace
+
+int main(void) {
+  CheckParse();
+#if defined(__linux__)
+  CheckServer();
+#else
+  printf("server: skip\n");
+#endif
+  return libwebsocket::TestResult();
+}
@@ -0,0 +1,345 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  handshake_test.cc
+// @Version :  1.0
+// @Desc    :  None
+//
+// 按表检查单次遍历的握手请求和响应解析: 头部名称大小写, 值两端的空白,
+// Connection和Upgrade列表, 缺少或非法的必需头部, 以及不完整的数据.
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "websocket.h"
+#include "test_util.h"
+
+
+using libwebsocket::HandshakeRequest;
+using libwebsocket::HandshakeRespond;
+using libwebsocket::HttpToken;
+using libwebsocket::kHandshakeParseError;
+using libwebsocket::kHandshakeParseIncomplete;
+using libwebsocket::kHandshakeParseOk;
+
+
+namespace {
+
+// RFC 6455 1.3中的示例.
+char const kKey[] = "dGhlIHNhbXBsZSBub25jZQ==";
+char const kAccept[] = "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=";
+
+struct RequestCase {
+  char const* name;
+  std::string text;
+  int result;
+  // 以下字段只在result为kHandshakeParseOk时比较, 空指针表示头部不存在.
+  size_t trailing;  // 请求之后的数据长度.
+  char const* path;
+  char const* host;
+  char const* origin;
+  char const* key;
+  char const* protocol;
+  char const* extensions;
+  char const* resume;
+};
+
+std::string const kRequestLine = "GET /chat HTTP/1.1\r\n";
+std::string const kRequiredHeaders =
+    "Host: server.example.com\r\n"
+    "Upgrade: websocket\r\n"
+    "Connection: Upgrade\r\n"
+    "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+    "Sec-WebSocket-Version: 13\r\n";
+
+// 去掉必需头部中的一行.
+std::string Without(std::string const& name) {
+  std::string headers = kRequiredHeaders;
+  size_t begin = headers.find(name + ":");
+  size_t end = headers.find("\r\n", begin);
+  return headers.erase(begin, end + 2 - begin);
+}
+
+std::vector<RequestCase> const kRequestCases = {
+  {"RFC 6455 example",
+   kRequestLine + kRequiredHeaders +
+   "Origin: http://example.com\r\n"
+   "Sec-WebSocket-Protocol: chat, superchat\r\n"
+   "Sec-WebSocket-Extensions: permessage-deflate\r\n\r\n",
+   kHandshakeParseOk, 0, "/chat", "server.example.com", "http://example.com",
+   kKey, "chat, superchat", "permessage-deflate", nullptr},
+  {"header names in any case",
+   kRequestLine +
+   "HOST: h\r\nupgrade: websocket\r\nCONNECTION: upgrade\r\n"
+   "sec-websocket-key: k\r\nSEC-WEBSOCKET-VERSION: 13\r\n"
+   "x-websocket-RESUME: new\r\n\r\n",
+   kHandshakeParseOk, 0, "/chat", "h", nullptr, "k", nullptr, nullptr, "new"},
+  {"whitespace around values",
+   kRequestLine +
+   "Host:h\r\nUpgrade: \t websocket \t\r\nConnection:Upgrade\r\n"
+   "Sec-WebSocket-Key:  \t k e y \t \r\nSec-WebSocket-Version:13 \r\n\r\n",
+   kHandshakeParseOk, 0, "/chat", "h", nullptr, "k e y", nullptr, nullptr,
+   nullptr},
+  {"token lists",
+   kRequestLine +
+   "Upgrade: h2c, WebSocket\r\nConnection: keep-alive,  UPGRADE ,x\r\n"
+   "Sec-WebSocket-Key: k\r\nSec-WebSocket-Version: 13\r\n\r\n",
+   kHandshakeParseOk, 0, "/chat", nullptr, nullptr, "k", nullptr, nullptr,
+   nullptr},
+  {"LF line endings",
+   "GET /a?b=c HTTP/1.1\nUpgrade: websocket\nConnection: Upgrade\n"
+   "Sec-WebSocket-Key: k\nSec-WebSocket-Version: 13\n\n",
+   kHandshakeParseOk, 0, "/a?b=c", nullptr, nullptr, "k", nullptr, nullptr,
+   nullptr},
+  {"data after the request",
+   kRequestLine + kRequiredHeaders + "\r\n" + std::string("\x81\x85", 2) +
+   "abcdefghi",
+   kHandshakeParseOk, 11, "/chat", "server.example.com", nullptr, kKey,
+   nullptr, nullptr, nullptr},
+  {"unknown headers", kRequestLine + "X-Custom: 1\r\n" + kRequiredHeaders +
+   "Cookie: a=b\r\n\r\n",
+   kHandshakeParseOk, 0, "/chat", "server.example.com", nullptr, kKey,
+   nullptr, nullptr, nullptr},
+  {"POST", "POST /chat HTTP/1.1\r\n" + kRequiredHeaders + "\r\n",
+   kHandshakeParseError},
+  {"lowercase method", "get /chat HTTP/1.1\r\n" + kRequiredHeaders + "\r\n",
+   kHandshakeParseError},
+  {"HTTP/1.0", "GET /chat HTTP/1.0\r\n" + kRequiredHeaders + "\r\n",
+   kHandshakeParseError},
+  {"no path", "GET HTTP/1.1\r\n" + kRequiredHeaders + "\r\n",
+   kHandshakeParseError},
+  {"space in path", "GET /a b HTTP/1.1\r\n" + kRequiredHeaders + "\r\n",
+   kHandshakeParseError},
+  {"no Upgrade", kRequestLine + Without("Upgrade") + "\r\n",
+   kHandshakeParseError},
+  {"Upgrade without websocket",
+   kRequestLine + Without("Upgrade") + "Upgrade: h2c\r\n\r\n",
+   kHandshakeParseError},
+  {"Upgrade with websocket as substring",
+   kRequestLine + Without("Upgrade") + "Upgrade: websockets\r\n\r\n",
+   kHandshakeParseError},
+  {"no Connection", kRequestLine + Without("Connection") + "\r\n",
+   kHandshakeParseError},
+  {"Connection close",
+   kRequestLine + Without("Connection") + "Connection: close\r\n\r\n",
+   kHandshakeParseError},
+  {"no version", kRequestLine + Without("Sec-WebSocket-Version") + "\r\n",
+   kHandshakeParseError},
+  {"version 8",
+   kRequestLine + Without("Sec-WebSocket-Version") +
+   "Sec-WebSocket-Version: 8\r\n\r\n",
+   kHandshakeParseError},
+  {"version 130",
+   kRequestLine + Without("Sec-WebSocket-Version") +
+   "Sec-WebSocket-Version: 130\r\n\r\n",
+   kHandshakeParseError},
+  {"no key", kRequestLine + Without("Sec-WebSocket-Key") + "\r\n",
+   kHandshakeParseError},
+  {"empty key",
+   kRequestLine + Without("Sec-WebSocket-Key") +
+   "Sec-WebSocket-Key: \t\r\n\r\n",
+   kHandshakeParseError},
+  {"header without colon",
+   kRequestLine + kRequiredHeaders + "Bad header\r\n\r\n",
+   kHandshakeParseError},
+  {"empty header name", kRequestLine + kRequiredHeaders + ": x\r\n\r\n",
+   kHandshakeParseError},
+  {"headers not finished", kRequestLine + kRequiredHeaders,
+   kHandshakeParseIncomplete},
+};
+
+std::string ToString(HttpToken const& token) {
+  return std::string(token.data, token.size);
+}
+
+// 期望的头部不存在时, 解析结果的长度也应为0.
+bool SameToken(HttpToken const& token, char const* expected) {
+  if (expected == nullptr) return token.size == 0;
+  return ToString(token) == expected;
+}
+
+void CheckRequests(void) {
+  for (auto const& test : kRequestCases) {
+    HandshakeRequest request {};
+    size_t length = 0;
+    int ret = libwebsocket::HandshakeRequestParse(
+        test.text.data(), test.text.size(), &request, &length);
+    TEST_CHECK(ret == test.result, "%s: returned %d", test.name, ret);
+    if (ret != kHandshakeParseOk || test.result != kHandshakeParseOk) continue;
+    TEST_CHECK(length == test.text.size() - test.trailing,
+               "%s: request length %zu", test.name, length);
+    TEST_CHECK(SameToken(request.path, test.path), "%s: path \"%s\"",
+               test.name, ToString(request.path).c_str());
+    TEST_CHECK(SameToken(request.host, test.host), "%s: host \"%s\"",
+               test.name, ToString(request.host).c_str());
+    TEST_CHECK(SameToken(request.origin, test.origin), "%s: origin \"%s\"",
+               test.name, ToString(request.origin).c_str());
+    TEST_CHECK(SameToken(request.key, test.key), "%s: key \"%s\"", test.name,
+               ToString(request.key).c_str());
+    TEST_CHECK(SameToken(request.protocol, test.protocol),
+               "%s: protocol \"%s\"", test.name,
+               ToString(request.protocol).c_str());
+    TEST_CHECK(SameToken(request.extensions, test.extensions),
+               "%s: extensions \"%s\"", test.name,
+               ToString(request.extensions).c_str());
+    TEST_CHECK(SameToken(request.resume, test.resume), "%s: resume \"%s\"",
+               test.name, ToString(request.resume).c_str());
+    // 任何不含结尾空行的前缀都需继续接收.
+    size_t const end = test.text.size() - test.trailing;
+    for (size_t size = 0; size < end; ++size) {
+      ret = libwebsocket::HandshakeRequestParse(test.text.data(), size,
+                                                &request, &length);
+      TEST_CHECK(ret == kHandshakeParseIncomplete,
+                 "%s: prefix of %zu bytes returned %d", test.name, size, ret);
+    }
+  }
+}
+
+struct RespondCase {
+  char const* name;
+  std::string text;
+  int result;
+  // 以下字段只在result为kHandshakeParseOk时比较, 空指针表示头部不存在.
+  char const* accept;
+  char const* protocol;
+  char const* extensions;
+  char const* resume;
+};
+
+std::string const kRespondHeaders =
+    "Upgrade: websocket\r\n"
+    "Connection: Upgrade\r\n"
+    "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n";
+
+std::vector<RespondCase> const kRespondCases = {
+  {"RFC 6455 example",
+   "HTTP/1.1 101 Switching Protocols\r\n" + kRespondHeaders +
+   "Sec-WebSocket-Protocol: chat\r\n"
+   "Sec-WebSocket-Extensions: permessage-deflate; server_max_window_bits=10"
+   "\r\nX-WebSocket-Resume: 0123456789abcdef0123456789abcdef 7\r\n\r\n",
+   kHandshakeParseOk, kAccept, "chat",
+   "permessage-deflate; server_max_window_bits=10",
+   "0123456789abcdef0123456789abcdef 7"},
+  {"no reason phrase", "HTTP/1.1 101\r\n" + kRespondHeaders + "\r\n",
+   kHandshakeParseOk, kAccept, nullptr, nullptr, nullptr},
+  {"header names in any case",
+   "HTTP/1.1 101 OK\r\nUPGRADE: WebSocket\r\nconnection: upgrade\r\n"
+   "sec-websocket-ACCEPT:  abc \r\n\r\n",
+   kHandshakeParseOk, "abc", nullptr, nullptr, nullptr},
+  {"status 200", "HTTP/1.1 200 OK\r\n" + kRespondHeaders + "\r\n",
+   kHandshakeParseError},
+  {"status 1010", "HTTP/1.1 1010 x\r\n" + kRespondHeaders + "\r\n",
+   kHandshakeParseError},
+  {"HTTP/1.0", "HTTP/1.0 101 x\r\n" + kRespondHeaders + "\r\n",
+   kHandshakeParseError},
+  {"no accept",
+   "HTTP/1.1 101 x\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n\r\n",
+   kHandshakeParseError},
+  {"no Upgrade",
+   "HTTP/1.1 101 x\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: a\r\n\r\n",
+   kHandshakeParseError},
+  {"no Connection",
+   "HTTP/1.1 101 x\r\nUpgrade: websocket\r\nSec-WebSocket-Accept: a\r\n\r\n",
+   kHandshakeParseError},
+  {"header without colon",
+   "HTTP/1.1 101 x\r\n" + kRespondHeaders + "Bad\r\n\r\n",
+   kHandshakeParseError},
+  {"headers not finished", "HTTP/1.1 101 x\r\n" + kRespondHeaders,
+   kHandshakeParseIncomplete},
+};
+
+void CheckResponds(void) {
+  for (auto const& test : kRespondCases) {
+    HandshakeRespond respond {};
+    size_t length = 0;
+    int ret = libwebsocket::HandshakeRespondParse(
+        test.text.data(), test.text.size(), &respond, &length);
+    TEST_CHECK(ret == test.result, "%s: returned %d", test.name, ret);
+    if (ret != kHandshakeParseOk || test.result != kHandshakeParseOk) continue;
+    TEST_CHECK(length == test.text.size(), "%s: respond length %zu",
+               test.name, length);
+    TEST_CHECK(SameToken(respond.accept, test.accept), "%s: accept \"%s\"",
+               test.name, ToString(respond.accept).c_str());
+    TEST_CHECK(SameToken(respond.protocol, test.protocol),
+               "%s: protocol \"%s\"", test.name,
+               ToString(respond.protocol).c_str());
+    TEST_CHECK(SameToken(respond.extensions, test.extensions),
+               "%s: extensions \"%s\"", test.name,
+               ToString(respond.extensions).c_str());
+    TEST_CHECK(SameToken(respond.resume, test.resume), "%s: resume \"%s\"",
+               test.name, ToString(respond.resume).c_str());
+    for (size_t size = 0; size < test.text.size(); ++size) {
+      ret = libwebsocket::HandshakeRespondParse(test.text.data(), size,
+                                                &respond, &length);
+      TEST_CHECK(ret == kHandshakeParseIncomplete,
+                 "%s: prefix of %zu bytes returned %d", test.name, size, ret);
+    }
+  }
+}
+
+// 服务端生成的响应可被客户端解析, 接受值与RFC示例相同, 且不回显子协议.
+void CheckRespondPackaging(void) {
+  std::string const text = kRequestLine + kRequiredHeaders +
+                           "Sec-WebSocket-Protocol: chat\r\n\r\n";
+  HandshakeRequest request {};
+  size_t length = 0;
+  TEST_CHECK(libwebsocket::HandshakeRequestParse(text.data(), text.size(),
+                                                 &request, &length) ==
+             kHandshakeParseOk, "parse request");
+  char const extensions[] = "permessage-deflate";
+  char const resume[] = "0123456789abcdef0123456789abcdef 0";
+  char buffer[libwebsocket::kMaxHandshakeRespondLength];
+  int size = libwebsocket::HandshakeRespondPackaging(
+      request, HttpToken {extensions, strlen(extensions)},
+      HttpToken {resume, strlen(resume)}, buffer, sizeof(buffer));
+  TEST_CHECK(size > 0, "package respond returned %d", size);
+  if (size <= 0) return;
+  HandshakeRespond respond {};
+  TEST_CHECK(libwebsocket::HandshakeRespondParse(buffer, size, &respond,
+                                                 &length) ==
+             kHandshakeParseOk && length == static_cast<size_t>(size),
+             "parse packaged respond");
+  TEST_CHECK(SameToken(respond.accept, kAccept) &&
+             SameToken(respond.protocol, nullptr) &&
+             SameToken(respond.extensions, extensions) &&
+             SameToken(respond.resume, resume),
+             "packaged respond: accept \"%s\", protocol \"%s\"",
+             ToString(respond.accept).c_str(),
+             ToString(respond.protocol).c_str());
+  // 缓冲区不足时返回-1.
+  TEST_CHECK(libwebsocket::HandshakeRespondPackaging(
+                 request, HttpToken {extensions, strlen(extensions)},
+                 HttpToken {resume, strlen(resume)}, buffer,
+                 static_cast<size_t>(size) - 1) < 0,
+             "package respond into a short buffer");
+}
+
+}  // namespace
+
+int main(void) {
+  CheckRequests();
+  CheckResponds();
+  CheckRespondPackaging();
+  return libwebsocket::TestResult();
+}
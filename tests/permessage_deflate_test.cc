@@ -0,0 +1,300 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  permessage_deflate_test.cc
+// @Version :  1.0
+// @Desc    :  None
+//
+// 按表检查permessage-deflate的协商: 服务端选择客户端请求并生成响应,
+// 客户端检查服务端响应. 未知, 重复或非法的参数须被拒绝.
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "permessage_deflate.h"
+#include "test_util.h"
+
+
+using libwebsocket::DeflateOptions;
+using libwebsocket::HttpToken;
+
+
+namespace {
+
+// 启用扩展的本端配置.
+DeflateOptions Local(int const& server_max_window_bits = 15,
+                     int const& client_max_window_bits = 15,
+                     bool const& server_no_context_takeover = false) {
+  DeflateOptions local;
+  local.enabled = true;
+  local.server_max_window_bits = server_max_window_bits;
+  local.client_max_window_bits = client_max_window_bits;
+  local.server_no_context_takeover = server_no_context_takeover;
+  return local;
+}
+
+DeflateOptions Disabled(void) { return DeflateOptions {}; }
+
+HttpToken Token(char const* text) {
+  return HttpToken {text, strlen(text)};
+}
+
+// 约定的参数.
+struct Agreed {
+  bool server_no_context_takeover;
+  bool client_no_context_takeover;
+  int server_max_window_bits;
+  int client_max_window_bits;
+};
+
+Agreed const kDefault = {false, false, 15, 15};
+
+bool SameAgreed(DeflateOptions const& agreed, Agreed const& expected) {
+  return agreed.enabled &&
+         agreed.server_no_context_takeover ==
+             expected.server_no_context_takeover &&
+         agreed.client_no_context_takeover ==
+             expected.client_no_context_takeover &&
+         agreed.server_max_window_bits == expected.server_max_window_bits &&
+         agreed.client_max_window_bits == expected.client_max_window_bits;
+}
+
+struct NegotiateCase {
+  char const* name;
+  char const* offers;
+  DeflateOptions local;
+  char const* response;  // 空指针表示拒绝扩展.
+  Agreed agreed;
+};
+
+std::vector<NegotiateCase> const kNegotiateCases = {
+  {"plain offer", "permessage-deflate", Local(), "permessage-deflate",
+   kDefault},
+  {"client window without value",
+   "permessage-deflate; client_max_window_bits", Local(),
+   "permessage-deflate", kDefault},
+  {"client window limited locally",
+   "permessage-deflate; client_max_window_bits", Local(15, 10),
+   "permessage-deflate; client_max_window_bits=10", {false, false, 15, 10}},
+  {"client window not offered", "permessage-deflate", Local(15, 10),
+   "permessage-deflate", kDefault},
+  {"client window offered",
+   "permessage-deflate; client_max_window_bits=9", Local(15, 10),
+   "permessage-deflate; client_max_window_bits=9", {false, false, 15, 9}},
+  {"server window offered", "permessage-deflate; server_max_window_bits=10",
+   Local(), "permessage-deflate; server_max_window_bits=10",
+   {false, false, 10, 15}},
+  {"server window limited locally", "permessage-deflate", Local(12),
+   "permessage-deflate; server_max_window_bits=12", {false, false, 12, 15}},
+  {"smaller server window wins",
+   "permessage-deflate; server_max_window_bits=13", Local(11),
+   "permessage-deflate; server_max_window_bits=11", {false, false, 11, 15}},
+  {"quoted window", "permessage-deflate; server_max_window_bits=\"9\"",
+   Local(), "permessage-deflate; server_max_window_bits=9",
+   {false, false, 9, 15}},
+  {"no context takeover",
+   "permessage-deflate; client_no_context_takeover; "
+   "server_no_context_takeover",
+   Local(), "permessage-deflate; server_no_context_takeover; "
+   "client_no_context_takeover", {true, true, 15, 15}},
+  {"no context takeover locally", "permessage-deflate", Local(15, 15, true),
+   "permessage-deflate; server_no_context_takeover", {true, false, 15, 15}},
+  {"names in any case",
+   " PerMessage-Deflate ;Server_Max_Window_Bits = 8 ", Local(),
+   "permessage-deflate; server_max_window_bits=8", {false, false, 8, 15}},
+  {"first offer invalid",
+   "permessage-deflate; server_max_window_bits=7, "
+   "permessage-deflate; client_max_window_bits",
+   Local(15, 11), "permessage-deflate; client_max_window_bits=11",
+   {false, false, 15, 11}},
+  {"unknown extension first", "x-webkit-deflate-frame, permessage-deflate",
+   Local(), "permessage-deflate", kDefault},
+  {"empty offers", "", Local(), nullptr},
+  {"unknown extension", "x-webkit-deflate-frame", Local(), nullptr},
+  {"local disabled", "permessage-deflate", Disabled(), nullptr},
+  {"window bits 7", "permessage-deflate; server_max_window_bits=7", Local(),
+   nullptr},
+  {"window bits 16", "permessage-deflate; client_max_window_bits=16",
+   Local(), nullptr},
+  {"window bits 1a", "permessage-deflate; server_max_window_bits=1a",
+   Local(), nullptr},
+  {"window bits 010", "permessage-deflate; server_max_window_bits=010",
+   Local(), nullptr},
+  {"empty window bits", "permessage-deflate; client_max_window_bits=",
+   Local(), nullptr},
+  {"server window without value",
+   "permessage-deflate; server_max_window_bits", Local(), nullptr},
+  {"server_no_context_takeover with value",
+   "permessage-deflate; server_no_context_takeover=1", Local(), nullptr},
+  {"client_no_context_takeover with value",
+   "permessage-deflate; client_no_context_takeover=\"\"", Local(), nullptr},
+  {"duplicate flag",
+   "permessage-deflate; client_no_context_takeover; "
+   "client_no_context_takeover", Local(), nullptr},
+  {"duplicate window",
+   "permessage-deflate; server_max_window_bits=10; "
+   "server_max_window_bits=10", Local(), nullptr},
+  {"unknown parameter", "permessage-deflate; mux", Local(), nullptr},
+  {"unterminated quote", "permessage-deflate; server_max_window_bits=\"9",
+   Local(), nullptr},
+  {"empty parameter", "permessage-deflate;; client_no_context_takeover",
+   Local(), nullptr},
+  {"too many parameters",
+   "permessage-deflate; a; b; c; d; e; f; g; h; i", Local(), nullptr},
+};
+
+void CheckNegotiate(void) {
+  char response[256];
+  for (auto const& test : kNegotiateCases) {
+    DeflateOptions agreed;
+    agreed.enabled = true;
+    int size = libwebsocket::DeflateNegotiate(
+        Token(test.offers), test.local, &agreed, response, sizeof(response));
+    if (test.response == nullptr) {
+      TEST_CHECK(size == 0 && !agreed.enabled, "%s: returned %d", test.name,
+                 size);
+      continue;
+    }
+    std::string const value(response, size > 0 ? size : 0);
+    TEST_CHECK(value == test.response, "%s: response \"%s\"", test.name,
+               value.c_str());
+    TEST_CHECK(SameAgreed(agreed, test.agreed),
+               "%s: agreed %d %d %d %d", test.name,
+               agreed.server_no_context_takeover,
+               agreed.client_no_context_takeover,
+               agreed.server_max_window_bits, agreed.client_max_window_bits);
+    // 响应须完整写入, 空间不足时拒绝扩展.
+    size_t const length = strlen(test.response);
+    size = libwebsocket::DeflateNegotiate(Token(test.offers), test.local,
+                                          &agreed, response, length);
+    TEST_CHECK(size == static_cast<int>(length),
+               "%s: exact capacity returned %d", test.name, size);
+    size = libwebsocket::DeflateNegotiate(Token(test.offers), test.local,
+                                          &agreed, response, length - 1);
+    TEST_CHECK(size == 0 && !agreed.enabled,
+               "%s: short capacity returned %d", test.name, size);
+  }
+}
+
+struct ResponseCase {
+  char const* name;
+  char const* extensions;
+  DeflateOptions local;
+  int result;
+  Agreed agreed;  // 只在result为1时比较.
+};
+
+std::vector<ResponseCase> const kResponseCases = {
+  {"no extensions", "", Local(), 0},
+  {"no extensions, local disabled", "", Disabled(), 0},
+  {"plain", "permessage-deflate", Local(), 1, kDefault},
+  {"all parameters",
+   "permessage-deflate; server_max_window_bits=10; client_max_window_bits=9;"
+   " server_no_context_takeover; client_no_context_takeover",
+   Local(), 1, {true, true, 10, 9}},
+  {"client window limited locally", "permessage-deflate", Local(15, 10), 1,
+   {false, false, 15, 10}},
+  {"smaller client window wins",
+   "permessage-deflate; client_max_window_bits=12", Local(15, 10), 1,
+   {false, false, 15, 10}},
+  {"server context takeover is not assumed", "permessage-deflate",
+   Local(15, 15, true), 1, kDefault},
+  {"client window without value",
+   "permessage-deflate; client_max_window_bits", Local(), -1},
+  {"window bits 16", "permessage-deflate; server_max_window_bits=16",
+   Local(), -1},
+  {"two extensions", "permessage-deflate, permessage-deflate", Local(), -1},
+  {"unrequested extension", "x-webkit-deflate-frame", Local(), -1},
+  {"unknown parameter", "permessage-deflate; mux", Local(), -1},
+  {"not requested", "permessage-deflate", Disabled(), -1},
+};
+
+void CheckResponse(void) {
+  for (auto const& test : kResponseCases) {
+    DeflateOptions agreed;
+    agreed.enabled = true;
+    int ret = libwebsocket::DeflateResponseParse(Token(test.extensions),
+                                                 test.local, &agreed);
+    TEST_CHECK(ret == test.result, "%s: returned %d", test.name, ret);
+    if (ret != 1 || test.result != 1) {
+      TEST_CHECK(!agreed.enabled, "%s: enabled", test.name);
+      continue;
+    }
+    TEST_CHECK(SameAgreed(agreed, test.agreed),
+               "%s: agreed %d %d %d %d", test.name,
+               agreed.server_no_context_takeover,
+               agreed.client_no_context_takeover,
+               agreed.server_max_window_bits, agreed.client_max_window_bits);
+  }
+}
+
+// 客户端请求经服务端协商后, 双方得到相同的参数.
+void CheckHandshake(void) {
+  std::vector<DeflateOptions> const options = {
+    Local(), Local(9), Local(15, 9), Local(10, 12, true), Local(8, 8),
+  };
+  for (auto const& client : options) {
+    for (auto const& server : options) {
+      std::string offer;
+      libwebsocket::DeflateOfferPackaging(client, &offer);
+      char response[256];
+      DeflateOptions server_agreed;
+      int size = libwebsocket::DeflateNegotiate(
+          HttpToken {offer.data(), offer.size()}, server, &server_agreed,
+          response, sizeof(response));
+      DeflateOptions client_agreed;
+      int ret = libwebsocket::DeflateResponseParse(
+          HttpToken {response, size > 0 ? static_cast<size_t>(size) : 0},
+          client, &client_agreed);
+      TEST_CHECK(size > 0 && ret == 1, "%s: negotiate %d, response %d",
+                 offer.c_str(), size, ret);
+      Agreed const expected = {
+        server_agreed.server_no_context_takeover,
+        server_agreed.client_no_context_takeover,
+        server_agreed.server_max_window_bits,
+        server_agreed.client_max_window_bits,
+      };
+      TEST_CHECK(SameAgreed(client_agreed, expected),
+                 "%s -> %.*s: client agreed %d %d %d %d", offer.c_str(),
+                 size, response, client_agreed.server_no_context_takeover,
+                 client_agreed.client_no_context_takeover,
+                 client_agreed.server_max_window_bits,
+                 client_agreed.client_max_window_bits);
+    }
+  }
+}
+
+}  // namespace
+
+int main(void) {
+  if (!libwebsocket::DeflateAvailable()) {
+    printf("permessage-deflate: skip\n");
+    return 0;
+  }
+  CheckNegotiate();
+  CheckResponse();
+  CheckHandshake();
+  return libwebsocket::TestResult();
+}
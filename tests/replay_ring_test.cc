@@ -0,0 +1,248 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  replay_ring_test.cc
+// @Version :  1.0
+// @Desc    :  None
+//
+// 检查映射到文件的重放缓冲区在重新映射后记录不变, 以及损坏的文件不会被
+// 当作有效的缓冲区恢复.
+
+#include <stdlib.h>
+#include <string.h>
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <string>
+#include <vector>
+
+#include "replay_ring.h"
+#include "test_util.h"
+
+
+using libwebsocket::NextRandom;
+
+
+namespace {
+
+#if defined(__linux__)
+// 数据区容量, 较小的容量使记录频繁绕过数据区末尾.
+constexpr size_t kCapacity = 256;
+// 文件头部的长度和各字段的位置.
+constexpr size_t kHeaderLength = 56;
+constexpr size_t kHeadOffset = 16;
+constexpr size_t kTailOffset = 24;
+constexpr size_t kCountOffset = 32;
+
+struct Record {
+  uint64_t seq;
+  uint8_t opcode;
+  std::string data;
+};
+
+std::vector<Record> ReadAll(libwebsocket::ReplayRing const& ring, int* ret) {
+  std::vector<Record> records;
+  *ret = ring.ReadAfter(ring.first_sequence() - 1,
+      [&records] (uint64_t const& seq, uint8_t const& opcode,
+                  char const* data, size_t const& size) {
+    records.push_back(Record {seq, opcode, std::string(data, size)});
+  });
+  return records;
+}
+
+bool SameRecords(std::vector<Record> const& a, std::vector<Record> const& b) {
+  if (a.size() != b.size()) return false;
+  for (size_t i = 0; i < a.size(); ++i) {
+    if (a[i].seq != b[i].seq || a[i].opcode != b[i].opcode ||
+        a[i].data != b[i].data) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// 追加count条长度不同的记录, 负载内容由序号决定.
+void AppendRecords(libwebsocket::ReplayRing* ring, int count,
+                   uint32_t* seed) {
+  for (int i = 0; i < count; ++i) {
+    std::string data(NextRandom(seed) % 60, '\0');
+    for (size_t k = 0; k < data.size(); ++k) {
+      data[k] = static_cast<char>(ring->next_sequence() + k);
+    }
+    ring->Append(libwebsocket::kOPCodeBinary, data.data(), data.size());
+  }
+}
+
+std::string ReadFile(std::string const& path) {
+  std::string content;
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return content;
+  char buffer[4096];
+  ssize_t n = 0;
+  while ((n = read(fd, buffer, sizeof(buffer))) > 0) content.append(buffer, n);
+  close(fd);
+  return content;
+}
+
+void WriteFile(std::string const& path, std::string const& content) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) return;
+  TEST_CHECK(write(fd, content.data(), content.size()) ==
+             static_cast<ssize_t>(content.size()), "write %s", path.c_str());
+  close(fd);
+}
+
+// 按小端序改写offset处size字节的字段.
+void WriteField(std::string* content, size_t offset, size_t size,
+                uint64_t value) {
+  for (size_t i = 0; i < size; ++i) {
+    (*content)[offset + i] = static_cast<char>(value >> (8*i));
+  }
+}
+
+// 重新映射后记录与关闭前相同, 且可以继续追加.
+void CheckReopen(std::string const& path) {
+  uint32_t seed = 0x6A09E667;
+  libwebsocket::ReplayRing ring;
+  TEST_CHECK(ring.Map(path, kCapacity) == 0, "create %s", path.c_str());
+  for (int round = 0; round < 50; ++round) {
+    AppendRecords(&ring, 1 + round % 7, &seed);
+    int ret = 0;
+    std::vector<Record> const before = ReadAll(ring, &ret);
+    TEST_CHECK(ret == static_cast<int>(ring.size()), "round %d: read %d",
+               round, ret);
+    ring.Close(false);
+    TEST_CHECK(ring.Map(path, 0, false) == 0, "round %d: reopen", round);
+    std::vector<Record> const after = ReadAll(ring, &ret);
+    TEST_CHECK(SameRecords(before, after), "round %d: records changed",
+               round);
+  }
+  ring.Close(true);
+}
+
+// 修改文件的任一字节后, 映射成功时记录必须可以完整读出, 且之后的追加和
+// 丢弃不会越界.
+void CheckCorruptBytes(std::string const& path) {
+  uint32_t seed = 0xBB67AE85;
+  std::string original;
+  {
+    libwebsocket::ReplayRing ring;
+    TEST_CHECK(ring.Map(path, kCapacity) == 0, "create %s", path.c_str());
+    AppendRecords(&ring, 37, &seed);
+    ring.Close(false);
+    original = ReadFile(path);
+  }
+  TEST_CHECK(original.size() == kHeaderLength + kCapacity, "file size %zu",
+             original.size());
+  for (size_t i = 0; i < original.size(); ++i) {
+    for (uint8_t flip : {0x01, 0x80, 0xFF}) {
+      std::string content = original;
+      content[i] = static_cast<char>(content[i] ^ flip);
+      WriteFile(path, content);
+      libwebsocket::ReplayRing ring;
+      if (ring.Map(path, 0, false) != 0) continue;
+      int ret = 0;
+      ReadAll(ring, &ret);
+      TEST_CHECK(ret == static_cast<int>(ring.size()),
+                 "byte %zu ^ 0x%02X accepted but read %d of %zu records", i,
+                 flip, ret, ring.size());
+      AppendRecords(&ring, 20, &seed);
+      std::vector<Record> const records = ReadAll(ring, &ret);
+      TEST_CHECK(ret == static_cast<int>(ring.size()),
+                 "byte %zu ^ 0x%02X: read %d after appending", i, flip, ret);
+      ring.Close(false);
+    }
+  }
+  unlink(path.c_str());
+}
+
+// 头部中的位置或记录数与记录不符时视为无效, 可以重新创建为空缓冲区.
+void CheckCorruptHeader(std::string const& path) {
+  uint32_t seed = 0x3C6EF372;
+  std::string original;
+  {
+    libwebsocket::ReplayRing ring;
+    TEST_CHECK(ring.Map(path, kCapacity) == 0, "create %s", path.c_str());
+    AppendRecords(&ring, 23, &seed);
+    ring.Close(false);
+    original = ReadFile(path);
+  }
+  uint64_t head = 0;
+  uint64_t tail = 0;
+  memcpy(&head, &original[kHeadOffset], sizeof(head));
+  memcpy(&tail, &original[kTailOffset], sizeof(tail));
+  // 最早一条记录的序号(8字节)和长度(4字节).
+  size_t const record = kHeaderLength + head;
+  struct Corruption {
+    char const* name;
+    size_t offset;
+    size_t size;
+    uint64_t value;
+  };
+  std::vector<Corruption> const corruptions = {
+    {"head + 8", kHeadOffset, 8, head + 8},
+    {"head at end", kHeadOffset, 8, kCapacity},
+    {"tail - 8", kTailOffset, 8, tail - 8},
+    {"tail + 8", kTailOffset, 8, tail + 8},
+    {"count 0", kCountOffset, 8, 0},
+    {"huge record length", record + 8, 4, 0x7FFFFFF0},
+    {"record length past end", record + 8, 4, kCapacity},
+    {"skip marker", record + 8, 4, 0xFFFFFFFF},
+    {"record sequence", record, 8, 12345},
+  };
+  for (auto const& corruption : corruptions) {
+    std::string content = original;
+    WriteField(&content, corruption.offset, corruption.size,
+               corruption.value);
+    WriteFile(path, content);
+    libwebsocket::ReplayRing ring;
+    TEST_CHECK(ring.Map(path, 0, false) != 0, "%s: accepted",
+               corruption.name);
+    TEST_CHECK(ring.Map(path, kCapacity) == 0 && ring.size() == 0,
+               "%s: not recreated", corruption.name);
+    ring.Close(false);
+  }
+  unlink(path.c_str());
+}
+#endif  // __linux__
+
+}  // namespace
+
+int main(void) {
+#if defined(__linux__)
+  char dir[] = "/tmp/replay_ring_testXXXXXX";
+  if (mkdtemp(dir) == nullptr) {
+    printf("mkdtemp failed\n");
+    return 1;
+  }
+  std::string const path = std::string(dir) + "/ring";
+  CheckReopen(path);
+  CheckCorruptBytes(path);
+  CheckCorruptHeader(path);
+  rmdir(dir);
+#else
+  printf("skip\n");
+#endif
+  return libwebsocket::TestResult();
+}
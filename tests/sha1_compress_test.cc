@@ -0,0 +1,214 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  sha1_compress_test.cc
+// @Version :  1.0
+// @Desc    :  None
+//
+// 逐一强制使用每种SHA-1实现, 与标量实现和标准测试向量比较.
+// 当前编译器或CPU不支持的实现输出skip后跳过.
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "sha1.h"
+#include "sha1_compress.h"
+#include "websocket.h"
+#include "test_util.h"
+
+
+using libwebsocket::HttpToken;
+using libwebsocket::kWebSocketAcceptKeyLength;
+using libwebsocket::NextRandom;
+using libwebsocket::TestKernel;
+
+
+namespace {
+
+struct KnownDigest {
+  std::string message;
+  unsigned digest[5];
+};
+
+// FIPS 180-1附录中的测试向量.
+std::vector<KnownDigest> const kKnownDigests = {
+  {"", {0xda39a3ee, 0x5e6b4b0d, 0x3255bfef, 0x95601890, 0xafd80709}},
+  {"abc", {0xa9993e36, 0x4706816a, 0xba3e2571, 0x7850c26c, 0x9cd0d89d}},
+  {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+   {0x84983e44, 0x1c3bd26e, 0xbaae4aa1, 0xf95129e5, 0xe54670f1}},
+  {std::string(1000000, 'a'),
+   {0x34aa973c, 0xd4c4daa4, 0xf61eeb2b, 0xdbad2731, 0x6534016f}},
+};
+
+// RFC 6455 1.3中的示例.
+char const kRfcKey[] = "dGhlIHNhbXBsZSBub25jZQ==";
+char const kRfcAccept[] = "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=";
+
+constexpr size_t kLaneBlocks = 3;
+
+std::vector<TestKernel> const kKernels = {
+  {libwebsocket::kSha1KernelScalar, "scalar"},
+  {libwebsocket::kSha1KernelVector4, "vector x4"},
+  {libwebsocket::kSha1KernelAvx2, "avx2 x8"},
+  {libwebsocket::kSha1KernelShaNi, "sha-ni"},
+  {libwebsocket::kSha1KernelArmv8, "armv8 crypto"},
+};
+
+// 各实现的输入和标量实现的结果.
+struct Expected {
+  std::vector<std::string> messages;
+  std::vector<std::vector<unsigned>> digests;
+  uint8_t lane_blocks[libwebsocket::kMaxSha1Lanes][kLaneBlocks*64];
+  uint32_t lane_states[libwebsocket::kMaxSha1Lanes][5];
+  // 第count-1项为count路各压缩1至kLaneBlocks个块的结果.
+  uint32_t lane_results[libwebsocket::kMaxSha1Lanes][kLaneBlocks]
+                       [libwebsocket::kMaxSha1Lanes][5];
+  std::vector<std::string> keys;
+  std::vector<std::string> accepts;
+};
+
+std::vector<unsigned> Digest(std::string const& message) {
+  libwebsocket::SHA1 sha1;
+  // 分段输入, 覆盖跨块缓存的路径.
+  size_t const step = 1000;
+  for (size_t i = 0; i < message.size(); i += step) {
+    size_t n = message.size() - i < step ? message.size() - i : step;
+    sha1.Input(message.data() + i, static_cast<unsigned>(n));
+  }
+  std::vector<unsigned> digest(5);
+  sha1.Result(digest.data());
+  return digest;
+}
+
+void CompressLanes(Expected const& input, size_t lanes, size_t count,
+                   uint32_t (*out)[5]) {
+  uint8_t const* blocks[libwebsocket::kMaxSha1Lanes];
+  for (size_t i = 0; i < lanes; ++i) {
+    memcpy(out[i], input.lane_states[i], sizeof(out[i]));
+    blocks[i] = input.lane_blocks[i];
+  }
+  libwebsocket::Sha1CompressLanes(out, blocks, lanes, count);
+}
+
+void BuildExpected(Expected* expected) {
+  uint32_t seed = 0x12345678;
+  // 长度覆盖填充跨块的各种情况.
+  for (size_t size = 0; size <= 300; ++size) {
+    std::string message(size, '\0');
+    for (auto& c : message) c = static_cast<char>(NextRandom(&seed));
+    expected->messages.push_back(message);
+  }
+  for (size_t size : {4096 + 17, 65536 + 3}) {
+    std::string message(size, '\0');
+    for (auto& c : message) c = static_cast<char>(NextRandom(&seed));
+    expected->messages.push_back(message);
+  }
+  for (auto const& message : expected->messages) {
+    expected->digests.push_back(Digest(message));
+  }
+  for (size_t i = 0; i < libwebsocket::kMaxSha1Lanes; ++i) {
+    for (auto& byte : expected->lane_blocks[i]) {
+      byte = static_cast<uint8_t>(NextRandom(&seed));
+    }
+    for (auto& word : expected->lane_states[i]) word = NextRandom(&seed);
+  }
+  for (size_t lanes = 1; lanes <= libwebsocket::kMaxSha1Lanes; ++lanes) {
+    for (size_t count = 1; count <= kLaneBlocks; ++count) {
+      CompressLanes(*expected, lanes, count,
+                    expected->lane_results[lanes - 1][count - 1]);
+    }
+  }
+  static char const kAlphabet[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  expected->keys.push_back(kRfcKey);
+  for (int i = 0; i < 40; ++i) {
+    std::string key(22, 'A');
+    for (auto& c : key) c = kAlphabet[NextRandom(&seed) % 64];
+    expected->keys.push_back(key + "==");
+  }
+  for (auto const& key : expected->keys) {
+    char accept[kWebSocketAcceptKeyLength];
+    libwebsocket::WebSocketAcceptKey(key.data(), key.size(), accept);
+    expected->accepts.emplace_back(accept, kWebSocketAcceptKeyLength);
+  }
+}
+
+void CheckKernel(char const* name, Expected const& expected) {
+  for (auto const& known : kKnownDigests) {
+    std::vector<unsigned> digest = Digest(known.message);
+    TEST_CHECK(memcmp(digest.data(), known.digest, sizeof(known.digest)) == 0,
+               "%s: known digest, message size %zu", name,
+               known.message.size());
+  }
+  for (size_t i = 0; i < expected.messages.size(); ++i) {
+    TEST_CHECK(Digest(expected.messages[i]) == expected.digests[i],
+               "%s: message size %zu", name, expected.messages[i].size());
+  }
+  for (size_t lanes = 1; lanes <= libwebsocket::kMaxSha1Lanes; ++lanes) {
+    for (size_t count = 1; count <= kLaneBlocks; ++count) {
+      uint32_t states[libwebsocket::kMaxSha1Lanes][5];
+      CompressLanes(expected, lanes, count, states);
+      TEST_CHECK(memcmp(states, expected.lane_results[lanes - 1][count - 1],
+                        lanes*sizeof(states[0])) == 0,
+                 "%s: %zu lanes, %zu blocks", name, lanes, count);
+    }
+  }
+  char accept[kWebSocketAcceptKeyLength];
+  libwebsocket::WebSocketAcceptKey(kRfcKey, strlen(kRfcKey), accept);
+  TEST_CHECK(memcmp(accept, kRfcAccept, kWebSocketAcceptKeyLength) == 0,
+             "%s: RFC 6455 accept key", name);
+  // 批量计算覆盖不足一组和多组的情况.
+  std::vector<HttpToken> tokens;
+  for (auto const& key : expected.keys) {
+    tokens.push_back(HttpToken {key.data(), key.size()});
+  }
+  for (size_t count = 1; count <= tokens.size(); ++count) {
+    std::vector<char> accepts(count*kWebSocketAcceptKeyLength);
+    libwebsocket::WebSocketAcceptKeys(tokens.data(), count, accepts.data());
+    for (size_t i = 0; i < count; ++i) {
+      TEST_CHECK(expected.accepts[i] ==
+                 std::string(accepts.data() + i*kWebSocketAcceptKeyLength,
+                             kWebSocketAcceptKeyLength),
+                 "%s: batch of %zu accept keys, key %zu", name, count, i);
+    }
+  }
+}
+
+}  // namespace
+
+int main(void) {
+  printf("auto: %s / %s\n", libwebsocket::Sha1Implementation(),
+         libwebsocket::Sha1LanesImplementation());
+  // 以标量实现的结果作为参照.
+  libwebsocket::Sha1ForceKernel(libwebsocket::kSha1KernelScalar);
+  Expected expected;
+  BuildExpected(&expected);
+  libwebsocket::ForEachKernel(libwebsocket::Sha1ForceKernel, kKernels,
+                              [&expected] (char const* name) {
+    printf("  %s / %s\n", libwebsocket::Sha1Implementation(),
+           libwebsocket::Sha1LanesImplementation());
+    CheckKernel(name, expected);
+  });
+  return libwebsocket::TestResult();
+}
@@ -0,0 +1,100 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  test_util.h
+// @Version :  1.0
+// @Desc    :  None
+
+#ifndef WEBSOCKET_TESTS_TEST_UTIL_H_
+#define WEBSOCKET_TESTS_TEST_UTIL_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+
+namespace libwebsocket {
+
+// 失败的检查数, 测试程序以此作为退出码.
+inline int& TestFailures(void) {
+  static int failures = 0;
+  return failures;
+}
+
+// 输出失败的检查数, 返回测试程序的退出码.
+inline int TestResult(void) {
+  printf("%d failures\n", TestFailures());
+  return TestFailures() == 0 ? 0 : 1;
+}
+
+// 固定种子的伪随机数, 保证每次运行的输入相同.
+inline uint32_t NextRandom(uint32_t* seed) {
+  *seed ^= *seed << 13;
+  *seed ^= *seed >> 17;
+  *seed ^= *seed << 5;
+  return *seed;
+}
+
+// 可强制使用的一种实现, id为各模块ForceKernel函数的参数.
+struct TestKernel {
+  int id;
+  char const* name;
+};
+
+}  // namespace libwebsocket
+
+// 检查条件, 失败时输出位置和附加信息并计数, 不中断测试.
+#define TEST_CHECK(condition, ...)                                      \
+  do {                                                                  \
+    if (!(condition)) {                                                 \
+      printf("%s[%d]: CHECK(%s) failed: ", __FILE__, __LINE__,          \
+             #condition);                                               \
+      printf(__VA_ARGS__);                                              \
+      printf("\n");                                                     \
+      ++libwebsocket::TestFailures();                                   \
+    }                                                                   \
+  } while (0)
+
+namespace libwebsocket {
+
+// 依次以force强制使用kernels中的每种实现并调用body(name), 编译器或CPU
+// 不支持的实现输出skip后跳过. 第一种实现作为参照, 必须可用. 结束后以0
+// 恢复按CPU特性选择.
+template <typename Force, typename Body>
+void ForEachKernel(Force const& force, std::vector<TestKernel> const& kernels,
+                   Body const& body) {
+  for (size_t i = 0; i < kernels.size(); ++i) {
+    if (!force(kernels[i].id)) {
+      TEST_CHECK(i > 0, "%s must always be available", kernels[i].name);
+      printf("%s: skip\n", kernels[i].name);
+      continue;
+    }
+    printf("%s\n", kernels[i].name);
+    body(kernels[i].name);
+  }
+  force(0);
+}
+
+}  // namespace libwebsocket
+
+#endif  // WEBSOCKET_TESTS_TEST_UTIL_H_
@@ -0,0 +1,263 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  utf8_validator_test.cc
+// @Version :  1.0
+// @Desc    :  None
+//
+// 分别强制使用逐字节和AVX2实现, 检查超长编码, 代理区, 大于U+10FFFF的码点
+// 和不完整的字符. 每个序列放在32字节块边界和64字节最小长度附近的各位置,
+// 并在序列附近和块边界处拆分后增量校验.
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "utf8_validator.h"
+#include "test_util.h"
+
+
+using libwebsocket::NextRandom;
+using libwebsocket::TestKernel;
+
+
+namespace {
+
+struct Sequence {
+  std::string bytes;
+  bool valid;
+};
+
+std::vector<Sequence> const kSequences = {
+  // 各长度的边界码点.
+  {"\x7F", true},
+  {"\xC2\x80", true},
+  {"\xDF\xBF", true},
+  {"\xE0\xA0\x80", true},
+  {"\xE1\x80\x80", true},
+  {"\xED\x9F\xBF", true},  // U+D7FF.
+  {"\xEE\x80\x80", true},  // U+E000.
+  {"\xEF\xBF\xBF", true},
+  {"\xF0\x90\x80\x80", true},
+  {"\xF3\xBF\xBF\xBF", true},
+  {"\xF4\x8F\xBF\xBF", true},  // U+10FFFF.
+  // 超长编码.
+  {"\xC0\x80", false},
+  {"\xC0\xAF", false},
+  {"\xC1\xBF", false},
+  {"\xE0\x80\x80", false},
+  {"\xE0\x80\xAF", false},
+  {"\xE0\x9F\xBF", false},
+  {"\xF0\x80\x80\x80", false},
+  {"\xF0\x80\x80\xAF", false},
+  {"\xF0\x8F\xBF\xBF", false},
+  // 代理区.
+  {"\xED\xA0\x80", false},
+  {"\xED\xAD\xBF", false},
+  {"\xED\xB0\x80", false},
+  {"\xED\xBF\xBF", false},
+  {"\xED\xA0\x80\xED\xB0\x80", false},
+  // 大于U+10FFFF.
+  {"\xF4\x90\x80\x80", false},
+  {"\xF4\xBF\xBF\xBF", false},
+  {"\xF5\x80\x80\x80", false},
+  {"\xF7\xBF\xBF\xBF", false},
+  {"\xF8\x88\x80\x80\x80", false},
+  {"\xFC\x84\x80\x80\x80\x80", false},
+  {"\xFE", false},
+  {"\xFF", false},
+  // 不完整的字符.
+  {"\xC2", false},
+  {"\xE0\xA0", false},
+  {"\xEF\xBF", false},
+  {"\xF0\x90\x80", false},
+  {"\xF4\x8F\xBF", false},
+  // 多余或缺少的后续字节.
+  {"\x80", false},
+  {"\xBF", false},
+  {"\xC2\x80\x80", false},
+  {"\xE1\x80\x80\x80", false},
+  {"\xC2\x41", false},
+  {"\xE1\x80\x41", false},
+  {"\xF1\x80\x80\x41", false},
+  {"\xF1\x80\x80\xC0", false},
+};
+
+// 填充用的合法字符, 使序列的起始位置不总是对齐.
+std::vector<std::string> const kFillers = {
+  "a",
+  "a\xC3\xA9\xE4\xB8\xAD\xF0\x9F\x98\x80",
+};
+
+std::vector<TestKernel> const kKernels = {
+  {libwebsocket::kUtf8KernelScalar, "scalar"},
+  {libwebsocket::kUtf8KernelAvx2, "avx2"},
+};
+
+// 先解出码点再检查范围的参考实现.
+bool ReferenceValid(std::string const& text) {
+  size_t i = 0;
+  while (i < text.size()) {
+    uint8_t const lead = static_cast<uint8_t>(text[i]);
+    size_t length = 1;
+    uint32_t code = lead;
+    uint32_t min = 0;
+    if (lead >= 0x80) {
+      if ((lead & 0xE0) == 0xC0) {
+        length = 2, code = lead & 0x1F, min = 0x80;
+      } else if ((lead & 0xF0) == 0xE0) {
+        length = 3, code = lead & 0x0F, min = 0x800;
+      } else if ((lead & 0xF8) == 0xF0) {
+        length = 4, code = lead & 0x07, min = 0x10000;
+      } else {
+        return false;
+      }
+    }
+    if (text.size() - i < length) return false;
+    for (size_t k = 1; k < length; ++k) {
+      uint8_t const byte = static_cast<uint8_t>(text[i+k]);
+      if ((byte & 0xC0) != 0x80) return false;
+      code = (code << 6) | (byte & 0x3F);
+    }
+    if (code < min || code > 0x10FFFF) return false;
+    if (code >= 0xD800 && code <= 0xDFFF) return false;
+    i += length;
+  }
+  return true;
+}
+
+// 由完整的填充字符组成的不少于size字节的数据.
+std::string Fill(std::string const& filler, size_t size) {
+  std::string text;
+  while (text.size() < size) text += filler;
+  return text;
+}
+
+// 按给定位置拆分后增量校验.
+bool FeedSplit(std::string const& text, std::vector<size_t> const& cuts) {
+  libwebsocket::Utf8Validator validator;
+  size_t begin = 0;
+  for (size_t cut : cuts) {
+    if (!validator.Feed(text.data() + begin, cut - begin)) return false;
+    begin = cut;
+  }
+  if (!validator.Feed(text.data() + begin, text.size() - begin)) return false;
+  return validator.Finish();
+}
+
+void CheckText(char const* name, std::string const& text, bool valid,
+               size_t begin, size_t end) {
+  TEST_CHECK(libwebsocket::IsValidUtf8(text.data(), text.size()) == valid,
+             "%s: size %zu, sequence at %zu", name, text.size(), begin);
+  // 序列附近的每个位置.
+  size_t const first = begin > 4 ? begin - 4 : 0;
+  size_t const last = end + 4 < text.size() ? end + 4 : text.size();
+  for (size_t cut = first; cut <= last; ++cut) {
+    TEST_CHECK(FeedSplit(text, {cut}) == valid,
+               "%s: size %zu, sequence at %zu, split at %zu", name,
+               text.size(), begin, cut);
+  }
+  // 32字节块边界两侧, 拆成三段.
+  for (size_t block = 32; block < text.size(); block += 32) {
+    for (size_t cut = block - 1; cut <= block + 1; ++cut) {
+      if (cut > text.size()) continue;
+      TEST_CHECK(FeedSplit(text, {cut/2, cut}) == valid,
+                 "%s: size %zu, sequence at %zu, split at %zu and %zu", name,
+                 text.size(), begin, cut/2, cut);
+    }
+  }
+}
+
+void CheckSequences(char const* name) {
+  for (size_t i = 0; i < kSequences.size(); ++i) {
+    auto const& sequence = kSequences[i];
+    TEST_CHECK(ReferenceValid(sequence.bytes) == sequence.valid,
+               "reference: sequence %zu", i);
+    for (auto const& filler : kFillers) {
+      for (size_t offset = 0; offset <= 100; ++offset) {
+        std::string const prefix = Fill(filler, offset);
+        for (size_t suffix : {0, 1, 31, 70}) {
+          std::string const text = prefix + sequence.bytes +
+                                   Fill(filler, suffix);
+          CheckText(name, text, sequence.valid, prefix.size(),
+                    prefix.size() + sequence.bytes.size());
+        }
+      }
+    }
+  }
+}
+
+// 随机组成的合法字符和随机修改一个字节后的数据, 与参考实现比较.
+void CheckRandom(char const* name) {
+  static uint32_t const kCodeRanges[][2] = {
+    {0x20, 0x7F}, {0x80, 0x7FF}, {0x800, 0xD7FF}, {0xE000, 0xFFFF},
+    {0x10000, 0x10FFFF},
+  };
+  uint32_t seed = 0x9E3779B9;
+  for (int round = 0; round < 3000; ++round) {
+    std::string text;
+    size_t const size = NextRandom(&seed) % 300;
+    while (text.size() < size) {
+      auto const& range = kCodeRanges[NextRandom(&seed) % 5];
+      uint32_t code = range[0] + NextRandom(&seed) % (range[1] - range[0] + 1);
+      if (code < 0x80) {
+        text.push_back(static_cast<char>(code));
+      } else if (code < 0x800) {
+        text.push_back(static_cast<char>(0xC0 | (code >> 6)));
+        text.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+      } else if (code < 0x10000) {
+        text.push_back(static_cast<char>(0xE0 | (code >> 12)));
+        text.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+        text.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+      } else {
+        text.push_back(static_cast<char>(0xF0 | (code >> 18)));
+        text.push_back(static_cast<char>(0x80 | ((code >> 12) & 0x3F)));
+        text.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+        text.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+      }
+    }
+    TEST_CHECK(libwebsocket::IsValidUtf8(text.data(), text.size()),
+               "%s: random valid text, round %d", name, round);
+    if (text.empty()) continue;
+    size_t const position = NextRandom(&seed) % text.size();
+    text[position] = static_cast<char>(NextRandom(&seed));
+    bool const valid = ReferenceValid(text);
+    TEST_CHECK(libwebsocket::IsValidUtf8(text.data(), text.size()) == valid,
+               "%s: random text, round %d, byte changed at %zu", name, round,
+               position);
+    TEST_CHECK(FeedSplit(text, {position/2, position}) == valid,
+               "%s: random text, round %d, split at %zu", name, round,
+               position);
+  }
+}
+
+}  // namespace
+
+int main(void) {
+  libwebsocket::ForEachKernel(libwebsocket::Utf8ForceKernel, kKernels,
+                              [] (char const* name) {
+    CheckSequences(name);
+    CheckRandom(name);
+  });
+  return libwebsocket::TestResult();
+}
@@ -33,6 +33,11 @@
 #include <stdint.h>
 #include <string.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WEBSOCKET_BASE64_AVX2 1
+#include <immintrin.h>
+#endif
+
 
 namespace libwebsocket {
 
@@ -41,64 +46,281 @@ namespace {
 constexpr char kBase64CodingTable[] =
   "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
-inline int GetIndexByChar(char const& ch) {
-  for (int i = 0; i < 64; ++i) {
-    if (ch == kBase64CodingTable[i]) {
-      return i;
+// 字符到6位值的映射, 非法字符为0xFF, 合并前检查最高位.
+constexpr uint8_t kBase64DecodingTable[256] = {
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF,   62, 0xFF, 0xFF, 0xFF,   63,
+    52,   53,   54,   55,   56,   57,   58,   59,
+    60,   61, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF,    0,    1,    2,    3,    4,    5,    6,
+     7,    8,    9,   10,   11,   12,   13,   14,
+    15,   16,   17,   18,   19,   20,   21,   22,
+    23,   24,   25, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF,   26,   27,   28,   29,   30,   31,   32,
+    33,   34,   35,   36,   37,   38,   39,   40,
+    41,   42,   43,   44,   45,   46,   47,   48,
+    49,   50,   51, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+// 使用AVX2的最小输入长度, 更短的数据直接使用查表实现.
+constexpr size_t kAvx2MinLength = 64;
+
+// 每次编码3个字节, 不处理结尾不足3字节的部分, 返回已处理的字节数.
+size_t EncodeScalar(uint8_t const* src, size_t size, char* out) {
+  size_t i = 0;
+  for (; i + 3 <= size; i += 3) {
+    uint32_t group = (src[i] << 16) | (src[i+1] << 8) | src[i+2];
+    *out++ = kBase64CodingTable[(group >> 18) & 0x3F];
+    *out++ = kBase64CodingTable[(group >> 12) & 0x3F];
+    *out++ = kBase64CodingTable[(group >> 6) & 0x3F];
+    *out++ = kBase64CodingTable[group & 0x3F];
+  }
+  return i;
+}
+
+// 每次解码4个字符, 不含填充字符, 返回已处理的字符数, 遇到非法字符返回-1.
+int64_t DecodeScalar(char const* src, size_t size, uint8_t* out) {
+  auto data = reinterpret_cast<uint8_t const*>(src);
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    uint32_t const a = kBase64DecodingTable[data[i]];
+    uint32_t const b = kBase64DecodingTable[data[i+1]];
+    uint32_t const c = kBase64DecodingTable[data[i+2]];
+    uint32_t const d = kBase64DecodingTable[data[i+3]];
+    // 任一字符非法时最高位为1.
+    if ((a | b | c | d) & 0x80) return -1;
+    uint32_t const group = (a << 18) | (b << 12) | (c << 6) | d;
+    *out++ = static_cast<uint8_t>(group >> 16);
+    *out++ = static_cast<uint8_t>(group >> 8);
+    *out++ = static_cast<uint8_t>(group);
+  }
+  return i;
+}
+
+#if defined(WEBSOCKET_BASE64_AVX2)
+// 每次将24字节编码为32个字符, 输入须至少有28字节可读.
+// 先把每3个字节扩展到一个32位字中, 再用乘法把4个6位值移到各自的字节,
+// 最后按值所在区间查表得到与字符的差值.
+__attribute__((target("avx2")))
+size_t EncodeAvx2(uint8_t const* src, size_t size, char* out) {
+  __m256i const kShuffle = _mm256_setr_epi8(
+      1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+      1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+  __m256i const kOffsets = _mm256_setr_epi8(
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+      '/' - 63, 'A', 0, 0,
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+      '/' - 63, 'A', 0, 0);
+  size_t i = 0;
+  for (; i + 28 <= size; i += 24, out += 32) {
+    __m128i low = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src + i));
+    __m128i high = _mm_loadu_si128(
+        reinterpret_cast<__m128i const*>(src + i + 12));
+    __m256i input = _mm256_shuffle_epi8(
+        _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1),
+        kShuffle);
+    __m256i t0 = _mm256_mulhi_epu16(
+        _mm256_and_si256(input, _mm256_set1_epi32(0x0FC0FC00)),
+        _mm256_set1_epi32(0x04000040));
+    __m256i t1 = _mm256_mullo_epi16(
+        _mm256_and_si256(input, _mm256_set1_epi32(0x003F03F0)),
+        _mm256_set1_epi32(0x01000010));
+    __m256i indices = _mm256_or_si256(t0, t1);
+    // 0..25 -> 13, 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12.
+    __m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    __m256i upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+    range = _mm256_or_si256(range,
+                            _mm256_and_si256(upper, _mm256_set1_epi8(13)));
+    __m256i result = _mm256_add_epi8(_mm256_shuffle_epi8(kOffsets, range),
+                                     indices);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), result);
+  }
+  return i;
+}
+
+// 每次将32个字符解码为24字节, 输出须至少有32字节可写.
+// 以字符的高4位查差值表, 以低4位和高4位共同查合法性位图.
+__attribute__((target("avx2")))
+int64_t DecodeAvx2(char const* src, size_t size, uint8_t* out) {
+  __m256i const kShifts = _mm256_setr_epi8(
+      0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+      0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  __m256i const kValidMasks = _mm256_setr_epi8(
+      '\xA8', '\xF8', '\xF8', '\xF8', '\xF8', '\xF8', '\xF8', '\xF8',
+      '\xF8', '\xF8', '\xF0', 0x54, 0x50, 0x50, 0x50, 0x54,
+      '\xA8', '\xF8', '\xF8', '\xF8', '\xF8', '\xF8', '\xF8', '\xF8',
+      '\xF8', '\xF8', '\xF0', 0x54, 0x50, 0x50, 0x50, 0x54);
+  __m256i const kHighBits = _mm256_setr_epi8(
+      0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, '\x80',
+      0, 0, 0, 0, 0, 0, 0, 0,
+      0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, '\x80',
+      0, 0, 0, 0, 0, 0, 0, 0);
+  __m256i const kPack = _mm256_setr_epi8(
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  __m256i const kPermute = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32, out += 24) {
+    __m256i input = _mm256_loadu_si256(
+        reinterpret_cast<__m256i const*>(src + i));
+    __m256i high = _mm256_and_si256(_mm256_srli_epi32(input, 4),
+                                    _mm256_set1_epi8(0x0F));
+    __m256i low = _mm256_and_si256(input, _mm256_set1_epi8(0x0F));
+    __m256i valid = _mm256_and_si256(_mm256_shuffle_epi8(kValidMasks, low),
+                                     _mm256_shuffle_epi8(kHighBits, high));
+    if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+            valid, _mm256_setzero_si256())) != 0) {
+      return -1;
     }
+    // '/'与'+'的高4位相同, 单独处理.
+    __m256i shift = _mm256_blendv_epi8(
+        _mm256_shuffle_epi8(kShifts, high), _mm256_set1_epi8(16),
+        _mm256_cmpeq_epi8(input, _mm256_set1_epi8('/')));
+    __m256i values = _mm256_add_epi8(input, shift);
+    __m256i merged = _mm256_madd_epi16(
+        _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140)),
+        _mm256_set1_epi32(0x00011000));
+    merged = _mm256_permutevar8x32_epi32(
+        _mm256_shuffle_epi8(merged, kPack), kPermute);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), merged);
   }
-  return -1;
+  return i;
 }
 
-inline char GetCharByIndex(int const& index) {
-  return kBase64CodingTable[index%64];
+bool CpuSupportsAvx2(void) {
+  static bool const supported = __builtin_cpu_supports("avx2");
+  return supported;
 }
 
+// 是否使用AVX2实现, 默认按CPU特性选择, 可由Base64ForceKernel修改.
+bool& UseAvx2(void) {
+  static bool use = CpuSupportsAvx2();
+  return use;
+}
+#endif  // WEBSOCKET_BASE64_AVX2
+
 }  // namespace
 
 
 int Base64Encode(std::vector<char> const& src, std::string* out) {
   if (src.empty() || out == nullptr) return -1;
-  int const& len = src.size();
-  char temp[3] = {0};
-  int i = 0;
-  int fill_count = 0;
-  if (len%3 != 0) fill_count = 3-len%3;
-  out->clear();
-  while (i < len) {
-    memcpy(temp, src.data()+i, len-i >= 3 ? 3 : len-i);
-    out->push_back(GetCharByIndex((temp[0]&0xFC)>>2));
-    out->push_back(GetCharByIndex(((temp[0]&0x3)<<4)|((temp[1]&0xF0)>>4)));
-    if (temp[1] == 0) break;
-    out->push_back(GetCharByIndex(((temp[1]&0xF)<<2)|((temp[2]&0xC0)>>6)));
-    if (temp[2] == 0) break;
-    out->push_back(GetCharByIndex(temp[2]&0x3F));
-    i += 3;
-    memset(temp, 0x0, 3);
-  }
-  for (int i = 0; i < fill_count; ++i) out->push_back('=');
+  out->resize(Base64EncodedLength(src.size()));
+  Base64Encode(src.data(), src.size(), &(*out)[0]);
   return 0;
 }
 
 int Base64Decode(std::string const& src, std::vector<char>* out) {
-  if (src.empty() || src.size()%4 != 0|| out == nullptr) return -1;
-  char temp[4] = {0};
-  int i = 0;
-  out->clear();
-  int const& length = src.size();
-  while (i < length) {
-    memcpy(temp, src.data()+i, 4);
-    out->push_back(((GetIndexByChar(temp[0])&0x3F)<<2)|
-                   ((GetIndexByChar(temp[1])&0x3F)>>4));
-    if (temp[2] == '=') break;
-    out->push_back(((GetIndexByChar(temp[1])&0xF)<<4)|
-                   ((GetIndexByChar(temp[2])&0x3F)>>2));
-    if (temp[3] == '=') break;
-    out->push_back(((GetIndexByChar(temp[2])&0x3)<<6)|
-                   ((GetIndexByChar(temp[3])&0x3F)));
-    i += 4;
+  if (src.empty() || src.size()%4 != 0 || out == nullptr) return -1;
+  out->resize(src.size()/4*3);
+  int64_t length = Base64Decode(src.data(), src.size(), out->data());
+  if (length < 0) {
+    out->clear();
+    return -1;
   }
+  out->resize(length);
   return 0;
 }
 
+size_t Base64Encode(char const* src, size_t size, char* out) {
+  auto data = reinterpret_cast<uint8_t const*>(src);
+  size_t i = 0;
+  char* begin = out;
+#if defined(WEBSOCKET_BASE64_AVX2)
+  if (size >= kAvx2MinLength && UseAvx2()) {
+    i = EncodeAvx2(data, size, out);
+    out += i/3*4;
+  }
+#endif
+  size_t done = EncodeScalar(data + i, size - i, out);
+  out += done/3*4;
+  i += done;
+  if (i < size) {
+    uint32_t group = data[i] << 16;
+    if (i + 1 < size) group |= data[i+1] << 8;
+    *out++ = kBase64CodingTable[(group >> 18) & 0x3F];
+    *out++ = kBase64CodingTable[(group >> 12) & 0x3F];
+    *out++ = i + 1 < size ? kBase64CodingTable[(group >> 6) & 0x3F] : '=';
+    *out++ = '=';
+  }
+  return out - begin;
+}
+
+int64_t Base64Decode(char const* src, size_t size, char* out) {
+  if (src == nullptr || out == nullptr || size%4 != 0) return -1;
+  if (size == 0) return 0;
+  // 最后4个字符可能含有填充, 单独处理.
+  size_t body = size - 4;
+  auto output = reinterpret_cast<uint8_t*>(out);
+  size_t i = 0;
+#if defined(WEBSOCKET_BASE64_AVX2)
+  // 每次写出32字节, 保证之后至少还有16个字符(不少于10字节输出).
+  if (body >= kAvx2MinLength && UseAvx2()) {
+    int64_t done = DecodeAvx2(src, body - 16, output);
+    if (done < 0) return -1;
+    i = done;
+    output += i/4*3;
+  }
+#endif
+  int64_t done = DecodeScalar(src + i, body - i, output);
+  if (done < 0) return -1;
+  output += done/4*3;
+  auto tail = reinterpret_cast<uint8_t const*>(src + body);
+  int padding = (tail[3] == '=') ? (tail[2] == '=' ? 2 : 1) : 0;
+  uint32_t const a = kBase64DecodingTable[tail[0]];
+  uint32_t const b = kBase64DecodingTable[tail[1]];
+  uint32_t const c = padding < 2 ? kBase64DecodingTable[tail[2]] : 0;
+  uint32_t const d = padding < 1 ? kBase64DecodingTable[tail[3]] : 0;
+  if ((a | b | c | d) & 0x80) return -1;
+  uint32_t const group = (a << 18) | (b << 12) | (c << 6) | d;
+  *output++ = static_cast<uint8_t>(group >> 16);
+  if (padding < 2) *output++ = static_cast<uint8_t>(group >> 8);
+  if (padding < 1) *output++ = static_cast<uint8_t>(group);
+  return output - reinterpret_cast<uint8_t*>(out);
+}
+
+bool Base64ForceKernel(int const& kernel) {
+  switch (kernel) {
+    case kBase64KernelAuto:
+#if defined(WEBSOCKET_BASE64_AVX2)
+      UseAvx2() = CpuSupportsAvx2();
+#endif
+      return true;
+    case kBase64KernelScalar:
+#if defined(WEBSOCKET_BASE64_AVX2)
+      UseAvx2() = false;
+#endif
+      return true;
+#if defined(WEBSOCKET_BASE64_AVX2)
+    case kBase64KernelAvx2:
+      if (!CpuSupportsAvx2()) return false;
+      UseAvx2() = true;
+      return true;
+#endif
+    default:
+      return false;
+  }
+}
+
 }  // namespace libwebsocket
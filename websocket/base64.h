@@ -30,14 +30,38 @@
 #ifndef WEBSOCKET_BASE64_H_
 #define WEBSOCKET_BASE64_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include <string>
 #include <vector>
 
 
 namespace libwebsocket {
 
+// 编码后的长度, 含填充字符.
+inline size_t Base64EncodedLength(size_t size) { return (size + 2)/3*4; }
+
 int Base64Encode(std::vector<char> const& src, std::string* out);
+// 解码, 含非法字符或长度不是4的倍数时返回-1.
 int Base64Decode(std::string const& src, std::vector<char> *out);
+// 编码到调用方提供的缓冲区, 缓冲区长度至少为Base64EncodedLength(size),
+// 不追加结束符, 返回写入的字符数. 输入较长且CPU支持AVX2时使用向量实现.
+size_t Base64Encode(char const* src, size_t size, char* out);
+// 解码到调用方提供的缓冲区, 缓冲区长度至少为size/4*3,
+// 返回写入的字节数, 含非法字符或长度不是4的倍数时返回-1.
+int64_t Base64Decode(char const* src, size_t size, char* out);
+
+// 可强制使用的实现.
+enum Base64Kernel {
+  kBase64KernelAuto = 0,  // 按CPU特性选择.
+  kBase64KernelScalar,  // 查表实现.
+  kBase64KernelAvx2,  // AVX2, 较短的输入和结尾部分仍使用查表实现.
+};
+
+// 强制使用指定实现, 用于测试各实现的结果是否一致. 编译器或CPU不支持时
+// 返回false, 当前实现不变. 不可与其它线程中的编解码同时调用.
+bool Base64ForceKernel(int const& kernel);
 
 }  // namespace libwebsocket
 
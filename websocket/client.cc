@@ -8,12 +8,14 @@
 
 #include "client.h"
 
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #if defined(__linux__)
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <fcntl.h>
+#include <poll.h>
 #endif
 
 #include <chrono>
@@ -24,9 +26,11 @@
 #include <thread>  // NOLINT.
 #include <vector>
 
+#include "client_event_loop.h"
+#include "frame_codec.h"
 #include "websocket.h"
 #include "base64.h"
-#include "sha1.h"
+#include "fast_random.h"
 
 
 namespace libwebsocket {
@@ -34,29 +38,17 @@ namespace libwebsocket {
 namespace {
 
 constexpr int kMaxBufferLength = 4096;
+constexpr int kMaxPollTimeout = 1000;  // 无定时器时poll的最长等待时间.
+constexpr size_t kMaxSendScratchSize = 1 << 20;  // 发送暂存区保留的最大容量.
 
-// 生成一条随机字符串.
-std::string GetRandomString(int const& length) {
-  std::string result;
-  for (int i = 0; i < length; i++) {
-    srand(time(NULL));
-    int flag = rand() % 3;
-    switch (flag) {
-      case 0:
-        result.push_back(static_cast<char>('A' + rand() % 26));
-        break;
-      case 1:
-        result.push_back(static_cast<char>('a' + rand() % 26));
-        break;
-      case 2:
-        result.push_back(static_cast<char>('0' + rand() % 10));
-        break;
-      default:
-        result.push_back('x');
-        break;
-    }
+// 回收线程, 在线程自身中调用时只能分离.
+void JoinThread(std::thread* thread) {
+  if (!thread->joinable()) return;
+  if (thread->get_id() == std::this_thread::get_id()) {
+    thread->detach();
+  } else {
+    thread->join();
   }
-  return result;
 }
 
 }  // namespace
@@ -65,12 +57,47 @@ std::string GetRandomString(int const& length) {
 void WebSocketClient::Init(void) {
   callback_ = [] (Socket const&, char const*, int const&) { return; };
   deep_callback_ = [] (Socket const&, char const*, int const&) { return; };
+  close_callback_ = [] (Socket const&, int const&) { return; };
+  state_callback_ = [] (int const&) { return; };
+  reconnect_options_ = ReconnectOptions {};
+  batch_options_ = BatchOptions {};
+  batch_deadline_us_.store(0);
+  stop_requested_.store(false);
+  reconnect_armed_ = false;
+  reconnect_attempts_.store(0);
+  reconnect_timer_.store(0);
+  resume_enabled_ = false;
+  resume_callback_ = [] (bool const&) { return; };
+  session_id_.clear();
+  last_sequence_.store(0);
+  sequenced_ = false;
   is_connected_.store(false);
   service_is_running_.store(false);
+  message_length_ = 0;
+  fragmented_ = false;
+  max_frame_size_ = kDefaultMaxFrameSize;
+  max_message_size_ = kDefaultMaxMessageSize;
+  validate_utf8_ = false;
+  fragment_size_ = kDefaultFragmentSize;
+  deflate_options_ = DeflateOptions {};
+  ping_interval_ms_ = 0;
+  rtt_stats_ = RttStats {};
+  connect_timeout_ms_ = kDefaultConnectTimeout;
+  handshake_timeout_ms_ = kDefaultHandshakeTimeout;
+  idle_timeout_ms_ = 0;
+  handshake_timer_ = 0;
+  idle_timer_ = 0;
+  ping_timer_ = 0;
+  deflate_timer_ = 0;
+  close_timeout_ms_ = kDefaultCloseTimeout;
+  closing_.store(false);
+  peer_closed_.store(false);
+  close_code_.store(0);
+  close_timer_.store(0);
 }
 
-// 与远程服务器建立TCP连接, 并设置socket为非阻塞模式.
-int WebSocketClient::ConnectRemote(void) {
+// 创建非阻塞套接字并向远程服务器发起TCP连接.
+int WebSocketClient::OpenSocket(void) {
   struct sockaddr_in addr;
   memset(&addr, 0, sizeof(addr));
   addr.sin_family = AF_INET;
@@ -82,9 +109,9 @@ int WebSocketClient::ConnectRemote(void) {
     printf("%s[%d]: Create socket failed!!!\n", __FUNCTION__, __LINE__);
     return -1;
   }
-  struct timeval timeout = {0, 500000};
-  setsockopt(socket_, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
-  setsockopt(socket_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  // 设置非阻塞模式.
+  int flags = fcntl(socket_, F_GETFL, 0);
+  fcntl(socket_, F_SETFL, flags | O_NONBLOCK);
 #elif defined(_WIN32)
   WSADATA ws_data;
   if (WSAStartup(MAKEWORD(2,2), &ws_data) != 0) {
@@ -97,169 +124,885 @@ int WebSocketClient::ConnectRemote(void) {
     return -1;
   }
   addr.sin_addr.S_un.S_addr = inet_addr(server_ip_.c_str());
+  unsigned long ul = 1;
+  if (ioctlsocket(socket_, FIONBIO, (unsigned long *)&ul) == SOCKET_ERROR) {
+    printf("%s[%d]: Set socket nonblock failed!!!\n", __FUNCTION__, __LINE__);
+    Close(socket_);
+    WSACleanup();
+    return -1;
+  }
 #endif
   if (Connect(socket_, reinterpret_cast<struct sockaddr *>(&addr),
-              sizeof(addr)) == -1) {
+              sizeof(addr)) == 0) {
+    return 0;
+  }
+#if defined(__linux__)
+  if (errno == EINPROGRESS) return 1;
+#elif defined(_WIN32)
+  if (WSAGetLastError() == WSAEWOULDBLOCK) return 1;
+#endif
+  printf("%s[%d]: Connect to remote server failed!!!\n",
+         __FUNCTION__, __LINE__);
+  Close(socket_);
+  socket_ = -1;
+#if defined(_WIN32)
+  WSACleanup();
+#endif
+  return -1;
+}
+
+// 与远程服务器建立TCP连接, 套接字为非阻塞模式, 最多等待连接超时时间.
+int WebSocketClient::ConnectRemote(void) {
+  stop_requested_.store(false);
+  reconnect_armed_ = false;
+  reconnect_attempts_.store(0);
+  ChangeState(kClientConnecting);
+  int ret = OpenSocket();
+  if (ret < 0) return -1;
+  if (ret > 0 && WaitConnected(socket_, connect_timeout_ms_) != 0) {
     printf("%s[%d]: Connect to remote server failed!!!\n",
            __FUNCTION__, __LINE__);
     Close(socket_);
+    socket_ = -1;
 #if defined(_WIN32)
     WSACleanup();
 #endif
     return -1;
   }
-  // 设置非阻塞模式.
-#if defined(__linux__)
-  int flags = fcntl(socket_, F_GETFL, 0);
-  fcntl(socket_, F_SETFL, flags | O_NONBLOCK);
-#elif defined(_WIN32)
-  unsigned long ul = 1;
-  if (ioctlsocket(socket_, FIONBIO, (unsigned long *)&ul) == SOCKET_ERROR) {
-    printf("%s[%d]: Set socket nonblock failed!!!\n", __FUNCTION__, __LINE__);
+  is_connected_.store(true);
+  return 0;
+}
+
+int WebSocketClient::ConnectAsync(ClientEventLoop* loop,
+                                  ConnectCallback const& callback) {
+  if (loop == nullptr || !loop->is_running() || service_is_running_) {
+    return -1;
+  }
+  stop_requested_.store(false);
+  reconnect_armed_ = false;
+  reconnect_attempts_.store(0);
+  ChangeState(kClientConnecting);
+  connect_callback_ = callback;
+  if (BeginConnect(loop) < 0) {
+    connect_callback_ = nullptr;
+    return -1;
+  }
+  return 0;
+}
+
+// 发起非阻塞连接后交给事件循环, TCP连接完成后发送握手请求.
+int WebSocketClient::BeginConnect(ClientEventLoop* loop) {
+  JoinThread(&service_thread_);
+  int ret = OpenSocket();
+  if (ret < 0) return -1;
+  loop_ = loop;
+  timers_ = loop->Assign(this);
+  connect_result_ = kConnectFailed;
+  handshake_state_ = kConnecting;
+  send_queue_.Clear();
+  if (ret == 0) {
+    is_connected_.store(true);
+    if (StartHandshake() < 0) return -1;
+  } else {
+    handshake_timer_ = timers()->Add(connect_timeout_ms_, [this] () {
+      printf("%s[%d]: Connect timeout !!!\n", __FUNCTION__, __LINE__);
+      connect_result_ = kConnectTimeout;
+      FinishHandshake(kHandshakeFailed);
+      WakeService();
+    });
+  }
+  service_is_running_.store(true);
+  if (loop->Attach(this) < 0) {
+    service_is_running_.store(false);
+    timers()->Cancel(handshake_timer_);
+    Close(socket_);
+    socket_ = -1;
+    is_connected_.store(false);
     return -1;
   }
-#endif
-  is_connected_.store(true);
   return 0;
 }
 
-// 开启与客户端进行握手, 握手成功后转到服务线程处理数据.
+// 发送握手请求并启动服务线程, 服务线程收到握手响应或握手超时后返回.
 bool WebSocketClient::Run(void) {
   if (!is_connected_) return false;
-  int ret;
-  std::string key = GetRandomString(20);
-  std::vector<char> keytemp(key.begin(), key.end());
-  Base64Encode(keytemp, &key);
+  // 回收上一次连接已退出的服务线程.
+  JoinThread(&service_thread_);
+  loop_ = nullptr;
+  timers_ = own_timers_.get();
+  connect_callback_ = nullptr;
+  if (!wakeup_) wakeup_.reset(new Wakeup());
+  if (StartHandshake() < 0) return false;
+  service_is_running_.store(true);
+  service_thread_ = std::thread(&WebSocketClient::ThreadHandler, this);
+  // 等待服务线程完成握手.
+  std::unique_lock<std::mutex> lock(handshake_mutex_);
+  handshake_cv_.wait(lock, [this] () {
+    return handshake_state_ != kHandshaking;
+  });
+  return handshake_state_ == kHandshakeDone;
+}
+
+// 发送握手请求并交给事件循环, 事件循环线程收到握手响应或握手超时后返回.
+bool WebSocketClient::Run(ClientEventLoop* loop) {
+  if (!is_connected_ || loop == nullptr || !loop->is_running()) return false;
+  JoinThread(&service_thread_);
+  loop_ = loop;
+  timers_ = loop->Assign(this);
+  connect_callback_ = nullptr;
+  if (StartHandshake() < 0) return false;
+  service_is_running_.store(true);
+  if (loop->Attach(this) < 0) {
+    service_is_running_.store(false);
+    timers_->Cancel(handshake_timer_);
+    Close(socket_);
+    socket_ = -1;
+    is_connected_.store(false);
+    return false;
+  }
+  std::unique_lock<std::mutex> lock(handshake_mutex_);
+  handshake_cv_.wait(lock, [this] () {
+    return handshake_state_ != kHandshaking;
+  });
+  return handshake_state_ == kHandshakeDone;
+}
+
+// 重置连接状态, 生成握手请求放入发送队列并启动握手超时定时器.
+int WebSocketClient::StartHandshake(void) {
+  // Sec-WebSocket-Key为16字节随机数的Base64编码.
+  char nonce[16];
+  char encoded_nonce[24];
+  FastRandomFill(nonce, sizeof(nonce));
+  std::string key(encoded_nonce,
+                  Base64Encode(nonce, sizeof(nonce), encoded_nonce));
   // Get authentication key.
-  std::string authen_key = key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
-  SHA1 sha;
-  uint32_t message_digest[5];
-  sha.Reset();
-  sha << authen_key.c_str();
-  sha.Result(message_digest);
-  for (int i = 0; i < 5; i++) message_digest[i] = htonl(message_digest[i]);
-  keytemp.assign(reinterpret_cast<char*>(message_digest),
-                 reinterpret_cast<char*>(message_digest)+20);
-  Base64Encode(keytemp, &authen_key);
+  char accept_key[kWebSocketAcceptKeyLength];
+  WebSocketAcceptKey(key.data(), key.size(), accept_key);
+  accept_key_.assign(accept_key, kWebSocketAcceptKeyLength);
+  std::string extensions;
+  DeflateOfferPackaging(deflate_options_, &extensions);
+  if (!extensions.empty()) {
+    extensions = "Sec-WebSocket-Extensions: " + extensions + "\r\n";
+  }
+  deflate_.Reset(DeflateOptions {}, false);
+  std::string resume;
+  if (resume_enabled_) {
+    resume = "X-WebSocket-Resume: " + (session_id_.empty() ? "new" :
+        session_id_ + " " + std::to_string(last_sequence_.load())) + "\r\n";
+  }
   // Generate request data.
   std::string request =
       "GET / HTTP/1.1\r\n"
       "Connection: Upgrade\r\n"
       "Host: " + server_ip_ + ":" + std::to_string(server_port_) + "\r\n"
-      "Origin: null\r\n"
-      "Sec-WebSocket-Extensions: x-webkit-deflate-frame\r\n"
+      "Origin: null\r\n" + extensions +
       "Sec-WebSocket-Key: " + key + "\r\n"
       "Sec-WebSocket-Version: 13\r\n"
-      "Upgrade: websocket\r\n";
-  if (Send(socket_, request.c_str(), request.size(), 0) <= 0) {
+      "Upgrade: websocket\r\n" + resume + "\r\n";
+  send_queue_.Clear();
+  SendQueue::Frame frame(new std::vector<char>(request.begin(),
+                                               request.end()));
+  if (send_queue_.PushData(socket_, frame) < 0) {
     printf("%s[%d]: Send request data failed !!!\n", __FUNCTION__, __LINE__);
     Close(socket_);
-    return false;
-  }
-  // Waitting for respond.
-  int timeout = 3;
-  std::unique_ptr<char[]> buffer(new char[kMaxBufferLength],
-                                 std::default_delete<char[]>());
-
-  while (timeout--) {
-    ret = Recv(socket_, buffer.get(), kMaxBufferLength, 0);
-    if (ret > 0) {
-      std::string respond = buffer.get();
-      if ((respond.find("HTTP/1.1 101") == std::string::npos) ||
-          (respond.find(authen_key) == std::string::npos)) {
-        printf("%s[%d]: Authentication failed !!!\n", __FUNCTION__, __LINE__);
-        Close(socket_);
-        return false;
-      }
-      break;
-    } else if (ret == 0) {
-      printf("%s[%d]: Remote socket close !!!\n", __FUNCTION__, __LINE__);
-      Close(socket_);
-      return false;
-    }
-    std::this_thread::sleep_for(std::chrono::seconds(1));
+    socket_ = -1;
+    is_connected_.store(false);
+    return -1;
   }
-  if (timeout < 0) {
-    Close(socket_);
-    return false;
+  recv_buffer_.clear();
+  message_length_ = 0;
+  fragmented_ = false;
+  compressed_ = false;
+  text_ = false;
+  utf8_.Reset();
+  sequenced_ = false;
+  sequence_ = 0;
+  sequence_length_ = 0;
+  {
+    std::lock_guard<std::mutex> lock(rtt_mutex_);
+    rtt_stats_ = RttStats {};
   }
-  service_thread_ = std::thread(&WebSocketClient::ThreadHandler, this);
-  service_thread_.detach();
-  return true;
+  last_recv_ms_ = SteadyClockMicroseconds()/1000;
+  handshake_state_ = kHandshaking;
+  closing_.store(false);
+  peer_closed_.store(false);
+  close_code_.store(0);
+  close_timer_.store(0);
+  idle_timer_ = 0;
+  ping_timer_ = 0;
+  deflate_timer_ = 0;
+  handshake_timer_ = timers()->Add(handshake_timeout_ms_, [this] () {
+    printf("%s[%d]: Handshake timeout !!!\n", __FUNCTION__, __LINE__);
+    connect_result_ = kConnectTimeout;
+    FinishHandshake(kHandshakeFailed);
+    WakeService();
+  });
+  return 0;
 }
 
 // 停止服务线程, 关闭并清空已连接的套接字.
 void WebSocketClient::Stop(void) {
-  if (service_is_running_) {
-    service_is_running_.store(false);
-    std::this_thread::sleep_for(std::chrono::seconds(1));
+  stop_requested_.store(true);
+  service_is_running_.store(false);
+  if (loop_ != nullptr) {
+    // 移除操作在事件循环线程中执行, 返回时重连定时器不会再运行.
+    timers()->Cancel(reconnect_timer_.load());
+    loop_->Remove(this);
+  } else if (wakeup_) {
+    wakeup_->Notify();
   }
+  JoinThread(&service_thread_);
   if (socket_ > 0) {
     Close(socket_);
+    socket_ = -1;
   }
   is_connected_.store(false);
 }
 
 // 发送原始数据.
 int WebSocketClient::SendRawData(char const* buffer, int const& size) {
-  return Send(socket_, buffer, size, 0);
+  if (buffer == nullptr || size <= 0) return -1;
+  SendQueue::Frame frame(new std::vector<char>(buffer, buffer + size));
+  int ret = send_queue_.PushData(socket_, frame);
+  if (ret < 0) return -1;
+  if (ret == 2) {
+    ArmBatch();
+  } else {
+    WakeService();
+  }
+  return size;
 }
 
 // 将原始数据封装后再进行发送.
-int WebSocketClient::SendData(char const* buffer, int const& size) {
-  WebSocketMsg websocket_msg{};
-  websocket_msg.msg_head.bit.fin = 1;
-  websocket_msg.msg_head.bit.mask = 1;
-  websocket_msg.msg_head.bit.opcode = kOPCodeText;
-  std::vector<char> msgout;
-  websocket_msg.payload_content.assign(buffer, buffer + size);
-  if (WebSocketFramePackaging(websocket_msg, &msgout) == 0) {
-    return SendRawData(msgout);
+int WebSocketClient::SendData(char const* buffer, int const& size,
+                              OPCodeType const& opcode) {
+  if (size < 0) return -1;
+  PayloadSegment const segment = {buffer, static_cast<uint64_t>(size)};
+  return SendData(opcode, &segment, 1);
+}
+
+// 片段加掩码后写入暂存区, 发送队列写不完时才复制未写出的部分.
+int WebSocketClient::SendData(OPCodeType const& opcode,
+                              PayloadSegment const* segments,
+                              size_t const& count) {
+  if ((opcode != kOPCodeText && opcode != kOPCodeBinary) ||
+      (segments == nullptr && count > 0)) {
+    return -1;
   }
-  return -1;
+  uint64_t size = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (segments[i].data == nullptr && segments[i].size > 0) return -1;
+    size += segments[i].size;
+  }
+  if (size > static_cast<uint64_t>(INT_MAX)) return -1;
+  // 压缩上下文依赖消息顺序, 压缩和入队须在同一临界区内完成.
+  std::lock_guard<std::mutex> lock(send_mutex_);
+  PayloadSegment const* payload = segments;
+  size_t payload_count = count;
+  PayloadSegment compressed = {nullptr, 0};
+  uint8_t reserve = 0;
+  if (deflate_.enabled()) {
+    // 压缩需要连续的输入, 多个片段先拼接.
+    char const* input = (count > 0) ? segments[0].data : nullptr;
+    if (count > 1) {
+      send_input_.clear();
+      for (size_t i = 0; i < count; ++i) {
+        send_input_.insert(send_input_.end(), segments[i].data,
+                           segments[i].data + segments[i].size);
+      }
+      input = send_input_.data();
+    }
+    int ret = deflate_.Compress(input, size, &send_compressed_);
+    if (ret < 0) return -1;
+    if (ret == 0) {
+      // 压缩消息只在第一个分片中设置RSV1.
+      compressed.data = send_compressed_.data();
+      compressed.size = send_compressed_.size();
+      payload = &compressed;
+      payload_count = 1;
+      reserve = kFrameRsv1Bit;
+    }
+  }
+  send_buffer_.clear();
+  send_lengths_.clear();
+  if (ClientFrameCodec::PackageMessage(opcode, payload, payload_count,
+                                       fragment_size_, reserve,
+                                       &send_buffer_, &send_lengths_) != 0) {
+    return -1;
+  }
+  int ret = send_queue_.PushData(socket_, send_buffer_.data(), send_lengths_);
+  // 偶尔发送的大消息不长期占用暂存区.
+  if (send_buffer_.capacity() > kMaxSendScratchSize) {
+    std::vector<char>().swap(send_buffer_);
+    std::vector<char>().swap(send_input_);
+    std::vector<char>().swap(send_compressed_);
+  }
+  if (ret < 0) return -1;
+  // 已全部写出时不必唤醒服务线程等待可写.
+  if (ret == 1) WakeService();
+  if (ret == 2) ArmBatch();
+  return static_cast<int>(size);
 }
 
-// 接收服务端发过来的数据, 调用回调函数进行外部处理.
+// 只有本次积攒的第一帧设置截止时间, 写出时截止时间先清零再写出,
+// 之后积攒的帧重新设置.
+void WebSocketClient::ArmBatch(void) {
+  int64_t expected = 0;
+  int64_t const deadline_us =
+      SteadyClockMicroseconds() + batch_options_.max_delay_us;
+  if (!batch_deadline_us_.compare_exchange_strong(expected, deadline_us)) {
+    return;
+  }
+  if (loop_ != nullptr) {
+    loop_->ScheduleFlush(this, deadline_us);
+  } else {
+    WakeService();
+  }
+}
+
+// 封装控制帧并放入优先队列发送.
+int WebSocketClient::SendControl(OPCodeType const& opcode,
+                                 char const* buffer, int const& size) {
+  if (!(opcode & 0x8) || size < 0 || size > 125) return -1;
+  std::shared_ptr<std::vector<char>> frame(new std::vector<char>());
+  if (ClientFrameCodec::Package(kFrameFinBit | opcode, buffer, size,
+                                frame.get()) != 0) {
+    return -1;
+  }
+  if (send_queue_.PushControl(socket_, frame) < 0) return -1;
+  WakeService();
+  return size;
+}
+
+int WebSocketClient::Disconnect(int const& code, std::string const& reason) {
+  if (!service_is_running_ || handshake_state_ != kHandshakeDone) return -1;
+  stop_requested_.store(true);
+  return BeginClose(code, reason);
+}
+
+int WebSocketClient::BeginClose(int const& code, std::string const& reason) {
+  std::shared_ptr<std::vector<char>> close_frame(new std::vector<char>());
+  if (WebSocketCloseFramePackaging(code, reason, true,
+                                   close_frame.get()) != 0) {
+    return -1;
+  }
+  if (closing_.exchange(true)) return -1;
+  send_queue_.PushClose(socket_, close_frame, false);
+  int expected = 0;
+  close_code_.compare_exchange_strong(expected, code);
+  close_timer_.store(timers()->Add(close_timeout_ms_, [this] () {
+    printf("%s[%d]: Close timeout !!!\n", __FUNCTION__, __LINE__);
+    RequestStop();
+  }));
+  WakeService();
+  return 0;
+}
+
+void WebSocketClient::WakeService(void) {
+  if (loop_ != nullptr) {
+    loop_->Schedule(this);
+  } else if (wakeup_) {
+    wakeup_->Notify();
+  }
+}
+
+// 在Linux下以poll等待套接字事件, 唤醒事件和最近到期的定时器,
+// 其它平台空闲时休眠10ms后轮询. 连接断开后按需在本线程中重连.
 void WebSocketClient::ThreadHandler(void) {
-  service_is_running_.store(true);
-  int ret;
   std::unique_ptr<char[]> buffer(new char[kMaxBufferLength],
                                    std::default_delete<char[]>());
-  WebSocketMsg websocket;
-  std::vector<char> recv_data, payload_content;
+  do {
+    ServiceLoop(buffer.get());
+    FinishService();
+  } while (ReconnectInThread());
+}
+
+void WebSocketClient::ServiceLoop(char* buffer) {
+  bool readable = true;
+  bool writable = true;
   while (service_is_running_) {
-    ret = Recv(socket_, buffer.get(), kMaxBufferLength, 0);
-    if (ret > 0) {
-      deep_callback_(socket_, buffer.get(), ret);
-      recv_data.assign(buffer.get(), buffer.get() + ret);
-      // 解析出实际消息内容.
-      if (WebSocketFrameParse(recv_data, &websocket) == 0) {
-        callback_(socket_, websocket.payload_content.data(),
-                  websocket.payload_content.size());
-      }
-    } else if (ret <= 0) {
-      if (ret < 0) {  // 排除正常错误返回码.
+    // 执行到期的定时器.
+    timers()->Advance();
+    if (!service_is_running_ || handshake_state_ == kHandshakeFailed) break;
 #if defined(__linux__)
-        if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) {
-          continue;
-        }
-#elif defined(_WIN32)
-        auto wsa_errno = WSAGetLastError();
-        if (wsa_errno == WSAEINTR || wsa_errno == WSAEWOULDBLOCK) continue;
+    // 等待套接字事件, 唤醒事件或最近到期的定时器.
+    int64_t timeout = timers()->NextTimeout();
+    if (timeout < 0 || timeout > kMaxPollTimeout) timeout = kMaxPollTimeout;
+    // 积攒的数据按微秒级的截止时间写出.
+    int64_t timeout_us = timeout * 1000;
+    int64_t const deadline_us = batch_deadline_us_;
+    if (deadline_us != 0) {
+      int64_t remaining_us = deadline_us - SteadyClockMicroseconds();
+      if (remaining_us < 0) remaining_us = 0;
+      if (remaining_us < timeout_us) timeout_us = remaining_us;
+    }
+    struct timespec wait_time;
+    wait_time.tv_sec = timeout_us / 1000000;
+    wait_time.tv_nsec = (timeout_us % 1000000) * 1000;
+    struct pollfd fds[2];
+    fds[0].fd = socket_;
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+    if (WantWrite()) fds[0].events |= POLLOUT;
+    fds[1].fd = wakeup_->fd();
+    fds[1].events = POLLIN;
+    fds[1].revents = 0;
+    if (ppoll(fds, 2, &wait_time, nullptr) < 0 && errno != EINTR) {
+      printf("%s[%d]: Poll failed !!!\n", __FUNCTION__, __LINE__);
+      break;
+    }
+    if (fds[1].revents & POLLIN) wakeup_->Consume();
+    readable = (fds[0].revents & (POLLIN | POLLERR | POLLHUP)) != 0;
+    writable = (fds[0].revents & POLLOUT) != 0;
 #endif
+    if (HandleEvents(readable, writable, buffer, kMaxBufferLength) < 0) break;
+  }
+}
+
+bool WebSocketClient::PrepareReconnect(int64_t* delay_ms) {
+  auto const& options = reconnect_options_;
+  int attempts = reconnect_attempts_;
+  if (!options.enabled || !reconnect_armed_ || stop_requested_ ||
+      (options.max_attempts > 0 && attempts >= options.max_attempts)) {
+    ChangeState(kClientClosed);
+    return false;
+  }
+  // full jitter: 在[0, min(上限, 基数*2^n)]内均匀取值.
+  int64_t ceiling = options.max_delay_ms;
+  if (attempts < 32 &&
+      (static_cast<int64_t>(options.base_delay_ms) << attempts) < ceiling) {
+    ceiling = static_cast<int64_t>(options.base_delay_ms) << attempts;
+  }
+  *delay_ms = ceiling > 0 ? FastRandom64() % (ceiling + 1) : 0;
+  reconnect_attempts_.store(attempts + 1);
+  ChangeState(kClientWaiting);
+  return true;
+}
+
+void WebSocketClient::ScheduleReconnect(void) {
+  int64_t delay_ms = 0;
+  if (!PrepareReconnect(&delay_ms)) return;
+  reconnect_timer_.store(timers()->Add(delay_ms, [this] () {
+    reconnect_timer_.store(0);
+    if (stop_requested_) return;
+    ChangeState(kClientConnecting);
+    if (BeginConnect(loop_) < 0) ScheduleReconnect();
+  }));
+}
+
+// 同时等待唤醒事件, Stop后立即放弃本次连接.
+int WebSocketClient::WaitReconnected(void) {
+#if defined(__linux__)
+  int64_t const deadline_ms = SteadyClockMicroseconds()/1000 +
+                              connect_timeout_ms_;
+  while (!stop_requested_) {
+    int64_t const now_ms = SteadyClockMicroseconds()/1000;
+    if (now_ms >= deadline_ms) return 1;
+    struct pollfd fds[2] = {{socket_, POLLOUT, 0}, {wakeup_->fd(), POLLIN, 0}};
+    int ret = poll(fds, 2, static_cast<int>(deadline_ms - now_ms));
+    if (ret < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    if (fds[1].revents & POLLIN) wakeup_->Consume();
+    if (fds[0].revents != 0) return WaitConnected(socket_, 0);
+  }
+  return -1;
+#else
+  return WaitConnected(socket_, connect_timeout_ms_);
+#endif
+}
+
+// 等待期间可被Stop唤醒; 连接失败时继续退避, 直到成功发出握手请求.
+bool WebSocketClient::ReconnectInThread(void) {
+  int64_t delay_ms = 0;
+  while (PrepareReconnect(&delay_ms)) {
+    int64_t now_ms = SteadyClockMicroseconds()/1000;
+    int64_t const deadline_ms = now_ms + delay_ms;
+    while (!stop_requested_ && now_ms < deadline_ms) {
+#if defined(__linux__)
+      struct pollfd fds = {wakeup_->fd(), POLLIN, 0};
+      if (poll(&fds, 1, static_cast<int>(deadline_ms - now_ms)) > 0) {
+        wakeup_->Consume();
       }
-      printf("%s[%d]: Disconnect !!!\n", __FUNCTION__, __LINE__);
+#else
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+#endif
+      now_ms = SteadyClockMicroseconds()/1000;
+    }
+    if (stop_requested_) continue;
+    ChangeState(kClientConnecting);
+    int ret = OpenSocket();
+    if (ret > 0 && WaitReconnected() != 0) {
+      printf("%s[%d]: Connect to remote server failed!!!\n",
+             __FUNCTION__, __LINE__);
       Close(socket_);
-      break;
+      socket_ = -1;
+      ret = -1;
     }
+    if (ret < 0) continue;
+    is_connected_.store(true);
+    if (StartHandshake() < 0) continue;
+    service_is_running_.store(true);
+    // Stop可能在设置运行标志之前已将其清除.
+    if (stop_requested_) service_is_running_.store(false);
+    return true;
+  }
+  return false;
+}
+
+// TCP连接完成后发送握手请求. 先写出发送队列中积压的数据, 再接收一次数据;
+// 握手完成前解析握手响应, 之后按帧解析并回调.
+int WebSocketClient::HandleEvents(bool const& readable, bool const& writable,
+                                  char* buffer, int const& size) {
+  if (!service_is_running_ || handshake_state_ == kHandshakeFailed) return -1;
+  if (handshake_state_ == kConnecting) {
+    if (!readable && !writable) return 0;
+    if (WaitConnected(socket_, 0) != 0) {
+      printf("%s[%d]: Connect to remote server failed!!!\n",
+             __FUNCTION__, __LINE__);
+      return -1;
+    }
+    timers()->Cancel(handshake_timer_);
+    is_connected_.store(true);
+    if (StartHandshake() < 0) return -1;
+  }
+  // 到达截止时间后先清除截止时间再写出, 之后积攒的帧会重新设置.
+  int64_t deadline_us = batch_deadline_us_;
+  int ret = 0;
+  if (deadline_us != 0 && SteadyClockMicroseconds() >= deadline_us &&
+      batch_deadline_us_.compare_exchange_strong(deadline_us, 0)) {
+    ret = send_queue_.FlushBatch(socket_);
+  } else {
+    ret = send_queue_.Flush(socket_);
+  }
+  if (ret < 0) {
+    printf("%s[%d]: Send failed !!!\n", __FUNCTION__, __LINE__);
+    return -1;
+  } else if (ret == 0 && peer_closed_ && closing_) {
+    // 双方均已发出关闭帧且数据已全部写出.
+    return -1;
+  }
+  if (!readable) return 0;
+  ret = Recv(socket_, buffer, size, 0);
+  if (ret > 0) {
+    last_recv_ms_ = SteadyClockMicroseconds()/1000;
+    if (handshake_state_ == kHandshaking) {
+      recv_buffer_.insert(recv_buffer_.end(), buffer, buffer + ret);
+      if (ProcessHandshake() < 0) {
+        printf("%s[%d]: Authentication failed !!!\n", __FUNCTION__, __LINE__);
+        connect_result_ = kConnectRejected;
+        return -1;
+      }
+      return 0;
+    }
+    deep_callback_(socket_, buffer, ret);
+    recv_buffer_.insert(recv_buffer_.end(), buffer, buffer + ret);
+    // 解析出实际消息内容.
+    if (ProcessFrames() < 0) {
+      printf("%s[%d]: Invalid frame !!!\n", __FUNCTION__, __LINE__);
+      return -1;
+    }
+    return 0;
+  }
+  if (ret < 0 && IsRetryableError()) {  // 排除正常错误返回码.
+#if !defined(__linux__)
     std::this_thread::sleep_for(std::chrono::milliseconds(10));
+#endif
+    return 0;
   }
+  printf("%s[%d]: Disconnect !!!\n", __FUNCTION__, __LINE__);
+  return -1;
+}
+
+// 重连时可能换到另一个事件循环线程, 定时器标识只在所属的时间轮中有效,
+// 取消后清零, 避免误取消新时间轮中的其它定时器.
+void WebSocketClient::FinishService(void) {
+  bool established = (handshake_state_ == kHandshakeDone);
+  FinishHandshake(kHandshakeFailed);
+  timers()->Cancel(handshake_timer_);
+  timers()->Cancel(idle_timer_);
+  timers()->Cancel(ping_timer_);
+  timers()->Cancel(deflate_timer_);
+  timers()->Cancel(close_timer_);
+  handshake_timer_ = 0;
+  idle_timer_ = 0;
+  ping_timer_ = 0;
+  deflate_timer_ = 0;
+  close_timer_.store(0);
+  batch_deadline_us_.store(0);
+  Socket socket = socket_;
   if (socket_ > 0) {
     Close(socket_);
     socket_ = -1;
   }
   service_is_running_.store(false);
-  Stop();
+  is_connected_.store(false);
+  if (established) {
+    int code = close_code_;
+    close_callback_(socket, code != 0 ? code : kCloseAbnormal);
+  } else if (connect_callback_) {
+    ConnectCallback callback;
+    callback.swap(connect_callback_);
+    callback(connect_result_);
+  }
+  if (loop_ != nullptr) ScheduleReconnect();
+}
+
+// 收到完整的握手响应后校验状态码, Sec-WebSocket-Accept和扩展协商结果,
+// 成功后启动空闲超时和定时ping, 响应之后已到达的数据按帧继续解析.
+int WebSocketClient::ProcessHandshake(void) {
+  HandshakeRespond respond;
+  size_t respond_length = 0;
+  int ret = HandshakeRespondParse(recv_buffer_.data(), recv_buffer_.size(),
+                                  &respond, &respond_length);
+  if (ret == kHandshakeParseIncomplete) {
+    return recv_buffer_.size() > kMaxBufferLength ? -1 : 0;
+  }
+  if (ret != kHandshakeParseOk ||
+      respond.accept.size != accept_key_.size() ||
+      memcmp(respond.accept.data, accept_key_.data(),
+             accept_key_.size()) != 0) {
+    return -1;
+  }
+  DeflateOptions agreed;
+  if (DeflateResponseParse(respond.extensions, deflate_options_,
+                           &agreed) < 0) {
+    return -1;
+  }
+  deflate_.Reset(agreed, false);
+  bool const resumed = resume_enabled_ && AcceptResume(respond.resume);
+  // respond中的字段指向接收缓冲区, 校验完成后才能移除响应数据.
+  recv_buffer_.erase(recv_buffer_.begin(),
+                     recv_buffer_.begin() + respond_length);
+  timers()->Cancel(handshake_timer_);
+  if (idle_timeout_ms_ > 0) {
+    idle_timer_ = timers()->Add(idle_timeout_ms_,
+                                   [this] () { CheckIdle(); });
+  }
+  if (ping_interval_ms_ > 0) {
+    ping_timer_ = timers()->Add(ping_interval_ms_, [this] () {
+      char ping_payload[8];
+      EncodePingTimestamp(SteadyClockMicroseconds(), ping_payload);
+      SendControl(kOPCodePing, ping_payload, 8);
+    }, ping_interval_ms_);
+  }
+  if (agreed.enabled && agreed.release_idle_ms > 0) {
+    // 压缩流在发送线程中使用, 须持有发送锁; 解压流只在本线程中使用.
+    deflate_timer_ = timers()->Add(agreed.release_idle_ms, [this] () {
+      {
+        std::lock_guard<std::mutex> lock(send_mutex_);
+        deflate_.ReleaseIdleDeflate();
+      }
+      deflate_.ReleaseIdleInflate();
+    }, agreed.release_idle_ms);
+  }
+  if (batch_options_.enabled) {
+    send_queue_.SetBatchBytes(batch_options_.max_bytes);
+  }
+  FinishHandshake(kHandshakeDone);
+  reconnect_armed_ = true;
+  reconnect_attempts_.store(0);
+  ChangeState(kClientOpen);
+  if (connect_callback_) {
+    ConnectCallback callback;
+    callback.swap(connect_callback_);
+    callback(kConnectOk);
+  }
+  if (resume_enabled_) resume_callback_(resumed);
+  if (recv_buffer_.empty()) return 0;
+  deep_callback_(socket_, recv_buffer_.data(), recv_buffer_.size());
+  return ProcessFrames();
+}
+
+// 服务端沿用原会话标识并从客户端的序号继续时为恢复成功; 新会话的序号从头
+// 开始. 响应中没有该头部时服务端不支持会话恢复, 消息不带序号.
+bool WebSocketClient::AcceptResume(HttpToken const& resume) {
+  std::string id;
+  uint64_t seq = 0;
+  if (resume.size == 0 || ResumeTokenParse(resume, &id, &seq) != 0 ||
+      id.empty()) {
+    session_id_.clear();
+    last_sequence_.store(0);
+    sequenced_ = false;
+    return false;
+  }
+  bool const resumed = !session_id_.empty() && id == session_id_ &&
+                       seq == last_sequence_;
+  session_id_ = id;
+  last_sequence_.store(seq);
+  sequenced_ = true;
+  return resumed;
+}
+
+void WebSocketClient::CheckIdle(void) {
+  int64_t idle_ms = SteadyClockMicroseconds()/1000 - last_recv_ms_;
+  if (idle_ms < idle_timeout_ms_) {
+    idle_timer_ = timers()->Add(idle_timeout_ms_ - idle_ms,
+                                   [this] () { CheckIdle(); });
+    return;
+  }
+  printf("%s[%d]: Idle timeout !!!\n", __FUNCTION__, __LINE__);
+  std::shared_ptr<std::vector<char>> close_frame(new std::vector<char>());
+  if (WebSocketCloseFramePackaging(kCloseGoingAway, true,
+                                   close_frame.get()) == 0) {
+    send_queue_.PushClose(socket_, close_frame, true);
+    close_code_.store(kCloseGoingAway);
+  }
+  RequestStop();
+}
+
+void WebSocketClient::FinishHandshake(int const& state) {
+  std::lock_guard<std::mutex> lock(handshake_mutex_);
+  if (handshake_state_ != kHandshaking && handshake_state_ != kConnecting) {
+    return;
+  }
+  handshake_state_ = state;
+  handshake_cv_.notify_all();
+}
+
+// 依次解析接收缓冲区中的完整帧并回调, 不完整的数据留待下次接收.
+// 帧或消息长度超出限制时发送1009关闭帧, 文本不是合法的UTF-8时发送1007关闭帧,
+// 协议错误时发送1002关闭帧.
+int WebSocketClient::ProcessFrames(void) {
+  FrameHeader header {};
+  std::vector<char> inflated;
+  uint64_t offset = 0;
+  uint64_t frame_length = 0;
+  int ret = kFrameParseOk;
+  while (offset < recv_buffer_.size()) {
+    uint64_t max_payload_length = max_frame_size_;
+    if (max_message_size_ - message_length_ < max_payload_length) {
+      max_payload_length = max_message_size_ - message_length_;
+    }
+    ret = ClientFrameCodec::Parse(recv_buffer_.data() + offset,
+                          recv_buffer_.size() - offset, max_payload_length,
+                          &header, &frame_length);
+    if (ret != kFrameParseOk) break;
+    char const* data = recv_buffer_.data() + offset + header.header_length;
+    uint64_t size = header.payload_length;
+    offset += frame_length;
+    auto const opcode = header.opcode;
+    // 只有协商了permessage-deflate时才允许RSV1, 且只能出现在消息的首帧.
+    uint8_t const reserve = header.reserve;
+    if ((reserve & ~kFrameRsv1Bit) ||
+        (reserve && (!deflate_.enabled() || opcode == kOPCodePacket ||
+                     (opcode & 0x8)))) {
+      ret = kFrameParseError;
+      break;
+    }
+    if (opcode == kOPCodePing) {
+      // 自动回复pong, 负载原样返回.
+      SendControl(kOPCodePong, data, size);
+      continue;
+    } else if (opcode == kOPCodePong) {
+      int64_t timestamp_us = DecodePingTimestamp(data, size);
+      if (timestamp_us >= 0) {
+        std::lock_guard<std::mutex> lock(rtt_mutex_);
+        RttStatsUpdate(SteadyClockMicroseconds() - timestamp_us,
+                       &rtt_stats_);
+      }
+      continue;
+    } else if (opcode == kOPCodeClose) {
+      int code = WebSocketCloseCodeParse(data, size);
+      if (code < 0) {
+        ret = kFrameParseError;
+        break;
+      }
+      if (validate_utf8_ && size > 2 && !IsValidUtf8(data + 2, size - 2)) {
+        ret = kFrameParseInvalidPayload;
+        break;
+      }
+      // 对端发起关闭时回复相同的状态码, 回复排在已排队的数据之后.
+      peer_closed_.store(true);
+      if (!closing_) {
+        close_code_.store(code);
+        BeginClose(code == kCloseNoStatus ? kCloseNormal : code,
+                   std::string());
+      }
+      offset = recv_buffer_.size();
+      break;
+    } else if (peer_closed_) {
+      continue;
+    } else if (!(opcode & 0x8)) {
+      bool const fin = header.fin;
+      // 续帧只能接在未结束的分片消息之后, 新消息须等上一条结束后开始.
+      if ((opcode == kOPCodePacket) != fragmented_) {
+        ret = kFrameParseError;
+        break;
+      }
+      if (opcode != kOPCodePacket) compressed_ = (reserve != 0);
+      if (compressed_) {
+        int inflate_ret = deflate_.Decompress(
+            data, size, fin, max_message_size_ - message_length_, &inflated);
+        if (inflate_ret != kInflateOk) {
+          ret = (inflate_ret == kInflateTooLarge) ?
+              kFrameParseTooLarge : kFrameParseError;
+          break;
+        }
+        data = inflated.data();
+        size = inflated.size();
+      }
+      if (opcode != kOPCodePacket) {
+        text_ = (opcode == kOPCodeText);
+        message_opcode_ = static_cast<OPCodeType>(opcode);
+        message_buffer_.clear();
+        utf8_.Reset();
+        sequence_ = 0;
+        sequence_length_ = 0;
+      }
+      if (sequenced_) {
+        // 序号可能被分片或解压拆开, 逐字节累积.
+        while (sequence_length_ < kSequenceLength && size > 0) {
+          sequence_ = (sequence_ << 8) | static_cast<uint8_t>(*data);
+          ++sequence_length_;
+          ++data;
+          --size;
+        }
+        if (fin && sequence_length_ < kSequenceLength) {
+          ret = kFrameParseError;
+          break;
+        }
+      }
+      if (validate_utf8_ && text_ &&
+          (!utf8_.Feed(data, size) || (fin && !utf8_.Finish()))) {
+        ret = kFrameParseInvalidPayload;
+        break;
+      }
+      message_length_ = fin ? 0 : message_length_ + size;
+      fragmented_ = !fin;
+      callback_(socket_, data, size);
+      if (message_callback_) {
+        // 未分片的消息直接回调, 不经过组装缓冲区.
+        if (fin && opcode != kOPCodePacket) {
+          message_callback_(socket_, message_opcode_, data, size);
+        } else {
+          message_buffer_.insert(message_buffer_.end(), data, data + size);
+          if (fin) {
+            message_callback_(socket_, message_opcode_,
+                              message_buffer_.data(), message_buffer_.size());
+            message_buffer_.clear();
+          }
+        }
+      }
+      if (sequenced_ && fin) last_sequence_.store(sequence_);
+      continue;
+    }
+    callback_(socket_, data, size);
+  }
+  recv_buffer_.erase(recv_buffer_.begin(), recv_buffer_.begin() + offset);
+  if (ret < 0) {
+    uint16_t code = (ret == kFrameParseTooLarge) ? kCloseMessageTooBig :
+        (ret == kFrameParseInvalidPayload) ? kCloseInvalidPayload :
+        kCloseProtocolError;
+    std::shared_ptr<std::vector<char>> close_frame(new std::vector<char>());
+    if (WebSocketCloseFramePackaging(code, true, close_frame.get()) == 0) {
+      send_queue_.PushClose(socket_, close_frame, true);
+      close_code_.store(code);
+    }
+    return -1;
+  }
+  return 0;
 }
 
 }  // namespace libwebsocket
@@ -0,0 +1,365 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  client_event_loop.cc
+// @Version :  1.0
+// @Desc    :  None
+
+
+#include "client_event_loop.h"
+
+#if defined(__linux__)
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#endif
+#include <stdio.h>
+
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>  // NOLINT.
+#include <unordered_set>
+
+#include "client.h"
+#include "rtt_stats.h"
+#include "wakeup.h"
+
+
+namespace libwebsocket {
+
+namespace {
+
+constexpr int kMaxBufferLength = 65536;  // 每次接收的最大长度.
+constexpr int kMaxEvents = 256;  // 每次epoll_wait返回的最大事件数.
+constexpr int kMaxPollTimeout = 1000;  // 无定时器时的最长等待时间.
+
+#if defined(__linux__)
+// 设置timerfd在deadline_us(单调时钟微秒)时到期.
+void ArmTimerFd(int const& fd, int64_t const& deadline_us) {
+  int64_t remaining_us = deadline_us - SteadyClockMicroseconds();
+  // it_value全为0会停止定时器.
+  if (remaining_us < 1) remaining_us = 1;
+  struct itimerspec spec = {};
+  spec.it_value.tv_sec = remaining_us / 1000000;
+  spec.it_value.tv_nsec = (remaining_us % 1000000) * 1000;
+  timerfd_settime(fd, 0, &spec, nullptr);
+}
+#endif
+
+}  // namespace
+
+// 事件循环线程, 除tasks和ready外的成员只在该线程中访问.
+struct ClientEventLoop::Worker {
+  int epoll_fd = -1;  // epoll实例.
+  Wakeup wakeup;  // 唤醒阻塞在epoll_wait上的线程.
+  TimerWheel timer_wheel;  // 所属连接共用的定时器.
+  std::thread thread;  // 线程.
+  int timer_fd = -1;  // 批量发送写出时间的定时器.
+  std::mutex mutex;  // 保护running, tasks, ready, flushes和flush_us.
+  bool running = false;  // 是否接受新的任务.
+  std::vector<std::function<void (void)>> tasks;  // 待执行的任务.
+  std::vector<WebSocketClient*> ready;  // 待处理的连接.
+  // 等待写出积攒数据的连接及其写出时间.
+  std::vector<std::pair<int64_t, WebSocketClient*>> flushes;
+  int64_t flush_us = 0;  // timer_fd的到期时间, 0表示未设置.
+  std::unordered_set<WebSocketClient*> clients;  // 所属连接.
+  WebSocketClient* current = nullptr;  // 正在处理的连接.
+  std::unique_ptr<char[]> buffer;  // 接收缓冲区.
+};
+
+ClientEventLoop::ClientEventLoop(int const& threads)
+    : next_worker_(0), size_(0), is_running_(false) {
+  int count = threads > 0 ? threads : 1;
+  for (int i = 0; i < count; ++i) workers_.emplace_back(new Worker());
+}
+
+ClientEventLoop::~ClientEventLoop() {
+  Stop();
+}
+
+bool ClientEventLoop::Start(void) {
+#if defined(__linux__)
+  if (is_running_) return true;
+  for (auto& worker : workers_) {
+    worker->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    worker->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+                                      TFD_NONBLOCK | TFD_CLOEXEC);
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+    struct epoll_event timer_event = {};
+    timer_event.events = EPOLLIN;
+    timer_event.data.ptr = &worker->timer_fd;
+    if (worker->epoll_fd < 0 || worker->wakeup.fd() < 0 ||
+        worker->timer_fd < 0 ||
+        epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->wakeup.fd(),
+                  &event) < 0 ||
+        epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->timer_fd,
+                  &timer_event) < 0) {
+      printf("%s[%d]: Create epoll failed !!!\n", __FUNCTION__, __LINE__);
+      Stop();
+      return false;
+    }
+    if (!worker->buffer) worker->buffer.reset(new char[kMaxBufferLength]);
+    worker->running = true;
+  }
+  is_running_.store(true);
+  for (auto& worker : workers_) {
+    worker->thread = std::thread(&ClientEventLoop::WorkerHandler, this,
+                                 worker.get());
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+void ClientEventLoop::Stop(void) {
+  is_running_.store(false);
+  for (auto& worker : workers_) {
+    worker->wakeup.Notify();
+    if (worker->thread.joinable()) worker->thread.join();
+#if defined(__linux__)
+    if (worker->epoll_fd >= 0) {
+      close(worker->epoll_fd);
+      worker->epoll_fd = -1;
+    }
+    if (worker->timer_fd >= 0) {
+      close(worker->timer_fd);
+      worker->timer_fd = -1;
+    }
+#endif
+  }
+}
+
+TimerWheel* ClientEventLoop::Assign(WebSocketClient* client) {
+  client->loop_index_ = next_worker_.fetch_add(1) % workers_.size();
+  return &workers_[client->loop_index_]->timer_wheel;
+}
+
+int ClientEventLoop::Attach(WebSocketClient* client) {
+  Worker* worker = workers_[client->loop_index_].get();
+  {
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    if (!worker->running) return -1;
+    worker->tasks.push_back([this, worker, client] () {
+#if defined(__linux__)
+      client->want_write_ = client->WantWrite();
+      struct epoll_event event = {};
+      event.events = EPOLLIN | (client->want_write_ ? EPOLLOUT : 0);
+      event.data.ptr = client;
+      if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, client->socket_,
+                    &event) < 0) {
+        printf("%s[%d]: Add to epoll failed !!!\n", __FUNCTION__, __LINE__);
+        client->FinishService();
+        return;
+      }
+#endif
+      // 上次移除前留下的待处理标记不再有对应的处理, 清除后才能重新调度.
+      client->scheduled_.store(false);
+      worker->clients.insert(client);
+      ++size_;
+    });
+  }
+  worker->wakeup.Notify();
+  return 0;
+}
+
+void ClientEventLoop::Remove(WebSocketClient* client) {
+  if (client->loop_index_ >= workers_.size()) return;
+  Worker* worker = workers_[client->loop_index_].get();
+  if (worker->thread.get_id() == std::this_thread::get_id()) {
+    // 正在处理的连接在本次处理结束后移除.
+    if (worker->current != client) Detach(worker, client);
+    return;
+  }
+  std::promise<void> done;
+  std::future<void> removed = done.get_future();
+  {
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    if (!worker->running) return;
+    worker->tasks.push_back([this, worker, client, &done] () {
+      Detach(worker, client);
+      done.set_value();
+    });
+  }
+  worker->wakeup.Notify();
+  removed.wait();
+}
+
+void ClientEventLoop::Schedule(WebSocketClient* client) {
+  if (client->scheduled_.exchange(true)) return;
+  Worker* worker = workers_[client->loop_index_].get();
+  {
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    if (!worker->running) return;
+    worker->ready.push_back(client);
+  }
+  worker->wakeup.Notify();
+}
+
+void ClientEventLoop::ScheduleFlush(WebSocketClient* client,
+                                    int64_t const& deadline_us) {
+#if defined(__linux__)
+  Worker* worker = workers_[client->loop_index_].get();
+  std::lock_guard<std::mutex> lock(worker->mutex);
+  if (!worker->running) return;
+  worker->flushes.emplace_back(deadline_us, client);
+  // 比当前设置的到期时间早时才重新设置, 不需要唤醒事件循环线程.
+  if (worker->flush_us == 0 || deadline_us < worker->flush_us) {
+    worker->flush_us = deadline_us;
+    ArmTimerFd(worker->timer_fd, deadline_us);
+  }
+#endif
+}
+
+void ClientEventLoop::FlushDue(Worker* worker) {
+#if defined(__linux__)
+  uint64_t expirations = 0;
+  if (read(worker->timer_fd, &expirations, sizeof(expirations)) < 0 &&
+      errno != EAGAIN) {
+    return;
+  }
+  std::vector<WebSocketClient*> due;
+  {
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    int64_t const now_us = SteadyClockMicroseconds();
+    int64_t next_us = 0;
+    size_t kept = 0;
+    auto& flushes = worker->flushes;
+    for (auto const& item : flushes) {
+      if (item.first <= now_us) {
+        due.push_back(item.second);
+        continue;
+      }
+      if (next_us == 0 || item.first < next_us) next_us = item.first;
+      flushes[kept++] = item;
+    }
+    flushes.resize(kept);
+    worker->flush_us = next_us;
+    if (next_us != 0) ArmTimerFd(worker->timer_fd, next_us);
+  }
+  for (auto client : due) Process(worker, client, false, false);
+#endif
+}
+
+// 以epoll等待套接字事件, 唤醒事件和最近到期的定时器, 之后依次处理就绪的
+// 连接, 到期的定时器, 新加入或移除的连接和需要写出数据的连接.
+void ClientEventLoop::WorkerHandler(Worker* worker) {
+#if defined(__linux__)
+  std::vector<struct epoll_event> events(kMaxEvents);
+  std::vector<std::function<void (void)>> tasks;
+  std::vector<WebSocketClient*> ready;
+  while (is_running_) {
+    int64_t timeout = worker->timer_wheel.NextTimeout();
+    if (timeout < 0 || timeout > kMaxPollTimeout) timeout = kMaxPollTimeout;
+    int count = epoll_wait(worker->epoll_fd, events.data(), kMaxEvents,
+                           static_cast<int>(timeout));
+    if (count < 0) {
+      if (errno == EINTR) continue;
+      printf("%s[%d]: Epoll wait failed !!!\n", __FUNCTION__, __LINE__);
+      break;
+    }
+    bool flush_due = false;
+    for (int i = 0; i < count; ++i) {
+      if (events[i].data.ptr == &worker->timer_fd) {
+        flush_due = true;
+        continue;
+      }
+      auto client = static_cast<WebSocketClient*>(events[i].data.ptr);
+      if (client == nullptr) {
+        worker->wakeup.Consume();
+        continue;
+      }
+      Process(worker, client,
+              (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) != 0,
+              (events[i].events & EPOLLOUT) != 0);
+    }
+    if (flush_due) FlushDue(worker);
+    worker->timer_wheel.Advance();
+    {
+      std::lock_guard<std::mutex> lock(worker->mutex);
+      tasks.swap(worker->tasks);
+      ready.swap(worker->ready);
+    }
+    for (auto& task : tasks) task();
+    tasks.clear();
+    for (auto client : ready) Process(worker, client, false, false);
+    ready.clear();
+  }
+  {
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    worker->running = false;
+    tasks.swap(worker->tasks);
+    worker->ready.clear();
+    worker->flushes.clear();
+    worker->flush_us = 0;
+  }
+  for (auto& task : tasks) task();
+  // 断开剩余的连接.
+  std::vector<WebSocketClient*> clients(worker->clients.begin(),
+                                        worker->clients.end());
+  for (auto client : clients) Detach(worker, client);
+#endif
+}
+
+void ClientEventLoop::Process(Worker* worker, WebSocketClient* client,
+                              bool const& readable, bool const& writable) {
+  // 同一批事件中先处理的连接可能已将其移除.
+  if (worker->clients.count(client) == 0) return;
+  client->scheduled_.store(false);
+  worker->current = client;
+  int ret = client->HandleEvents(readable, writable, worker->buffer.get(),
+                                 kMaxBufferLength);
+  worker->current = nullptr;
+  if (ret < 0 || !client->service_is_running_) {
+    Detach(worker, client);
+    return;
+  }
+#if defined(__linux__)
+  // 正在连接或发送队列有积压时才关注可写事件.
+  bool want_write = client->WantWrite();
+  if (want_write != client->want_write_) {
+    struct epoll_event event = {};
+    event.events = EPOLLIN | (want_write ? EPOLLOUT : 0);
+    event.data.ptr = client;
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_MOD, client->socket_, &event);
+    client->want_write_ = want_write;
+  }
+#endif
+}
+
+void ClientEventLoop::Detach(Worker* worker, WebSocketClient* client) {
+  if (worker->clients.erase(client) == 0) return;
+  --size_;
+#if defined(__linux__)
+  epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL, client->socket_, nullptr);
+#endif
+  client->want_write_ = false;
+  // 待处理列表中的该连接将被Process忽略, 不清除则重新加入后无法再被调度.
+  client->scheduled_.store(false);
+  client->FinishService();
+}
+
+}  // namespace libwebsocket
@@ -0,0 +1,112 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  client_event_loop.h
+// @Version :  1.0
+// @Desc    :  None
+
+
+#ifndef WEBSOCKET_CLIENT_EVENT_LOOP_H_
+#define WEBSOCKET_CLIENT_EVENT_LOOP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "timer_wheel.h"
+
+
+namespace libwebsocket {
+
+class WebSocketClient;
+
+// 驱动多个WebSocketClient连接的事件循环.
+// 每个线程使用一个epoll实例等待所属连接的套接字事件, 新连接按轮转分配到
+// 各线程. 同一连接的收发处理, 定时器和回调都在所属线程中执行, 回调中
+// 不应长时间阻塞. 仅支持Linux, 其它平台Start返回false.
+// 事件循环须晚于其驱动的连接析构, 或先于连接调用Stop.
+//
+// Example:
+//    ClientEventLoop loop(2);
+//    loop.Start();
+//    std::vector<std::unique_ptr<WebSocketClient>> clients;
+//    for (int i = 0; i < 1000; ++i) {
+//      clients.emplace_back(new WebSocketClient());
+//      auto& client = clients.back();
+//      client->Init();
+//      client->SetRemoteAccessPoint("127.0.0.1", 8081);
+//      client->OnReceived(callback);
+//      if (client->ConnectRemote() == 0) client->Run(&loop);
+//    }
+class ClientEventLoop {
+ public:
+  explicit ClientEventLoop(int const& threads = 1);
+  ClientEventLoop(ClientEventLoop const&) = delete;
+  ClientEventLoop& operator=(ClientEventLoop const&) = delete;
+  ~ClientEventLoop();
+
+  // 启动事件循环线程.
+  bool Start(void);
+  // 停止事件循环线程, 仍在循环中的连接被断开并回调连接关闭.
+  // 不能在事件循环线程中调用.
+  void Stop(void);
+  bool is_running(void) const { return is_running_; }
+  // 当前由事件循环驱动的连接数.
+  size_t size(void) const { return size_; }
+
+ private:
+  friend class WebSocketClient;
+  struct Worker;
+
+  // 为连接分配所属线程, 返回该线程的定时器.
+  TimerWheel* Assign(WebSocketClient* client);
+  // 将已分配线程的连接加入事件循环.
+  int Attach(WebSocketClient* client);
+  // 将连接移出事件循环并断开, 在其它线程调用时等待移除完成.
+  void Remove(WebSocketClient* client);
+  // 通知所属线程处理连接的发送队列和状态变化, 可在任意线程调用.
+  void Schedule(WebSocketClient* client);
+  // 在deadline_us(单调时钟微秒)时处理连接, 写出积攒的数据, 可在任意
+  // 线程调用.
+  void ScheduleFlush(WebSocketClient* client, int64_t const& deadline_us);
+  // 处理已到达写出时间的连接.
+  void FlushDue(Worker* worker);
+  // 事件循环线程处理函数.
+  void WorkerHandler(Worker* worker);
+  // 处理连接的一次事件, 连接需断开时将其移出事件循环.
+  void Process(Worker* worker, WebSocketClient* client,
+               bool const& readable, bool const& writable);
+  // 在所属线程中将连接移出事件循环并断开.
+  void Detach(Worker* worker, WebSocketClient* client);
+
+  std::vector<std::unique_ptr<Worker>> workers_;  // 事件循环线程.
+  std::atomic<size_t> next_worker_;  // 下一个新连接分配的线程.
+  std::atomic<size_t> size_;  // 连接数.
+  std::atomic_bool is_running_;  // 运行标志.
+};
+
+}  // namespace libwebsocket
+
+#endif  // WEBSOCKET_CLIENT_EVENT_LOOP_H_
@@ -0,0 +1,121 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  fast_random.cc
+// @Version :  1.0
+// @Desc    :  None
+
+
+#include "fast_random.h"
+
+#include <string.h>
+#if defined(__linux__)
+#include <sys/random.h>
+#endif
+
+#include <chrono>
+#include <functional>
+#include <random>
+#include <thread>
+
+
+namespace libwebsocket {
+
+namespace {
+
+inline uint64_t Rotl(uint64_t value, int bits) {
+  return (value << bits) | (value >> (64 - bits));
+}
+
+// 用于在熵源不可用时扩展种子.
+uint64_t SplitMix64(uint64_t* state) {
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+struct Xoshiro256 {
+  uint64_t s[4];
+
+  Xoshiro256() {
+    bool seeded = false;
+#if defined(__linux__)
+    seeded = (getrandom(s, sizeof(s), 0) == static_cast<ssize_t>(sizeof(s)));
+#else
+    try {
+      std::random_device device;
+      for (auto& word : s) {
+        word = (static_cast<uint64_t>(device()) << 32) | device();
+      }
+      seeded = true;
+    } catch (...) {
+    }
+#endif
+    if (!seeded) {
+      uint64_t seed = static_cast<uint64_t>(
+          std::chrono::steady_clock::now().time_since_epoch().count());
+      seed ^= std::hash<std::thread::id>()(std::this_thread::get_id());
+      seed ^= reinterpret_cast<uintptr_t>(this);
+      for (auto& word : s) word = SplitMix64(&seed);
+    }
+    // 全零状态不会产生新的值.
+    if ((s[0] | s[1] | s[2] | s[3]) == 0) s[0] = 0x9E3779B97F4A7C15ULL;
+  }
+
+  uint64_t Next(void) {
+    uint64_t const result = Rotl(s[1] * 5, 7) * 9;
+    uint64_t const t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = Rotl(s[3], 45);
+    return result;
+  }
+};
+
+thread_local Xoshiro256 random_state;
+
+}  // namespace
+
+
+uint64_t FastRandom64(void) {
+  return random_state.Next();
+}
+
+void FastRandomFill(void* out, size_t size) {
+  auto bytes = static_cast<uint8_t*>(out);
+  while (size >= 8) {
+    uint64_t value = random_state.Next();
+    memcpy(bytes, &value, 8);
+    bytes += 8;
+    size -= 8;
+  }
+  if (size > 0) {
+    uint64_t value = random_state.Next();
+    memcpy(bytes, &value, size);
+  }
+}
+
+}  // namespace libwebsocket
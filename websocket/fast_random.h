@@ -0,0 +1,54 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  fast_random.h
+// @Version :  1.0
+// @Desc    :  None
+
+
+#ifndef WEBSOCKET_FAST_RANDOM_H_
+#define WEBSOCKET_FAST_RANDOM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+namespace libwebsocket {
+
+// 线程局部的xoshiro256**伪随机数发生器, 每个线程首次使用时从
+// getrandom取得种子, 之后不再加锁或进行系统调用.
+// 不是密码学安全的, 用于掩码和握手随机串等需要不可预测但吞吐优先的场合.
+uint64_t FastRandom64(void);
+// 填充size字节随机数据.
+void FastRandomFill(void* out, size_t size);
+// 生成一个4字节的帧掩码.
+inline void RandomMaskKey(uint8_t* out) {
+  uint64_t value = FastRandom64();
+  out[0] = static_cast<uint8_t>(value);
+  out[1] = static_cast<uint8_t>(value >> 8);
+  out[2] = static_cast<uint8_t>(value >> 16);
+  out[3] = static_cast<uint8_t>(value >> 24);
+}
+
+}  // namespace libwebsocket
+
+#endif  // WEBSOCKET_FAST_RANDOM_H_
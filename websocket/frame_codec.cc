@@ -0,0 +1,307 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  frame_codec.cc
+// @Version :  1.0
+// @Desc    :  None
+
+
+#include "frame_codec.h"
+
+#include <string.h>
+
+#include "fast_random.h"
+
+
+namespace libwebsocket {
+
+namespace {
+
+inline uint16_t LoadBigEndian16(char const* data) {
+  return static_cast<uint16_t>((static_cast<uint8_t>(data[0]) << 8) |
+                               static_cast<uint8_t>(data[1]));
+}
+
+inline void StoreBigEndian16(uint16_t value, uint8_t* out) {
+  out[0] = static_cast<uint8_t>(value >> 8);
+  out[1] = static_cast<uint8_t>(value);
+}
+
+inline uint64_t LoadBigEndian64(char const* data) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  uint64_t value;
+  memcpy(&value, data, 8);
+  return __builtin_bswap64(value);
+#elif defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  uint64_t value;
+  memcpy(&value, data, 8);
+  return value;
+#else
+  uint64_t value = 0;
+  for (int i = 0; i < 8; ++i) {
+    value = (value << 8) | static_cast<uint8_t>(data[i]);
+  }
+  return value;
+#endif
+}
+
+inline void StoreBigEndian64(uint64_t value, uint8_t* out) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  value = __builtin_bswap64(value);
+  memcpy(out, &value, 8);
+#elif defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  memcpy(out, &value, 8);
+#else
+  for (int i = 7; i >= 0; --i) {
+    out[i] = static_cast<uint8_t>(value);
+    value >>= 8;
+  }
+#endif
+}
+
+}  // namespace
+
+
+size_t EncodeFrameHeader(uint8_t flags, uint64_t payload_length,
+                         uint8_t const* mask_key, uint8_t* out) {
+  uint8_t const mask = (mask_key != nullptr) ? kFrameMaskBit : 0;
+  size_t pos = 2;
+  out[0] = flags;
+  if (payload_length < 126) {
+    out[1] = mask | static_cast<uint8_t>(payload_length);
+  } else if (payload_length < 65536) {
+    out[1] = mask | 126;
+    StoreBigEndian16(static_cast<uint16_t>(payload_length), out + 2);
+    pos = 4;
+  } else {
+    out[1] = mask | 127;
+    StoreBigEndian64(payload_length, out + 2);
+    pos = 10;
+  }
+  if (mask_key != nullptr) {
+    memcpy(out + pos, mask_key, 4);
+    pos += 4;
+  }
+  return pos;
+}
+
+int DecodeFrameHeader(char const* data, uint64_t size, FrameHeader* out) {
+  if (data == nullptr || out == nullptr) return kFrameParseError;
+  if (size < 2) return kFrameParseIncomplete;
+  uint8_t const first = static_cast<uint8_t>(data[0]);
+  uint8_t const second = static_cast<uint8_t>(data[1]);
+  out->fin = (first & kFrameFinBit) != 0;
+  out->reserve = first & kFrameRsvBits;
+  out->opcode = first & kFrameOpcodeBits;
+  // 0x3-0x7和0xB-0xF为保留操作码(RFC 6455 5.2).
+  if ((out->opcode & 0x7) > kOPCodeBinary) return kFrameParseError;
+  out->mask = (second & kFrameMaskBit) != 0;
+  uint64_t payload_length = second & 0x7F;
+  size_t pos = 2;
+  if (payload_length == 126) {
+    if (size < 4) return kFrameParseIncomplete;
+    payload_length = LoadBigEndian16(data + 2);
+    pos = 4;
+  } else if (payload_length == 127) {
+    if (size < 10) return kFrameParseIncomplete;
+    payload_length = LoadBigEndian64(data + 2);
+    // 最高位必须为0.
+    if (payload_length >> 63) return kFrameParseError;
+    pos = 10;
+  }
+  // 控制帧不可分片, 且负载不超过125字节.
+  if ((out->opcode & 0x8) && (!out->fin || payload_length > 125)) {
+    return kFrameParseError;
+  }
+  if (out->mask) {
+    if (size < pos + 4) return kFrameParseIncomplete;
+    memcpy(out->mask_key, data + pos, 4);
+    pos += 4;
+  }
+  out->payload_length = payload_length;
+  out->header_length = pos;
+  return kFrameParseOk;
+}
+
+void MaskPayload(char const* src, uint64_t size, uint8_t const* mask_key,
+                 char* dst) {
+  uint8_t pattern[8];
+  memcpy(pattern, mask_key, 4);
+  memcpy(pattern + 4, mask_key, 4);
+  uint64_t key;
+  memcpy(&key, pattern, 8);
+  uint64_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t value;
+    memcpy(&value, src + i, 8);
+    value ^= key;
+    memcpy(dst + i, &value, 8);
+  }
+  for (; i < size; ++i) dst[i] = src[i] ^ mask_key[i & 3];
+}
+
+void MaskPayload(char const* src, uint64_t size, uint8_t const* mask_key,
+                 uint64_t offset, char* dst) {
+  uint8_t rotated[4];
+  for (int i = 0; i < 4; ++i) rotated[i] = mask_key[(offset + i) & 3];
+  MaskPayload(src, size, rotated, dst);
+}
+
+template <FrameRole kRole>
+int FrameCodec<kRole>::Package(uint8_t flags, char const* payload,
+                               uint64_t size, std::vector<char>* out) {
+  if (out == nullptr || (payload == nullptr && size > 0)) return -1;
+  uint8_t header[kMaxFrameHeaderLength];
+  uint8_t mask_key[4];
+  if (kMaskOutbound) RandomMaskKey(mask_key);
+  size_t header_length = EncodeFrameHeader(
+      flags, size, kMaskOutbound ? mask_key : nullptr, header);
+  out->resize(header_length + size);
+  memcpy(out->data(), header, header_length);
+  if (size > 0) {
+    if (kMaskOutbound) {
+      MaskPayload(payload, size, mask_key, out->data() + header_length);
+    } else {
+      memcpy(out->data() + header_length, payload, size);
+    }
+  }
+  return 0;
+}
+
+template <FrameRole kRole>
+int FrameCodec<kRole>::PackageMessage(OPCodeType const& opcode,
+                                      char const* buffer, uint64_t size,
+                                      uint64_t fragment_size,
+                                      uint8_t reserve,
+                                      std::vector<std::vector<char>>* out) {
+  if (out == nullptr || (buffer == nullptr && size > 0)) return -1;
+  if (fragment_size == 0) fragment_size = size;
+  out->clear();
+  out->reserve(size / (fragment_size ? fragment_size : 1) + 1);
+  uint64_t offset = 0;
+  do {
+    uint64_t length = size - offset;
+    if (length > fragment_size) length = fragment_size;
+    uint8_t flags = (offset == 0) ?
+        static_cast<uint8_t>((reserve & kFrameRsvBits) | opcode) :
+        static_cast<uint8_t>(kOPCodePacket);
+    if (offset + length == size) flags |= kFrameFinBit;
+    out->emplace_back();
+    if (Package(flags, buffer + offset, length, &out->back()) != 0) {
+      return -1;
+    }
+    offset += length;
+  } while (offset < size);
+  return 0;
+}
+
+template <FrameRole kRole>
+int FrameCodec<kRole>::PackageMessage(OPCodeType const& opcode,
+                                      PayloadSegment const* segments,
+                                      size_t count, uint64_t fragment_size,
+                                      uint8_t reserve,
+                                      std::vector<char>* out,
+                                      std::vector<uint64_t>* frame_lengths) {
+  if (out == nullptr || (segments == nullptr && count > 0)) return -1;
+  uint64_t size = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (segments[i].data == nullptr && segments[i].size > 0) return -1;
+    size += segments[i].size;
+  }
+  if (fragment_size == 0 || fragment_size > size) fragment_size = size;
+  uint64_t const frames =
+      fragment_size ? (size + fragment_size - 1) / fragment_size : 1;
+  out->reserve(out->size() + size + frames * kMaxFrameHeaderLength);
+  size_t index = 0;  // 正在读取的片段.
+  uint64_t consumed = 0;  // 该片段已读取的字节数.
+  uint64_t offset = 0;
+  do {
+    uint64_t length = size - offset;
+    if (length > fragment_size) length = fragment_size;
+    uint8_t flags = (offset == 0) ?
+        static_cast<uint8_t>((reserve & kFrameRsvBits) | opcode) :
+        static_cast<uint8_t>(kOPCodePacket);
+    if (offset + length == size) flags |= kFrameFinBit;
+    uint8_t header[kMaxFrameHeaderLength];
+    uint8_t mask_key[4];
+    if (kMaskOutbound) RandomMaskKey(mask_key);
+    size_t header_length = EncodeFrameHeader(
+        flags, length, kMaskOutbound ? mask_key : nullptr, header);
+    size_t const position = out->size();
+    out->resize(position + header_length + length);
+    char* payload = out->data() + position;
+    memcpy(payload, header, header_length);
+    payload += header_length;
+    uint64_t written = 0;
+    while (written < length) {
+      while (consumed == segments[index].size) {
+        ++index;
+        consumed = 0;
+      }
+      uint64_t n = segments[index].size - consumed;
+      if (n > length - written) n = length - written;
+      char const* src = segments[index].data + consumed;
+      if (kMaskOutbound) {
+        MaskPayload(src, n, mask_key, written, payload + written);
+      } else {
+        memcpy(payload + written, src, n);
+      }
+      written += n;
+      consumed += n;
+    }
+    if (frame_lengths != nullptr) {
+      frame_lengths->push_back(header_length + length);
+    }
+    offset += length;
+  } while (offset < size);
+  return 0;
+}
+
+template <FrameRole kRole>
+int FrameCodec<kRole>::Parse(char* data, uint64_t size,
+                             uint64_t max_payload_length,
+                             FrameHeader* header, uint64_t* frame_length) {
+  if (header == nullptr || frame_length == nullptr) return kFrameParseError;
+  int ret = DecodeFrameHeader(data, size, header);
+  if (ret != kFrameParseOk) return ret;
+  // 服务端收到的帧必须带掩码, 客户端收到的帧不能带掩码.
+  if (header->mask == kMaskOutbound) return kFrameParseError;
+  // 负载长度在帧头解出后立即检查, 超出时不必等待负载到达.
+  if (!(header->opcode & 0x8) &&
+      header->payload_length > max_payload_length) {
+    return kFrameParseTooLarge;
+  }
+  if (size - header->header_length < header->payload_length) {
+    return kFrameParseIncomplete;
+  }
+  if (!kMaskOutbound) {
+    char* payload = data + header->header_length;
+    MaskPayload(payload, header->payload_length, header->mask_key, payload);
+  }
+  *frame_length = header->header_length + header->payload_length;
+  return kFrameParseOk;
+}
+
+template class FrameCodec<kClientRole>;
+template class FrameCodec<kServerRole>;
+
+}  // namespace libwebsocket
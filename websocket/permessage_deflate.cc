@@ -0,0 +1,639 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  permessage_deflate.cc
+// @Version :  1.0
+// @Desc    :  None
+
+
+#include "permessage_deflate.h"
+
+#include <string.h>
+
+#if defined(WEBSOCKET_ENABLE_DEFLATE)
+#include <zlib.h>
+#endif
+
+
+namespace libwebsocket {
+
+namespace {
+
+constexpr char kExtensionName[] = "permessage-deflate";
+// 每条压缩消息末尾被省略的空存储块.
+constexpr char kDeflateTrailer[] = {0x00, 0x00, '\xff', '\xff'};
+// 单个扩展最多接受的参数个数.
+constexpr size_t kMaxExtensionParams = 8;
+// 解压时每次扩充的输出空间.
+constexpr size_t kInflateChunkSize = 16*1024;
+
+// Sec-WebSocket-Extensions中的一个扩展, 不带值的参数value.data为空.
+struct Extension {
+  HttpToken name;
+  size_t param_count;
+  HttpToken params[kMaxExtensionParams];
+  HttpToken values[kMaxExtensionParams];
+};
+
+// 客户端请求或服务端响应中的permessage-deflate参数, 窗口为0表示未出现.
+struct DeflateParams {
+  bool server_no_context_takeover;
+  bool client_no_context_takeover;
+  bool has_server_max_window_bits;
+  bool has_client_max_window_bits;
+  int server_max_window_bits;
+  int client_max_window_bits;
+};
+
+inline bool IsOws(char const& ch) { return ch == ' ' || ch == '\t'; }
+
+inline HttpToken Trim(char const* begin, char const* end) {
+  while (begin < end && IsOws(*begin)) ++begin;
+  while (end > begin && IsOws(*(end-1))) --end;
+  return HttpToken {begin, static_cast<size_t>(end - begin)};
+}
+
+// 不区分大小写比较, name须为小写.
+inline bool TokenEquals(HttpToken const& token, char const* name) {
+  size_t size = strlen(name);
+  if (token.size != size) return false;
+  for (size_t i = 0; i < size; ++i) {
+    char ch = token.data[i];
+    if (ch >= 'A' && ch <= 'Z') ch += 'a' - 'A';
+    if (ch != name[i]) return false;
+  }
+  return true;
+}
+
+// 取出pos开始的下一个扩展, 引号内的逗号和分号不作为分隔符.
+// 返回1表示取得一个扩展, 0表示已到末尾, -1表示格式错误.
+int NextExtension(HttpToken const& list, size_t* pos, Extension* out) {
+  char const* p = list.data + *pos;
+  char const* end = list.data + list.size;
+  while (p < end && (IsOws(*p) || *p == ',')) ++p;
+  if (p == end) {
+    *pos = list.size;
+    return 0;
+  }
+  out->param_count = 0;
+  bool has_name = false;
+  while (p < end) {
+    char const* begin = p;
+    char const* equal = nullptr;
+    bool quoted = false;
+    for (; p < end; ++p) {
+      if (*p == '"') quoted = !quoted;
+      if (quoted) continue;
+      if (*p == ',' || *p == ';') break;
+      if (*p == '=' && equal == nullptr) equal = p;
+    }
+    if (quoted) return -1;
+    if (!has_name) {
+      if (equal != nullptr) return -1;
+      out->name = Trim(begin, p);
+      if (out->name.size == 0) return -1;
+      has_name = true;
+    } else {
+      if (out->param_count == kMaxExtensionParams) return -1;
+      size_t i = out->param_count++;
+      if (equal == nullptr) {
+        out->params[i] = Trim(begin, p);
+        out->values[i] = HttpToken {nullptr, 0};
+      } else {
+        out->params[i] = Trim(begin, equal);
+        HttpToken value = Trim(equal + 1, p);
+        if (value.size >= 2 && value.data[0] == '"' &&
+            value.data[value.size-1] == '"') {
+          value = HttpToken {value.data + 1, value.size - 2};
+        }
+        out->values[i] = value;
+      }
+      if (out->params[i].size == 0) return -1;
+    }
+    if (p == end || *p == ',') break;
+    ++p;  // 跳过';'.
+  }
+  *pos = p - list.data;
+  return 1;
+}
+
+// 解析窗口参数, 合法值为8-15.
+int ParseWindowBits(HttpToken const& value) {
+  if (value.data == nullptr || value.size == 0 || value.size > 2) return -1;
+  int bits = 0;
+  for (size_t i = 0; i < value.size; ++i) {
+    if (value.data[i] < '0' || value.data[i] > '9') return -1;
+    bits = bits*10 + (value.data[i] - '0');
+  }
+  return (bits >= 8 && bits <= 15) ? bits : -1;
+}
+
+// 解析permessage-deflate的参数, 未知参数, 重复参数或非法值时返回false.
+// client_max_window_bits在客户端请求中可以不带值.
+bool ParseDeflateParams(Extension const& extension, DeflateParams* out) {
+  *out = DeflateParams {};
+  for (size_t i = 0; i < extension.param_count; ++i) {
+    HttpToken const& name = extension.params[i];
+    HttpToken const& value = extension.values[i];
+    if (TokenEquals(name, "server_no_context_takeover")) {
+      if (out->server_no_context_takeover || value.data != nullptr) {
+        return false;
+      }
+      out->server_no_context_takeover = true;
+    } else if (TokenEquals(name, "client_no_context_takeover")) {
+      if (out->client_no_context_takeover || value.data != nullptr) {
+        return false;
+      }
+      out->client_no_context_takeover = true;
+    } else if (TokenEquals(name, "server_max_window_bits")) {
+      if (out->has_server_max_window_bits) return false;
+      out->has_server_max_window_bits = true;
+      out->server_max_window_bits = ParseWindowBits(value);
+      if (out->server_max_window_bits < 0) return false;
+    } else if (TokenEquals(name, "client_max_window_bits")) {
+      if (out->has_client_max_window_bits) return false;
+      out->has_client_max_window_bits = true;
+      if (value.data != nullptr) {
+        out->client_max_window_bits = ParseWindowBits(value);
+        if (out->client_max_window_bits < 0) return false;
+      }
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+inline int ClampWindowBits(int const& bits) {
+  return bits < 8 ? 8 : (bits > 15 ? 15 : bits);
+}
+
+#if defined(WEBSOCKET_ENABLE_DEFLATE)
+z_stream* NewDeflateStream(int const& level, int const& window_bits,
+                           int const& mem_level) {
+  z_stream* stream = new z_stream {};
+  if (deflateInit2(stream, level, Z_DEFLATED, -window_bits, mem_level,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    delete stream;
+    return nullptr;
+  }
+  return stream;
+}
+
+z_stream* NewInflateStream(int const& window_bits) {
+  z_stream* stream = new z_stream {};
+  if (inflateInit2(stream, -window_bits) != Z_OK) {
+    delete stream;
+    return nullptr;
+  }
+  return stream;
+}
+
+void DeleteStream(z_stream* stream, bool const& inflate) {
+  if (inflate) {
+    inflateEnd(stream);
+  } else {
+    deflateEnd(stream);
+  }
+  delete stream;
+}
+#endif
+
+}  // namespace
+
+
+bool DeflateAvailable(void) {
+#if defined(WEBSOCKET_ENABLE_DEFLATE)
+  return true;
+#else
+  return false;
+#endif
+}
+
+int DeflateNegotiate(HttpToken const& offers, DeflateOptions const& local,
+                     DeflateOptions* agreed, char* response, size_t capacity) {
+  if (agreed == nullptr || response == nullptr) return 0;
+  *agreed = DeflateOptions {};
+  if (!local.enabled || !DeflateAvailable() || offers.size == 0) return 0;
+  size_t pos = 0;
+  Extension extension;
+  DeflateParams params;
+  while (NextExtension(offers, &pos, &extension) > 0) {
+    if (!TokenEquals(extension.name, kExtensionName) ||
+        !ParseDeflateParams(extension, &params)) {
+      continue;
+    }
+    *agreed = local;
+    agreed->server_no_context_takeover =
+        params.server_no_context_takeover || local.server_no_context_takeover;
+    agreed->client_no_context_takeover =
+        params.client_no_context_takeover || local.client_no_context_takeover;
+    agreed->server_max_window_bits =
+        ClampWindowBits(local.server_max_window_bits);
+    if (params.has_server_max_window_bits &&
+        params.server_max_window_bits < agreed->server_max_window_bits) {
+      agreed->server_max_window_bits = params.server_max_window_bits;
+    }
+    // 客户端未声明client_max_window_bits时不能限制其压缩窗口.
+    agreed->client_max_window_bits = 15;
+    if (params.has_client_max_window_bits) {
+      agreed->client_max_window_bits =
+          ClampWindowBits(local.client_max_window_bits);
+      if (params.client_max_window_bits > 0 &&
+          params.client_max_window_bits < agreed->client_max_window_bits) {
+        agreed->client_max_window_bits = params.client_max_window_bits;
+      }
+    }
+    std::string value(kExtensionName);
+    if (agreed->server_no_context_takeover) {
+      value += "; server_no_context_takeover";
+    }
+    if (agreed->client_no_context_takeover) {
+      value += "; client_no_context_takeover";
+    }
+    if (params.has_server_max_window_bits ||
+        agreed->server_max_window_bits < 15) {
+      value += "; server_max_window_bits=" +
+               std::to_string(agreed->server_max_window_bits);
+    }
+    if (params.has_client_max_window_bits &&
+        agreed->client_max_window_bits < 15) {
+      value += "; client_max_window_bits=" +
+               std::to_string(agreed->client_max_window_bits);
+    }
+    if (value.size() > capacity) break;
+    memcpy(response, value.data(), value.size());
+    return value.size();
+  }
+  *agreed = DeflateOptions {};
+  return 0;
+}
+
+void DeflateOfferPackaging(DeflateOptions const& local, std::string* out) {
+  if (out == nullptr) return;
+  out->clear();
+  if (!local.enabled || !DeflateAvailable()) return;
+  out->assign(kExtensionName);
+  int client_bits = ClampWindowBits(local.client_max_window_bits);
+  int server_bits = ClampWindowBits(local.server_max_window_bits);
+  // 总是声明client_max_window_bits, 允许服务端限制客户端的压缩窗口.
+  *out += "; client_max_window_bits";
+  if (client_bits < 15) *out += "=" + std::to_string(client_bits);
+  if (server_bits < 15) {
+    *out += "; server_max_window_bits=" + std::to_string(server_bits);
+  }
+  if (local.server_no_context_takeover) *out += "; server_no_context_takeover";
+  if (local.client_no_context_takeover) *out += "; client_no_context_takeover";
+}
+
+int DeflateResponseParse(HttpToken const& extensions,
+                         DeflateOptions const& local, DeflateOptions* agreed) {
+  if (agreed == nullptr) return -1;
+  *agreed = DeflateOptions {};
+  if (extensions.size == 0) return 0;
+  if (!local.enabled || !DeflateAvailable()) return -1;
+  size_t pos = 0;
+  Extension extension;
+  DeflateParams params;
+  // 只请求了一个扩展, 响应中只能有一个permessage-deflate.
+  if (NextExtension(extensions, &pos, &extension) <= 0 ||
+      !TokenEquals(extension.name, kExtensionName) ||
+      !ParseDeflateParams(extension, &params) ||
+      NextExtension(extensions, &pos, &extension) != 0) {
+    return -1;
+  }
+  if (params.has_client_max_window_bits &&
+      params.client_max_window_bits == 0) {
+    return -1;
+  }
+  *agreed = local;
+  agreed->server_no_context_takeover = params.server_no_context_takeover;
+  agreed->client_no_context_takeover = params.client_no_context_takeover;
+  agreed->server_max_window_bits = params.has_server_max_window_bits ?
+      params.server_max_window_bits : 15;
+  agreed->client_max_window_bits =
+      ClampWindowBits(local.client_max_window_bits);
+  if (params.has_client_max_window_bits &&
+      params.client_max_window_bits < agreed->client_max_window_bits) {
+    agreed->client_max_window_bits = params.client_max_window_bits;
+  }
+  return 1;
+}
+
+DeflatePool::~DeflatePool() {
+#if defined(WEBSOCKET_ENABLE_DEFLATE)
+  for (auto const& entry : entries_) {
+    DeleteStream(entry.stream, entry.inflate);
+  }
+#endif
+}
+
+z_stream_s* DeflatePool::AcquireDeflate(int const& level,
+                                        int const& window_bits,
+                                        int const& mem_level) {
+#if defined(WEBSOCKET_ENABLE_DEFLATE)
+  z_stream* stream = Take(false, level, window_bits, mem_level);
+  return stream != nullptr ? stream :
+      NewDeflateStream(level, window_bits, mem_level);
+#else
+  return nullptr;
+#endif
+}
+
+z_stream_s* DeflatePool::AcquireInflate(int const& window_bits) {
+#if defined(WEBSOCKET_ENABLE_DEFLATE)
+  z_stream* stream = Take(true, 0, window_bits, 0);
+  return stream != nullptr ? stream : NewInflateStream(window_bits);
+#else
+  return nullptr;
+#endif
+}
+
+void DeflatePool::ReleaseDeflate(z_stream_s* stream, int const& level,
+                                 int const& window_bits,
+                                 int const& mem_level) {
+#if defined(WEBSOCKET_ENABLE_DEFLATE)
+  if (stream == nullptr) return;
+  if (deflateReset(stream) != Z_OK ||
+      !Put(Entry {stream, false, level, window_bits, mem_level})) {
+    DeleteStream(stream, false);
+  }
+#endif
+}
+
+void DeflatePool::ReleaseInflate(z_stream_s* stream, int const& window_bits) {
+#if defined(WEBSOCKET_ENABLE_DEFLATE)
+  if (stream == nullptr) return;
+  if (inflateReset(stream) != Z_OK ||
+      !Put(Entry {stream, true, 0, window_bits, 0})) {
+    DeleteStream(stream, true);
+  }
+#endif
+}
+
+z_stream_s* DeflatePool::Take(bool const& inflate, int const& level,
+                              int const& window_bits, int const& mem_level) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto it = entries_.rbegin(); it != entries_.rend(); ++it) {
+    if (it->inflate == inflate && it->level == level &&
+        it->window_bits == window_bits && it->mem_level == mem_level) {
+      z_stream_s* stream = it->stream;
+      *it = entries_.back();
+      entries_.pop_back();
+      return stream;
+    }
+  }
+  return nullptr;
+}
+
+bool DeflatePool::Put(Entry const& entry) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (entries_.size() >= max_size_) return false;
+  entries_.push_back(entry);
+  return true;
+}
+
+PerMessageDeflate::PerMessageDeflate()
+    : deflate_window_bits_(15),
+      inflate_window_bits_(15),
+      deflate_no_context_takeover_(false),
+      inflate_no_context_takeover_(false),
+      deflate_used_(false),
+      inflate_used_(false),
+      inflate_in_message_(false),
+      pool_(nullptr),
+      deflate_(nullptr),
+      inflate_(nullptr) {
+}
+
+PerMessageDeflate::~PerMessageDeflate() {
+  ReleaseDeflate();
+  inflate_no_context_takeover_ = true;  // 不再需要保存上下文.
+  ReleaseInflate();
+}
+
+void PerMessageDeflate::Reset(DeflateOptions const& agreed, bool is_server) {
+  // 参数可能变化, 先归还旧参数下的流, 之后按新参数重新取出.
+  ReleaseDeflate();
+  inflate_no_context_takeover_ = true;
+  ReleaseInflate();
+  std::vector<char>().swap(dictionary_);
+  agreed_ = agreed;
+  if (is_server) {
+    deflate_window_bits_ = agreed.server_max_window_bits;
+    inflate_window_bits_ = agreed.client_max_window_bits;
+    deflate_no_context_takeover_ = agreed.server_no_context_takeover;
+    inflate_no_context_takeover_ = agreed.client_no_context_takeover;
+  } else {
+    deflate_window_bits_ = agreed.client_max_window_bits;
+    inflate_window_bits_ = agreed.server_max_window_bits;
+    deflate_no_context_takeover_ = agreed.client_no_context_takeover;
+    inflate_no_context_takeover_ = agreed.server_no_context_takeover;
+  }
+  // 基于zlib的对端协商256字节窗口时实际使用512字节.
+  if (inflate_window_bits_ < 9) inflate_window_bits_ = 9;
+  deflate_used_ = false;
+  inflate_used_ = false;
+  inflate_in_message_ = false;
+}
+
+int PerMessageDeflate::Compress(char const* data, size_t size,
+                                std::vector<char>* out) {
+#if defined(WEBSOCKET_ENABLE_DEFLATE)
+  if (out == nullptr || (data == nullptr && size > 0)) return -1;
+  // zlib的原始deflate流不支持256字节窗口, 此时只能不压缩发送.
+  if (!agreed_.enabled || deflate_window_bits_ < 9) return 1;
+  // 空消息在已刷新的流上不产生输出, 直接不压缩发送.
+  if (size == 0) return 1;
+  // 保持上下文时压缩过的数据必须发出, 否则对端的上下文会不一致.
+  if (size < agreed_.min_size && deflate_no_context_takeover_) return 1;
+  if (deflate_ == nullptr && !AcquireDeflate()) return -1;
+  deflate_used_ = true;
+  out->resize(deflateBound(deflate_, size) + 16);
+  deflate_->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+  deflate_->avail_in = size;
+  size_t produced = 0;
+  do {
+    if (produced == out->size()) out->resize(out->size()*2);
+    deflate_->next_out = reinterpret_cast<Bytef*>(out->data() + produced);
+    deflate_->avail_out = out->size() - produced;
+    int ret = deflate(deflate_, Z_SYNC_FLUSH);
+    produced = out->size() - deflate_->avail_out;
+    if (ret != Z_OK && ret != Z_BUF_ERROR) {
+      deflateReset(deflate_);
+      return -1;
+    }
+  } while (deflate_->avail_in > 0 || deflate_->avail_out == 0);
+  if (produced < sizeof(kDeflateTrailer) ||
+      memcmp(out->data() + produced - sizeof(kDeflateTrailer),
+             kDeflateTrailer, sizeof(kDeflateTrailer)) != 0) {
+    deflateReset(deflate_);
+    return -1;
+  }
+  out->resize(produced - sizeof(kDeflateTrailer));
+  if (deflate_no_context_takeover_) {
+    deflateReset(deflate_);
+    if (out->size() >= size) return 1;
+  }
+  return 0;
+#else
+  return 1;
+#endif
+}
+
+int PerMessageDeflate::Decompress(char const* data, size_t size, bool fin,
+                                  uint64_t max_size, std::vector<char>* out) {
+  if (out == nullptr || (data == nullptr && size > 0)) return kInflateError;
+  out->clear();
+  int ret = Inflate(data, size, max_size, out);
+  if (ret == kInflateOk && fin) {
+    ret = Inflate(kDeflateTrailer, sizeof(kDeflateTrailer), max_size, out);
+  }
+  inflate_in_message_ = !fin;
+#if defined(WEBSOCKET_ENABLE_DEFLATE)
+  if (inflate_ != nullptr &&
+      (ret != kInflateOk || (fin && inflate_no_context_takeover_))) {
+    inflateReset(inflate_);
+  }
+#endif
+  return ret;
+}
+
+void PerMessageDeflate::ReleaseIdleDeflate(void) {
+  if (!deflate_used_) ReleaseDeflate();
+  deflate_used_ = false;
+}
+
+void PerMessageDeflate::ReleaseIdleInflate(void) {
+  // 分片消息的中途不能丢弃解压流中尚未输出的状态.
+  if (!inflate_used_ && !inflate_in_message_) ReleaseInflate();
+  inflate_used_ = false;
+}
+
+int PerMessageDeflate::Inflate(char const* data, size_t size,
+                               uint64_t max_size, std::vector<char>* out) {
+#if defined(WEBSOCKET_ENABLE_DEFLATE)
+  if (!agreed_.enabled) return kInflateError;
+  if (inflate_ == nullptr && !AcquireInflate()) return kInflateError;
+  inflate_used_ = true;
+  inflate_->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+  inflate_->avail_in = size;
+  size_t produced = out->size();
+  do {
+    if (out->size() - produced < kInflateChunkSize) {
+      out->resize(produced + kInflateChunkSize);
+    }
+    inflate_->next_out = reinterpret_cast<Bytef*>(out->data() + produced);
+    inflate_->avail_out = out->size() - produced;
+    int ret = inflate(inflate_, Z_SYNC_FLUSH);
+    produced = out->size() - inflate_->avail_out;
+    if (ret == Z_STREAM_END) {
+      // 对端发送了最终块, 之后的数据属于新的deflate流.
+      inflateReset(inflate_);
+    } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+      out->resize(produced);
+      return kInflateError;
+    }
+    if (produced > max_size) {
+      out->resize(produced);
+      return kInflateTooLarge;
+    }
+  } while (inflate_->avail_in > 0 || inflate_->avail_out == 0);
+  out->resize(produced);
+  return kInflateOk;
+#else
+  (void)data;
+  (void)size;
+  (void)max_size;
+  (void)out;
+  return kInflateError;
+#endif
+}
+
+bool PerMessageDeflate::AcquireDeflate(void) {
+#if defined(WEBSOCKET_ENABLE_DEFLATE)
+  deflate_ = (pool_ != nullptr) ?
+      pool_->AcquireDeflate(agreed_.level, deflate_window_bits_,
+                            agreed_.mem_level) :
+      NewDeflateStream(agreed_.level, deflate_window_bits_,
+                       agreed_.mem_level);
+  return deflate_ != nullptr;
+#else
+  return false;
+#endif
+}
+
+bool PerMessageDeflate::AcquireInflate(void) {
+#if defined(WEBSOCKET_ENABLE_DEFLATE)
+  inflate_ = (pool_ != nullptr) ?
+      pool_->AcquireInflate(inflate_window_bits_) :
+      NewInflateStream(inflate_window_bits_);
+  if (inflate_ == nullptr) return false;
+  if (!dictionary_.empty()) {
+    // 恢复归还解压流前保存的上下文.
+    int ret = inflateSetDictionary(
+        inflate_, reinterpret_cast<Bytef const*>(dictionary_.data()),
+        dictionary_.size());
+    std::vector<char>().swap(dictionary_);
+    if (ret != Z_OK) return false;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+void PerMessageDeflate::ReleaseDeflate(void) {
+#if defined(WEBSOCKET_ENABLE_DEFLATE)
+  if (deflate_ == nullptr) return;
+  if (pool_ != nullptr) {
+    pool_->ReleaseDeflate(deflate_, agreed_.level, deflate_window_bits_,
+                          agreed_.mem_level);
+  } else {
+    DeleteStream(deflate_, false);
+  }
+  deflate_ = nullptr;
+#endif
+}
+
+void PerMessageDeflate::ReleaseInflate(void) {
+#if defined(WEBSOCKET_ENABLE_DEFLATE)
+  if (inflate_ == nullptr) return;
+  if (!inflate_no_context_takeover_) {
+    uInt length = 0;
+    inflateGetDictionary(inflate_, nullptr, &length);
+    dictionary_.resize(length);
+    if (length > 0) {
+      inflateGetDictionary(
+          inflate_, reinterpret_cast<Bytef*>(dictionary_.data()), &length);
+    }
+  }
+  if (pool_ != nullptr) {
+    pool_->ReleaseInflate(inflate_, inflate_window_bits_);
+  } else {
+    DeleteStream(inflate_, true);
+  }
+  inflate_ = nullptr;
+#endif
+}
+
+}  // namespace libwebsocket
@@ -0,0 +1,208 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  permessage_deflate.h
+// @Version :  1.0
+// @Desc    :  None
+
+
+#ifndef WEBSOCKET_PERMESSAGE_DEFLATE_H_
+#define WEBSOCKET_PERMESSAGE_DEFLATE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "websocket.h"
+
+
+struct z_stream_s;
+
+namespace libwebsocket {
+
+// permessage-deflate扩展参数(RFC 7692).
+// 作为本端配置时表示期望的参数, 作为协商结果时表示双方约定的参数.
+struct DeflateOptions {
+  bool enabled = false;  // 是否启用.
+  int level = 6;  // 压缩级别, 1-9.
+  int server_max_window_bits = 15;  // 服务端压缩使用的LZ77窗口, 8-15.
+  int client_max_window_bits = 15;  // 客户端压缩使用的LZ77窗口, 8-15.
+  bool server_no_context_takeover = false;  // 服务端每条消息重置压缩上下文.
+  bool client_no_context_takeover = false;  // 客户端每条消息重置压缩上下文.
+  size_t min_size = 64;  // 小于该长度的消息不压缩.
+  int mem_level = 8;  // zlib压缩内存级别, 1-9, 越小压缩流占用内存越少.
+  // 压缩/解压流空闲超过该时间(毫秒)后归还到池中, 0表示一直保留.
+  int release_idle_ms = 30000;
+};
+
+// 解压返回值.
+enum InflateResult {
+  kInflateOk = 0,  // 解压成功.
+  kInflateError = -1,  // 数据非法.
+  kInflateTooLarge = -2,  // 解压后长度超过限制.
+};
+
+// 是否编译了zlib支持, 不支持时协商总是拒绝该扩展.
+bool DeflateAvailable(void);
+// 服务端从客户端的Sec-WebSocket-Extensions中选择第一个可接受的
+// permessage-deflate请求, 将约定的参数写入agreed, 响应头部的值写入response.
+// 返回响应值的长度, 没有可接受的请求或本端未启用时返回0.
+int DeflateNegotiate(HttpToken const& offers, DeflateOptions const& local,
+                     DeflateOptions* agreed, char* response, size_t capacity);
+// 客户端根据本端配置生成Sec-WebSocket-Extensions的值, 未启用时为空.
+void DeflateOfferPackaging(DeflateOptions const& local, std::string* out);
+// 客户端检查服务端响应的Sec-WebSocket-Extensions, 返回1表示启用扩展,
+// 0表示服务端未接受, -1表示响应中含有未请求的扩展或参数, 须关闭连接.
+int DeflateResponseParse(HttpToken const& extensions,
+                         DeflateOptions const& local, DeflateOptions* agreed);
+
+// zlib流对象池, 按参数缓存空闲的压缩/解压流, 供多个连接复用.
+// 缓存数量超过上限时直接释放归还的流. 所有接口均可在任意线程调用.
+class DeflatePool {
+ public:
+  explicit DeflatePool(size_t const& max_size = 32) : max_size_(max_size) {}
+  DeflatePool(DeflatePool const&) = delete;
+  DeflatePool& operator=(DeflatePool const&) = delete;
+  ~DeflatePool();
+
+  // 取出参数匹配的压缩流, 没有时新建, 失败时返回空指针.
+  z_stream_s* AcquireDeflate(int const& level, int const& window_bits,
+                             int const& mem_level);
+  // 取出窗口匹配的解压流, 没有时新建, 失败时返回空指针.
+  z_stream_s* AcquireInflate(int const& window_bits);
+  // 重置并归还压缩流, 参数须与取出时一致.
+  void ReleaseDeflate(z_stream_s* stream, int const& level,
+                      int const& window_bits, int const& mem_level);
+  // 重置并归还解压流, 参数须与取出时一致.
+  void ReleaseInflate(z_stream_s* stream, int const& window_bits);
+  // 当前缓存的流数量.
+  size_t size(void) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+  }
+
+ private:
+  struct Entry {
+    z_stream_s* stream;
+    bool inflate;  // 是否为解压流.
+    int level;
+    int window_bits;
+    int mem_level;
+  };
+  // 取出匹配的缓存项, 没有时返回空指针.
+  z_stream_s* Take(bool const& inflate, int const& level,
+                   int const& window_bits, int const& mem_level);
+  // 缓存归还的流, 超出上限时返回false.
+  bool Put(Entry const& entry);
+
+  std::vector<Entry> entries_;  // 空闲的流.
+  size_t max_size_;  // 缓存数量上限.
+  std::mutex mutex_;  // 缓存互斥锁.
+};
+
+// 单个连接的压缩/解压上下文.
+// zlib流在第一次使用时创建, 设置了对象池时从池中取出, 空闲后可归还到池中,
+// 因此空闲连接几乎不占用压缩相关的内存. Reset后可复用于新的连接.
+// 非线程安全, 压缩和解压可分别在不同线程中调用.
+//
+// Example:
+//    PerMessageDeflate deflate;
+//    deflate.Reset(agreed, true);
+//    std::vector<char> payload;
+//    if (deflate.Compress(data, size, &payload) == 0) {
+//      // 以RSV1置位的数据帧发送payload.
+//    }
+class PerMessageDeflate {
+ public:
+  PerMessageDeflate();
+  PerMessageDeflate(PerMessageDeflate const&) = delete;
+  PerMessageDeflate& operator=(PerMessageDeflate const&) = delete;
+  ~PerMessageDeflate();
+
+  // 设置zlib流对象池, 为空时直接创建和释放, 须在Reset之前调用.
+  void SetPool(DeflatePool* pool) { pool_ = pool; }
+  // 按协商结果重新设置上下文, is_server指明本端角色.
+  void Reset(DeflateOptions const& agreed, bool is_server);
+  // 是否已协商启用.
+  bool enabled(void) const { return agreed_.enabled; }
+  // 协商结果.
+  DeflateOptions const& agreed(void) const { return agreed_; }
+  // 本端压缩是否每条消息重置上下文, 此时压缩结果只取决于压缩参数.
+  bool stateless(void) const { return deflate_no_context_takeover_; }
+  // 本端压缩参数是否相同, 相同且stateless时同一消息的压缩结果相同.
+  bool SameCompression(PerMessageDeflate const& other) const {
+    return agreed_.level == other.agreed_.level &&
+           agreed_.mem_level == other.agreed_.mem_level &&
+           agreed_.min_size == other.agreed_.min_size &&
+           deflate_window_bits_ == other.deflate_window_bits_;
+  }
+
+  // 压缩一条完整消息, 结果不含末尾的00 00 ff ff.
+  // 返回0表示以压缩形式发送out, 1表示应以未压缩形式发送原数据, -1表示失败.
+  int Compress(char const* data, size_t size, std::vector<char>* out);
+  // 解压消息的一个分片负载, out被清空后写入解压结果, fin为消息最后一个分片.
+  // 解压结果超过max_size时返回kInflateTooLarge.
+  int Decompress(char const* data, size_t size, bool fin,
+                 uint64_t max_size, std::vector<char>* out);
+
+  // 自上次调用以来没有压缩过消息时归还压缩流, 与Compress在同一线程或锁内调用.
+  // 压缩端丢弃上下文不影响对端解压, 之后的消息使用新的压缩流.
+  void ReleaseIdleDeflate(void);
+  // 自上次调用以来没有解压过数据时归还解压流, 与Decompress在同一线程调用.
+  // 对端保留上下文时只保存最近窗口大小的解压结果, 下次使用时作为字典恢复.
+  void ReleaseIdleInflate(void);
+  // 当前持有的zlib流数量, 用于统计内存占用.
+  int streams(void) const {
+    return (deflate_ != nullptr) + (inflate_ != nullptr);
+  }
+
+ private:
+  // 将数据送入解压流并追加到out.
+  int Inflate(char const* data, size_t size, uint64_t max_size,
+              std::vector<char>* out);
+  // 创建或取出压缩/解压流.
+  bool AcquireDeflate(void);
+  bool AcquireInflate(void);
+  // 释放或归还压缩/解压流.
+  void ReleaseDeflate(void);
+  void ReleaseInflate(void);
+
+  DeflateOptions agreed_;  // 协商结果.
+  int deflate_window_bits_;  // 本端压缩窗口.
+  int inflate_window_bits_;  // 对端压缩窗口.
+  bool deflate_no_context_takeover_;  // 本端压缩是否重置上下文.
+  bool inflate_no_context_takeover_;  // 对端压缩是否重置上下文.
+  bool deflate_used_;  // 上次检查空闲以来是否压缩过.
+  bool inflate_used_;  // 上次检查空闲以来是否解压过.
+  bool inflate_in_message_;  // 是否处于压缩消息的分片之间.
+  std::vector<char> dictionary_;  // 归还解压流时保存的上下文.
+  DeflatePool* pool_;  // zlib流对象池.
+  z_stream_s* deflate_;  // 压缩流.
+  z_stream_s* inflate_;  // 解压流.
+};
+
+}  // namespace libwebsocket
+
+#endif  // WEBSOCKET_PERMESSAGE_DEFLATE_H_
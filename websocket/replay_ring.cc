@@ -0,0 +1,350 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  replay_ring.cc
+// @Version :  1.0
+// @Desc    :  None
+
+#include "replay_ring.h"
+
+#include <string.h>
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace libwebsocket {
+
+namespace {
+
+constexpr uint32_t kRingMagic = 0x52525357;  // "WSRR".
+constexpr uint32_t kRingVersion = 1;
+// 数据区的最小容量.
+constexpr size_t kMinCapacity = 64;
+// 记录头: 序号(8), 负载长度(4), 操作码(1), 保留(3).
+constexpr uint64_t kRecordHeaderLength = 16;
+// 记录头中的长度为该值时表示其后到数据区末尾的空间被跳过.
+constexpr uint32_t kSkipMarker = 0xFFFFFFFF;
+
+struct RecordHeader {
+  uint64_t seq;
+  uint32_t length;
+  uint8_t opcode;
+  uint8_t reserved[3];
+};
+static_assert(sizeof(RecordHeader) == kRecordHeaderLength,
+              "unexpected record header size");
+
+// 记录占用的字节数, 按8字节对齐.
+inline uint64_t RecordSize(uint64_t length) {
+  return (kRecordHeaderLength + length + 7) & ~static_cast<uint64_t>(7);
+}
+
+}  // namespace
+
+// 存储开头的缓冲区头部, 映射到文件时随记录一起保存.
+// 数据区中[head, tail)为有效记录, tail不大于head且count不为0时
+// 有效记录绕过了数据区末尾.
+struct ReplayRing::Header {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t capacity;  // 数据区字节数.
+  uint64_t head;  // 最早一条记录的位置.
+  uint64_t tail;  // 下一条记录的写入位置.
+  uint64_t count;  // 记录数.
+  uint64_t first_seq;  // 最早一条记录的序号.
+  uint64_t next_seq;  // 下一条记录的序号.
+};
+
+int ReplayRing::Open(size_t capacity) {
+  Close(false);
+  capacity &= ~static_cast<size_t>(7);
+  if (capacity < kMinCapacity) return -1;
+  memory_.reset(new char[sizeof(Header) + capacity]);
+  Attach(memory_.get(), capacity);
+  return 0;
+}
+
+// 先读出已有文件的头部校验格式, 有效时按文件中的容量映射后再校验所有记录,
+// 之后的追加和丢弃只需信任头部和记录中的长度.
+int ReplayRing::Map(std::string const& path, size_t capacity,
+                    bool const& create) {
+  Close(false);
+#if defined(__linux__)
+  int fd = open(path.c_str(), create ? (O_RDWR | O_CREAT) : O_RDWR, 0600);
+  if (fd < 0) return -1;
+  struct stat st;
+  Header existing {};
+  bool valid = fstat(fd, &st) == 0 &&
+      static_cast<size_t>(st.st_size) >= sizeof(Header) &&
+      pread(fd, &existing, sizeof(existing), 0) ==
+          static_cast<ssize_t>(sizeof(existing)) &&
+      existing.magic == kRingMagic && existing.version == kRingVersion &&
+      existing.capacity >= kMinCapacity && existing.capacity % 8 == 0 &&
+      static_cast<uint64_t>(st.st_size) == sizeof(Header) + existing.capacity &&
+      existing.head <= existing.capacity && existing.tail <= existing.capacity &&
+      existing.first_seq <= existing.next_seq &&
+      existing.count <= existing.next_seq - existing.first_seq;
+  if (valid) {
+    size_t const size = sizeof(Header) + existing.capacity;
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                        fd, 0);
+    if (memory != MAP_FAILED) {
+      Attach(static_cast<char*>(memory), 0);
+      if (CheckRecords()) {
+        close(fd);
+        map_size_ = size;
+        path_ = path;
+        return 0;
+      }
+      munmap(memory, size);
+      header_ = nullptr;
+      data_ = nullptr;
+    }
+  }
+  capacity &= ~static_cast<size_t>(7);
+  if (!create || capacity < kMinCapacity ||
+      ftruncate(fd, sizeof(Header) + capacity) != 0) {
+    close(fd);
+    return -1;
+  }
+  size_t const size = sizeof(Header) + capacity;
+  void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED) return -1;
+  map_size_ = size;
+  path_ = path;
+  Attach(static_cast<char*>(memory), capacity);
+  return 0;
+#else
+  (void)path;
+  (void)capacity;
+  (void)create;
+  return -1;
+#endif
+}
+
+void ReplayRing::Close(bool const& remove_file) {
+#if defined(__linux__)
+  if (map_size_ > 0) {
+    munmap(header_, map_size_);
+    if (remove_file) unlink(path_.c_str());
+  }
+#endif
+  header_ = nullptr;
+  data_ = nullptr;
+  memory_.reset();
+  map_size_ = 0;
+  path_.clear();
+}
+
+void ReplayRing::Attach(char* memory, size_t capacity) {
+  header_ = reinterpret_cast<Header*>(memory);
+  data_ = memory + sizeof(Header);
+  if (capacity == 0) return;
+  header_->magic = kRingMagic;
+  header_->version = kRingVersion;
+  header_->capacity = capacity;
+  header_->head = 0;
+  header_->tail = 0;
+  header_->count = 0;
+  header_->first_seq = 1;
+  header_->next_seq = 1;
+}
+
+uint64_t ReplayRing::Wrap(uint64_t pos) const {
+  if (header_->capacity - pos < kRecordHeaderLength) return 0;
+  uint32_t length = 0;
+  memcpy(&length, data_ + pos + 8, sizeof(length));
+  return length == kSkipMarker ? 0 : pos;
+}
+
+void ReplayRing::EvictOldest(void) {
+  uint64_t const pos = Wrap(header_->head);
+  RecordHeader record;
+  memcpy(&record, data_ + pos, sizeof(record));
+  header_->head = pos + RecordSize(record.length);
+  header_->first_seq = record.seq + 1;
+  --header_->count;
+}
+
+// 记录数须等于序号之差, 从head起的每条记录不越出数据区且序号连续,
+// 最后一条记录结束于tail; tail不大于head时记录恰好绕过数据区末尾一次,
+// 否则不绕过. 满足这些条件时Append计算的空闲空间不会与保留的记录重叠.
+bool ReplayRing::CheckRecords(void) const {
+  Header const* const h = header_;
+  if (h->count != h->next_seq - h->first_seq) return false;
+  if (h->count == 0) return true;
+  uint64_t pos = h->head;
+  int wraps = 0;
+  for (uint64_t i = 0; i < h->count; ++i) {
+    uint64_t const next = Wrap(pos);
+    if (next < pos) ++wraps;
+    pos = next;
+    RecordHeader record;
+    memcpy(&record, data_ + pos, sizeof(record));
+    if (record.seq != h->first_seq + i || record.length == kSkipMarker ||
+        RecordSize(record.length) > h->capacity - pos) {
+      return false;
+    }
+    pos += RecordSize(record.length);
+  }
+  return pos == h->tail && wraps == (h->tail <= h->head ? 1 : 0);
+}
+
+// 记录不跨越数据区末尾: 末尾剩余空间不足时写入跳过标记并从开头写入,
+// 需要的空间由丢弃最早的记录腾出.
+uint64_t ReplayRing::Append(uint8_t const& opcode, char const* data,
+                            size_t size) {
+  if (header_ == nullptr) return 0;
+  Header* const h = header_;
+  uint64_t const seq = h->next_seq++;
+  uint64_t const need = RecordSize(size);
+  if (size >= kSkipMarker || need > h->capacity) {
+    h->head = 0;
+    h->tail = 0;
+    h->count = 0;
+    h->first_seq = h->next_seq;
+    return seq;
+  }
+  while (true) {
+    if (h->count == 0) {
+      h->head = 0;
+      h->tail = 0;
+    }
+    if (h->count == 0 || h->tail > h->head) {
+      // 空闲空间为[tail, capacity)和[0, head).
+      if (h->capacity - h->tail >= need) break;
+      if (h->head >= need) {
+        if (h->capacity - h->tail >= kRecordHeaderLength) {
+          memcpy(data_ + h->tail + 8, &kSkipMarker, sizeof(kSkipMarker));
+        }
+        h->tail = 0;
+        break;
+      }
+    } else if (h->head - h->tail >= need) {
+      // 空闲空间为[tail, head).
+      break;
+    }
+    EvictOldest();
+  }
+  RecordHeader record {};
+  record.seq = seq;
+  record.length = static_cast<uint32_t>(size);
+  record.opcode = opcode;
+  memcpy(data_ + h->tail, &record, sizeof(record));
+  if (size > 0) memcpy(data_ + h->tail + kRecordHeaderLength, data, size);
+  h->tail += need;
+  if (h->count == 0) h->first_seq = seq;
+  ++h->count;
+  return seq;
+}
+
+// 映射的文件可能已损坏, 读取时校验每条记录不越出数据区且序号连续.
+int ReplayRing::ReadAfter(uint64_t const& seq, Visitor const& visitor) const {
+  if (header_ == nullptr) return -1;
+  Header const* const h = header_;
+  if (seq >= h->next_seq || seq + 1 < h->first_seq) return -1;
+  uint64_t pos = h->head;
+  uint64_t expected = h->first_seq;
+  int count = 0;
+  for (uint64_t i = 0; i < h->count; ++i) {
+    pos = Wrap(pos);
+    RecordHeader record;
+    memcpy(&record, data_ + pos, sizeof(record));
+    uint64_t const record_size = RecordSize(record.length);
+    if (record.seq != expected++ || record.length == kSkipMarker ||
+        record_size > h->capacity - pos) {
+      return -1;
+    }
+    if (record.seq > seq) {
+      visitor(record.seq, record.opcode, data_ + pos + kRecordHeaderLength,
+              record.length);
+      ++count;
+    }
+    pos += record_size;
+  }
+  return count;
+}
+
+uint64_t ReplayRing::next_sequence(void) const {
+  return header_ != nullptr ? header_->next_seq : 0;
+}
+
+uint64_t ReplayRing::first_sequence(void) const {
+  return header_ != nullptr ? header_->first_seq : 0;
+}
+
+size_t ReplayRing::size(void) const {
+  return header_ != nullptr ? header_->count : 0;
+}
+
+void EncodeSequence(uint64_t const& seq, char* out) {
+  for (size_t i = 0; i < kSequenceLength; ++i) {
+    out[i] = static_cast<char>(seq >> (8*(kSequenceLength - 1 - i)));
+  }
+}
+
+uint64_t DecodeSequence(char const* data) {
+  uint64_t seq = 0;
+  for (size_t i = 0; i < kSequenceLength; ++i) {
+    seq = (seq << 8) | static_cast<uint8_t>(data[i]);
+  }
+  return seq;
+}
+
+int ResumeTokenParse(HttpToken const& token, std::string* session_id,
+                     uint64_t* seq) {
+  if (token.data == nullptr || session_id == nullptr || seq == nullptr) {
+    return -1;
+  }
+  if (token.size == 3 && memcmp(token.data, "new", 3) == 0) {
+    session_id->clear();
+    *seq = 0;
+    return 0;
+  }
+  // 序号最多20位十进制数.
+  if (token.size < kSessionIdLength + 2 || token.size > kSessionIdLength + 21 ||
+      token.data[kSessionIdLength] != ' ') {
+    return -1;
+  }
+  for (size_t i = 0; i < kSessionIdLength; ++i) {
+    char const c = token.data[i];
+    if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) return -1;
+  }
+  uint64_t value = 0;
+  for (size_t i = kSessionIdLength + 1; i < token.size; ++i) {
+    char const c = token.data[i];
+    uint64_t const digit = c - '0';
+    if (c < '0' || c > '9' || value > (UINT64_MAX - digit)/10) return -1;
+    value = value*10 + digit;
+  }
+  session_id->assign(token.data, kSessionIdLength);
+  *seq = value;
+  return 0;
+}
+
+}  // namespace libwebsocket
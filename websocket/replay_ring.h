@@ -0,0 +1,125 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  replay_ring.h
+// @Version :  1.0
+// @Desc    :  None
+
+#ifndef WEBSOCKET_REPLAY_RING_H_
+#define WEBSOCKET_REPLAY_RING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "websocket.h"
+
+
+namespace libwebsocket {
+
+// 按字节容量限制的消息重放环形缓冲区.
+// 每条记录保存消息的序号, 操作码和负载, 序号从1开始连续递增; 空间不足时
+// 丢弃最早的记录. 存储可以是堆内存, 也可以是映射到文件的共享内存,
+// 后者在进程重启后仍保留其中的记录. 接口不加锁, 由调用方保证互斥.
+//
+// Example:
+//     ReplayRing ring;
+//     ring.Open(1024*1024);
+//     uint64_t seq = ring.Append(kOPCodeText, "hello", 5);
+//     // 重放序号大于last的消息.
+//     ring.ReadAfter(last, [] (uint64_t const& seq, uint8_t const& opcode,
+//                              char const* data, size_t const& size) {
+//       ...
+//     });
+class ReplayRing {
+ public:
+  // 遍历记录的回调函数定义.
+  using Visitor = std::function<void (uint64_t const& seq,
+      uint8_t const& opcode, char const* data, size_t const& size)>;
+
+  ReplayRing() : header_(nullptr), data_(nullptr), map_size_(0) {}
+  ~ReplayRing() { Close(false); }
+  ReplayRing(ReplayRing const&) = delete;
+  ReplayRing& operator=(ReplayRing const&) = delete;
+
+  // 在堆内存中创建容量为capacity字节的空缓冲区.
+  int Open(size_t capacity);
+  // 将缓冲区映射到文件path. 文件已存在, 格式有效且所有记录完好时恢复其中
+  // 的记录并沿用文件的容量; 否则create为true时创建容量为capacity字节的
+  // 空缓冲区, 为false时返回-1. 只支持Linux.
+  int Map(std::string const& path, size_t capacity, bool const& create = true);
+  // 释放存储, remove_file为true时同时删除映射的文件.
+  void Close(bool const& remove_file);
+  bool is_open(void) const { return header_ != nullptr; }
+
+  // 追加一条记录并返回其序号. 单条记录超过容量时不保存, 之前的记录也一并
+  // 丢弃, 使之后的重放不会跳过该消息.
+  uint64_t Append(uint8_t const& opcode, char const* data, size_t size);
+  // 按序号顺序回调序号大于seq的所有记录, 返回回调的记录数.
+  // seq之后的记录已被丢弃或seq超出已分配的序号时返回-1.
+  int ReadAfter(uint64_t const& seq, Visitor const& visitor) const;
+  // 下一条记录的序号.
+  uint64_t next_sequence(void) const;
+  // 最早一条保留记录的序号, 没有记录时等于next_sequence.
+  uint64_t first_sequence(void) const;
+  // 保留的记录数.
+  size_t size(void) const;
+
+ private:
+  struct Header;
+
+  // 从有效的头部开始使用存储, capacity不为0时初始化为空缓冲区.
+  void Attach(char* memory, size_t capacity);
+  // pos处放不下记录头或为跳过标记时回到数据区开头.
+  uint64_t Wrap(uint64_t pos) const;
+  // 丢弃最早的一条记录.
+  void EvictOldest(void);
+  // 检查头部与各条记录是否一致, 用于校验映射的已有文件.
+  bool CheckRecords(void) const;
+
+  Header* header_;  // 缓冲区头部, 保存读写位置和序号.
+  char* data_;  // 记录数据区.
+  std::unique_ptr<char[]> memory_;  // 堆内存存储.
+  size_t map_size_;  // 文件映射的长度, 0表示未映射.
+  std::string path_;  // 映射的文件路径.
+};
+
+// 会话连接上每条数据消息的负载之前附加的序号长度, 序号按网络字节序编码.
+constexpr size_t kSequenceLength = 8;
+// 会话标识的长度, 为16字节随机数的十六进制编码.
+constexpr size_t kSessionIdLength = 32;
+
+// 将消息序号编码为kSequenceLength字节.
+void EncodeSequence(uint64_t const& seq, char* out);
+// 解码kSequenceLength字节的消息序号.
+uint64_t DecodeSequence(char const* data);
+// 解析X-WebSocket-Resume头部的值"<会话标识> <序号>"; 请求新会话时值为
+// "new", 此时session_id为空, seq为0. 格式错误时返回-1.
+int ResumeTokenParse(HttpToken const& token, std::string* session_id,
+                     uint64_t* seq);
+
+}  // namespace libwebsocket
+
+#endif  // WEBSOCKET_REPLAY_RING_H_
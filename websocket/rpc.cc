@@ -0,0 +1,477 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  rpc.cc
+// @Version :  1.0
+// @Desc    :  None
+
+#include "rpc.h"
+
+#include <string.h>
+
+#include <utility>
+
+#include "rtt_stats.h"
+
+
+namespace libwebsocket {
+
+// 待完成调用表及其超时检查. 由RPC对象和检查定时器共同持有,
+// RPC对象析构后已添加的定时器仍可安全执行.
+struct RpcSweeper {
+  // 在所在线程的定时器中添加一次检查.
+  using AddTimer = std::function<void (TimerWheel::Callback const&)>;
+
+  RpcSweeper(size_t const& capacity, AddTimer const& add)
+      : table(capacity), add_timer(add), armed(false), stopped(false) {}
+
+  RpcPendingTable table;  // 待完成调用表.
+  AddTimer add_timer;  // 添加检查定时器.
+  std::atomic_bool armed;  // 检查定时器是否已添加.
+  std::atomic_bool stopped;  // RPC对象已析构, 不再添加检查定时器.
+};
+
+namespace {
+
+void ArmSweeper(std::shared_ptr<RpcSweeper> const& sweeper);
+
+// 完成已到期的调用, 仍有待完成的调用时继续检查, 否则停止直到下次调用.
+void Sweep(std::shared_ptr<RpcSweeper> const& sweeper) {
+  sweeper->table.Expire(SteadyClockMicroseconds());
+  sweeper->armed.store(false);
+  // 清除标志前登记的调用可能没有添加检查, 在此补上.
+  if (sweeper->table.size() > 0) ArmSweeper(sweeper);
+}
+
+// 有待完成的调用时添加检查定时器, 已添加时直接返回.
+void ArmSweeper(std::shared_ptr<RpcSweeper> const& sweeper) {
+  if (sweeper->stopped || sweeper->armed.exchange(true)) return;
+  std::shared_ptr<RpcSweeper> self = sweeper;
+  sweeper->add_timer([self] () { Sweep(self); });
+}
+
+// 将调用结果转交给promise.
+RpcPendingTable::Callback PromiseCallback(
+    std::shared_ptr<std::promise<RpcReply>> const& promise) {
+  return [promise] (int const& result, char const* data,
+                    size_t const& size) {
+    RpcReply reply;
+    reply.result = result;
+    if (data != nullptr) reply.data.assign(data, data + size);
+    promise->set_value(std::move(reply));
+  };
+}
+
+// 立即以result完成的future.
+std::future<RpcReply> FailedReply(int const& result) {
+  std::promise<RpcReply> promise;
+  RpcReply reply;
+  reply.result = result;
+  promise.set_value(std::move(reply));
+  return promise.get_future();
+}
+
+// 封装完整的RPC消息.
+void RpcMessagePackaging(RpcMessageType const& type, uint64_t const& id,
+                         char const* data, int const& size,
+                         std::vector<char>* out) {
+  out->resize(kRpcHeaderLength + size);
+  RpcHeaderPackaging(type, id, out->data());
+  if (size > 0) memcpy(out->data() + kRpcHeaderLength, data, size);
+}
+
+char const kNoHandler[] = "no request handler";
+
+}  // namespace
+
+void RpcHeaderPackaging(RpcMessageType const& type, uint64_t const& id,
+                        char* out) {
+  out[0] = static_cast<char>(kRpcMagic);
+  out[1] = static_cast<char>(type);
+  for (int i = 0; i < 8; ++i) {
+    out[2 + i] = static_cast<char>((id >> (56 - 8 * i)) & 0xFF);
+  }
+}
+
+int RpcHeaderParse(char const* data, size_t const& size,
+                   RpcMessageType* type, uint64_t* id) {
+  if (data == nullptr || size < kRpcHeaderLength ||
+      static_cast<uint8_t>(data[0]) != kRpcMagic) {
+    return -1;
+  }
+  uint8_t const value = static_cast<uint8_t>(data[1]);
+  if (value < kRpcRequest || value > kRpcError) return -1;
+  uint64_t result = 0;
+  for (int i = 0; i < 8; ++i) {
+    result = (result << 8) | static_cast<uint8_t>(data[2 + i]);
+  }
+  if (type != nullptr) *type = static_cast<RpcMessageType>(value);
+  if (id != nullptr) *id = result;
+  return 0;
+}
+
+//
+// RpcPendingTable.
+//
+
+constexpr uint32_t RpcPendingTable::kNoSlot;
+
+RpcPendingTable::RpcPendingTable(size_t const& capacity)
+    : capacity_(capacity < kNoSlot ? capacity : kNoSlot - 1),
+      slots_(new Slot[capacity_]), free_head_(kNoSlot), used_(0),
+      count_(0) {
+  for (size_t i = 0; i < capacity_; ++i) {
+    slots_[i].id.store(0);
+    slots_[i].next.store(kNoSlot);
+    slots_[i].deadline_us.store(0);
+    slots_[i].owner.store(0);
+    slots_[i].generation = 0;
+  }
+}
+
+uint64_t RpcPendingTable::Add(int64_t const& deadline_us,
+                              uint64_t const& owner,
+                              Callback const& callback) {
+  uint32_t const index = Acquire();
+  if (index == kNoSlot) return 0;
+  Slot& slot = slots_[index];
+  ++slot.generation;
+  slot.deadline_us.store(deadline_us, std::memory_order_relaxed);
+  slot.owner.store(owner, std::memory_order_relaxed);
+  slot.callback = callback;
+  ++count_;
+  uint64_t const id =
+      (static_cast<uint64_t>(slot.generation) << 32) | (index + 1);
+  slot.id.store(id, std::memory_order_release);
+  return id;
+}
+
+bool RpcPendingTable::Remove(uint64_t const& id) {
+  Callback callback;
+  return Take(id, &callback);
+}
+
+bool RpcPendingTable::Complete(uint64_t const& id, uint64_t const& owner,
+                               int const& result, char const* data,
+                               size_t const& size) {
+  uint64_t const index = id & 0xFFFFFFFF;
+  if (index == 0 || index > capacity_) return false;
+  Slot& slot = slots_[index - 1];
+  // 槽位随后被重新使用时, Take会因关联ID不同而失败.
+  if (slot.id.load(std::memory_order_acquire) != id ||
+      slot.owner.load(std::memory_order_relaxed) != owner) {
+    return false;
+  }
+  Callback callback;
+  if (!Take(id, &callback)) return false;
+  if (callback) callback(result, data, size);
+  return true;
+}
+
+int RpcPendingTable::Expire(int64_t const& now_us) {
+  return Finish([now_us] (Slot const& slot) {
+    return slot.deadline_us.load(std::memory_order_relaxed) <= now_us;
+  }, kRpcTimeout);
+}
+
+int RpcPendingTable::CancelOwner(uint64_t const& owner, int const& result) {
+  return Finish([owner] (Slot const& slot) {
+    return slot.owner.load(std::memory_order_relaxed) == owner;
+  }, result);
+}
+
+int RpcPendingTable::CancelAll(int const& result) {
+  return Finish([] (Slot const&) { return true; }, result);
+}
+
+int RpcPendingTable::Finish(std::function<bool (Slot const&)> const& match,
+                            int const& result) {
+  int count = 0;
+  uint32_t const used = used_.load(std::memory_order_acquire);
+  for (uint32_t i = 0; i < used; ++i) {
+    Slot const& slot = slots_[i];
+    uint64_t const id = slot.id.load(std::memory_order_acquire);
+    if (id == 0 || !match(slot)) continue;
+    Callback callback;
+    if (!Take(id, &callback)) continue;
+    if (callback) callback(result, nullptr, 0);
+    ++count;
+  }
+  return count;
+}
+
+uint32_t RpcPendingTable::Acquire(void) {
+  uint64_t head = free_head_.load(std::memory_order_acquire);
+  while (static_cast<uint32_t>(head) != kNoSlot) {
+    uint32_t const index = static_cast<uint32_t>(head);
+    uint32_t const next = slots_[index].next.load(std::memory_order_relaxed);
+    uint64_t const replaced = (((head >> 32) + 1) << 32) | next;
+    if (free_head_.compare_exchange_weak(head, replaced,
+                                         std::memory_order_acq_rel,
+                                         std::memory_order_acquire)) {
+      return index;
+    }
+  }
+  // 空闲链表为空时分配从未使用过的槽位.
+  uint32_t used = used_.load(std::memory_order_relaxed);
+  while (used < capacity_) {
+    if (used_.compare_exchange_weak(used, used + 1,
+                                    std::memory_order_acq_rel,
+                                    std::memory_order_relaxed)) {
+      return used;
+    }
+  }
+  return kNoSlot;
+}
+
+void RpcPendingTable::Release(uint32_t const& index) {
+  uint64_t head = free_head_.load(std::memory_order_relaxed);
+  uint64_t replaced = 0;
+  do {
+    slots_[index].next.store(static_cast<uint32_t>(head),
+                             std::memory_order_relaxed);
+    replaced = (((head >> 32) + 1) << 32) | index;
+  } while (!free_head_.compare_exchange_weak(head, replaced,
+                                             std::memory_order_release,
+                                             std::memory_order_relaxed));
+}
+
+bool RpcPendingTable::Take(uint64_t const& id, Callback* callback) {
+  uint64_t const index = id & 0xFFFFFFFF;
+  if (index == 0 || index > capacity_) return false;
+  Slot& slot = slots_[index - 1];
+  uint64_t expected = id;
+  if (!slot.id.compare_exchange_strong(expected, 0,
+                                       std::memory_order_acq_rel,
+                                       std::memory_order_relaxed)) {
+    return false;
+  }
+  *callback = std::move(slot.callback);
+  slot.callback = nullptr;
+  --count_;
+  Release(static_cast<uint32_t>(index - 1));
+  return true;
+}
+
+//
+// RpcClient.
+//
+
+RpcClient::RpcClient(WebSocketClient* client, size_t const& capacity)
+    : client_(client),
+      sweeper_(new RpcSweeper(capacity,
+          [client] (TimerWheel::Callback const& callback) {
+            client->AddTimer(kRpcSweepInterval, callback);
+          })) {
+  request_handler_ = [this] (uint64_t const& id, char const*, int const&) {
+    Respond(id, kNoHandler, sizeof(kNoHandler) - 1, true);
+  };
+  message_callback_ = [] (WebSocketClient::Socket const&, OPCodeType const&,
+                          char const*, int const&) { return; };
+  client_->OnMessage([this] (WebSocketClient::Socket const& fd,
+                             OPCodeType const& opcode, char const* data,
+                             int const& size) {
+    HandleMessage(fd, opcode, data, size);
+  });
+}
+
+RpcClient::~RpcClient() {
+  sweeper_->stopped.store(true);
+  sweeper_->table.CancelAll(kRpcCancelled);
+}
+
+int RpcClient::Call(char const* data, int const& size, int const& timeout_ms,
+                    Callback const& callback) {
+  if (size < 0 || (data == nullptr && size > 0)) return -1;
+  auto& table = sweeper_->table;
+  uint64_t const id = table.Add(
+      SteadyClockMicroseconds() + static_cast<int64_t>(timeout_ms) * 1000,
+      0, callback);
+  if (id == 0) return -1;
+  if (SendMessage(kRpcRequest, id, data, size) < 0) {
+    // 撤销失败说明调用已超时并回调过.
+    return table.Remove(id) ? -1 : 0;
+  }
+  ArmSweeper(sweeper_);
+  return 0;
+}
+
+std::future<RpcReply> RpcClient::Call(char const* data, int const& size,
+                                      int const& timeout_ms) {
+  std::shared_ptr<std::promise<RpcReply>> promise(
+      new std::promise<RpcReply>());
+  std::future<RpcReply> future = promise->get_future();
+  if (Call(data, size, timeout_ms, PromiseCallback(promise)) < 0) {
+    return FailedReply(kRpcSendFailed);
+  }
+  return future;
+}
+
+int RpcClient::Respond(uint64_t const& id, char const* data, int const& size,
+                       bool const& error) {
+  if (size < 0 || (data == nullptr && size > 0)) return -1;
+  return SendMessage(error ? kRpcError : kRpcResponse, id, data, size);
+}
+
+int RpcClient::CancelPending(void) {
+  return sweeper_->table.CancelAll(kRpcCancelled);
+}
+
+size_t RpcClient::pending(void) const {
+  return sweeper_->table.size();
+}
+
+void RpcClient::HandleMessage(WebSocketClient::Socket const& fd,
+                              OPCodeType const& opcode, char const* data,
+                              int const& size) {
+  RpcMessageType type = kRpcRequest;
+  uint64_t id = 0;
+  if (opcode != kOPCodeBinary || RpcHeaderParse(data, size, &type, &id) < 0) {
+    message_callback_(fd, opcode, data, size);
+    return;
+  }
+  char const* payload = data + kRpcHeaderLength;
+  int const length = size - static_cast<int>(kRpcHeaderLength);
+  if (type == kRpcRequest) {
+    request_handler_(id, payload, length);
+  } else {
+    sweeper_->table.Complete(id, 0,
+                             type == kRpcResponse ? kRpcOk : kRpcRemoteError,
+                             payload, length);
+  }
+}
+
+int RpcClient::SendMessage(RpcMessageType const& type, uint64_t const& id,
+                           char const* data, int const& size) {
+  char header[kRpcHeaderLength];
+  RpcHeaderPackaging(type, id, header);
+  PayloadSegment const segments[] = {
+    {header, kRpcHeaderLength},
+    {data, static_cast<uint64_t>(size)},
+  };
+  return client_->SendData(kOPCodeBinary, segments, 2);
+}
+
+//
+// RpcServer.
+//
+
+RpcServer::RpcServer(WebSocketServer* server, size_t const& capacity)
+    : server_(server),
+      sweeper_(new RpcSweeper(capacity,
+          [server] (TimerWheel::Callback const& callback) {
+            server->AddTimer(kRpcSweepInterval, callback);
+          })) {
+  request_handler_ = [this] (WebSocketServer::Socket const& fd,
+                             uint64_t const& id, char const*, int const&) {
+    Respond(fd, id, kNoHandler, sizeof(kNoHandler) - 1, true);
+  };
+  message_callback_ = [] (WebSocketServer::Socket const&, OPCodeType const&,
+                          char const*, int const&) { return; };
+  server_->OnMessage([this] (WebSocketServer::Socket const& fd,
+                             OPCodeType const& opcode, char const* data,
+                             int const& size) {
+    HandleMessage(fd, opcode, data, size);
+  });
+}
+
+RpcServer::~RpcServer() {
+  sweeper_->stopped.store(true);
+  sweeper_->table.CancelAll(kRpcCancelled);
+}
+
+int RpcServer::Call(WebSocketServer::Socket const& socket, char const* data,
+                    int const& size, int const& timeout_ms,
+                    Callback const& callback) {
+  if (size < 0 || (data == nullptr && size > 0)) return -1;
+  auto& table = sweeper_->table;
+  uint64_t const id = table.Add(
+      SteadyClockMicroseconds() + static_cast<int64_t>(timeout_ms) * 1000,
+      static_cast<uint64_t>(socket), callback);
+  if (id == 0) return -1;
+  if (SendMessage(socket, kRpcRequest, id, data, size) < 0) {
+    // 撤销失败说明调用已超时并回调过.
+    return table.Remove(id) ? -1 : 0;
+  }
+  ArmSweeper(sweeper_);
+  return 0;
+}
+
+std::future<RpcReply> RpcServer::Call(WebSocketServer::Socket const& socket,
+                                      char const* data, int const& size,
+                                      int const& timeout_ms) {
+  std::shared_ptr<std::promise<RpcReply>> promise(
+      new std::promise<RpcReply>());
+  std::future<RpcReply> future = promise->get_future();
+  if (Call(socket, data, size, timeout_ms, PromiseCallback(promise)) < 0) {
+    return FailedReply(kRpcSendFailed);
+  }
+  return future;
+}
+
+int RpcServer::Respond(WebSocketServer::Socket const& socket,
+                       uint64_t const& id, char const* data, int const& size,
+                       bool const& error) {
+  if (size < 0 || (data == nullptr && size > 0)) return -1;
+  return SendMessage(socket, error ? kRpcError : kRpcResponse, id, data,
+                     size);
+}
+
+int RpcServer::CancelPending(WebSocketServer::Socket const& socket) {
+  return sweeper_->table.CancelOwner(static_cast<uint64_t>(socket),
+                                     kRpcCancelled);
+}
+
+size_t RpcServer::pending(void) const {
+  return sweeper_->table.size();
+}
+
+void RpcServer::HandleMessage(WebSocketServer::Socket const& fd,
+                              OPCodeType const& opcode, char const* data,
+                              int const& size) {
+  RpcMessageType type = kRpcRequest;
+  uint64_t id = 0;
+  if (opcode != kOPCodeBinary || RpcHeaderParse(data, size, &type, &id) < 0) {
+    message_callback_(fd, opcode, data, size);
+    return;
+  }
+  char const* payload = data + kRpcHeaderLength;
+  int const length = size - static_cast<int>(kRpcHeaderLength);
+  if (type == kRpcRequest) {
+    request_handler_(fd, id, payload, length);
+  } else {
+    sweeper_->table.Complete(id, static_cast<uint64_t>(fd),
+                             type == kRpcResponse ? kRpcOk : kRpcRemoteError,
+                             payload, length);
+  }
+}
+
+int RpcServer::SendMessage(WebSocketServer::Socket const& socket,
+                           RpcMessageType const& type, uint64_t const& id,
+                           char const* data, int const& size) {
+  std::vector<char> message;
+  RpcMessagePackaging(type, id, data, size, &message);
+  return server_->SendData(socket, message.data(), message.size(),
+                           kOPCodeBinary);
+}
+
+}  // namespace libwebsocket
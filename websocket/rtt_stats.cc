@@ -0,0 +1,92 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  rtt_stats.cc
+// @Version :  1.0
+// @Desc    :  None
+
+#include "rtt_stats.h"
+
+#include <chrono>
+
+
+namespace libwebsocket {
+
+namespace {
+
+// pong负载中时间戳允许的最大间隔, 超出视为非本端生成.
+constexpr int64_t kMaxRttMicroseconds = 60LL*1000*1000;
+
+}  // namespace
+
+void RttStatsUpdate(int64_t const& rtt_us, RttStats* stats) {
+  if (stats == nullptr || rtt_us < 0) return;
+  if (stats->samples == 0) {
+    stats->smoothed_us = rtt_us;
+    stats->variance_us = rtt_us / 2;
+    stats->min_us = rtt_us;
+    stats->max_us = rtt_us;
+  } else {
+    int64_t delta = rtt_us - stats->smoothed_us;
+    stats->smoothed_us += delta / 8;
+    stats->variance_us += ((delta < 0 ? -delta : delta) -
+                           stats->variance_us) / 4;
+    if (rtt_us < stats->min_us) stats->min_us = rtt_us;
+    if (rtt_us > stats->max_us) stats->max_us = rtt_us;
+  }
+  stats->last_us = rtt_us;
+  ++stats->samples;
+  int bucket = 0;
+  for (uint64_t value = rtt_us >> 1; value != 0; value >>= 1) ++bucket;
+  if (bucket >= kRttHistogramBuckets) bucket = kRttHistogramBuckets - 1;
+  ++stats->histogram[bucket];
+}
+
+int64_t SteadyClockMicroseconds(void) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void EncodePingTimestamp(int64_t const& timestamp_us, char* out) {
+  uint64_t value = static_cast<uint64_t>(timestamp_us);
+  for (int i = 7; i >= 0; --i) {
+    out[i] = static_cast<char>(value & 0xFF);
+    value >>= 8;
+  }
+}
+
+int64_t DecodePingTimestamp(char const* payload, int const& size) {
+  if (payload == nullptr || size != 8) return -1;
+  uint64_t value = 0;
+  for (int i = 0; i < 8; ++i) {
+    value = (value << 8) | static_cast<uint8_t>(payload[i]);
+  }
+  int64_t timestamp_us = static_cast<int64_t>(value);
+  int64_t now = SteadyClockMicroseconds();
+  if (timestamp_us < 0 || timestamp_us > now ||
+      now - timestamp_us > kMaxRttMicroseconds) {
+    return -1;
+  }
+  return timestamp_us;
+}
+
+}  // namespace libwebsocket
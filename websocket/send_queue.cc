@@ -0,0 +1,231 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  send_queue.cc
+// @Version :  1.0
+// @Desc    :  None
+
+#include "send_queue.h"
+
+#include "socket_util.h"
+
+
+namespace libwebsocket {
+
+namespace {
+
+// 单次send调用的最大长度.
+constexpr size_t kMaxSendLength = 1 << 30;
+
+}  // namespace
+
+int SendQueue::PushData(Socket const& socket, Frame const& frame) {
+  if (!frame || frame->empty()) return -1;
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (closed_ || shutdown_) return -1;
+  data_frames_.push_back(frame);
+  pending_bytes_ += frame->size();
+  if (HoldLocked()) return 2;
+  return FlushLocked(socket);
+}
+
+int SendQueue::PushData(Socket const& socket, char const* data,
+                        std::vector<uint64_t> const& lengths) {
+  if (data == nullptr || lengths.empty()) return -1;
+  uint64_t size = 0;
+  for (auto const length : lengths) {
+    if (length == 0) return -1;
+    size += length;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (closed_ || shutdown_) return -1;
+  // 积攒时只有单条消息已达到批量字节数才直接写出.
+  bool const idle =
+      !current_ && control_frames_.empty() && data_frames_.empty() &&
+      (batch_bytes_ == 0 || size >= batch_bytes_);
+  uint64_t sent = 0;
+  while (idle && sent < size) {
+    uint64_t length = size - sent;
+    if (length > kMaxSendLength) length = kMaxSendLength;
+    int ret = Send(socket, data + sent, static_cast<int>(length), kSendFlags);
+    if (ret < 0) {
+      if (!IsRetryableError()) return -1;
+      break;
+    }
+    sent += ret;
+    if (static_cast<uint64_t>(ret) < length) break;
+  }
+  // 只写出一部分的帧作为当前帧继续发送, 控制帧不会插入其中.
+  uint64_t begin = 0;
+  for (auto const length : lengths) {
+    uint64_t const end = begin + length;
+    if (end > sent) {
+      uint64_t const from = (begin > sent) ? begin : sent;
+      Frame frame(new std::vector<char>(data + from, data + end));
+      pending_bytes_ += end - from;
+      if (from > begin) {
+        current_ = frame;
+        offset_ = 0;
+      } else {
+        data_frames_.push_back(frame);
+      }
+    }
+    begin = end;
+  }
+  if (sent == size) return 0;
+  if (idle) return 1;
+  if (HoldLocked()) return 2;
+  return FlushLocked(socket);
+}
+
+int SendQueue::PushControl(Socket const& socket, Frame const& frame) {
+  if (!frame || frame->empty()) return -1;
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (closed_ || shutdown_) return -1;
+  control_frames_.push_back(frame);
+  pending_bytes_ += frame->size();
+  holding_ = false;
+  return FlushLocked(socket);
+}
+
+int SendQueue::PushClose(Socket const& socket, Frame const& frame,
+                         bool const& discard_data) {
+  if (!frame || frame->empty()) return -1;
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (closed_ || shutdown_) return -1;
+  closed_ = true;
+  if (discard_data) {
+    for (auto const& data_frame : data_frames_) {
+      pending_bytes_ -= data_frame->size();
+    }
+    data_frames_.clear();
+    control_frames_.push_back(frame);
+  } else {
+    data_frames_.push_back(frame);
+  }
+  pending_bytes_ += frame->size();
+  holding_ = false;
+  return FlushLocked(socket);
+}
+
+int SendQueue::Flush(Socket const& socket) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (holding_) return 2;
+  return FlushLocked(socket);
+}
+
+void SendQueue::Clear(void) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  control_frames_.clear();
+  data_frames_.clear();
+  current_.reset();
+  offset_ = 0;
+  pending_bytes_ = 0;
+  closed_ = false;
+  shutdown_ = false;
+  batch_bytes_ = 0;
+  holding_ = false;
+}
+
+void SendQueue::Shutdown(void) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  control_frames_.clear();
+  data_frames_.clear();
+  current_.reset();
+  offset_ = 0;
+  pending_bytes_ = 0;
+  shutdown_ = true;
+  holding_ = false;
+}
+
+// 正在写出的帧未完成说明套接字暂不可写, 此时数据帧照常排队.
+bool SendQueue::HoldLocked(void) {
+  holding_ = batch_bytes_ > 0 && !current_ && control_frames_.empty() &&
+             pending_bytes_ < batch_bytes_;
+  return holding_;
+}
+
+// 只在帧边界处选择下一个待发送的帧, 控制帧优先. 当前帧之后没有控制帧
+// 时, 排队的数据帧与其一起写出, 写了一部分的帧成为新的当前帧.
+int SendQueue::FlushLocked(Socket const& socket) {
+  if (shutdown_) return -1;
+  SendBuffer buffers[kMaxSendBuffers];
+  while (true) {
+    if (!current_) {
+      if (!control_frames_.empty()) {
+        current_ = control_frames_.front();
+        control_frames_.pop_front();
+      } else if (!data_frames_.empty()) {
+        current_ = data_frames_.front();
+        data_frames_.pop_front();
+      } else {
+        return 0;
+      }
+      offset_ = 0;
+    }
+    size_t const remaining = current_->size() - offset_;
+    size_t length = remaining;
+    if (length > kMaxSendLength) length = kMaxSendLength;
+    buffers[0].data = current_->data() + offset_;
+    buffers[0].size = length;
+    int count = 1;
+    if (length == remaining && control_frames_.empty()) {
+      for (auto const& frame : data_frames_) {
+        if (count == kMaxSendBuffers ||
+            length + frame->size() > kMaxSendLength) {
+          break;
+        }
+        buffers[count].data = frame->data();
+        buffers[count].size = frame->size();
+        length += frame->size();
+        ++count;
+      }
+    }
+    int ret = (count == 1) ?
+        Send(socket, buffers[0].data, static_cast<int>(length), kSendFlags) :
+        SendBuffers(socket, buffers, count, kSendFlags);
+    if (ret < 0) {
+      return IsRetryableError() ? 1 : -1;
+    }
+    pending_bytes_ -= ret;
+    size_t written = ret;
+    if (written < remaining) {
+      offset_ += written;
+    } else {
+      written -= remaining;
+      current_.reset();
+      while (written > 0) {
+        Frame frame = data_frames_.front();
+        data_frames_.pop_front();
+        if (written < frame->size()) {
+          current_ = frame;
+          offset_ = written;
+          break;
+        }
+        written -= frame->size();
+      }
+    }
+    if (static_cast<size_t>(ret) < length) return 1;
+  }
+}
+
+}  // namespace libwebsocket
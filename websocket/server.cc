@@ -15,15 +15,19 @@
 #if defined(__linux__)
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <dirent.h>
 #include <fcntl.h>
+#include <poll.h>
 #endif
 
 #include <algorithm>
 #include <chrono>
 #include <memory>
+#include <random>
 #include <thread>  // NOLINT.
 #include <vector>
 
+#include "frame_codec.h"
 #include "socket_util.h"
 #include "websocket.h"
 
@@ -32,6 +36,34 @@ namespace libwebsocket {
 namespace {
 
 constexpr int kMaxBufferLength = 4096;
+constexpr int kMaxPollTimeout = 1000;  // 无定时器时poll的最长等待时间.
+
+// 生成会话标识, 取自系统随机源, 避免会话被猜测后冒用.
+std::string NewSessionId(void) {
+  static char const kHex[] = "0123456789abcdef";
+  std::random_device device;
+  std::string id(kSessionIdLength, '0');
+  for (size_t i = 0; i < kSessionIdLength; i += 8) {
+    uint32_t value = device();
+    for (size_t j = 0; j < 8; ++j, value >>= 4) id[i + j] = kHex[value & 0xF];
+  }
+  return id;
+}
+
+// 会话重放缓冲区映射的文件路径.
+std::string SessionPath(std::string const& directory, std::string const& id) {
+  return directory + "/" + id + ".ring";
+}
+
+// 回收线程, 在线程自身中调用时只能分离.
+void JoinThread(std::thread* thread) {
+  if (!thread->joinable()) return;
+  if (thread->get_id() == std::this_thread::get_id()) {
+    thread->detach();
+  } else {
+    thread->join();
+  }
+}
 
 }  // namespace
 
@@ -39,9 +71,24 @@ constexpr int kMaxBufferLength = 4096;
 void WebSocketServer::Init(void) {
   callback_ = [] (Socket const&, char const*, int const&) { return; };
   deep_callback_ = [] (Socket const&, char const*, int const&) { return; };
+  close_callback_ = [] (Socket const&, int const&) { return; };
+  session_callback_ = [] (Socket const&, std::string const&, bool const&) {
+    return;
+  };
   is_ready_.store(false);
+  draining_.store(false);
   waiting_is_running_.store(false);
   service_is_running_.store(false);
+  max_frame_size_ = kDefaultMaxFrameSize;
+  max_message_size_ = kDefaultMaxMessageSize;
+  validate_utf8_ = false;
+  fragment_size_ = kDefaultFragmentSize;
+  deflate_options_ = DeflateOptions {};
+  ping_interval_ms_ = 0;
+  handshake_timeout_ms_ = kDefaultHandshakeTimeout;
+  idle_timeout_ms_ = 0;
+  close_timeout_ms_ = kDefaultCloseTimeout;
+  resume_options_ = ResumeOptions {};
 }
 
 // 创建一个套接字, 并绑定到指定IP和端口上.
@@ -57,6 +104,9 @@ int WebSocketServer::InitServer(void) {
     printf("%s[%d]: Create socket failed!!!\n", __FUNCTION__, __LINE__);
     return -1;
   }
+  // 服务端先断开的连接处于TIME_WAIT状态, 重启后仍可立即绑定同一端口.
+  int reuse = 1;
+  setsockopt(listen_socket_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
 #elif defined(_WIN32)
   WSADATA ws_data;
   if (WSAStartup(MAKEWORD(2,2), &ws_data) != 0) {
@@ -80,6 +130,9 @@ int WebSocketServer::InitServer(void) {
 #endif
     return -1;
   }
+  if (resume_options_.enabled && !resume_options_.directory.empty()) {
+    RestoreSessions();
+  }
   is_ready_.store(true);
   return 0;
 }
@@ -87,23 +140,31 @@ int WebSocketServer::InitServer(void) {
 // 开启等待客户端连接和与客户端通信线程.
 bool WebSocketServer::Run(void) {
   if (!is_ready_) return false;
+  // 回收上一次运行中已自行退出的线程.
+  JoinThread(&service_thread_);
+  JoinThread(&waiting_thread_);
+  service_is_running_.store(true);
+  waiting_is_running_.store(true);
   service_thread_ = std::thread(&WebSocketServer::ServiceHandler, this);
-  service_thread_.detach();
   waiting_thread_ = std::thread(&WebSocketServer::WaitHandler, this);
-  waiting_thread_.detach();
   return true;
 }
 
 // 停止服务线程, 关闭并清空所有已连接的套接字.
 void WebSocketServer::Stop(void) {
+  RequestStop();
+  JoinThread(&waiting_thread_);
+  JoinThread(&service_thread_);
   if (listen_socket_ > 0) {
-    service_is_running_.store(false);
-    waiting_is_running_.store(false);
-    std::this_thread::sleep_for(std::chrono::seconds(3));
-    for (auto& socket : valid_sockets_) {
-      Close(socket);
+    {
+      std::lock_guard<std::mutex> lock(connections_mutex_);
+      for (auto& item : connections_) {
+        item.second->closed.store(true);
+        item.second->send_queue.Shutdown();
+        Close(item.first);
+      }
+      connections_.clear();
     }
-    valid_sockets_.clear();
     Close(listen_socket_);
     listen_socket_ = 0;
 #if defined(_WIN32)
@@ -115,89 +176,336 @@ void WebSocketServer::Stop(void) {
 
 int WebSocketServer::SendToOne(Socket const& socket,
                                char const* buffer, int const& size) {
-  for (auto client : valid_sockets_) {
-    if (socket == client) {
-      return Send(socket, buffer, size, 0);
+  auto conn = FindConnection(socket);
+  if (!conn || buffer == nullptr || size <= 0) return -1;
+  // 会话的客户端把数据帧负载的前8字节当作序号, 不能发送未附加序号的帧.
+  if (conn->session) return -1;
+  SendQueue::Frame frame(new std::vector<char>(buffer, buffer + size));
+  if (conn->send_queue.PushData(socket, frame) < 0) return -1;
+  wakeup_.Notify();
+  return size;
+}
+
+// 所有连接共享同一份帧数据, 绑定了会话的连接无法附加序号, 跳过.
+int WebSocketServer::SendToAll(char const* buffer, int const& size) {
+  if (buffer == nullptr || size <= 0) return -1;
+  SendQueue::Frame frame(new std::vector<char>(buffer, buffer + size));
+  std::vector<std::shared_ptr<Connection>> conns;
+  {
+    std::lock_guard<std::mutex> lock(connections_mutex_);
+    for (auto& item : connections_) conns.push_back(item.second);
+  }
+  for (auto& conn : conns) {
+    if (conn->established && !conn->session) {
+      conn->send_queue.PushData(conn->socket, frame);
     }
   }
-  return -1;
+  wakeup_.Notify();
+  return 0;
 }
 
-int WebSocketServer::SendToAll(char const* buffer, int const& size) {
-  for (auto socket : valid_sockets_) {
-    Send(socket, buffer, size, 0);
+// 每组压缩参数相同且不保留压缩上下文的连接只压缩一次, 共享压缩后的帧;
+// 保留上下文的连接须各自压缩, 其余连接共享未压缩的帧. 会话的序号各不相同,
+// 绑定了会话的连接逐个封装.
+int WebSocketServer::SendDataToAll(char const* buffer, int const& size,
+                                   OPCodeType const& opcode) {
+  if (size < 0 || (buffer == nullptr && size > 0)) return -1;
+  int count = 0;
+  std::vector<std::shared_ptr<Session>> sessions;
+  {
+    std::lock_guard<std::mutex> lock(sessions_mutex_);
+    for (auto& item : sessions_) sessions.push_back(item.second);
+  }
+  for (auto& session : sessions) {
+    std::lock_guard<std::mutex> lock(session->mutex);
+    if (SendSessionMessage(session.get(), opcode, buffer, size) > 0) ++count;
+  }
+  std::vector<std::shared_ptr<Connection>> conns;
+  {
+    std::lock_guard<std::mutex> lock(connections_mutex_);
+    for (auto& item : connections_) conns.push_back(item.second);
+  }
+  bool const compressible = (opcode == kOPCodeText || opcode == kOPCodeBinary);
+  std::vector<SendQueue::Frame> plain_frames;
+  // 共享压缩结果的一组连接, compressed为false时该组发送未压缩的帧.
+  struct SharedDeflate {
+    PerMessageDeflate const* deflate;
+    bool compressed;
+    std::vector<SendQueue::Frame> frames;
+  };
+  std::vector<SharedDeflate> groups;
+  std::vector<SendQueue::Frame> own_frames;
+  for (auto& conn : conns) {
+    if (!conn->established || conn->session) continue;
+    std::vector<SendQueue::Frame> const* frames = &plain_frames;
+    bool const stateless = compressible && conn->deflate.enabled() &&
+                           conn->deflate.stateless();
+    if (stateless) {
+      auto group = groups.begin();
+      while (group != groups.end() &&
+             !group->deflate->SameCompression(conn->deflate)) {
+        ++group;
+      }
+      if (group == groups.end()) {
+        groups.push_back(SharedDeflate {&conn->deflate, false, {}});
+        group = groups.end() - 1;
+        PerMessageDeflate deflate;
+        deflate.SetPool(&deflate_pool_);
+        deflate.Reset(conn->deflate.agreed(), true);
+        std::vector<char> compressed;
+        if (deflate.Compress(buffer, size, &compressed) == 0 &&
+            PackageFrames(opcode, compressed.data(), compressed.size(), true,
+                          &group->frames) == 0) {
+          group->compressed = true;
+        }
+      }
+      if (group->compressed) frames = &group->frames;
+    }
+    std::lock_guard<std::mutex> lock(conn->send_mutex);
+    if (compressible && conn->deflate.enabled() && !stateless) {
+      std::vector<char> compressed;
+      int ret = conn->deflate.Compress(buffer, size, &compressed);
+      if (ret < 0) continue;
+      if (ret == 0) {
+        if (PackageFrames(opcode, compressed.data(), compressed.size(), true,
+                          &own_frames) != 0) {
+          continue;
+        }
+        frames = &own_frames;
+      }
+    }
+    if (frames == &plain_frames && plain_frames.empty() &&
+        PackageFrames(opcode, buffer, size, false, &plain_frames) != 0) {
+      return -1;
+    }
+    for (auto const& frame : *frames) {
+      if (conn->send_queue.PushData(conn->socket, frame) < 0) break;
+    }
+    ++count;
+  }
+  wakeup_.Notify();
+  return count;
+}
+
+int WebSocketServer::SendData(Socket const& socket,
+                              char const* buffer, int const& size,
+                              OPCodeType const& opcode) {
+  auto conn = FindConnection(socket);
+  if (!conn || size < 0) return -1;
+  if (conn->session) {
+    // 连接已被恢复同一会话的新连接取代时不再发送.
+    std::lock_guard<std::mutex> lock(conn->session->mutex);
+    if (conn->session->owner.lock() != conn ||
+        SendSessionMessage(conn->session.get(), opcode, buffer, size) <= 0) {
+      return -1;
+    }
+  } else {
+    // 压缩上下文依赖消息顺序, 压缩和入队须在同一临界区内完成.
+    std::lock_guard<std::mutex> lock(conn->send_mutex);
+    if (QueueMessage(conn.get(), opcode, buffer, size) != 0) return -1;
+  }
+  wakeup_.Notify();
+  return size;
+}
+
+int WebSocketServer::SendDataToSession(std::string const& session_id,
+                                       char const* buffer, int const& size,
+                                       OPCodeType const& opcode) {
+  std::shared_ptr<Session> session;
+  {
+    std::lock_guard<std::mutex> lock(sessions_mutex_);
+    auto it = sessions_.find(session_id);
+    if (it == sessions_.end()) return -1;
+    session = it->second;
+  }
+  {
+    std::lock_guard<std::mutex> lock(session->mutex);
+    if (SendSessionMessage(session.get(), opcode, buffer, size) < 0) {
+      return -1;
+    }
+  }
+  wakeup_.Notify();
+  return size;
+}
+
+// 序号在会话锁内分配, 同一会话的消息按序号顺序入队.
+int WebSocketServer::SendSessionMessage(Session* session,
+                                        OPCodeType const& opcode,
+                                        char const* buffer, int const& size) {
+  if ((opcode != kOPCodeText && opcode != kOPCodeBinary) || size < 0 ||
+      (buffer == nullptr && size > 0) || !session->ring.is_open()) {
+    return -1;
+  }
+  uint64_t const seq = session->ring.Append(opcode, buffer, size);
+  auto conn = session->owner.lock();
+  if (!conn) return 0;
+  std::lock_guard<std::mutex> lock(conn->send_mutex);
+  return QueueSequenced(conn.get(), seq, opcode, buffer, size) == 0 ? 1 : 0;
+}
+
+int WebSocketServer::QueueSequenced(Connection* conn, uint64_t const& seq,
+                                    OPCodeType const& opcode,
+                                    char const* buffer, uint64_t const& size) {
+  std::vector<char> payload(kSequenceLength + size);
+  EncodeSequence(seq, payload.data());
+  if (size > 0) memcpy(payload.data() + kSequenceLength, buffer, size);
+  return QueueMessage(conn, opcode, payload.data(), payload.size());
+}
+
+int WebSocketServer::QueueMessage(Connection* conn, OPCodeType const& opcode,
+                                  char const* buffer, uint64_t const& size) {
+  std::vector<char> compressed;
+  int ret = 1;
+  if (conn->deflate.enabled() &&
+      (opcode == kOPCodeText || opcode == kOPCodeBinary)) {
+    if ((ret = conn->deflate.Compress(buffer, size, &compressed)) < 0) {
+      return -1;
+    }
+  }
+  std::vector<SendQueue::Frame> frames;
+  if ((ret == 0 ? PackageFrames(opcode, compressed.data(), compressed.size(),
+                                true, &frames) :
+                  PackageFrames(opcode, buffer, size, false, &frames)) != 0) {
+    return -1;
+  }
+  for (auto const& frame : frames) {
+    if (conn->send_queue.PushData(conn->socket, frame) < 0) return -1;
+  }
+  return 0;
+}
+
+int WebSocketServer::PackageFrames(OPCodeType const& opcode,
+                                   char const* buffer, uint64_t size,
+                                   bool compressed,
+                                   std::vector<SendQueue::Frame>* out) {
+  // 压缩消息只在第一个分片中设置RSV1.
+  std::vector<std::vector<char>> frames;
+  if (ServerFrameCodec::PackageMessage(opcode, buffer, size, fragment_size_,
+                                       compressed ? kFrameRsv1Bit : 0,
+                                       &frames) != 0) {
+    return -1;
+  }
+  out->clear();
+  for (auto& frame : frames) {
+    out->emplace_back(new std::vector<char>(std::move(frame)));
   }
   return 0;
 }
 
+int WebSocketServer::SendControl(Socket const& socket,
+                                 OPCodeType const& opcode,
+                                 char const* buffer, int const& size) {
+  auto conn = FindConnection(socket);
+  if (!conn || !(opcode & 0x8) || size < 0 || size > 125) return -1;
+  std::shared_ptr<std::vector<char>> frame(new std::vector<char>());
+  if (ServerFrameCodec::Package(kFrameFinBit | opcode, buffer, size,
+                                frame.get()) != 0) {
+    return -1;
+  }
+  if (conn->send_queue.PushControl(socket, frame) < 0) return -1;
+  wakeup_.Notify();
+  return size;
+}
+
+int WebSocketServer::GetRttStats(Socket const& socket, RttStats* stats) {
+  auto conn = FindConnection(socket);
+  if (!conn || stats == nullptr) return -1;
+  std::lock_guard<std::mutex> lock(conn->rtt_mutex);
+  *stats = conn->rtt_stats;
+  return 0;
+}
+
+int WebSocketServer::Disconnect(Socket const& socket, int const& code,
+                                std::string const& reason) {
+  auto conn = FindConnection(socket);
+  if (!conn) return -1;
+  return BeginClose(conn, code, reason, close_timeout_ms_);
+}
+
+// 唤醒阻塞在poll上的主服务线程, 并关闭监听套接字的读写使阻塞在accept上的
+// 等待连接线程立即返回.
+void WebSocketServer::RequestStop(void) {
+  service_is_running_.store(false);
+  waiting_is_running_.store(false);
+  wakeup_.Notify();
+  if (listen_socket_ > 0) {
+#if defined(__linux__)
+    shutdown(listen_socket_, SHUT_RDWR);
+#elif defined(_WIN32)
+    shutdown(listen_socket_, SD_BOTH);
+#endif
+  }
+}
+
+// 关闭监听套接字使等待连接线程退出, 随后所有连接的关闭握手在主服务线程中
+// 并行进行, 本线程等待连接表清空或到期.
+int WebSocketServer::Drain(int const& deadline_ms) {
+  if (!is_ready_) return 0;
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds(deadline_ms);
+  draining_.store(true);
+  waiting_is_running_.store(false);
+#if defined(__linux__)
+  shutdown(listen_socket_, SHUT_RDWR);
+#elif defined(_WIN32)
+  shutdown(listen_socket_, SD_BOTH);
+#endif
+  std::vector<std::shared_ptr<Connection>> conns;
+  {
+    std::lock_guard<std::mutex> lock(connections_mutex_);
+    for (auto& item : connections_) conns.push_back(item.second);
+  }
+  for (auto& conn : conns) {
+    if (conn->established) {
+      BeginClose(conn, kCloseGoingAway, std::string(), deadline_ms);
+    } else {
+      // 尚未完成握手的连接由主服务线程直接断开.
+      conn->peer_closed.store(true);
+      conn->closing.store(true);
+    }
+  }
+  wakeup_.Notify();
+  int remaining = 0;
+  {
+    std::unique_lock<std::mutex> lock(connections_mutex_);
+    connections_cv_.wait_until(lock, deadline, [this] () {
+      return connections_.empty();
+    });
+    remaining = connections_.size();
+  }
+  Stop();
+  draining_.store(false);
+  return remaining;
+}
+
+std::shared_ptr<WebSocketServer::Connection>
+WebSocketServer::FindConnection(Socket const& socket) {
+  std::lock_guard<std::mutex> lock(connections_mutex_);
+  auto it = connections_.find(socket);
+  if (it == connections_.end() || !it->second->established) return nullptr;
+  return it->second;
+}
+
 // 等待客户端连接线程处理函数.
-// 若有客户端进行连接, 先进行握手操作, 认证成功后
-// 将转到主服务线程中进行数据交换.
+// 若有客户端进行连接, 设置为非阻塞模式后转到主服务线程中完成握手
+// 并进行数据交换. 等待队列取系统上限, 避免大量客户端同时连接时握手请求
+// 被丢弃.
 void WebSocketServer::WaitHandler(void) {
-  waiting_is_running_.store(true);
-  if (Listen(listen_socket_, 10) < 0) {
-    waiting_is_running_.store(false);
-    Stop();
+  if (Listen(listen_socket_, SOMAXCONN) < 0) {
+    RequestStop();
     return;
   }
   struct sockaddr_in addr;
   int len = sizeof(addr);
-  std::vector<uint8_t> msg;
-  std::string request;
-  std::string respond;
-  int ret = -1;
-  int timeout_ms = 3*10;  // 超时时间, 100ms.
-  auto tp = std::chrono::steady_clock::now();
-  std::unique_ptr<char[]> buffer(
-      new char[kMaxBufferLength], std::default_delete<char[]>());
   while(waiting_is_running_) {
     // 等待新的连接.
     Socket socket = Accept(listen_socket_,
         reinterpret_cast<struct sockaddr *>(&addr), &len);
     if (socket <= 0) {
-      printf("%s[%d]: Invalid socket!!!\n", __FUNCTION__, __LINE__);
-      break;
-    }
-    tp = std::chrono::steady_clock::now();
-    while (1) {
-      if ((ret = Recv(socket, buffer.get(), kMaxBufferLength, 0)) > 0) {
-        msg.assign(buffer.get(), buffer.get()+ret);
-        break;
-      } else if (ret == 0) {
-        printf("%s[%d]: Disconnect !!!\n", __FUNCTION__, __LINE__);
-        break;
-      } else {
-#if defined(__linux__)
-        if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) {
-          continue;
-        }
-#elif defined(_WIN32)
-        auto wsa_errno = WSAGetLastError();
-        if (wsa_errno == WSAEINTR || wsa_errno == WSAEWOULDBLOCK) continue;
-#endif
-        printf("%s[%d]: Disconnect !!!\n", __FUNCTION__, __LINE__);
-        break;
-      }
-      // 检测超时退出.
-      if (std::chrono::duration_cast<std::chrono::milliseconds>(
-              std::chrono::steady_clock::now()-tp).count() >= timeout_ms) {
-        break;
+      if (waiting_is_running_) {
+        printf("%s[%d]: Invalid socket!!!\n", __FUNCTION__, __LINE__);
       }
-      std::this_thread::sleep_for(std::chrono::milliseconds(100));
-    }
-    if (msg.empty()) {
-      Close(socket);
-      continue;
-    }
-    request.assign(msg.begin(), msg.end());
-    if (!IsHandShake(request)) {
-      Close(socket);
-      continue;
-    }
-    HandShake(request, &respond);
-    if (Send(socket, respond.c_str(), respond.size(), 0) < 0) {
-      Close(socket);
-      continue;
+      break;
     }
     // 设置非阻塞模式.
 #if defined(__linux__)
@@ -212,57 +520,550 @@ void WebSocketServer::WaitHandler(void) {
       continue;
     }
 #endif
-    // 保存已通过认证的socket.
-    valid_sockets_.push_back(socket);
+    // 握手在主服务线程中完成, 超时未完成则关闭连接.
+    std::shared_ptr<Connection> conn(new Connection());
+    conn->socket = socket;
+    conn->established.store(false);
+    conn->message_length = 0;
+    conn->fragmented = false;
+    conn->compressed = false;
+    conn->text = false;
+    conn->utf8.Reset();
+    conn->rtt_stats = RttStats {};
+    conn->last_recv_ms = SteadyClockMicroseconds()/1000;
+    conn->closing.store(false);
+    conn->peer_closed.store(false);
+    conn->closed.store(false);
+    conn->close_code.store(0);
+    conn->close_timer.store(0);
+    std::weak_ptr<Connection> weak_conn(conn);
+    conn->handshake_timer = timer_wheel_.Add(handshake_timeout_ms_,
+        [this, weak_conn] () {
+      auto conn = weak_conn.lock();
+      if (conn && !conn->established) {
+        printf("%s[%d]: Handshake timeout !!!\n", __FUNCTION__, __LINE__);
+        CloseConnection(conn);
+      }
+    });
+    {
+      std::lock_guard<std::mutex> lock(connections_mutex_);
+      connections_[socket] = conn;
+    }
+    wakeup_.Notify();
   }
-  waiting_is_running_.store(false);
-  Stop();
+  if (!draining_) RequestStop();
 }
 
+// 在Linux下以poll等待套接字事件, 唤醒事件和最近到期的定时器,
+// 其它平台空闲时休眠10ms后轮询.
 void WebSocketServer::ServiceHandler(void) {
-  service_is_running_.store(true);
   int ret = -1;
   bool alive = false;
   std::unique_ptr<char[]> buffer(
     new char[kMaxBufferLength], std::default_delete<char[]>());
-  std::vector<char> msg;
-  WebSocketMsg websocket_msg {};
+  std::vector<std::shared_ptr<Connection>> conns;
+#if defined(__linux__)
+  std::vector<struct pollfd> fds;
+#endif
   while(service_is_running_) {
-    for (auto it = valid_sockets_.begin(); it != valid_sockets_.end(); ++it) {
-      if ((ret = Recv(*it, buffer.get(), kMaxBufferLength, 0)) > 0) {
-        if (!alive) alive = true;
-        deep_callback_(*it, buffer.get(), ret);
-        msg.assign(buffer.get(), buffer.get() + ret);
-        if (WebSocketFrameParse(msg, &websocket_msg) == 0) {
-          callback_(*it, websocket_msg.payload_content.data(),
-                    websocket_msg.payload_content.size());
-        }
+    {
+      std::lock_guard<std::mutex> lock(connections_mutex_);
+      conns.clear();
+      for (auto& item : connections_) conns.push_back(item.second);
+    }
+#if defined(__linux__)
+    int64_t timeout = timer_wheel_.NextTimeout();
+    if (timeout < 0 || timeout > kMaxPollTimeout) timeout = kMaxPollTimeout;
+    fds.resize(conns.size() + 1);
+    fds[0].fd = wakeup_.fd();
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+    for (size_t i = 0; i < conns.size(); ++i) {
+      auto& conn = conns[i];
+      fds[i + 1].fd = conn->socket;
+      fds[i + 1].events = POLLIN;
+      fds[i + 1].revents = 0;
+      if (conn->send_queue.pending_bytes() > 0) {
+        fds[i + 1].events |= POLLOUT;
+      }
+      if (conn->peer_closed && conn->closing) timeout = 0;
+    }
+    if (poll(fds.data(), fds.size(), static_cast<int>(timeout)) < 0 &&
+        errno != EINTR) {
+      printf("%s[%d]: Poll failed !!!\n", __FUNCTION__, __LINE__);
+      break;
+    }
+    if (fds[0].revents & POLLIN) wakeup_.Consume();
+    if (!service_is_running_) break;
+#endif
+    // 执行到期的定时器.
+    if (timer_wheel_.Advance() > 0) alive = true;
+    for (size_t i = 0; i < conns.size(); ++i) {
+      auto& conn = conns[i];
+      // 已被定时器或其它连接的处理关闭, 套接字编号可能已分配给新连接.
+      if (conn->closed) continue;
+      // 写出发送队列中积压的数据.
+      ret = conn->send_queue.Flush(conn->socket);
+      if (ret == 0 && conn->peer_closed && conn->closing) {
+        // 双方均已发出关闭帧且数据已全部写出, 由服务端先断开TCP连接.
+        CloseConnection(conn);
         continue;
-      } else if (ret <= 0) {
-        if (ret < 0) {
+      }
+      if (ret < 0) {
+        printf("%s[%d]: Send failed !!!\n", __FUNCTION__, __LINE__);
+      } else {
 #if defined(__linux__)
-          if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) {
-            continue;
-          }
-#elif defined(_WIN32)
-          auto wsa_errno = WSAGetLastError();
-          if (wsa_errno == WSAEINTR || wsa_errno == WSAEWOULDBLOCK) continue;
+        if (!(fds[i + 1].revents & (POLLIN | POLLERR | POLLHUP))) continue;
 #endif
+        if ((ret = Recv(conn->socket, buffer.get(),
+                        kMaxBufferLength, 0)) > 0) {
+          if (!alive) alive = true;
+          conn->last_recv_ms = SteadyClockMicroseconds()/1000;
+          conn->recv_buffer.insert(conn->recv_buffer.end(),
+                                   buffer.get(), buffer.get() + ret);
+          if (conn->established) {
+            deep_callback_(conn->socket, buffer.get(), ret);
+            if (ProcessFrames(conn) == 0) continue;
+          } else {
+            if (ProcessHandshake(conn) == 0) continue;
+          }
+        } else if (ret < 0 && IsRetryableError()) {
+          continue;
         }
-        printf("%s[%d]: Disconnect !!!\n", __FUNCTION__, __LINE__);
-        valid_sockets_.erase(it);
-        Close(*it);
-        if (!alive) alive = true;
-        break;  // 删除连接时不再继续遍历, 而是重新开始遍历.
       }
+      printf("%s[%d]: Disconnect !!!\n", __FUNCTION__, __LINE__);
+      CloseConnection(conn);
+      if (!alive) alive = true;
     }
+#if !defined(__linux__)
     if (!alive) {
       std::this_thread::sleep_for(std::chrono:: milliseconds(10));
     }
+#endif
     alive = false;
   }
-  service_is_running_.store(false);
-  Stop();
+  RequestStop();
+}
+
+// 收到完整的握手请求后回复握手响应, 并启动空闲超时和定时ping.
+// 请求了会话恢复时, 握手响应和需补发的消息在会话锁内入队, 排在之后发往
+// 该会话的消息之前. 请求之后已到达的数据按帧继续解析.
+int WebSocketServer::ProcessHandshake(std::shared_ptr<Connection> const& conn) {
+  auto& recv_buffer = conn->recv_buffer;
+  HandshakeRequest request;
+  size_t request_length = 0;
+  int ret = HandshakeRequestParse(recv_buffer.data(), recv_buffer.size(),
+                                  &request, &request_length);
+  if (ret == kHandshakeParseIncomplete) {
+    return recv_buffer.size() > kMaxBufferLength ? -1 : 0;
+  }
+  if (ret != kHandshakeParseOk) return -1;
+  DeflateOptions agreed;
+  char extensions[kMaxHandshakeRespondLength/2];
+  int extensions_length = DeflateNegotiate(request.extensions,
+                                           deflate_options_, &agreed,
+                                           extensions, sizeof(extensions));
+  conn->deflate.SetPool(&deflate_pool_);
+  conn->deflate.Reset(agreed, true);
+  std::unique_lock<std::mutex> session_lock;
+  std::shared_ptr<Connection> previous;
+  std::string resume;
+  uint64_t last = 0;
+  bool resumed = false;
+  if (resume_options_.enabled && request.resume.size > 0) {
+    auto session = OpenSession(request.resume, &session_lock, &last,
+                               &resumed);
+    if (session) {
+      // 同一会话的旧连接可能尚未发现断开, 由新连接取代.
+      previous = session->owner.lock();
+      session->owner = conn;
+      timer_wheel_.Cancel(session->expire_timer);
+      conn->session = session;
+      resume = session->id + " " + std::to_string(last);
+    }
+  }
+  char respond[kMaxHandshakeRespondLength];
+  if ((ret = HandshakeRespondPackaging(
+          request, HttpToken {extensions, static_cast<size_t>(
+              extensions_length)}, HttpToken {resume.data(), resume.size()},
+          respond, sizeof(respond))) < 0) {
+    return -1;
+  }
+  // request中的字段指向接收缓冲区, 生成响应后才能移除请求数据.
+  recv_buffer.erase(recv_buffer.begin(), recv_buffer.begin() + request_length);
+  SendQueue::Frame frame(new std::vector<char>(respond, respond + ret));
+  if (conn->send_queue.PushData(conn->socket, frame) < 0) return -1;
+  if (conn->session) {
+    // 新会话也可能已记录了绑定连接之前广播的消息.
+    std::lock_guard<std::mutex> lock(conn->send_mutex);
+    conn->session->ring.ReadAfter(last, [&conn, this] (
+        uint64_t const& seq, uint8_t const& opcode, char const* data,
+        size_t const& size) {
+      QueueSequenced(conn.get(), seq, static_cast<OPCodeType>(opcode),
+                     data, size);
+    });
+    session_lock.unlock();
+  }
+  if (previous) {
+    BeginClose(previous, kCloseGoingAway, std::string(), close_timeout_ms_);
+  }
+  conn->established.store(true);
+  timer_wheel_.Cancel(conn->handshake_timer);
+  std::weak_ptr<Connection> weak_conn(conn);
+  if (idle_timeout_ms_ > 0) {
+    conn->idle_timer = timer_wheel_.Add(idle_timeout_ms_,
+        [this, weak_conn] () { CheckIdle(weak_conn); });
+  }
+  if (ping_interval_ms_ > 0) {
+    conn->ping_timer = timer_wheel_.Add(ping_interval_ms_,
+        [this, weak_conn] () {
+      auto conn = weak_conn.lock();
+      if (!conn) return;
+      char ping_payload[8];
+      EncodePingTimestamp(SteadyClockMicroseconds(), ping_payload);
+      SendControl(conn->socket, kOPCodePing, ping_payload, 8);
+    }, ping_interval_ms_);
+  }
+  if (agreed.enabled && agreed.release_idle_ms > 0) {
+    // 压缩流在发送线程中使用, 须持有发送锁; 解压流只在本线程中使用.
+    conn->deflate_timer = timer_wheel_.Add(agreed.release_idle_ms,
+        [weak_conn] () {
+      auto conn = weak_conn.lock();
+      if (!conn) return;
+      {
+        std::lock_guard<std::mutex> lock(conn->send_mutex);
+        conn->deflate.ReleaseIdleDeflate();
+      }
+      conn->deflate.ReleaseIdleInflate();
+    }, agreed.release_idle_ms);
+  }
+  if (conn->session) {
+    session_callback_(conn->socket, conn->session->id, resumed);
+  }
+  if (recv_buffer.empty()) return 0;
+  deep_callback_(conn->socket, recv_buffer.data(), recv_buffer.size());
+  return ProcessFrames(conn);
+}
+
+// 会话已丢弃了客户端尚未收到的消息或已过期时新建会话, 由客户端重新获取
+// 状态.
+std::shared_ptr<WebSocketServer::Session> WebSocketServer::OpenSession(
+    HttpToken const& resume, std::unique_lock<std::mutex>* lock,
+    uint64_t* last, bool* resumed) {
+  std::string id;
+  uint64_t seq = 0;
+  if (ResumeTokenParse(resume, &id, &seq) != 0) return nullptr;
+  std::shared_ptr<Session> session;
+  if (!id.empty()) {
+    {
+      std::lock_guard<std::mutex> sessions_lock(sessions_mutex_);
+      auto it = sessions_.find(id);
+      if (it != sessions_.end()) session = it->second;
+    }
+    if (session) {
+      *lock = std::unique_lock<std::mutex>(session->mutex);
+      auto const& ring = session->ring;
+      if (ring.is_open() && seq < ring.next_sequence() &&
+          seq + 1 >= ring.first_sequence()) {
+        *last = seq;
+        *resumed = true;
+        return session;
+      }
+      lock->unlock();
+      DropSession(session);
+    }
+  }
+  session.reset(new Session());
+  session->id = NewSessionId();
+  session->expire_timer = 0;
+  int ret = resume_options_.directory.empty() ?
+      session->ring.Open(resume_options_.ring_bytes) :
+      session->ring.Map(SessionPath(resume_options_.directory, session->id),
+                        resume_options_.ring_bytes);
+  if (ret != 0) return nullptr;
+  {
+    std::lock_guard<std::mutex> sessions_lock(sessions_mutex_);
+    sessions_[session->id] = session;
+  }
+  *lock = std::unique_lock<std::mutex>(session->mutex);
+  *last = 0;
+  *resumed = false;
+  return session;
+}
+
+void WebSocketServer::DropSession(std::shared_ptr<Session> const& session) {
+  {
+    std::lock_guard<std::mutex> lock(sessions_mutex_);
+    auto it = sessions_.find(session->id);
+    if (it != sessions_.end() && it->second == session) sessions_.erase(it);
+  }
+  std::shared_ptr<Connection> owner;
+  {
+    std::lock_guard<std::mutex> lock(session->mutex);
+    session->ring.Close(true);
+    owner = session->owner.lock();
+    session->owner.reset();
+  }
+  if (owner) {
+    BeginClose(owner, kCloseGoingAway, std::string(), close_timeout_ms_);
+  }
+}
+
+void WebSocketServer::DetachSession(std::shared_ptr<Connection> const& conn) {
+  auto const& session = conn->session;
+  if (!session) return;
+  std::lock_guard<std::mutex> lock(session->mutex);
+  if (session->owner.lock() != conn) return;
+  session->owner.reset();
+  ExpireSession(session);
+}
+
+void WebSocketServer::ExpireSession(std::shared_ptr<Session> const& session) {
+  std::weak_ptr<Session> weak_session(session);
+  session->expire_timer = timer_wheel_.Add(resume_options_.session_timeout_ms,
+      [this, weak_session] () {
+    auto session = weak_session.lock();
+    if (!session) return;
+    std::lock_guard<std::mutex> lock(sessions_mutex_);
+    auto it = sessions_.find(session->id);
+    if (it == sessions_.end() || it->second != session) return;
+    std::lock_guard<std::mutex> session_lock(session->mutex);
+    if (!session->owner.expired()) return;
+    sessions_.erase(it);
+    session->ring.Close(true);
+  });
+}
+
+// 目录中的每个会话文件恢复为连接已断开的会话, 之后的广播照常记录,
+// 客户端在保留时间内重连即可补发, 服务端重启对客户端与连接中断相同.
+void WebSocketServer::RestoreSessions(void) {
+#if defined(__linux__)
+  DIR* dir = opendir(resume_options_.directory.c_str());
+  if (dir == nullptr) return;
+  static char const kSuffix[] = ".ring";
+  constexpr size_t kSuffixLength = sizeof(kSuffix) - 1;
+  struct dirent* entry = nullptr;
+  while ((entry = readdir(dir)) != nullptr) {
+    std::string name(entry->d_name);
+    if (name.size() != kSessionIdLength + kSuffixLength ||
+        name.compare(kSessionIdLength, kSuffixLength, kSuffix) != 0) {
+      continue;
+    }
+    std::shared_ptr<Session> session(new Session());
+    session->id = name.substr(0, kSessionIdLength);
+    session->expire_timer = 0;
+    if (session->ring.Map(SessionPath(resume_options_.directory, session->id),
+                          0, false) != 0) {
+      continue;
+    }
+    std::lock_guard<std::mutex> lock(sessions_mutex_);
+    if (sessions_.count(session->id) > 0) continue;
+    sessions_[session->id] = session;
+    std::lock_guard<std::mutex> session_lock(session->mutex);
+    ExpireSession(session);
+  }
+  closedir(dir);
+#endif
+}
+
+void WebSocketServer::CheckIdle(std::weak_ptr<Connection> const& weak_conn) {
+  auto conn = weak_conn.lock();
+  if (!conn) return;
+  int64_t idle_ms = SteadyClockMicroseconds()/1000 - conn->last_recv_ms;
+  if (idle_ms < idle_timeout_ms_) {
+    conn->idle_timer = timer_wheel_.Add(idle_timeout_ms_ - idle_ms,
+        [this, weak_conn] () { CheckIdle(weak_conn); });
+    return;
+  }
+  printf("%s[%d]: Idle timeout !!!\n", __FUNCTION__, __LINE__);
+  std::shared_ptr<std::vector<char>> close_frame(new std::vector<char>());
+  if (WebSocketCloseFramePackaging(kCloseGoingAway, false,
+                                   close_frame.get()) == 0) {
+    conn->send_queue.PushClose(conn->socket, close_frame, true);
+    conn->close_code.store(kCloseGoingAway);
+  }
+  CloseConnection(conn);
+}
+
+int WebSocketServer::BeginClose(std::shared_ptr<Connection> const& conn,
+                                int const& code, std::string const& reason,
+                                int const& timeout_ms) {
+  std::shared_ptr<std::vector<char>> close_frame(new std::vector<char>());
+  if (WebSocketCloseFramePackaging(code, reason, false,
+                                   close_frame.get()) != 0) {
+    return -1;
+  }
+  if (conn->closing.exchange(true)) return -1;
+  conn->send_queue.PushClose(conn->socket, close_frame, false);
+  int expected = 0;
+  conn->close_code.compare_exchange_strong(expected, code);
+  std::weak_ptr<Connection> weak_conn(conn);
+  conn->close_timer.store(timer_wheel_.Add(timeout_ms,
+      [this, weak_conn] () {
+    auto conn = weak_conn.lock();
+    if (!conn) return;
+    printf("%s[%d]: Close timeout !!!\n", __FUNCTION__, __LINE__);
+    CloseConnection(conn);
+  }));
+  wakeup_.Notify();
+  return 0;
+}
+
+void WebSocketServer::CloseConnection(std::shared_ptr<Connection> const& conn) {
+  timer_wheel_.Cancel(conn->handshake_timer);
+  timer_wheel_.Cancel(conn->idle_timer);
+  timer_wheel_.Cancel(conn->ping_timer);
+  timer_wheel_.Cancel(conn->deflate_timer);
+  timer_wheel_.Cancel(conn->close_timer);
+  {
+    std::lock_guard<std::mutex> lock(connections_mutex_);
+    auto it = connections_.find(conn->socket);
+    if (it == connections_.end() || it->second != conn) return;
+    connections_.erase(it);
+    if (connections_.empty()) connections_cv_.notify_all();
+  }
+  // 先解除会话绑定并停用发送队列, 之后发往该会话或仍持有该连接的发送
+  // 不会再写入已关闭的套接字.
+  DetachSession(conn);
+  conn->closed.store(true);
+  conn->send_queue.Shutdown();
+  Close(conn->socket);
+  if (conn->established) {
+    int code = conn->close_code;
+    close_callback_(conn->socket, code != 0 ? code : kCloseAbnormal);
+  }
+}
+
+// 依次解析接收缓冲区中的完整帧并回调, 不完整的数据留待下次接收.
+// 帧或消息长度超出限制时发送1009关闭帧, 文本不是合法的UTF-8时发送1007关闭帧,
+// 协议错误时发送1002关闭帧.
+int WebSocketServer::ProcessFrames(
+    std::shared_ptr<Connection> const& conn) {
+  FrameHeader header {};
+  std::vector<char> inflated;
+  uint64_t offset = 0;
+  uint64_t frame_length = 0;
+  int ret = kFrameParseOk;
+  auto& recv_buffer = conn->recv_buffer;
+  while (offset < recv_buffer.size()) {
+    uint64_t max_payload_length = max_frame_size_;
+    if (max_message_size_ - conn->message_length < max_payload_length) {
+      max_payload_length = max_message_size_ - conn->message_length;
+    }
+    ret = ServerFrameCodec::Parse(recv_buffer.data() + offset,
+                          recv_buffer.size() - offset, max_payload_length,
+                          &header, &frame_length);
+    if (ret != kFrameParseOk) break;
+    char const* data = recv_buffer.data() + offset + header.header_length;
+    uint64_t size = header.payload_length;
+    offset += frame_length;
+    auto const opcode = header.opcode;
+    // 只有协商了permessage-deflate时才允许RSV1, 且只能出现在消息的首帧.
+    uint8_t const reserve = header.reserve;
+    if ((reserve & ~kFrameRsv1Bit) ||
+        (reserve && (!conn->deflate.enabled() || opcode == kOPCodePacket ||
+                     (opcode & 0x8)))) {
+      ret = kFrameParseError;
+      break;
+    }
+    if (opcode == kOPCodePing) {
+      // 自动回复pong, 负载原样返回.
+      SendControl(conn->socket, kOPCodePong, data, size);
+      continue;
+    } else if (opcode == kOPCodePong) {
+      int64_t timestamp_us = DecodePingTimestamp(data, size);
+      if (timestamp_us >= 0) {
+        std::lock_guard<std::mutex> lock(conn->rtt_mutex);
+        RttStatsUpdate(SteadyClockMicroseconds() - timestamp_us,
+                       &conn->rtt_stats);
+      }
+      continue;
+    } else if (opcode == kOPCodeClose) {
+      int code = WebSocketCloseCodeParse(data, size);
+      if (code < 0) {
+        ret = kFrameParseError;
+        break;
+      }
+      if (validate_utf8_ && size > 2 && !IsValidUtf8(data + 2, size - 2)) {
+        ret = kFrameParseInvalidPayload;
+        break;
+      }
+      // 对端发起关闭时回复相同的状态码, 回复排在已排队的数据之后.
+      conn->peer_closed.store(true);
+      if (!conn->closing) {
+        conn->close_code.store(code);
+        BeginClose(conn, code == kCloseNoStatus ? kCloseNormal : code,
+                   std::string(), close_timeout_ms_);
+      }
+      offset = recv_buffer.size();
+      break;
+    } else if (conn->peer_closed) {
+      continue;
+    } else if (!(opcode & 0x8)) {
+      bool const fin = header.fin;
+      // 续帧只能接在未结束的分片消息之后, 新消息须等上一条结束后开始.
+      if ((opcode == kOPCodePacket) != conn->fragmented) {
+        ret = kFrameParseError;
+        break;
+      }
+      if (opcode != kOPCodePacket) conn->compressed = (reserve != 0);
+      if (conn->compressed) {
+        int inflate_ret = conn->deflate.Decompress(
+            data, size, fin, max_message_size_ - conn->message_length,
+            &inflated);
+        if (inflate_ret != kInflateOk) {
+          ret = (inflate_ret == kInflateTooLarge) ?
+              kFrameParseTooLarge : kFrameParseError;
+          break;
+        }
+        data = inflated.data();
+        size = inflated.size();
+      }
+      if (opcode != kOPCodePacket) {
+        conn->text = (opcode == kOPCodeText);
+        conn->message_opcode = static_cast<OPCodeType>(opcode);
+        conn->message_buffer.clear();
+        conn->utf8.Reset();
+      }
+      if (validate_utf8_ && conn->text &&
+          (!conn->utf8.Feed(data, size) || (fin && !conn->utf8.Finish()))) {
+        ret = kFrameParseInvalidPayload;
+        break;
+      }
+      conn->message_length = fin ? 0 : conn->message_length + size;
+      conn->fragmented = !fin;
+      callback_(conn->socket, data, size);
+      if (message_callback_) {
+        // 未分片的消息直接回调, 不经过组装缓冲区.
+        auto& message = conn->message_buffer;
+        if (fin && opcode != kOPCodePacket) {
+          message_callback_(conn->socket, conn->message_opcode, data, size);
+        } else {
+          message.insert(message.end(), data, data + size);
+          if (fin) {
+            message_callback_(conn->socket, conn->message_opcode,
+                              message.data(), message.size());
+            message.clear();
+          }
+        }
+      }
+      continue;
+    }
+    callback_(conn->socket, data, size);
+  }
+  recv_buffer.erase(recv_buffer.begin(), recv_buffer.begin() + offset);
+  if (ret < 0) {
+    uint16_t code = (ret == kFrameParseTooLarge) ? kCloseMessageTooBig :
+        (ret == kFrameParseInvalidPayload) ? kCloseInvalidPayload :
+        kCloseProtocolError;
+    std::shared_ptr<std::vector<char>> close_frame(new std::vector<char>());
+    if (WebSocketCloseFramePackaging(code, false, close_frame.get()) == 0) {
+      conn->send_queue.PushClose(conn->socket, close_frame, true);
+      conn->close_code.store(code);
+    }
+    return -1;
+  }
+  return 0;
 }
 
 }  // namespace libwebsocket
@@ -39,6 +39,10 @@
 
 #include "sha1.h"
 
+#include <string.h>
+
+#include "sha1_compress.h"
+
 
 namespace libwebsocket {
 
@@ -59,25 +63,6 @@ namespace libwebsocket {
  */
 SHA1::SHA1() { Reset(); }
 
-/*
- *  ~SHA1
- *
- *  Description:
- *      This is the destructor for the sha1 class
- *
- *  Parameters:
- *      None.
- *
- *  Returns:
- *      Nothing.
- *
- *  Comments:
- *
- */
-SHA1::~SHA1() {
-  // The destructor does nothing
-}
-
 /*
  *  Reset
  *
@@ -174,24 +159,43 @@ void SHA1::Input(const unsigned char *message_array, unsigned length) {
     return;
   }
 
-  while (length-- && !Corrupted) {
-    Message_Block[Message_Block_Index++] = (*message_array & 0xFF);
-
-    Length_Low += 8;
-    Length_Low &= 0xFFFFFFFF;  // Force it to 32 bits
-    if (Length_Low == 0) {
-      Length_High++;
-      Length_High &= 0xFFFFFFFF;  // Force it to 32 bits
-      if (Length_High == 0) {
-        Corrupted = true;  // Message is too long
-      }
-    }
+  uint64_t bits = (static_cast<uint64_t>(Length_High) << 32) | Length_Low;
+  uint64_t added = static_cast<uint64_t>(length) << 3;
+  if (bits + added < bits) {
+    Corrupted = true;  // Message is too long
+    return;
+  }
+  bits += added;
+  Length_Low = static_cast<unsigned>(bits & 0xFFFFFFFF);
+  Length_High = static_cast<unsigned>(bits >> 32);
 
+  /*
+   *  Complete a partially filled block first, then compress whole
+   *  blocks straight from the caller's buffer.
+   */
+  if (Message_Block_Index > 0) {
+    unsigned count = 64 - Message_Block_Index;
+    if (count > length) {
+      count = length;
+    }
+    memcpy(Message_Block + Message_Block_Index, message_array, count);
+    Message_Block_Index += count;
+    message_array += count;
+    length -= count;
     if (Message_Block_Index == 64) {
       ProcessMessageBlock();
     }
+  }
+
+  if (length >= 64) {
+    Sha1Compress(H, message_array, length / 64);
+    message_array += length & ~63u;
+    length &= 63;
+  }
 
-    message_array++;
+  if (length > 0) {
+    memcpy(Message_Block, message_array, length);
+    Message_Block_Index = length;
   }
 }
 
@@ -276,12 +280,7 @@ void SHA1::Input(char message_element) {
  *
  */
 SHA1 &SHA1::operator<<(const char *message_array) {
-  const char *p = message_array;
-
-  while (*p) {
-    Input(*p);
-    p++;
-  }
+  Input(message_array, strlen(message_array));
 
   return *this;
 }
@@ -305,12 +304,8 @@ SHA1 &SHA1::operator<<(const char *message_array) {
  *
  */
 SHA1 &SHA1::operator<<(const unsigned char *message_array) {
-  const unsigned char *p = message_array;
-
-  while (*p) {
-    Input(*p);
-    p++;
-  }
+  Input(message_array,
+        strlen(reinterpret_cast<const char *>(message_array)));
 
   return *this;
 }
@@ -375,85 +370,12 @@ SHA1 &SHA1::operator<<(const unsigned char message_element) {
  *      Nothing.
  *
  *  Comments:
- *      Many of the variable names in this function, especially the single
- *      character names, were used because those were the names used
- *      in the publication.
+ *      The compression itself is done by Sha1Compress, which uses the
+ *      SHA extensions of the processor when they are available.
  *
  */
 void SHA1::ProcessMessageBlock() {
-  const unsigned K[] = {// Constants defined for SHA-1
-                        0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6};
-  int t;                   // Loop counter
-  unsigned temp;           // Temporary word value
-  unsigned W[80];          // Word sequence
-  unsigned A, B, C, D, E;  // Word buffers
-
-  /*
-   *  Initialize the first 16 words in the array W
-   */
-  for (t = 0; t < 16; t++) {
-    W[t] = ((unsigned)Message_Block[t * 4]) << 24;
-    W[t] |= ((unsigned)Message_Block[t * 4 + 1]) << 16;
-    W[t] |= ((unsigned)Message_Block[t * 4 + 2]) << 8;
-    W[t] |= ((unsigned)Message_Block[t * 4 + 3]);
-  }
-
-  for (t = 16; t < 80; t++) {
-    W[t] = CircularShift(1, W[t - 3] ^ W[t - 8] ^ W[t - 14] ^ W[t - 16]);
-  }
-
-  A = H[0];
-  B = H[1];
-  C = H[2];
-  D = H[3];
-  E = H[4];
-
-  for (t = 0; t < 20; t++) {
-    temp = CircularShift(5, A) + ((B & C) | ((~B) & D)) + E + W[t] + K[0];
-    temp &= 0xFFFFFFFF;
-    E = D;
-    D = C;
-    C = CircularShift(30, B);
-    B = A;
-    A = temp;
-  }
-
-  for (t = 20; t < 40; t++) {
-    temp = CircularShift(5, A) + (B ^ C ^ D) + E + W[t] + K[1];
-    temp &= 0xFFFFFFFF;
-    E = D;
-    D = C;
-    C = CircularShift(30, B);
-    B = A;
-    A = temp;
-  }
-
-  for (t = 40; t < 60; t++) {
-    temp =
-        CircularShift(5, A) + ((B & C) | (B & D) | (C & D)) + E + W[t] + K[2];
-    temp &= 0xFFFFFFFF;
-    E = D;
-    D = C;
-    C = CircularShift(30, B);
-    B = A;
-    A = temp;
-  }
-
-  for (t = 60; t < 80; t++) {
-    temp = CircularShift(5, A) + (B ^ C ^ D) + E + W[t] + K[3];
-    temp &= 0xFFFFFFFF;
-    E = D;
-    D = C;
-    C = CircularShift(30, B);
-    B = A;
-    A = temp;
-  }
-
-  H[0] = (H[0] + A) & 0xFFFFFFFF;
-  H[1] = (H[1] + B) & 0xFFFFFFFF;
-  H[2] = (H[2] + C) & 0xFFFFFFFF;
-  H[3] = (H[3] + D) & 0xFFFFFFFF;
-  H[4] = (H[4] + E) & 0xFFFFFFFF;
+  Sha1Compress(H, Message_Block, 1);
 
   Message_Block_Index = 0;
 }
@@ -518,26 +440,4 @@ void SHA1::PadMessage() {
   ProcessMessageBlock();
 }
 
-/*
- *  CircularShift
- *
- *  Description:
- *      This member function will perform a circular shifting operation.
- *
- *  Parameters:
- *      bits: [in]
- *          The number of bits to shift (1-31)
- *      word: [in]
- *          The value to shift (assumes a 32-bit integer)
- *
- *  Returns:
- *      The shifted value.
- *
- *  Comments:
- *
- */
-unsigned SHA1::CircularShift(int bits, unsigned word) {
-  return ((word << bits) & 0xFFFFFFFF) | ((word & 0xFFFFFFFF) >> (32 - bits));
-}
-
 }  // namespace libwebsocket
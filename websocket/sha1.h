@@ -24,13 +24,14 @@
 #ifndef WEBSOCKET_SHA1_H_
 #define WEBSOCKET_SHA1_H_
 
+#include <stdint.h>
+
 
 namespace libwebsocket {
 
 class SHA1 {
  public:
   SHA1();
-  virtual ~SHA1();
 
   /*
    *  Re-initialize the class
@@ -65,12 +66,7 @@ class SHA1 {
    */
   void PadMessage();
 
-  /*
-   *  Performs a circular left shift operation
-   */
-  inline unsigned CircularShift(int bits, unsigned word);
-
-  unsigned H[5];  // Message digest buffers
+  uint32_t H[5];  // Message digest buffers
 
   unsigned Length_Low;   // Message length in bits
   unsigned Length_High;  // Message length in bits
@@ -0,0 +1,461 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  sha1_compress.cc
+// @Version :  1.0
+// @Desc    :  None
+
+#include "sha1_compress.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WEBSOCKET_SHA1_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__linux__)
+#define WEBSOCKET_SHA1_ARM 1
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#if defined(__GNUC__)
+#define WEBSOCKET_SHA1_VECTOR 1
+#endif
+
+
+namespace libwebsocket {
+
+namespace {
+
+constexpr uint32_t kK0 = 0x5A827999;
+constexpr uint32_t kK1 = 0x6ED9EBA1;
+constexpr uint32_t kK2 = 0x8F1BBCDC;
+constexpr uint32_t kK3 = 0xCA62C1D6;
+
+using CompressFunction = void (*)(uint32_t*, uint8_t const*, size_t);
+using LanesFunction = void (*)(uint32_t (*)[5], uint8_t const* const*, size_t);
+
+inline uint32_t Rotl(uint32_t x, int n) { return (x << n) | (x >> (32 - n)); }
+
+inline uint32_t LoadBigEndian32(uint8_t const* p) {
+  return (static_cast<uint32_t>(p[0]) << 24) |
+         (static_cast<uint32_t>(p[1]) << 16) |
+         (static_cast<uint32_t>(p[2]) << 8) | p[3];
+}
+
+// 标量实现, 消息扩展使用16个字的循环缓冲区.
+void CompressScalar(uint32_t* state, uint8_t const* blocks, size_t count) {
+  uint32_t w[16];
+  for (; count > 0; --count, blocks += 64) {
+    uint32_t a = state[0], b = state[1], c = state[2];
+    uint32_t d = state[3], e = state[4];
+    for (int t = 0; t < 80; ++t) {
+      uint32_t f, k;
+      if (t < 16) {
+        w[t] = LoadBigEndian32(blocks + t*4);
+      } else {
+        w[t&15] = Rotl(w[(t-3)&15] ^ w[(t-8)&15] ^ w[(t-14)&15] ^ w[t&15], 1);
+      }
+      if (t < 20) {
+        f = (b & c) | (~b & d);
+        k = kK0;
+      } else if (t < 40) {
+        f = b ^ c ^ d;
+        k = kK1;
+      } else if (t < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = kK2;
+      } else {
+        f = b ^ c ^ d;
+        k = kK3;
+      }
+      uint32_t temp = Rotl(a, 5) + f + e + k + w[t&15];
+      e = d;
+      d = c;
+      c = Rotl(b, 30);
+      b = a;
+      a = temp;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+  }
+}
+
+#if defined(WEBSOCKET_SHA1_VECTOR)
+// 多路实现, 每个向量元素对应一路消息. 函数强制内联到各指令集的入口函数中,
+// 由入口函数的target属性决定生成的指令.
+// 宏而非函数, 避免以32字节向量为参数时的ABI差异.
+#define WEBSOCKET_SHA1_VECTOR_ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+template <typename V, size_t N>
+inline void CompressVector(uint32_t (*states)[5], uint8_t const* const* blocks,
+                           size_t count) __attribute__((always_inline));
+template <typename V, size_t N>
+inline void CompressVector(uint32_t (*states)[5], uint8_t const* const* blocks,
+                           size_t count) {
+  V h[5];
+  for (int j = 0; j < 5; ++j) {
+    for (size_t i = 0; i < N; ++i) h[j][i] = states[i][j];
+  }
+  V w[16];
+  for (size_t offset = 0; count > 0; --count, offset += 64) {
+    V a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int t = 0; t < 80; ++t) {
+      V f;
+      uint32_t k;
+      if (t < 16) {
+        for (size_t i = 0; i < N; ++i) {
+          w[t][i] = LoadBigEndian32(blocks[i] + offset + t*4);
+        }
+      } else {
+        V x = w[(t-3)&15] ^ w[(t-8)&15] ^ w[(t-14)&15] ^ w[t&15];
+        w[t&15] = WEBSOCKET_SHA1_VECTOR_ROTL(x, 1);
+      }
+      if (t < 20) {
+        f = d ^ (b & (c ^ d));
+        k = kK0;
+      } else if (t < 40) {
+        f = b ^ c ^ d;
+        k = kK1;
+      } else if (t < 60) {
+        f = (b & c) | (d & (b | c));
+        k = kK2;
+      } else {
+        f = b ^ c ^ d;
+        k = kK3;
+      }
+      V temp = WEBSOCKET_SHA1_VECTOR_ROTL(a, 5) + f + e + k + w[t&15];
+      e = d;
+      d = c;
+      c = WEBSOCKET_SHA1_VECTOR_ROTL(b, 30);
+      b = a;
+      a = temp;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+  }
+  for (int j = 0; j < 5; ++j) {
+    for (size_t i = 0; i < N; ++i) states[i][j] = h[j][i];
+  }
+}
+
+#undef WEBSOCKET_SHA1_VECTOR_ROTL
+
+typedef uint32_t Vector4 __attribute__((vector_size(16)));
+
+void CompressLanes4(uint32_t (*states)[5], uint8_t const* const* blocks,
+                    size_t count) {
+  CompressVector<Vector4, 4>(states, blocks, count);
+}
+#endif  // WEBSOCKET_SHA1_VECTOR
+
+#if defined(WEBSOCKET_SHA1_X86)
+typedef uint32_t Vector8 __attribute__((vector_size(32)));
+
+__attribute__((target("avx2")))
+void CompressLanes8(uint32_t (*states)[5], uint8_t const* const* blocks,
+                    size_t count) {
+  CompressVector<Vector8, 8>(states, blocks, count);
+}
+
+// SHA-NI实现, 每条sha1rnds4指令完成4轮.
+// 第g组(4轮)的消息字位于msg[g&3], 按需提前计算后续组的消息扩展.
+#define WEBSOCKET_SHA1NI_ROUNDS(g)                                        \
+  e[(g) & 1] = _mm_sha1nexte_epu32(e[(g) & 1], msg[(g) & 3]);            \
+  e[((g) + 1) & 1] = abcd;                                                \
+  if ((g) >= 3 && (g) <= 18) {                                            \
+    msg[((g) + 1) & 3] = _mm_sha1msg2_epu32(msg[((g) + 1) & 3],          \
+                                            msg[(g) & 3]);                \
+  }                                                                       \
+  abcd = _mm_sha1rnds4_epu32(abcd, e[(g) & 1], (g) / 5);                 \
+  if ((g) >= 1 && (g) <= 16) {                                            \
+    msg[((g) + 3) & 3] = _mm_sha1msg1_epu32(msg[((g) + 3) & 3],          \
+                                            msg[(g) & 3]);                \
+  }                                                                       \
+  if ((g) >= 2 && (g) <= 17) {                                            \
+    msg[((g) + 2) & 3] = _mm_xor_si128(msg[((g) + 2) & 3], msg[(g) & 3]); \
+  }
+
+__attribute__((target("sha,sse4.1")))
+void CompressShaNi(uint32_t* state, uint8_t const* blocks, size_t count) {
+  __m128i const kByteSwap = _mm_set_epi64x(0x0001020304050607ULL,
+                                           0x08090a0b0c0d0e0fULL);
+  __m128i abcd = _mm_shuffle_epi32(
+      _mm_loadu_si128(reinterpret_cast<__m128i const*>(state)), 0x1B);
+  __m128i e0 = _mm_set_epi32(state[4], 0, 0, 0);
+  __m128i e[2];
+  __m128i msg[4];
+  for (; count > 0; --count, blocks += 64) {
+    __m128i abcd_save = abcd;
+    __m128i e_save = e0;
+    for (int i = 0; i < 4; ++i) {
+      msg[i] = _mm_shuffle_epi8(_mm_loadu_si128(
+          reinterpret_cast<__m128i const*>(blocks + i*16)), kByteSwap);
+    }
+    e[0] = _mm_add_epi32(e0, msg[0]);
+    e[1] = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e[0], 0);
+    WEBSOCKET_SHA1NI_ROUNDS(1)
+    WEBSOCKET_SHA1NI_ROUNDS(2)
+    WEBSOCKET_SHA1NI_ROUNDS(3)
+    WEBSOCKET_SHA1NI_ROUNDS(4)
+    WEBSOCKET_SHA1NI_ROUNDS(5)
+    WEBSOCKET_SHA1NI_ROUNDS(6)
+    WEBSOCKET_SHA1NI_ROUNDS(7)
+    WEBSOCKET_SHA1NI_ROUNDS(8)
+    WEBSOCKET_SHA1NI_ROUNDS(9)
+    WEBSOCKET_SHA1NI_ROUNDS(10)
+    WEBSOCKET_SHA1NI_ROUNDS(11)
+    WEBSOCKET_SHA1NI_ROUNDS(12)
+    WEBSOCKET_SHA1NI_ROUNDS(13)
+    WEBSOCKET_SHA1NI_ROUNDS(14)
+    WEBSOCKET_SHA1NI_ROUNDS(15)
+    WEBSOCKET_SHA1NI_ROUNDS(16)
+    WEBSOCKET_SHA1NI_ROUNDS(17)
+    WEBSOCKET_SHA1NI_ROUNDS(18)
+    WEBSOCKET_SHA1NI_ROUNDS(19)
+    e0 = _mm_sha1nexte_epu32(e[0], e_save);
+    abcd = _mm_add_epi32(abcd, abcd_save);
+  }
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(state),
+                   _mm_shuffle_epi32(abcd, 0x1B));
+  state[4] = _mm_extract_epi32(e0, 3);
+}
+
+#undef WEBSOCKET_SHA1NI_ROUNDS
+
+bool CpuSupportsShaNi(void) {
+  unsigned eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return false;
+  bool ssse3 = ecx & (1u << 9);
+  bool sse41 = ecx & (1u << 19);
+  if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return false;
+  return ssse3 && sse41 && (ebx & (1u << 29));
+}
+
+bool CpuSupportsAvx2(void) {
+  unsigned eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return false;
+  // 操作系统需开启YMM寄存器状态保存.
+  if (!(ecx & (1u << 27)) || !(ecx & (1u << 28))) return false;
+  unsigned xcr0_low, xcr0_high;
+  __asm__("xgetbv" : "=a"(xcr0_low), "=d"(xcr0_high) : "c"(0));
+  if ((xcr0_low & 0x6) != 0x6) return false;
+  if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return false;
+  return ebx & (1u << 5);
+}
+#endif  // WEBSOCKET_SHA1_X86
+
+#if defined(WEBSOCKET_SHA1_ARM)
+#if defined(__clang__)
+#define WEBSOCKET_SHA1_ARM_TARGET __attribute__((target("crypto")))
+#else
+#define WEBSOCKET_SHA1_ARM_TARGET __attribute__((target("+crypto")))
+#endif
+
+// ARMv8 Crypto扩展实现, 每组4轮, 提前两组计算消息字与常数之和.
+WEBSOCKET_SHA1_ARM_TARGET
+void CompressArmv8(uint32_t* state, uint8_t const* blocks, size_t count) {
+  uint32x4_t const k[4] = {vdupq_n_u32(kK0), vdupq_n_u32(kK1),
+                           vdupq_n_u32(kK2), vdupq_n_u32(kK3)};
+  uint32x4_t abcd = vld1q_u32(state);
+  uint32_t e0 = state[4];
+  for (; count > 0; --count, blocks += 64) {
+    uint32x4_t abcd_save = abcd;
+    uint32_t e_save = e0;
+    uint32x4_t msg[4];
+    for (int i = 0; i < 4; ++i) {
+      msg[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(blocks + i*16)));
+    }
+    uint32x4_t tmp[2] = {vaddq_u32(msg[0], k[0]), vaddq_u32(msg[1], k[0])};
+    uint32_t e[2] = {e0, 0};
+    for (int g = 0; g < 20; ++g) {
+      e[(g+1)&1] = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+      if (g < 5) {
+        abcd = vsha1cq_u32(abcd, e[g&1], tmp[g&1]);
+      } else if (g < 10 || g >= 15) {
+        abcd = vsha1pq_u32(abcd, e[g&1], tmp[g&1]);
+      } else {
+        abcd = vsha1mq_u32(abcd, e[g&1], tmp[g&1]);
+      }
+      if (g + 2 < 20) tmp[g&1] = vaddq_u32(msg[(g+2)&3], k[(g+2)/5]);
+      if (g + 3 >= 4 && g + 3 < 20) {
+        msg[(g+3)&3] = vsha1su1q_u32(msg[(g+3)&3], msg[(g+2)&3]);
+      }
+      if (g + 4 < 20) {
+        msg[g&3] = vsha1su0q_u32(msg[g&3], msg[(g+1)&3], msg[(g+2)&3]);
+      }
+    }
+    e0 = e[0] + e_save;
+    abcd = vaddq_u32(abcd, abcd_save);
+  }
+  vst1q_u32(state, abcd);
+  state[4] = e0;
+}
+
+#undef WEBSOCKET_SHA1_ARM_TARGET
+#endif  // WEBSOCKET_SHA1_ARM
+
+// 运行时选择的实现.
+struct Sha1Dispatch {
+  CompressFunction compress;
+  char const* compress_name;
+  LanesFunction lanes;
+  size_t lane_width;
+  char const* lanes_name;
+  size_t preferred_lanes;
+};
+
+Sha1Dispatch SelectImplementation(void) {
+  Sha1Dispatch dispatch {CompressScalar, "scalar", nullptr, 1, "scalar", 1};
+#if defined(WEBSOCKET_SHA1_VECTOR)
+  dispatch.lanes = CompressLanes4;
+  dispatch.lane_width = 4;
+  dispatch.lanes_name = "vector x4";
+  dispatch.preferred_lanes = 4;
+#endif
+#if defined(WEBSOCKET_SHA1_X86)
+  if (CpuSupportsAvx2()) {
+    dispatch.lanes = CompressLanes8;
+    dispatch.lane_width = 8;
+    dispatch.lanes_name = "avx2 x8";
+    dispatch.preferred_lanes = 8;
+  }
+  if (CpuSupportsShaNi()) {
+    dispatch.compress = CompressShaNi;
+    dispatch.compress_name = "sha-ni";
+    dispatch.preferred_lanes = 1;
+  }
+#elif defined(WEBSOCKET_SHA1_ARM)
+  if (getauxval(AT_HWCAP) & HWCAP_SHA1) {
+    dispatch.compress = CompressArmv8;
+    dispatch.compress_name = "armv8 crypto";
+    dispatch.preferred_lanes = 1;
+  }
+#endif
+  return dispatch;
+}
+
+Sha1Dispatch& Implementation(void) {
+  static Sha1Dispatch dispatch = SelectImplementation();
+  return dispatch;
+}
+
+}  // namespace
+
+void Sha1Compress(uint32_t state[5], uint8_t const* blocks, size_t count) {
+  Implementation().compress(state, blocks, count);
+}
+
+// 不足一组的路以第0路的数据补齐, 补齐路的结果丢弃.
+void Sha1CompressLanes(uint32_t (*states)[5], uint8_t const* const* blocks,
+                       size_t lanes, size_t count) {
+  auto const& dispatch = Implementation();
+  if (dispatch.lanes == nullptr) {
+    for (size_t i = 0; i < lanes; ++i) {
+      dispatch.compress(states[i], blocks[i], count);
+    }
+    return;
+  }
+  size_t const width = dispatch.lane_width;
+  uint32_t group_states[kMaxSha1Lanes][5];
+  uint8_t const* group_blocks[kMaxSha1Lanes];
+  for (size_t begin = 0; begin < lanes; begin += width) {
+    size_t n = lanes - begin < width ? lanes - begin : width;
+    for (size_t i = 0; i < width; ++i) {
+      size_t lane = begin + (i < n ? i : 0);
+      memcpy(group_states[i], states[lane], sizeof(group_states[i]));
+      group_blocks[i] = blocks[lane];
+    }
+    dispatch.lanes(group_states, group_blocks, count);
+    for (size_t i = 0; i < n; ++i) {
+      memcpy(states[begin + i], group_states[i], sizeof(group_states[i]));
+    }
+  }
+}
+
+size_t Sha1PreferredLanes(void) {
+  return Implementation().preferred_lanes;
+}
+
+char const* Sha1Implementation(void) {
+  return Implementation().compress_name;
+}
+
+char const* Sha1LanesImplementation(void) {
+  return Implementation().lanes_name;
+}
+
+bool Sha1ForceKernel(int const& kernel) {
+  Sha1Dispatch dispatch {CompressScalar, "scalar", nullptr, 1, "scalar", 1};
+  switch (kernel) {
+    case kSha1KernelAuto:
+      dispatch = SelectImplementation();
+      break;
+    case kSha1KernelScalar:
+      break;
+#if defined(WEBSOCKET_SHA1_VECTOR)
+    case kSha1KernelVector4:
+      dispatch.lanes = CompressLanes4;
+      dispatch.lane_width = 4;
+      dispatch.lanes_name = "vector x4";
+      dispatch.preferred_lanes = 4;
+      break;
+#endif
+#if defined(WEBSOCKET_SHA1_X86)
+    case kSha1KernelAvx2:
+      if (!CpuSupportsAvx2()) return false;
+      dispatch.lanes = CompressLanes8;
+      dispatch.lane_width = 8;
+      dispatch.lanes_name = "avx2 x8";
+      dispatch.preferred_lanes = 8;
+      break;
+    case kSha1KernelShaNi:
+      if (!CpuSupportsShaNi()) return false;
+      dispatch.compress = CompressShaNi;
+      dispatch.compress_name = "sha-ni";
+      dispatch.lanes_name = "sha-ni";
+      break;
+#elif defined(WEBSOCKET_SHA1_ARM)
+    case kSha1KernelArmv8:
+      if (!(getauxval(AT_HWCAP) & HWCAP_SHA1)) return false;
+      dispatch.compress = CompressArmv8;
+      dispatch.compress_name = "armv8 crypto";
+      dispatch.lanes_name = "armv8 crypto";
+      break;
+#endif
+    default:
+      return false;
+  }
+  Implementation() = dispatch;
+  return true;
+}
+
+}  // namespace libwebsocket
@@ -0,0 +1,71 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  sha1_compress.h
+// @Version :  1.0
+// @Desc    :  None
+
+#ifndef WEBSOCKET_SHA1_COMPRESS_H_
+#define WEBSOCKET_SHA1_COMPRESS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+namespace libwebsocket {
+
+// 多路并行压缩支持的最大路数.
+constexpr size_t kMaxSha1Lanes = 8;
+
+// SHA-1压缩函数, 依次处理blocks开始的count个64字节块.
+// 首次调用时按CPU特性选择SHA-NI, ARMv8 Crypto扩展或标量实现.
+void Sha1Compress(uint32_t state[5], uint8_t const* blocks, size_t count);
+
+// 多路并行压缩, 第i路以states[i]为初始状态处理blocks[i]开始的count个块.
+// lanes不超过kMaxSha1Lanes, 各路的块数必须相同.
+void Sha1CompressLanes(uint32_t (*states)[5], uint8_t const* const* blocks,
+                       size_t lanes, size_t count);
+
+// 批量计算时每批的推荐路数. 单路硬件加速快于SIMD多路时返回1.
+size_t Sha1PreferredLanes(void);
+
+// 当前使用的单路和多路实现名称, 用于调试和基准测试输出.
+char const* Sha1Implementation(void);
+char const* Sha1LanesImplementation(void);
+
+// 可强制使用的实现.
+enum Sha1Kernel {
+  kSha1KernelAuto = 0,  // 按CPU特性选择.
+  kSha1KernelScalar,  // 标量单路, 多路时逐路计算.
+  kSha1KernelVector4,  // 编译器向量扩展4路, 单路为标量.
+  kSha1KernelAvx2,  // AVX2 8路, 单路为标量.
+  kSha1KernelShaNi,  // SHA-NI单路, 多路时逐路计算.
+  kSha1KernelArmv8,  // ARMv8 Crypto扩展单路, 多路时逐路计算.
+};
+
+// 强制使用指定实现, 用于测试各实现的结果是否一致. 编译器或CPU不支持时
+// 返回false, 当前实现不变. 不可与其它线程中的计算同时调用.
+bool Sha1ForceKernel(int const& kernel);
+
+}  // namespace libwebsocket
+
+#endif  // WEBSOCKET_SHA1_COMPRESS_H_
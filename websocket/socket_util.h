@@ -30,9 +30,13 @@
 #ifndef WEBSOCKET_SOCKET_UTIL_H_
 #define WEBSOCKET_SOCKET_UTIL_H_
 
+#include <errno.h>
+#include <stddef.h>
 #if defined(__linux__)
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #elif defined(_WIN32) || defined(__WIN64)
 #include <winsock2.h>
@@ -122,6 +126,51 @@ inline int Send(SOCKET s, const char* buf, int len, int flags) {
 }
 #endif
 
+// 一次写出的多个缓冲区中的一个.
+struct SendBuffer {
+  char const* data;
+  size_t size;
+};
+// 单次SendBuffers调用的最大缓冲区数.
+constexpr int kMaxSendBuffers = 64;
+
+// writev, 以一次系统调用写出多个缓冲区.
+template<typename T>
+inline int SendBuffers(T s, SendBuffer const* buffers, int count, int flags) {
+  return -1;
+}
+#if defined(__linux__)
+inline int SendBuffers(int fd, SendBuffer const* buffers, int count,
+                       int flags) {
+  struct iovec iov[kMaxSendBuffers];
+  if (count > kMaxSendBuffers) count = kMaxSendBuffers;
+  for (int i = 0; i < count; ++i) {
+    iov[i].iov_base = const_cast<char*>(buffers[i].data);
+    iov[i].iov_len = buffers[i].size;
+  }
+  struct msghdr msg = {};
+  msg.msg_iov = iov;
+  msg.msg_iovlen = count;
+  return static_cast<int>(sendmsg(fd, &msg, flags));
+}
+#elif defined(_WIN32)
+template<>
+inline int SendBuffers(SOCKET s, SendBuffer const* buffers, int count,
+                       int flags) {
+  WSABUF wsa_buffers[kMaxSendBuffers];
+  if (count > kMaxSendBuffers) count = kMaxSendBuffers;
+  for (int i = 0; i < count; ++i) {
+    wsa_buffers[i].buf = const_cast<char*>(buffers[i].data);
+    wsa_buffers[i].len = static_cast<ULONG>(buffers[i].size);
+  }
+  DWORD sent = 0;
+  if (WSASend(s, wsa_buffers, count, &sent, flags, nullptr, nullptr) != 0) {
+    return -1;
+  }
+  return static_cast<int>(sent);
+}
+#endif
+
 // recv.
 template<typename T>
 inline int Recv(T s, char* buf, int len, int flags) {
@@ -155,6 +204,64 @@ inline int Close(SOCKET s) {
 }
 #endif
 
+// 等待非阻塞套接字的连接完成, timeout_ms为0时只检查当前状态.
+// 返回0表示已连接, 1表示超时仍未完成, -1表示连接失败.
+template<typename T>
+inline int WaitConnected(T s, int timeout_ms) {
+  return -1;
+}
+#if defined(__linux__)
+template<>
+inline int WaitConnected(int fd, int timeout_ms) {
+  struct pollfd pfd = {fd, POLLOUT, 0};
+  int ret = poll(&pfd, 1, timeout_ms);
+  if (ret < 0) return -1;
+  if (ret == 0) return 1;
+  int error = 0;
+  socklen_t length = sizeof(error);
+  if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0) return -1;
+  if (error != 0) {
+    errno = error;
+    return -1;
+  }
+  return 0;
+}
+#elif defined(_WIN32)
+template<>
+inline int WaitConnected(SOCKET s, int timeout_ms) {
+  fd_set write_set;
+  fd_set error_set;
+  FD_ZERO(&write_set);
+  FD_ZERO(&error_set);
+  FD_SET(s, &write_set);
+  FD_SET(s, &error_set);
+  struct timeval timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+  int ret = select(0, nullptr, &write_set, &error_set, &timeout);
+  if (ret < 0) return -1;
+  if (ret == 0) return 1;
+  return FD_ISSET(s, &error_set) ? -1 : 0;
+}
+#endif
+
+// 判断最近一次套接字操作的错误是否可重试.
+inline bool IsRetryableError(void) {
+#if defined(__linux__)
+  return errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK;
+#elif defined(_WIN32)
+  auto wsa_errno = WSAGetLastError();
+  return wsa_errno == WSAEINTR || wsa_errno == WSAEWOULDBLOCK;
+#else
+  return false;
+#endif
+}
+
+// 发送时使用的标志, 对端关闭后写入不产生SIGPIPE.
+#if defined(__linux__)
+constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+constexpr int kSendFlags = 0;
+#endif
+
 }  // namespace libwebsocket
 
 #endif  // WEBSOCKET_SOCKET_UTIL_H_
@@ -0,0 +1,240 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  timer_wheel.cc
+// @Version :  1.0
+// @Desc    :  None
+
+#include "timer_wheel.h"
+
+#include <chrono>
+
+
+namespace libwebsocket {
+
+namespace {
+
+constexpr int kRootBits = 8;  // 第0层槽数位宽.
+constexpr int kLevelBits = 6;  // 其余各层槽数位宽.
+constexpr int kLevels = 4;  // 层数.
+constexpr uint64_t kRootSize = 1 << kRootBits;
+constexpr uint64_t kLevelSize = 1 << kLevelBits;
+constexpr uint64_t kRootMask = kRootSize - 1;
+constexpr uint64_t kLevelMask = kLevelSize - 1;
+constexpr int kSlotCount = kRootSize + (kLevels - 1)*kLevelSize;
+// 可表示的最大延迟刻度.
+constexpr uint64_t kMaxTicks =
+    (1ULL << (kRootBits + (kLevels - 1)*kLevelBits)) - 1;
+constexpr uint32_t kNil = UINT32_MAX;
+
+// 第level层(level >= 1)的起始槽位置和刻度位移.
+inline int LevelOffset(int const& level) {
+  return kRootSize + (level - 1)*kLevelSize;
+}
+inline int LevelShift(int const& level) {
+  return kRootBits + (level - 1)*kLevelBits;
+}
+
+}  // namespace
+
+TimerWheel::TimerWheel(int const& tick_ms)
+    : tick_ms_(tick_ms > 0 ? tick_ms : 1), count_(0),
+      heads_(kSlotCount, kNil), free_head_(kNil) {
+  current_tick_ = NowTick();
+}
+
+TimerWheel::TimerId TimerWheel::Add(int64_t const& delay_ms,
+                                    Callback const& callback,
+                                    int64_t const& interval_ms) {
+  if (!callback) return 0;
+  std::lock_guard<std::mutex> lock(mutex_);
+  uint64_t delay_ticks = delay_ms > 0 ? (delay_ms + tick_ms_ - 1)/tick_ms_ : 0;
+  if (delay_ticks == 0) delay_ticks = 1;
+  if (delay_ticks > kMaxTicks) delay_ticks = kMaxTicks;
+  uint64_t expire_tick = NowTick() + delay_ticks;
+  if (expire_tick <= current_tick_) expire_tick = current_tick_ + 1;
+  uint32_t index = AllocNode();
+  auto& node = nodes_[index];
+  node.expire_tick = expire_tick;
+  node.interval_ticks = 0;
+  if (interval_ms > 0) {
+    node.interval_ticks = (interval_ms + tick_ms_ - 1)/tick_ms_;
+    if (node.interval_ticks > kMaxTicks) node.interval_ticks = kMaxTicks;
+  }
+  node.callback = callback;
+  Place(index);
+  ++count_;
+  return (static_cast<uint64_t>(node.generation) << 32) | (index + 1ULL);
+}
+
+bool TimerWheel::Cancel(TimerId const& id) {
+  uint64_t index = (id & 0xFFFFFFFF);
+  if (index == 0) return false;
+  --index;
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (index >= nodes_.size()) return false;
+  auto& node = nodes_[index];
+  if (node.slot < 0 || node.generation != (id >> 32)) return false;
+  Unlink(index);
+  FreeNode(index);
+  --count_;
+  return true;
+}
+
+// 逐刻度推进, 每当低层转完一圈时将上一层对应槽中的节点重新分配.
+int TimerWheel::Advance(void) {
+  std::vector<Callback> expired;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t target_tick = NowTick();
+    while (current_tick_ < target_tick) {
+      if (count_ == 0) {
+        current_tick_ = target_tick;
+        break;
+      }
+      ++current_tick_;
+      if ((current_tick_ & kRootMask) == 0) {
+        for (int level = 1; level < kLevels; ++level) {
+          uint64_t index = (current_tick_ >> LevelShift(level)) & kLevelMask;
+          Cascade(LevelOffset(level) + index);
+          if (index != 0) break;
+        }
+      }
+      uint32_t index = Detach(current_tick_ & kRootMask);
+      while (index != kNil) {
+        uint32_t next = nodes_[index].next;
+        auto& node = nodes_[index];
+        if (node.expire_tick > current_tick_) {
+          Place(index);
+        } else if (node.interval_ticks > 0) {
+          expired.push_back(node.callback);
+          node.expire_tick = current_tick_ + node.interval_ticks;
+          Place(index);
+        } else {
+          expired.push_back(std::move(node.callback));
+          FreeNode(index);
+          --count_;
+        }
+        index = next;
+      }
+    }
+  }
+  for (auto& callback : expired) callback();
+  return expired.size();
+}
+
+int64_t TimerWheel::NextTimeout(void) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (count_ == 0) return -1;
+  // 只需查找到第0层本轮结束为止, 届时高层节点会被重新分配.
+  uint64_t tick = current_tick_ + 1;
+  while ((tick & kRootMask) != 0 && heads_[tick & kRootMask] == kNil) ++tick;
+  int64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  int64_t timeout = static_cast<int64_t>(tick)*tick_ms_ - now_ms;
+  return timeout > 0 ? timeout : 0;
+}
+
+uint64_t TimerWheel::NowTick(void) const {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count()/tick_ms_;
+}
+
+uint32_t TimerWheel::AllocNode(void) {
+  uint32_t index = free_head_;
+  if (index != kNil) {
+    free_head_ = nodes_[index].next;
+  } else {
+    index = nodes_.size();
+    nodes_.emplace_back();
+    nodes_[index].generation = 0;
+  }
+  nodes_[index].prev = kNil;
+  nodes_[index].next = kNil;
+  return index;
+}
+
+void TimerWheel::FreeNode(uint32_t const& index) {
+  auto& node = nodes_[index];
+  node.callback = nullptr;
+  node.slot = -1;
+  ++node.generation;
+  node.prev = kNil;
+  node.next = free_head_;
+  free_head_ = index;
+}
+
+void TimerWheel::Place(uint32_t const& index) {
+  auto& node = nodes_[index];
+  uint64_t expire_tick = node.expire_tick;
+  uint64_t delta = expire_tick > current_tick_ ?
+      expire_tick - current_tick_ : 0;
+  if (delta > kMaxTicks) {
+    delta = kMaxTicks;
+    expire_tick = node.expire_tick = current_tick_ + kMaxTicks;
+  }
+  int slot = expire_tick & kRootMask;
+  if (delta >= kRootSize) {
+    for (int level = 1; level < kLevels; ++level) {
+      if (delta < (1ULL << (LevelShift(level) + kLevelBits)) ||
+          level == kLevels - 1) {
+        slot = LevelOffset(level) +
+               ((expire_tick >> LevelShift(level)) & kLevelMask);
+        break;
+      }
+    }
+  }
+  node.slot = slot;
+  node.prev = kNil;
+  node.next = heads_[slot];
+  if (node.next != kNil) nodes_[node.next].prev = index;
+  heads_[slot] = index;
+}
+
+void TimerWheel::Unlink(uint32_t const& index) {
+  auto& node = nodes_[index];
+  if (node.prev != kNil) {
+    nodes_[node.prev].next = node.next;
+  } else {
+    heads_[node.slot] = node.next;
+  }
+  if (node.next != kNil) nodes_[node.next].prev = node.prev;
+  node.prev = kNil;
+  node.next = kNil;
+}
+
+uint32_t TimerWheel::Detach(int const& slot) {
+  uint32_t head = heads_[slot];
+  heads_[slot] = kNil;
+  return head;
+}
+
+void TimerWheel::Cascade(int const& slot) {
+  uint32_t index = Detach(slot);
+  while (index != kNil) {
+    uint32_t next = nodes_[index].next;
+    Place(index);
+    index = next;
+  }
+}
+
+}  // namespace libwebsocket
@@ -0,0 +1,366 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  utf8_validator.cc
+// @Version :  1.0
+// @Desc    :  None
+
+
+#include "utf8_validator.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WEBSOCKET_UTF8_AVX2 1
+#include <immintrin.h>
+#endif
+
+
+namespace libwebsocket {
+
+namespace {
+
+// 使用AVX2的最小输入长度, 更短的数据直接逐字节校验.
+constexpr size_t kAvx2MinLength = 64;
+
+// 以lead开头的字符的字节数, 不能作为首字节时返回0.
+inline size_t SequenceLength(uint8_t lead) {
+  if (lead < 0x80) return 1;
+  if (lead < 0xC2) return 0;
+  if (lead < 0xE0) return 2;
+  if (lead < 0xF0) return 3;
+  if (lead < 0xF5) return 4;
+  return 0;
+}
+
+// 首字节之后第一个后续字节的合法区间(RFC 3629 第4节).
+inline bool SecondByteValid(uint8_t lead, uint8_t byte) {
+  uint8_t low = 0x80;
+  uint8_t high = 0xBF;
+  if (lead == 0xE0) {
+    low = 0xA0;  // 超长编码.
+  } else if (lead == 0xED) {
+    high = 0x9F;  // 代理区.
+  } else if (lead == 0xF0) {
+    low = 0x90;  // 超长编码.
+  } else if (lead == 0xF4) {
+    high = 0x8F;  // 大于U+10FFFF.
+  }
+  return byte >= low && byte <= high;
+}
+
+// 检查size字节是否为某个合法字符的前缀.
+bool IsValidPrefix(uint8_t const* data, size_t size) {
+  size_t length = SequenceLength(data[0]);
+  if (length < 2 || size > length) return false;
+  if (size >= 2 && !SecondByteValid(data[0], data[1])) return false;
+  for (size_t i = 2; i < size; ++i) {
+    if ((data[i] & 0xC0) != 0x80) return false;
+  }
+  return true;
+}
+
+// 逐字节校验, ASCII部分每次跳过8字节.
+bool ValidateScalar(uint8_t const* data, size_t size) {
+  size_t i = 0;
+  while (i < size) {
+    if (i + 8 <= size) {
+      uint64_t word;
+      memcpy(&word, data + i, 8);
+      if ((word & 0x8080808080808080ULL) == 0) {
+        i += 8;
+        continue;
+      }
+    }
+    uint8_t const lead = data[i];
+    if (lead < 0x80) {
+      ++i;
+      continue;
+    }
+    size_t const length = SequenceLength(lead);
+    if (length == 0 || size - i < length ||
+        !SecondByteValid(lead, data[i+1])) {
+      return false;
+    }
+    for (size_t k = 2; k < length; ++k) {
+      if ((data[i+k] & 0xC0) != 0x80) return false;
+    }
+    i += length;
+  }
+  return true;
+}
+
+#if defined(WEBSOCKET_UTF8_AVX2)
+// 查表法校验(Keiser & Lemire, "Validating UTF-8 In Less Than One
+// Instruction Per Byte"). 每个字节与前一个字节的高4位, 低4位以及本字节的
+// 高4位分别查表, 三个结果按位与后非零即为非法; 第3, 4字节位置是否应为后续
+// 字节另行检查.
+constexpr uint8_t kTooShort = 1 << 0;  // 首字节之后不是后续字节.
+constexpr uint8_t kTooLong = 1 << 1;  // ASCII之后是后续字节.
+constexpr uint8_t kOverlong3 = 1 << 2;
+constexpr uint8_t kTooLarge = 1 << 3;
+constexpr uint8_t kSurrogate = 1 << 4;
+constexpr uint8_t kOverlong2 = 1 << 5;
+constexpr uint8_t kTooLarge1000 = 1 << 6;
+constexpr uint8_t kOverlong4 = 1 << 6;
+constexpr uint8_t kTwoConts = 1 << 7;  // 两个连续的后续字节.
+constexpr uint8_t kCarry = kTooShort | kTooLong | kTwoConts;
+
+// 校验状态, 在32字节块之间传递.
+struct Avx2State {
+  __m256i error;
+  __m256i prev_input;
+  __m256i prev_incomplete;
+};
+
+__attribute__((target("avx2")))
+inline __m256i ShiftRight4(__m256i value) {
+  return _mm256_and_si256(_mm256_srli_epi16(value, 4),
+                          _mm256_set1_epi8(0x0F));
+}
+
+// 取input向前错开n字节的序列, 前n字节来自prev的末尾.
+template <int n>
+__attribute__((target("avx2")))
+inline __m256i Prev(__m256i input, __m256i prev) {
+  return _mm256_alignr_epi8(
+      input, _mm256_permute2x128_si256(prev, input, 0x21), 16 - n);
+}
+
+__attribute__((target("avx2")))
+void CheckBlock(__m256i input, Avx2State* state) {
+  if (_mm256_movemask_epi8(input) == 0) {
+    // 全为ASCII, 只需检查上一块末尾是否有未完成的字符.
+    state->error = _mm256_or_si256(state->error, state->prev_incomplete);
+    state->prev_input = input;
+    state->prev_incomplete = _mm256_setzero_si256();
+    return;
+  }
+  __m256i const byte_1_high_table = _mm256_setr_epi8(
+      kTooLong, kTooLong, kTooLong, kTooLong,
+      kTooLong, kTooLong, kTooLong, kTooLong,
+      kTwoConts, kTwoConts, kTwoConts, kTwoConts,
+      kTooShort | kOverlong2,
+      kTooShort,
+      kTooShort | kOverlong3 | kSurrogate,
+      kTooShort | kTooLarge | kTooLarge1000 | kOverlong4,
+      kTooLong, kTooLong, kTooLong, kTooLong,
+      kTooLong, kTooLong, kTooLong, kTooLong,
+      kTwoConts, kTwoConts, kTwoConts, kTwoConts,
+      kTooShort | kOverlong2,
+      kTooShort,
+      kTooShort | kOverlong3 | kSurrogate,
+      kTooShort | kTooLarge | kTooLarge1000 | kOverlong4);
+  __m256i const byte_1_low_table = _mm256_setr_epi8(
+      kCarry | kOverlong3 | kOverlong2 | kOverlong4,
+      kCarry | kOverlong2,
+      kCarry, kCarry,
+      kCarry | kTooLarge,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000 | kSurrogate,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kOverlong3 | kOverlong2 | kOverlong4,
+      kCarry | kOverlong2,
+      kCarry, kCarry,
+      kCarry | kTooLarge,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000 | kSurrogate,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000);
+  __m256i const byte_2_high_table = _mm256_setr_epi8(
+      kTooShort, kTooShort, kTooShort, kTooShort,
+      kTooShort, kTooShort, kTooShort, kTooShort,
+      static_cast<char>(kTooLong | kOverlong2 | kTwoConts | kOverlong3 |
+                        kTooLarge1000 | kOverlong4),
+      static_cast<char>(kTooLong | kOverlong2 | kTwoConts | kOverlong3 |
+                        kTooLarge),
+      static_cast<char>(kTooLong | kOverlong2 | kTwoConts | kSurrogate |
+                        kTooLarge),
+      static_cast<char>(kTooLong | kOverlong2 | kTwoConts | kSurrogate |
+                        kTooLarge),
+      kTooShort, kTooShort, kTooShort, kTooShort,
+      kTooShort, kTooShort, kTooShort, kTooShort,
+      kTooShort, kTooShort, kTooShort, kTooShort,
+      static_cast<char>(kTooLong | kOverlong2 | kTwoConts | kOverlong3 |
+                        kTooLarge1000 | kOverlong4),
+      static_cast<char>(kTooLong | kOverlong2 | kTwoConts | kOverlong3 |
+                        kTooLarge),
+      static_cast<char>(kTooLong | kOverlong2 | kTwoConts | kSurrogate |
+                        kTooLarge),
+      static_cast<char>(kTooLong | kOverlong2 | kTwoConts | kSurrogate |
+                        kTooLarge),
+      kTooShort, kTooShort, kTooShort, kTooShort);
+  __m256i const prev1 = Prev<1>(input, state->prev_input);
+  __m256i const special_cases = _mm256_and_si256(
+      _mm256_and_si256(
+          _mm256_shuffle_epi8(byte_1_high_table, ShiftRight4(prev1)),
+          _mm256_shuffle_epi8(byte_1_low_table, _mm256_and_si256(
+              prev1, _mm256_set1_epi8(0x0F)))),
+      _mm256_shuffle_epi8(byte_2_high_table, ShiftRight4(input)));
+  // 3字节字符的第3字节和4字节字符的第3, 4字节必须是后续字节.
+  __m256i const prev2 = Prev<2>(input, state->prev_input);
+  __m256i const prev3 = Prev<3>(input, state->prev_input);
+  __m256i const is_third_byte = _mm256_subs_epu8(
+      prev2, _mm256_set1_epi8(static_cast<char>(0xE0 - 0x80)));
+  __m256i const is_fourth_byte = _mm256_subs_epu8(
+      prev3, _mm256_set1_epi8(static_cast<char>(0xF0 - 0x80)));
+  __m256i const must23_80 = _mm256_and_si256(
+      _mm256_or_si256(is_third_byte, is_fourth_byte),
+      _mm256_set1_epi8(static_cast<char>(0x80)));
+  state->error = _mm256_or_si256(state->error,
+                                 _mm256_xor_si256(must23_80, special_cases));
+  // 块末尾3字节中是否有未完成的多字节字符.
+  __m256i const max_value = _mm256_setr_epi8(
+      -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+      -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+      static_cast<char>(0xF0 - 1), static_cast<char>(0xE0 - 1),
+      static_cast<char>(0xC0 - 1));
+  state->prev_incomplete = _mm256_subs_epu8(input, max_value);
+  state->prev_input = input;
+}
+
+__attribute__((target("avx2")))
+bool ValidateAvx2(uint8_t const* data, size_t size) {
+  Avx2State state;
+  state.error = _mm256_setzero_si256();
+  state.prev_input = _mm256_setzero_si256();
+  state.prev_incomplete = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    CheckBlock(_mm256_loadu_si256(
+        reinterpret_cast<__m256i const*>(data + i)), &state);
+  }
+  // 不足32字节的尾部补0(ASCII)后校验, 补齐的部分同时检查了末尾的完整性.
+  uint8_t tail[32] = {0};
+  memcpy(tail, data + i, size - i);
+  CheckBlock(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(tail)),
+             &state);
+  state.error = _mm256_or_si256(state.error, state.prev_incomplete);
+  return _mm256_testz_si256(state.error, state.error) != 0;
+}
+
+bool CpuSupportsAvx2(void) {
+  static bool const supported = __builtin_cpu_supports("avx2");
+  return supported;
+}
+
+// 是否使用AVX2实现, 默认按CPU特性选择, 可由Utf8ForceKernel修改.
+bool& UseAvx2(void) {
+  static bool use = CpuSupportsAvx2();
+  return use;
+}
+#endif  // WEBSOCKET_UTF8_AVX2
+
+// 数据末尾未完成的字符的起始位置, 末尾字符完整或非法时返回size.
+size_t IncompleteTail(uint8_t const* data, size_t size) {
+  for (size_t i = 1; i <= 3 && i <= size; ++i) {
+    uint8_t const byte = data[size-i];
+    if ((byte & 0xC0) == 0x80) continue;  // 后续字节.
+    size_t const length = SequenceLength(byte);
+    return (length > i) ? size - i : size;
+  }
+  return size;
+}
+
+}  // namespace
+
+
+bool IsValidUtf8(char const* data, size_t size) {
+  if (size == 0) return true;
+  if (data == nullptr) return false;
+  auto bytes = reinterpret_cast<uint8_t const*>(data);
+#if defined(WEBSOCKET_UTF8_AVX2)
+  if (size >= kAvx2MinLength && UseAvx2()) {
+    return ValidateAvx2(bytes, size);
+  }
+#endif
+  return ValidateScalar(bytes, size);
+}
+
+bool Utf8Validator::Feed(char const* data, size_t size) {
+  if (size == 0) return true;
+  if (data == nullptr) return false;
+  auto bytes = reinterpret_cast<uint8_t const*>(data);
+  if (pending_size_ > 0) {
+    // 先补全上一段末尾的字符.
+    size_t const length = SequenceLength(pending_[0]);
+    size_t take = length - pending_size_;
+    if (take > size) take = size;
+    memcpy(pending_ + pending_size_, bytes, take);
+    pending_size_ += take;
+    bytes += take;
+    size -= take;
+    if (pending_size_ < length) return IsValidPrefix(pending_, pending_size_);
+    pending_size_ = 0;
+    if (!ValidateScalar(pending_, length)) return false;
+  }
+  size_t const complete = IncompleteTail(bytes, size);
+  if (!IsValidUtf8(reinterpret_cast<char const*>(bytes), complete)) {
+    return false;
+  }
+  if (complete < size) {
+    pending_size_ = size - complete;
+    memcpy(pending_, bytes + complete, pending_size_);
+    return IsValidPrefix(pending_, pending_size_);
+  }
+  return true;
+}
+
+bool Utf8ForceKernel(int const& kernel) {
+  switch (kernel) {
+    case kUtf8KernelAuto:
+#if defined(WEBSOCKET_UTF8_AVX2)
+      UseAvx2() = CpuSupportsAvx2();
+#endif
+      return true;
+    case kUtf8KernelScalar:
+#if defined(WEBSOCKET_UTF8_AVX2)
+      UseAvx2() = false;
+#endif
+      return true;
+#if defined(WEBSOCKET_UTF8_AVX2)
+    case kUtf8KernelAvx2:
+      if (!CpuSupportsAvx2()) return false;
+      UseAvx2() = true;
+      return true;
+#endif
+    default:
+      return false;
+  }
+}
+
+}  // namespace libwebsocket
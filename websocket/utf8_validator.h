@@ -0,0 +1,84 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  utf8_validator.h
+// @Version :  1.0
+// @Desc    :  None
+
+
+#ifndef WEBSOCKET_UTF8_VALIDATOR_H_
+#define WEBSOCKET_UTF8_VALIDATOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+namespace libwebsocket {
+
+// 校验一段完整的数据是否为合法的UTF-8(RFC 3629), 拒绝超长编码,
+// 代理区码点和大于U+10FFFF的码点. CPU支持时使用AVX2每次校验32字节.
+bool IsValidUtf8(char const* data, size_t size);
+
+// 可强制使用的实现.
+enum Utf8Kernel {
+  kUtf8KernelAuto = 0,  // 按CPU特性选择.
+  kUtf8KernelScalar,  // 逐字节校验.
+  kUtf8KernelAvx2,  // AVX2, 不足64字节的输入仍逐字节校验.
+};
+
+// 强制使用指定实现, 用于测试各实现的结果是否一致. 编译器或CPU不支持时
+// 返回false, 当前实现不变. 不可与其它线程中的校验同时调用.
+bool Utf8ForceKernel(int const& kernel);
+
+// 增量UTF-8校验器, 同一条消息可分多次输入, 跨越分片边界的字符在下一次
+// 输入时继续校验. 非法序列一经出现即返回false, 不必等待消息结束.
+//
+// Example:
+//    Utf8Validator validator;
+//    if (!validator.Feed(fragment1, size1) ||
+//        !validator.Feed(fragment2, size2) ||
+//        !validator.Finish()) {
+//      // 以1007关闭连接.
+//    }
+class Utf8Validator {
+ public:
+  Utf8Validator() : pending_size_(0) {}
+
+  // 开始校验一条新消息.
+  void Reset(void) { pending_size_ = 0; }
+  // 校验消息的下一段数据, 发现非法序列时返回false.
+  bool Feed(char const* data, size_t size);
+  // 消息结束, 末尾有不完整的字符时返回false. 之后可直接校验下一条消息.
+  bool Finish(void) {
+    bool complete = (pending_size_ == 0);
+    pending_size_ = 0;
+    return complete;
+  }
+
+ private:
+  uint8_t pending_[4];  // 上一段末尾未完成的字符.
+  size_t pending_size_;  // 未完成字符已输入的字节数.
+};
+
+}  // namespace libwebsocket
+
+#endif  // WEBSOCKET_UTF8_VALIDATOR_H_
@@ -0,0 +1,71 @@
+// MIT License
+//
+// Copyright (c) 2020 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// @File    :  wakeup.cc
+// @Version :  1.0
+// @Desc    :  None
+
+#include "wakeup.h"
+
+#include <stdint.h>
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+
+namespace libwebsocket {
+
+Wakeup::Wakeup() : fd_(-1) {
+#if defined(__linux__)
+  fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+  pending_.store(false);
+}
+
+Wakeup::~Wakeup() {
+#if defined(__linux__)
+  if (fd_ >= 0) close(fd_);
+#endif
+}
+
+void Wakeup::Notify(void) {
+  if (fd_ < 0 || pending_.exchange(true)) return;
+#if defined(__linux__)
+  uint64_t value = 1;
+  if (write(fd_, &value, sizeof(value)) < 0) {
+    pending_.store(false);
+  }
+#endif
+}
+
+// 先清除标志再读取, 保证之后的Notify一定会再次写入.
+void Wakeup::Consume(void) {
+  if (fd_ < 0) return;
+  pending_.store(false);
+#if defined(__linux__)
+  uint64_t value = 0;
+  if (read(fd_, &value, sizeof(value)) < 0) return;
+#endif
+}
+
+}  // namespace libwebsocket
@@ -8,184 +8,497 @@
 
 #include "websocket.h"
 
-#if defined(__linux__)
-#include <arpa/inet.h>
-#elif defined(_WIN32)
-#include <winsock2.h>
-#include <windows.h>
-#endif
-
 #include <assert.h>
-#include <time.h>
+#include <string.h>
 
-#include <map>
 #include <vector>
 
 #include "base64.h"
+#include "frame_codec.h"
 #include "sha1.h"
+#include "sha1_compress.h"
 
 namespace libwebsocket {
 
 namespace {
 
-constexpr char kMaskKey[] = {'f', 'u', 'c', 'k'};
+constexpr char kWebSocketGuid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
 
-union U16Converter {
-  uint16_t value;
-  uint8_t array[2];
-};
+// 由协议头中的各字段组成帧首字节, 不依赖位域在内存中的布局.
+inline uint8_t FrameFlags(WebSocketProtocolHead const& head) {
+  return static_cast<uint8_t>((head.bit.fin ? kFrameFinBit : 0) |
+                              ((head.bit.reserve & 0x7) << 4) |
+                              (head.bit.opcode & kFrameOpcodeBits));
+}
 
-union U64Converter {
-  uint64_t value;
-  uint8_t array[8];
-};
+inline bool IsOws(char const& ch) { return ch == ' ' || ch == '\t'; }
 
-int StringSplit(std::string const& str, std::string const& div,
-                std::vector<std::string>* out) {
-  if (out == nullptr) return -1;
-  out->clear();
-  std::string::size_type pos1 = 0;
-  std::string::size_type pos2 = str.find(div);
-  while (std::string::npos != pos2) {
-    out->push_back(str.substr(pos1, pos2-pos1));
-    pos1 = pos2 + div.size();
-    pos2 = str.find(div, pos1);
-  }
-  if (pos1 != str.length()) out->push_back(str.substr(pos1));
-  return 0;
+// 不区分大小写比较, name须为小写.
+inline bool TokenEquals(char const* data, size_t size,
+                        char const* name, size_t name_size) {
+  if (size != name_size) return false;
+  for (size_t i = 0; i < size; ++i) {
+    char ch = data[i];
+    if (ch >= 'A' && ch <= 'Z') ch += 'a' - 'A';
+    if (ch != name[i]) return false;
+  }
+  return true;
 }
 
-int GetRandomMaskKey(std::vector<char>* out) {
-  if (out == nullptr) return -1;
-  srand(time(nullptr));
-  union {
-    int i32val;
-    char ch_array[4];
-  } mask_key {rand()};
-  out->assign(mask_key.ch_array, mask_key.ch_array+4);
-  return 0;
+// 可在两个块内完成计算的最大key长度.
+constexpr size_t kMaxShortKeyLength = 128 - (sizeof(kWebSocketGuid) - 1) - 9;
+
+// 将key与GUID拼接并按SHA-1规则填充为两个块, key长度不超过kMaxShortKeyLength.
+void PadAcceptMessage(char const* key, size_t size, uint8_t* out) {
+  constexpr size_t kGuidLength = sizeof(kWebSocketGuid) - 1;
+  memcpy(out, key, size);
+  memcpy(out + size, kWebSocketGuid, kGuidLength);
+  size_t length = size + kGuidLength;
+  out[length] = 0x80;
+  memset(out + length + 1, 0, 120 - length - 1);
+  uint64_t bits = static_cast<uint64_t>(length) << 3;
+  for (int i = 0; i < 8; ++i) {
+    out[127 - i] = static_cast<uint8_t>(bits >> (i*8));
+  }
 }
 
-}  // namespace
+inline void InitSha1State(uint32_t state[5]) {
+  state[0] = 0x67452301;
+  state[1] = 0xEFCDAB89;
+  state[2] = 0x98BADCFE;
+  state[3] = 0x10325476;
+  state[4] = 0xC3D2E1F0;
+}
 
+// 将摘要按大端序输出并进行Base64编码.
+void EncodeAcceptKey(uint32_t const state[5], char* out) {
+  char digest[20];
+  for (int i = 0; i < 5; ++i) {
+    digest[i*4] = static_cast<char>(state[i] >> 24);
+    digest[i*4+1] = static_cast<char>(state[i] >> 16);
+    digest[i*4+2] = static_cast<char>(state[i] >> 8);
+    digest[i*4+3] = static_cast<char>(state[i]);
+  }
+  Base64Encode(digest, sizeof(digest), out);
+}
 
-int HandShake(const std::string &request, std::string *respond) {
-  std::vector<std::string> lines;
-  std::vector<std::string> header;
-  std::map<std::string, std::string> header_map;
-  StringSplit(request, "\r\n", &lines);
-  for (auto str : lines) {
-    if (str.find(": ") != std::string::npos) {
-      StringSplit(str, ": ", &header);
-    } else if (str.find(":") != std::string::npos) {
-      StringSplit(str, ":", &header);
-    } else {
-      continue;
+// 逗号分隔的列表中是否包含指定token, token须为小写.
+bool TokenListContains(HttpToken const& list,
+                       char const* token, size_t token_size) {
+  size_t i = 0;
+  while (i < list.size) {
+    while (i < list.size && (IsOws(list.data[i]) || list.data[i] == ',')) ++i;
+    size_t begin = i;
+    while (i < list.size && list.data[i] != ',') ++i;
+    size_t end = i;
+    while (end > begin && IsOws(list.data[end-1])) --end;
+    if (TokenEquals(list.data + begin, end - begin, token, token_size)) {
+      return true;
     }
-    header_map[header.at(0)] = header.at(1);
-  }
-  // Generate respond data.
-  *respond = "HTTP/1.1 101 Switching Protocols\r\n";
-  *respond += "Connection: upgrade\r\n";
-  *respond += "Sec-WebSocket-Accept: ";
-  std::string real_key = header_map["Sec-WebSocket-Key"];
-  real_key += "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
-  SHA1 sha;
-  uint32_t message_digest[5];
-  sha.Reset();
-  sha << real_key.c_str();
-  sha.Result(message_digest);
-  for (int i = 0; i < 5; i++) {
-    message_digest[i] = htonl(message_digest[i]);
-  }
-  std::vector<char> keytemp(reinterpret_cast<char*>(message_digest),
-                            reinterpret_cast<char*>(message_digest)+20);
-  Base64Encode(keytemp, &real_key);
-  real_key += "\r\n";
-  *respond += real_key.c_str();
-  *respond += "Upgrade: websocket\r\n\r\n";
-  return 0;
+  }
+  return false;
 }
 
-int WebSocketFramePackaging(const WebSocketMsg& msg,
-                            std::vector<char> *out) {
-  if (out == nullptr) return -1;
-  out->clear();
-  uint64_t length = msg.payload_content.size();
-  auto head = msg.msg_head;
-  out->push_back(head.u8val[0]);
-  // Payload length.
-  if (length < 126) {
-    head.bit.payload_len = length;
-    out->push_back(head.u8val[1]);
-  } else if (length < 65536) {
-    head.bit.payload_len = 126;
-    out->push_back(head.u8val[1]);
-    U16Converter converter;
-    converter.value = length;
-    for (int i = 0; i < 2; ++i) {
-      out->push_back(converter.array[1-i]);
+// 取出pos开始的一行, 不含行尾的CRLF或LF. 数据不足一行时返回false.
+bool NextHttpLine(char const* data, size_t size, size_t* pos,
+                  HttpToken* line) {
+  char const* begin = data + *pos;
+  auto eol = static_cast<char const*>(memchr(begin, '\n', size - *pos));
+  if (eol == nullptr) return false;
+  size_t length = eol - begin;
+  *pos += length + 1;
+  if (length > 0 && begin[length-1] == '\r') --length;
+  *line = HttpToken {begin, length};
+  return true;
+}
+
+// 握手请求和响应中关心的头部.
+struct HandshakeHeaders {
+  bool upgrade;  // Upgrade包含websocket.
+  bool connection;  // Connection包含upgrade.
+  bool version;  // Sec-WebSocket-Version为13.
+  HttpToken host;
+  HttpToken origin;
+  HttpToken key;
+  HttpToken accept;
+  HttpToken protocol;
+  HttpToken extensions;
+  HttpToken resume;
+};
+
+// 解析pos开始的各头部直到空行, 结束时pos指向空行之后.
+int ParseHandshakeHeaders(char const* data, size_t size, size_t* pos,
+                          HandshakeHeaders* out) {
+  HttpToken line {};
+  while (true) {
+    if (!NextHttpLine(data, size, pos, &line)) {
+      return kHandshakeParseIncomplete;
     }
+    if (line.size == 0) break;  // 头部结束.
+    auto colon = static_cast<char const*>(memchr(line.data, ':', line.size));
+    if (colon == nullptr || colon == line.data) return kHandshakeParseError;
+    char const* name = line.data;
+    size_t name_size = colon - line.data;
+    char const* begin = colon + 1;
+    char const* end = line.data + line.size;
+    while (begin < end && IsOws(*begin)) ++begin;
+    while (end > begin && IsOws(*(end-1))) --end;
+    HttpToken value {begin, static_cast<size_t>(end - begin)};
+    // 先按长度区分, 每个头部最多比较一次名称.
+    switch (name_size) {
+      case 4:
+        if (TokenEquals(name, name_size, "host", 4)) out->host = value;
+        break;
+      case 6:
+        if (TokenEquals(name, name_size, "origin", 6)) out->origin = value;
+        break;
+      case 7:
+        if (TokenEquals(name, name_size, "upgrade", 7)) {
+          out->upgrade = TokenListContains(value, "websocket", 9);
+        }
+        break;
+      case 10:
+        if (TokenEquals(name, name_size, "connection", 10)) {
+          out->connection = TokenListContains(value, "upgrade", 7);
+        }
+        break;
+      case 17:
+        if (TokenEquals(name, name_size, "sec-websocket-key", 17)) {
+          out->key = value;
+        }
+        break;
+      case 18:
+        if (TokenEquals(name, name_size, "x-websocket-resume", 18)) {
+          out->resume = value;
+        }
+        break;
+      case 20:
+        if (TokenEquals(name, name_size, "sec-websocket-accept", 20)) {
+          out->accept = value;
+        }
+        break;
+      case 21:
+        if (TokenEquals(name, name_size, "sec-websocket-version", 21)) {
+          out->version = (value.size == 2 && memcmp(value.data, "13", 2) == 0);
+        }
+        break;
+      case 22:
+        if (TokenEquals(name, name_size, "sec-websocket-protocol", 22)) {
+          out->protocol = value;
+        }
+        break;
+      case 24:
+        if (TokenEquals(name, name_size, "sec-websocket-extensions", 24)) {
+          out->extensions = value;
+        }
+        break;
+      default:
+        break;
+    }
+  }
+  return kHandshakeParseOk;
+}
+
+}  // namespace
+
+
+int HandshakeRequestParse(char const* data, size_t size,
+                          HandshakeRequest* out, size_t* request_length) {
+  if (data == nullptr || out == nullptr || request_length == nullptr) {
+    return kHandshakeParseError;
+  }
+  *out = HandshakeRequest {};
+  size_t pos = 0;
+  HttpToken line {};
+  if (!NextHttpLine(data, size, &pos, &line)) return kHandshakeParseIncomplete;
+  // GET <path> HTTP/1.1
+  static char const kVersion[] = " HTTP/1.1";
+  constexpr size_t kVersionLength = sizeof(kVersion) - 1;
+  if (line.size <= 4 + kVersionLength || memcmp(line.data, "GET ", 4) != 0 ||
+      memcmp(line.data + line.size - kVersionLength, kVersion,
+             kVersionLength) != 0) {
+    return kHandshakeParseError;
+  }
+  out->path = HttpToken {line.data + 4, line.size - 4 - kVersionLength};
+  if (memchr(out->path.data, ' ', out->path.size) != nullptr) {
+    return kHandshakeParseError;
+  }
+  HandshakeHeaders headers {};
+  int ret = ParseHandshakeHeaders(data, size, &pos, &headers);
+  if (ret != kHandshakeParseOk) return ret;
+  if (!headers.upgrade || !headers.connection || !headers.version ||
+      headers.key.size == 0) {
+    return kHandshakeParseError;
+  }
+  out->host = headers.host;
+  out->origin = headers.origin;
+  out->key = headers.key;
+  out->protocol = headers.protocol;
+  out->extensions = headers.extensions;
+  out->resume = headers.resume;
+  *request_length = pos;
+  return kHandshakeParseOk;
+}
+
+int HandshakeRespondParse(char const* data, size_t size,
+                          HandshakeRespond* out, size_t* respond_length) {
+  if (data == nullptr || out == nullptr || respond_length == nullptr) {
+    return kHandshakeParseError;
+  }
+  *out = HandshakeRespond {};
+  size_t pos = 0;
+  HttpToken line {};
+  if (!NextHttpLine(data, size, &pos, &line)) return kHandshakeParseIncomplete;
+  // HTTP/1.1 101 <reason>
+  static char const kStatus[] = "HTTP/1.1 101";
+  constexpr size_t kStatusLength = sizeof(kStatus) - 1;
+  if (line.size < kStatusLength ||
+      memcmp(line.data, kStatus, kStatusLength) != 0 ||
+      (line.size > kStatusLength && line.data[kStatusLength] != ' ')) {
+    return kHandshakeParseError;
+  }
+  HandshakeHeaders headers {};
+  int ret = ParseHandshakeHeaders(data, size, &pos, &headers);
+  if (ret != kHandshakeParseOk) return ret;
+  if (!headers.upgrade || !headers.connection || headers.accept.size == 0) {
+    return kHandshakeParseError;
+  }
+  out->accept = headers.accept;
+  out->protocol = headers.protocol;
+  out->extensions = headers.extensions;
+  out->resume = headers.resume;
+  *respond_length = pos;
+  return kHandshakeParseOk;
+}
+
+void WebSocketAcceptKey(char const* key, size_t size, char* out) {
+  uint32_t state[5];
+  if (size <= kMaxShortKeyLength) {
+    uint8_t message[128];
+    PadAcceptMessage(key, size, message);
+    InitSha1State(state);
+    Sha1Compress(state, message, 2);
   } else {
-    head.bit.payload_len = 127;
-    out->push_back(head.u8val[1]);
-    U64Converter converter;
-    converter.value = length;
-    for (int i = 0; i < 8; ++i) {
-      out->push_back(converter.array[7-i]);
+    SHA1 sha;
+    unsigned message_digest[5];
+    sha.Input(key, size);
+    sha.Input(kWebSocketGuid, sizeof(kWebSocketGuid) - 1);
+    sha.Result(message_digest);
+    for (int i = 0; i < 5; ++i) state[i] = message_digest[i];
+  }
+  EncodeAcceptKey(state, out);
+}
+
+// 收集一批可在两个块内完成的key并行计算, 过长的key单独计算.
+void WebSocketAcceptKeys(HttpToken const* keys, size_t count, char* out) {
+  if (keys == nullptr || out == nullptr) return;
+  size_t const lanes = Sha1PreferredLanes();
+  if (lanes <= 1) {
+    for (size_t i = 0; i < count; ++i) {
+      WebSocketAcceptKey(keys[i].data, keys[i].size,
+                         out + i*kWebSocketAcceptKeyLength);
     }
+    return;
   }
-  // Payload data.
-  if (head.bit.mask) {  // Has mask key.
-    std::vector<char> mask_key;
-    if (GetRandomMaskKey(&mask_key) != 0) {
-      mask_key.assign(kMaskKey, kMaskKey+4);
+  uint8_t messages[kMaxSha1Lanes][128];
+  uint32_t states[kMaxSha1Lanes][5];
+  uint8_t const* blocks[kMaxSha1Lanes];
+  size_t index[kMaxSha1Lanes];
+  size_t i = 0;
+  while (i < count) {
+    size_t n = 0;
+    for (; i < count && n < lanes; ++i) {
+      if (keys[i].size > kMaxShortKeyLength) {
+        WebSocketAcceptKey(keys[i].data, keys[i].size,
+                           out + i*kWebSocketAcceptKeyLength);
+        continue;
+      }
+      PadAcceptMessage(keys[i].data, keys[i].size, messages[n]);
+      InitSha1State(states[n]);
+      blocks[n] = messages[n];
+      index[n++] = i;
     }
-    for (auto const& ch : mask_key) out->push_back(ch);
-    for (uint64_t i = 0; i < length; ++i) {
-      out->push_back(msg.payload_content[i]^mask_key[i%4]);
+    if (n == 0) continue;
+    Sha1CompressLanes(states, blocks, n, 2);
+    for (size_t j = 0; j < n; ++j) {
+      EncodeAcceptKey(states[j], out + index[j]*kWebSocketAcceptKeyLength);
     }
-  } else {
-    for (auto const& ch : msg.payload_content) out->push_back(ch);
   }
+}
+
+int HandshakeRespondPackaging(HandshakeRequest const& request,
+                              char* out, size_t capacity) {
+  return HandshakeRespondPackaging(request, HttpToken {nullptr, 0},
+                                   out, capacity);
+}
+
+int HandshakeRespondPackaging(HandshakeRequest const& request,
+                              HttpToken const& extensions,
+                              char* out, size_t capacity) {
+  return HandshakeRespondPackaging(request, extensions, HttpToken {nullptr, 0},
+                                   out, capacity);
+}
+
+int HandshakeRespondPackaging(HandshakeRequest const& request,
+                              HttpToken const& extensions,
+                              HttpToken const& resume,
+                              char* out, size_t capacity) {
+  static char const kHead[] =
+      "HTTP/1.1 101 Switching Protocols\r\n"
+      "Connection: Upgrade\r\n"
+      "Upgrade: websocket\r\n"
+      "Sec-WebSocket-Accept: ";
+  static char const kExtensions[] = "\r\nSec-WebSocket-Extensions: ";
+  static char const kResume[] = "\r\nX-WebSocket-Resume: ";
+  static char const kTail[] = "\r\n\r\n";
+  constexpr size_t kHeadLength = sizeof(kHead) - 1;
+  constexpr size_t kExtensionsLength = sizeof(kExtensions) - 1;
+  constexpr size_t kResumeLength = sizeof(kResume) - 1;
+  constexpr size_t kTailLength = sizeof(kTail) - 1;
+  size_t length = kHeadLength + kWebSocketAcceptKeyLength + kTailLength;
+  if (extensions.size > 0) length += kExtensionsLength + extensions.size;
+  if (resume.size > 0) length += kResumeLength + resume.size;
+  if (out == nullptr || capacity < length || request.key.size == 0) {
+    return -1;
+  }
+  char* p = out;
+  memcpy(p, kHead, kHeadLength);
+  p += kHeadLength;
+  WebSocketAcceptKey(request.key.data, request.key.size, p);
+  p += kWebSocketAcceptKeyLength;
+  if (extensions.size > 0) {
+    memcpy(p, kExtensions, kExtensionsLength);
+    p += kExtensionsLength;
+    memcpy(p, extensions.data, extensions.size);
+    p += extensions.size;
+  }
+  if (resume.size > 0) {
+    memcpy(p, kResume, kResumeLength);
+    p += kResumeLength;
+    memcpy(p, resume.data, resume.size);
+    p += resume.size;
+  }
+  memcpy(p, kTail, kTailLength);
+  return length;
+}
+
+bool IsHandShake(std::string const& request) {
+  HandshakeRequest parsed;
+  size_t length = 0;
+  return HandshakeRequestParse(request.data(), request.size(),
+                               &parsed, &length) == kHandshakeParseOk;
+}
+
+int HandShake(std::string const& request, std::string* respond) {
+  if (respond == nullptr) return -1;
+  HandshakeRequest parsed;
+  size_t length = 0;
+  if (HandshakeRequestParse(request.data(), request.size(),
+                            &parsed, &length) != kHandshakeParseOk) {
+    return -1;
+  }
+  char buffer[kMaxHandshakeRespondLength];
+  int ret = HandshakeRespondPackaging(parsed, buffer, sizeof(buffer));
+  if (ret < 0) return -1;
+  respond->assign(buffer, ret);
   return 0;
 }
 
+int WebSocketFramePackaging(const WebSocketMsg& msg,
+                            std::vector<char> *out) {
+  auto const& payload = msg.payload_content;
+  uint8_t const flags = FrameFlags(msg.msg_head);
+  return msg.msg_head.bit.mask ?
+      ClientFrameCodec::Package(flags, payload.data(), payload.size(), out) :
+      ServerFrameCodec::Package(flags, payload.data(), payload.size(), out);
+}
+
 int WebSocketFrameParse(std::vector<char> const& msg,
                         WebSocketMsg* out) {
-  if (out == nullptr) return -1;
+  uint64_t frame_length = 0;
+  return WebSocketFrameParse(msg.data(), msg.size(), UINT64_MAX,
+                             out, &frame_length);
+}
+
+int WebSocketFrameParse(char const* data, uint64_t size,
+                        uint64_t max_payload_length,
+                        WebSocketMsg* out, uint64_t* frame_length) {
+  if (data == nullptr || out == nullptr || frame_length == nullptr) {
+    return kFrameParseError;
+  }
+  FrameHeader header;
+  int ret = DecodeFrameHeader(data, size, &header);
+  if (ret != kFrameParseOk) return ret;
+  // 数据帧受调用方的长度限制.
+  if (!(header.opcode & 0x8) && header.payload_length > max_payload_length) {
+    return kFrameParseTooLarge;
+  }
+  if (size - header.header_length < header.payload_length) {
+    return kFrameParseIncomplete;
+  }
+  // Payload content.
   auto& head = out->msg_head;
+  head.u16val = 0;
+  head.bit.fin = header.fin ? 1 : 0;
+  head.bit.reserve = header.reserve >> 4;
+  head.bit.opcode = header.opcode;
+  head.bit.mask = header.mask ? 1 : 0;
+  head.bit.payload_len = header.payload_length < 126 ? header.payload_length :
+      (header.payload_length < 65536 ? 126 : 127);
   auto& content = out->payload_content;
-  head.u8val[0] = static_cast<uint8_t>(msg[0]);
-  head.u8val[1] = static_cast<uint8_t>(msg[1]);
-  // Payload length.
-  uint64_t payload_length = head.bit.payload_len;
-  int pos = 6;
-  if (head.bit.payload_len == 126) {
-    U16Converter converter;
-    for (int i = 0; i < 2; ++i) {
-      converter.array[1-i] = msg[2+i];
-    }
-    payload_length = converter.value;
-    pos = 8;
-  } else if (head.bit.payload_len > 126) {
-    U64Converter converter;
-    for (int i = 0; i < 8; ++i) {
-      converter.array[7-i] = msg[2+i];
-    }
-    payload_length = converter.value;
-    pos = 14;
+  content.resize(header.payload_length);
+  char const* payload = data + header.header_length;
+  if (header.mask) {
+    MaskPayload(payload, header.payload_length, header.mask_key,
+                content.data());
+  } else if (header.payload_length > 0) {
+    memcpy(content.data(), payload, header.payload_length);
   }
-  // Payload content.
-  if (head.bit.mask == 1) {
-    content.clear();
-    for (uint64_t i = 0; i < payload_length; ++i) {
-      content.push_back(msg[pos+i]^msg[pos-4+i%4]);
-    }
-  } else {
-    content.assign(msg.begin()+pos-4, msg.end());
+  *frame_length = header.header_length + header.payload_length;
+  return kFrameParseOk;
+}
+
+int WebSocketMessagePackaging(OPCodeType const& opcode,
+                              char const* buffer, uint64_t size,
+                              uint64_t fragment_size, bool mask,
+                              std::vector<std::vector<char>>* out) {
+  return mask ?
+      ClientFrameCodec::PackageMessage(opcode, buffer, size, fragment_size,
+                                       0, out) :
+      ServerFrameCodec::PackageMessage(opcode, buffer, size, fragment_size,
+                                       0, out);
+}
+
+int WebSocketCloseFramePackaging(uint16_t code, bool mask,
+                                 std::vector<char>* out) {
+  return WebSocketCloseFramePackaging(code, std::string(), mask, out);
+}
+
+int WebSocketCloseFramePackaging(uint16_t code, std::string const& reason,
+                                 bool mask, std::vector<char>* out) {
+  // 控制帧负载不超过125字节.
+  if (reason.size() > 123) return -1;
+  char payload[125];
+  payload[0] = static_cast<char>(code >> 8);
+  payload[1] = static_cast<char>(code & 0xFF);
+  memcpy(payload + 2, reason.data(), reason.size());
+  uint8_t const flags = kFrameFinBit | kOPCodeClose;
+  return mask ?
+      ClientFrameCodec::Package(flags, payload, reason.size() + 2, out) :
+      ServerFrameCodec::Package(flags, payload, reason.size() + 2, out);
+}
+
+// 可出现在关闭帧中的状态码为1000-1003, 1007-1011及3000-4999.
+int WebSocketCloseCodeParse(char const* payload, uint64_t size) {
+  if (size == 0) return kCloseNoStatus;
+  if (payload == nullptr || size < 2) return -1;
+  int code = (static_cast<uint8_t>(payload[0]) << 8) |
+             static_cast<uint8_t>(payload[1]);
+  if ((code >= 1000 && code <= 1003) || (code >= 1007 && code <= 1011) ||
+      (code >= 3000 && code <= 4999)) {
+    return code;
   }
-  return 0;
+  return -1;
 }
 
 }  // namespace libwebsocket
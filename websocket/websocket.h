@@ -9,6 +9,7 @@
 #ifndef WEBSOCKET_WEBSOCKET_H_
 #define WEBSOCKET_WEBSOCKET_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include <string>
@@ -17,6 +18,8 @@
 namespace libwebsocket {
 
 // WebSocket协议头.
+// 位域在内存中的布局依赖编译器和字节序, 应按字段读写, 不要通过u8val/u16val
+// 直接组帧; 库内部的编解码见frame_codec.h.
 union WebSocketProtocolHead {
   struct Bits {
     // 用于表示消息接收类型, 如果接收到未知的opcode, 接收端必须关闭连接.
@@ -48,6 +51,47 @@ enum OPCodeType {
   kOPCodePong,  // pong.
 };
 
+// 关闭帧状态码定义(RFC 6455 7.4.1).
+enum CloseCode {
+  kCloseNormal = 1000,  // 正常关闭.
+  kCloseGoingAway = 1001,  // 端点离开.
+  kCloseProtocolError = 1002,  // 协议错误.
+  kCloseUnsupportedData = 1003,  // 不支持的数据类型.
+  kCloseNoStatus = 1005,  // 关闭帧中没有状态码, 不可在关闭帧中发送.
+  kCloseAbnormal = 1006,  // 未收到关闭帧即断开, 不可在关闭帧中发送.
+  kCloseInvalidPayload = 1007,  // 消息内容与类型不符.
+  kClosePolicyViolation = 1008,  // 违反策略.
+  kCloseMessageTooBig = 1009,  // 消息过大.
+  kCloseInternalError = 1011,  // 内部错误.
+};
+
+// 数据帧解析返回值.
+enum FrameParseResult {
+  kFrameParseOk = 0,  // 解析成功.
+  kFrameParseIncomplete = 1,  // 数据不足, 需继续接收.
+  kFrameParseError = -1,  // 数据非法.
+  kFrameParseTooLarge = -2,  // 负载长度超过限制.
+  kFrameParseInvalidPayload = -3,  // 文本消息不是合法的UTF-8.
+};
+
+// 帧首字节中的RSV1-RSV3位.
+constexpr uint8_t kFrameRsvBits = 0x70;
+// 帧首字节中的RSV1位, permessage-deflate用于标识压缩消息.
+constexpr uint8_t kFrameRsv1Bit = 0x40;
+
+// 默认单帧负载长度上限.
+constexpr uint64_t kDefaultMaxFrameSize = 16*1024*1024;
+// 默认单条消息(含所有分片)负载长度上限.
+constexpr uint64_t kDefaultMaxMessageSize = 64*1024*1024;
+// 默认TCP连接超时时间(毫秒).
+constexpr int kDefaultConnectTimeout = 3000;
+// 默认握手超时时间(毫秒).
+constexpr int kDefaultHandshakeTimeout = 3000;
+// 默认关闭握手超时时间(毫秒).
+constexpr int kDefaultCloseTimeout = 3000;
+// 默认发送分片负载长度, 控制帧可在两个分片之间插队发送.
+constexpr uint64_t kDefaultFragmentSize = 64*1024;
+
 struct WebSocketMsg {
   // WebSocket协议头.
   WebSocketProtocolHead msg_head;
@@ -55,18 +99,93 @@ struct WebSocketMsg {
   std::vector<char> payload_content;
 };
 
-inline bool IsHandShake(const std::string &request) {
-  return ((request.find("GET / HTTP/1.1") != std::string::npos) &&
-          (request.find("Connection: Upgrade") != std::string::npos ||
-           request.find("Connection:Upgrade") != std::string::npos) &&
-          (request.find("Upgrade: websocket") != std::string::npos ||
-           request.find("Upgrade:websocket") != std::string::npos) &&
-          (request.find("Sec-WebSocket-Key:") != std::string::npos));
-}
+// 握手请求/响应解析返回值.
+enum HandshakeParseResult {
+  kHandshakeParseOk = 0,  // 解析成功.
+  kHandshakeParseIncomplete = 1,  // 头部不完整, 需继续接收.
+  kHandshakeParseError = -1,  // 不是合法的WebSocket升级请求或响应.
+};
+
+// Sec-WebSocket-Accept的长度.
+constexpr size_t kWebSocketAcceptKeyLength = 28;
+// 握手响应的最大长度.
+constexpr size_t kMaxHandshakeRespondLength = 512;
+
+// 指向外部缓冲区的字符串片段, 不持有数据.
+struct HttpToken {
+  char const* data;
+  size_t size;
+};
+
+// WebSocket升级请求, 各字段指向原始请求数据, 未出现的头部长度为0.
+struct HandshakeRequest {
+  HttpToken path;  // 请求路径.
+  HttpToken host;  // Host.
+  HttpToken origin;  // Origin.
+  HttpToken key;  // Sec-WebSocket-Key.
+  HttpToken protocol;  // Sec-WebSocket-Protocol.
+  HttpToken extensions;  // Sec-WebSocket-Extensions.
+  HttpToken resume;  // X-WebSocket-Resume.
+};
+
+// WebSocket升级响应, 各字段指向原始响应数据, 未出现的头部长度为0.
+struct HandshakeRespond {
+  HttpToken accept;  // Sec-WebSocket-Accept.
+  HttpToken protocol;  // Sec-WebSocket-Protocol.
+  HttpToken extensions;  // Sec-WebSocket-Extensions.
+  HttpToken resume;  // X-WebSocket-Resume.
+};
+
+// 单次遍历解析数据流头部的升级请求, 不分配内存.
+// 头部名称不区分大小写, 值两端的空白被忽略, Connection和Upgrade按逗号分隔的
+// 列表匹配. 成功时request_length为请求头占用的字节数(含结尾空行).
+int HandshakeRequestParse(char const* data, size_t size,
+                          HandshakeRequest* out, size_t* request_length);
+// 解析数据流头部的升级响应, 状态码须为101, 规则同HandshakeRequestParse.
+int HandshakeRespondParse(char const* data, size_t size,
+                          HandshakeRespond* out, size_t* respond_length);
+// 计算key对应的Sec-WebSocket-Accept, 写入kWebSocketAcceptKeyLength个字符.
+void WebSocketAcceptKey(char const* key, size_t size, char* out);
+// 批量计算count个key对应的Sec-WebSocket-Accept, 第i个结果写入
+// out + i*kWebSocketAcceptKeyLength. 没有SHA-1硬件加速时多个key在SIMD的
+// 不同通道中并行计算.
+void WebSocketAcceptKeys(HttpToken const* keys, size_t count, char* out);
+// 将握手响应写入调用方提供的缓冲区, 返回写入的字节数, 缓冲区不足时返回-1.
+int HandshakeRespondPackaging(HandshakeRequest const& request,
+                              char* out, size_t capacity);
+// 同上, extensions非空时附带Sec-WebSocket-Extensions头部.
+int HandshakeRespondPackaging(HandshakeRequest const& request,
+                              HttpToken const& extensions,
+                              char* out, size_t capacity);
+// 同上, resume非空时附带X-WebSocket-Resume头部.
+int HandshakeRespondPackaging(HandshakeRequest const& request,
+                              HttpToken const& extensions,
+                              HttpToken const& resume,
+                              char* out, size_t capacity);
 
+bool IsHandShake(std::string const& request);
 int HandShake(std::string const& reuest, std::string* respond);
 int WebSocketFramePackaging(WebSocketMsg const& msg, std::vector<char>* out);
 int WebSocketFrameParse(std::vector<char> const& msg, WebSocketMsg* out);
+// 从数据流头部解析一个完整的数据帧, 成功时frame_length为该帧占用的字节数.
+// 数据帧的负载长度在解出扩展长度后立即与max_payload_length比较,
+// 超出时返回kFrameParseTooLarge, 不会为负载分配内存.
+int WebSocketFrameParse(char const* data, uint64_t size,
+                        uint64_t max_payload_length,
+                        WebSocketMsg* out, uint64_t* frame_length);
+// 将一条消息拆分为负载不超过fragment_size的分片帧并分别封装.
+int WebSocketMessagePackaging(OPCodeType const& opcode,
+                              char const* buffer, uint64_t size,
+                              uint64_t fragment_size, bool mask,
+                              std::vector<std::vector<char>>* out);
+// 封装关闭帧, 负载为网络字节序的状态码.
+int WebSocketCloseFramePackaging(uint16_t code, bool mask,
+                                 std::vector<char>* out);
+// 封装关闭帧, 负载为网络字节序的状态码和UTF-8编码的关闭原因.
+int WebSocketCloseFramePackaging(uint16_t code, std::string const& reason,
+                                 bool mask, std::vector<char>* out);
+// 解析关闭帧负载中的状态码, 负载为空时返回kCloseNoStatus, 非法时返回-1.
+int WebSocketCloseCodeParse(char const* payload, uint64_t size);
 
 }  // namespace libwebsocket
 